@@ -362,6 +362,23 @@ ADF_RETCODE adfDevReadBlock ( struct AdfDevice * const dev,
 }
 
 
+/*
+ * adfDevReadDataBlock
+ *
+ * same as adfDevReadBlock, but for file data (uses the driver's
+ * readDataSector if it has one)
+ */
+ADF_RETCODE adfDevReadDataBlock ( struct AdfDevice * const dev,
+                                  const uint32_t           pSect,
+                                  const uint32_t           size,
+                                  uint8_t * const          buf )
+{
+    if ( dev->drv->readDataSector != NULL )
+        return dev->drv->readDataSector ( dev, pSect, size, buf );
+    return dev->drv->readSector ( dev, pSect, size, buf );
+}
+
+
 ADF_RETCODE adfDevWriteBlock ( struct AdfDevice * const dev,
                                const uint32_t           pSect,
                                const uint32_t           size,
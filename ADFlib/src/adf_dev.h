@@ -97,6 +97,11 @@ ADF_RETCODE adfDevReadBlock ( struct AdfDevice * const dev,
                               const uint32_t           size,
                               uint8_t * const          buf );
 
+ADF_RETCODE adfDevReadDataBlock ( struct AdfDevice * const dev,
+                                  const uint32_t           pSect,
+                                  const uint32_t           size,
+                                  uint8_t * const          buf );
+
 ADF_RETCODE adfDevWriteBlock ( struct AdfDevice * const dev,
                                const uint32_t           pSect,
                                const uint32_t           size,
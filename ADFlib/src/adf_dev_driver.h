@@ -62,6 +62,15 @@ struct AdfDeviceDriver {
     /* optional (can be NULL); should help to match device string with the driver */
 
     bool (*isDevice)( const char * const name );
+
+    /* optional (can be NULL); used instead of readSector for file data blocks,
+       so that the driver can cache bulk file data differently from
+       filesystem structures (root, bitmap, directory blocks etc.) */
+
+    ADF_RETCODE (*readDataSector)( struct AdfDevice * const dev,
+                                   const uint32_t           n,
+                                   const unsigned           size,
+                                   uint8_t * const          buf );
 };
 
 #endif  /* ADF_DEV_DRIVER_H */
@@ -246,7 +246,7 @@ ADF_RETCODE adfReadDataBlock ( struct AdfVolume * const vol,
 
     uint8_t buf[512];
 
-    ADF_RETCODE rc = adfVolReadBlock ( vol, (uint32_t) nSect, buf );
+    ADF_RETCODE rc = adfVolReadDataBlock ( vol, (uint32_t) nSect, buf );
     if ( rc != ADF_RC_OK ) {
         adfEnv.eFct ( "adfReadDataBlock: error reading block %d, volume '%s'",
                        nSect, vol->volName );
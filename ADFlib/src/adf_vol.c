@@ -465,13 +465,14 @@ printf("%3d %x, ",i,vol->bitmapTable[0]->map[i]);
 /*-----*/
 
 /*
- * adfVolReadBlock
+ * adfVolReadBlockHint_
  *
- * read logical block
+ * read logical block, as filesystem structure or file data
  */
-ADF_RETCODE adfVolReadBlock ( struct AdfVolume * const vol,
-                              const uint32_t           nSect,
-                              uint8_t * const          buf )
+static ADF_RETCODE adfVolReadBlockHint_ ( struct AdfVolume * const vol,
+                                          const uint32_t           nSect,
+                                          uint8_t * const          buf,
+                                          const bool               fileData )
 {
     if (!vol->mounted) {
         adfEnv.eFct ( "the volume isn't mounted, adfVolReadBlock not possible" );
@@ -496,7 +497,8 @@ ADF_RETCODE adfVolReadBlock ( struct AdfVolume * const vol,
         return ADF_RC_BLOCKOUTOFRANGE;
     }
 
-    ADF_RETCODE rc = adfDevReadBlock ( vol->dev, pSect, 512, buf );
+    ADF_RETCODE rc = fileData ? adfDevReadDataBlock ( vol->dev, pSect, 512, buf )
+                              : adfDevReadBlock ( vol->dev, pSect, 512, buf );
     if ( rc != ADF_RC_OK ) {
         adfEnv.eFct ( "adfVolReadBlock: error reading block %d, volume '%s'",
                       nSect, vol->volName );
@@ -505,6 +507,32 @@ ADF_RETCODE adfVolReadBlock ( struct AdfVolume * const vol,
 }
 
 
+/*
+ * adfVolReadBlock
+ *
+ * read logical block
+ */
+ADF_RETCODE adfVolReadBlock ( struct AdfVolume * const vol,
+                              const uint32_t           nSect,
+                              uint8_t * const          buf )
+{
+    return adfVolReadBlockHint_ ( vol, nSect, buf, false );
+}
+
+
+/*
+ * adfVolReadDataBlock
+ *
+ * read logical block containing file data
+ */
+ADF_RETCODE adfVolReadDataBlock ( struct AdfVolume * const vol,
+                                  const uint32_t           nSect,
+                                  uint8_t * const          buf )
+{
+    return adfVolReadBlockHint_ ( vol, nSect, buf, true );
+}
+
+
 /*
  * adfVolWriteBlock
  *
@@ -155,6 +155,10 @@ ADF_PREFIX ADF_RETCODE adfVolReadBlock ( struct AdfVolume * const vol,
                                          const uint32_t           nSect,
                                          uint8_t * const          buf );
 
+ADF_PREFIX ADF_RETCODE adfVolReadDataBlock ( struct AdfVolume * const vol,
+                                             const uint32_t           nSect,
+                                             uint8_t * const          buf );
+
 ADF_PREFIX ADF_RETCODE adfVolWriteBlock ( struct AdfVolume * const vol,
                                           const uint32_t           nSect,
                                           const uint8_t * const    buf );
@@ -0,0 +1,225 @@
+#include <check.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "adflib.h"
+#include "adf_dev_driver_ramdisk.h"
+
+
+/*
+ * A ramdisk that counts which driver hook each read went through
+ */
+
+static unsigned nSectorReads = 0,
+                nDataSectorReads = 0;
+
+static struct AdfDevice * countingCreate ( const char * const name,
+                                           const uint32_t     cylinders,
+                                           const uint32_t     heads,
+                                           const uint32_t     sectors );
+
+static ADF_RETCODE countingReadSector ( struct AdfDevice * const dev,
+                                        const uint32_t           n,
+                                        const unsigned           size,
+                                        uint8_t * const          buf )
+{
+    nSectorReads++;
+    return adfDeviceDriverRamdisk.readSector ( dev, n, size, buf );
+}
+
+static ADF_RETCODE countingReadDataSector ( struct AdfDevice * const dev,
+                                            const uint32_t           n,
+                                            const unsigned           size,
+                                            uint8_t * const          buf )
+{
+    nDataSectorReads++;
+    return adfDeviceDriverRamdisk.readSector ( dev, n, size, buf );
+}
+
+static ADF_RETCODE countingWriteSector ( struct AdfDevice * const dev,
+                                         const uint32_t           n,
+                                         const unsigned           size,
+                                         const uint8_t * const    buf )
+{
+    return adfDeviceDriverRamdisk.writeSector ( dev, n, size, buf );
+}
+
+static ADF_RETCODE countingClose ( struct AdfDevice * const dev )
+{
+    return adfDeviceDriverRamdisk.closeDev ( dev );
+}
+
+static bool countingIsNative ( void )
+{
+    return false;
+}
+
+/* with the file data hook */
+static const struct AdfDeviceDriver countingDriver = {
+    .name           = "counting",
+    .data           = NULL,
+    .createDev      = countingCreate,
+    .openDev        = NULL,
+    .closeDev       = countingClose,
+    .readSector     = countingReadSector,
+    .writeSector    = countingWriteSector,
+    .isNative       = countingIsNative,
+    .isDevice       = NULL,
+    .readDataSector = countingReadDataSector
+};
+
+/* and without it */
+static const struct AdfDeviceDriver countingNoDataDriver = {
+    .name           = "countingNoData",
+    .data           = NULL,
+    .createDev      = countingCreate,
+    .openDev        = NULL,
+    .closeDev       = countingClose,
+    .readSector     = countingReadSector,
+    .writeSector    = countingWriteSector,
+    .isNative       = countingIsNative,
+    .isDevice       = NULL,
+    .readDataSector = NULL
+};
+
+static const struct AdfDeviceDriver * createDriver = &countingDriver;
+
+static struct AdfDevice * countingCreate ( const char * const name,
+                                           const uint32_t     cylinders,
+                                           const uint32_t     heads,
+                                           const uint32_t     sectors )
+{
+    struct AdfDevice * const dev =
+        adfDeviceDriverRamdisk.createDev ( name, cylinders, heads, sectors );
+    if ( dev != NULL )
+        dev->drv = createDriver;
+    return dev;
+}
+
+
+/*
+ * Writes a file, remounts and reads it back, returning how many data blocks
+ * it should have
+ */
+static unsigned write_and_read_back ( const char * const driverName,
+                                      const uint8_t      fstype )
+{
+    struct AdfDevice * const device = adfDevCreate ( driverName, "test", 80, 2, 11 );
+    ck_assert_ptr_nonnull ( device );
+    ck_assert_int_eq ( ADF_RC_OK, adfCreateFlop ( device, "Test", fstype ) );
+    ck_assert_int_eq ( ADF_RC_OK, adfDevMount ( device ) );
+
+    // write a file a few blocks long
+    uint8_t wbuf[ 5 * 512 ];
+    for ( unsigned i = 0 ; i < sizeof ( wbuf ) ; i++ )
+        wbuf[ i ] = (uint8_t) ( i * 7 + 3 );
+
+    struct AdfVolume * vol = adfVolMount ( device, 0, ADF_ACCESS_MODE_READWRITE );
+    ck_assert_ptr_nonnull ( vol );
+    struct AdfFile * file = adfFileOpen ( vol, "testfile", ADF_FILE_MODE_WRITE );
+    ck_assert_ptr_nonnull ( file );
+    ck_assert_uint_eq ( sizeof ( wbuf ), adfFileWrite ( file, sizeof ( wbuf ), wbuf ) );
+    adfFileClose ( file );
+    adfVolUnMount ( vol );
+
+    // and read it back
+    nSectorReads = nDataSectorReads = 0;
+    vol = adfVolMount ( device, 0, ADF_ACCESS_MODE_READONLY );
+    ck_assert_ptr_nonnull ( vol );
+    file = adfFileOpen ( vol, "testfile", ADF_FILE_MODE_READ );
+    ck_assert_ptr_nonnull ( file );
+
+    uint8_t rbuf[ sizeof ( wbuf ) ];
+    ck_assert_uint_eq ( sizeof ( rbuf ), adfFileRead ( file, sizeof ( rbuf ), rbuf ) );
+    ck_assert_int_eq ( 0, memcmp ( wbuf, rbuf, sizeof ( wbuf ) ) );
+
+    adfFileClose ( file );
+    adfVolUnMount ( vol );
+    adfDevUnMount ( device );
+    adfDevClose ( device );
+
+    // OFS data blocks have a header, FFS ones are just data
+    const unsigned blockDataSize = ( fstype & ADF_DOSFS_FFS ) ? 512 : 488;
+    return ( (unsigned) sizeof ( wbuf ) + blockDataSize - 1 ) / blockDataSize;
+}
+
+
+START_TEST ( test_check_framework )
+{
+    ck_assert ( 1 );
+}
+END_TEST
+
+
+START_TEST ( test_data_sector_hook_ofs )
+{
+    createDriver = &countingDriver;
+    const unsigned nDataBlocks = write_and_read_back ( "counting", 0 );
+    ck_assert_uint_eq ( nDataBlocks, nDataSectorReads );
+    ck_assert_uint_gt ( nSectorReads, 0 );
+}
+END_TEST
+
+
+START_TEST ( test_data_sector_hook_ffs )
+{
+    createDriver = &countingDriver;
+    const unsigned nDataBlocks = write_and_read_back ( "counting", ADF_DOSFS_FFS );
+    ck_assert_uint_eq ( nDataBlocks, nDataSectorReads );
+    ck_assert_uint_gt ( nSectorReads, 0 );
+}
+END_TEST
+
+
+START_TEST ( test_data_sector_no_hook )
+{
+    // drivers without the hook read file data with readSector
+    createDriver = &countingNoDataDriver;
+    const unsigned nDataBlocks = write_and_read_back ( "countingNoData", ADF_DOSFS_FFS );
+    ck_assert_uint_eq ( 0, nDataSectorReads );
+    ck_assert_uint_gt ( nSectorReads, nDataBlocks );
+}
+END_TEST
+
+
+Suite * adflib_suite ( void )
+{
+    Suite * s = suite_create ( "adflib" );
+
+    TCase * tc = tcase_create ( "check framework" );
+    tcase_add_test ( tc, test_check_framework );
+    suite_add_tcase ( s, tc );
+
+    tc = tcase_create ( "adflib test_data_sector_hook_ofs" );
+    tcase_add_test ( tc, test_data_sector_hook_ofs );
+    suite_add_tcase ( s, tc );
+
+    tc = tcase_create ( "adflib test_data_sector_hook_ffs" );
+    tcase_add_test ( tc, test_data_sector_hook_ffs );
+    suite_add_tcase ( s, tc );
+
+    tc = tcase_create ( "adflib test_data_sector_no_hook" );
+    tcase_add_test ( tc, test_data_sector_no_hook );
+    suite_add_tcase ( s, tc );
+
+    return s;
+}
+
+
+int main ( void )
+{
+    Suite * s = adflib_suite();
+    SRunner * sr = srunner_create ( s );
+
+    adfEnvInitDefault();
+    adfAddDeviceDriver ( &countingDriver );
+    adfAddDeviceDriver ( &countingNoDataDriver );
+    srunner_run_all ( sr, CK_VERBOSE );
+    adfEnvCleanUp();
+
+    int number_failed = srunner_ntests_failed ( sr );
+    srunner_free ( sr );
+    return ( number_failed == 0 ) ?
+        EXIT_SUCCESS :
+        EXIT_FAILURE;
+}
@@ -1078,7 +1078,7 @@ static int CachedRead(ULONG blocknr, SIPTR *error, bool fake, globaldata *g)
 	if (fake)
 		memset(&g->dc.data[i<<BLOCKSHIFT], 0xAA, BLOCKSIZE);
 	else {
-		*error = RawRead(&g->dc.data[i << BLOCKSHIFT], 1, blocknr, g);
+		*error = RawReadData(&g->dc.data[i << BLOCKSHIFT], 1, blocknr, g);
 	}
 	g->dc.roving = (g->dc.roving+1)&g->dc.mask;
 	g->dc.ref[i].dirty = 0;
@@ -1226,7 +1226,7 @@ ULONG DiskRead(UBYTE* buffer, ULONG blockstoread, ULONG blocknr, globaldata* g)
 		return error;
 	}
 	ValidateCache(blocknr, blockstoread, read, g);
-	return RawRead(buffer, blockstoread, blocknr, g);
+	return RawReadData(buffer, blockstoread, blocknr, g);
 }
 
 
@@ -1274,14 +1274,16 @@ ULONG DiskWrite(UBYTE* buffer, ULONG blockstowrite, ULONG blocknr, globaldata* g
 }
 
 
+// Read filesystem structures (anodes, directory blocks, bitmaps etc)
 ULONG RawRead(UBYTE *buffer, ULONG blocks, ULONG blocknr, globaldata *g) {
-	while (blocks) {
-		if (!g->readSector(blocknr, buffer)) return 1;
-		blocknr++;
-		blocks--;
-		buffer += g->blocksize;		
-	}
-	return 0;
+	if (!blocks) return 0;
+	return g->readSector(blocknr, blocks, buffer, true) ? 0 : 1;
+}
+
+// Read file data
+ULONG RawReadData(UBYTE *buffer, ULONG blocks, ULONG blocknr, globaldata *g) {
+	if (!blocks) return 0;
+	return g->readSector(blocknr, blocks, buffer, false) ? 0 : 1;
 }
 
 
@@ -1292,14 +1294,9 @@ ULONG RawWrite(UBYTE *buffer, ULONG blocks, ULONG blocknr, globaldata *g) {
 		b = false;
 	}
 	b = true;
-	while (blocks) {
-		if (!g->writeSector(blocknr, buffer)) {
-			b = false;
-			return 1;
-		}
-		blocknr++;
-		blocks--;
-		buffer += g->blocksize;
+	if ((blocks) && (!g->writeSector(blocknr, blocks, buffer))) {
+		b = false;
+		return 1;
 	}
 	b = false;
 	return 0;
@@ -19,6 +19,8 @@ ULONG DiskWrite(UBYTE * , ULONG , ULONG , globaldata * );
 
 ULONG RawRead(UBYTE * , ULONG , ULONG , globaldata * );
 
+ULONG RawReadData(UBYTE * , ULONG , ULONG , globaldata * );
+
 ULONG RawWrite(UBYTE * , ULONG , ULONG , globaldata * );
 
 void FlushDataCache (globaldata *g);
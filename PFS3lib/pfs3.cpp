@@ -20,8 +20,8 @@
 
 class PFS3 : public IPFS3 {
 private:
-	const std::function<bool(uint32_t physicalSector, uint32_t readSize, void* data)> m_readSector;
-	const std::function<bool(uint32_t physicalSector, uint32_t readSize, const void* data)> m_writeSector;
+	const std::function<bool(uint32_t physicalSector, uint32_t numSectors, uint32_t sectorSize, void* data, bool metadata)> m_readSector;
+	const std::function<bool(uint32_t physicalSector, uint32_t numSectors, uint32_t sectorSize, const void* data)> m_writeSector;
 	const std::function<void(const std::string& message)> m_pfsError;
 	bool m_readOnly;
 
@@ -34,8 +34,8 @@ public:
 	const uint8_t MaxNameLength();
 
 	PFS3(const struct DriveInfo& drive, const struct PartitionInfo& partition,
-		const std::function<bool(uint32_t physicalSector, uint32_t readSize, void* data)> readSector,
-		const std::function<bool(uint32_t physicalSector, uint32_t readSize, const void* data)> writeSector,
+		const std::function<bool(uint32_t physicalSector, uint32_t numSectors, uint32_t sectorSize, void* data, bool metadata)> readSector,
+		const std::function<bool(uint32_t physicalSector, uint32_t numSectors, uint32_t sectorSize, const void* data)> writeSector,
 		const std::function<void(const std::string& message)> pfsError,
 		const bool readOnly);
 	~PFS3();
@@ -102,7 +102,7 @@ public:
 	virtual Error Dir(const std::string& path, std::function<void(const FileInformation& fileDir)> onFileDir) override;
 };
 
-IPFS3* IPFS3::createInstance(const struct DriveInfo& drive, const struct PartitionInfo& partition, const std::function<bool(uint32_t physicalSector, uint32_t readSize, void* data)> readSector, const std::function<bool(uint32_t physicalSector, uint32_t readSize, const void* data)> writeSector, const std::function<void(const std::string& message)> pfsError, const bool readOnly) {
+IPFS3* IPFS3::createInstance(const struct DriveInfo& drive, const struct PartitionInfo& partition, const std::function<bool(uint32_t physicalSector, uint32_t numSectors, uint32_t sectorSize, void* data, bool metadata)> readSector, const std::function<bool(uint32_t physicalSector, uint32_t numSectors, uint32_t sectorSize, const void* data)> writeSector, const std::function<void(const std::string& message)> pfsError, const bool readOnly) {
 	return new PFS3(drive, partition, readSector, writeSector, pfsError, readOnly);
 }
 
@@ -156,8 +156,8 @@ LONG _NormalErrorMsg(CONST_STRPTR melding, APTR arg, ULONG notargets, globaldata
 
 
 PFS3::PFS3(const struct PFS3::DriveInfo& drive, const struct PartitionInfo& partition, 
-		const std::function<bool(uint32_t physicalSector, uint32_t readSize, void* data) > readSector,
-		const std::function<bool(uint32_t physicalSector, uint32_t readSize, const void* data) > writeSector,
+		const std::function<bool(uint32_t physicalSector, uint32_t numSectors, uint32_t sectorSize, void* data, bool metadata) > readSector,
+		const std::function<bool(uint32_t physicalSector, uint32_t numSectors, uint32_t sectorSize, const void* data) > writeSector,
 		const std::function<void(const std::string& message)> pfsError,
 		const bool readOnly
 	)
@@ -186,17 +186,17 @@ PFS3::PFS3(const struct PFS3::DriveInfo& drive, const struct PartitionInfo& part
 	g->geom.dg_Flags = g->geom.dg_Flags;
 	g->ErrorMsg = _NormalErrorMsg;
 
-	g->readSector = [this](uint32_t logicalSector, void* data) {
+	g->readSector = [this](uint32_t logicalSector, uint32_t numSectors, void* data, bool metadata) {
 		// TODO: Handle g->blocksize not being 512
 		if (!m_readSector) return false;
-		return m_readSector(g->firstblocknative + logicalSector, g->blocksize, data);
+		return m_readSector(g->firstblocknative + logicalSector, numSectors, g->blocksize, data, metadata);
 	};
 
-	g->writeSector = [this](uint32_t logicalSector, void* data) {
+	g->writeSector = [this](uint32_t logicalSector, uint32_t numSectors, void* data) {
 		if (m_readOnly) return false;
 		// TODO: Handle g->blocksize not being 512
 		if (!m_writeSector) return false;
-		return m_writeSector(g->firstblocknative + logicalSector, g->blocksize, data);
+		return m_writeSector(g->firstblocknative + logicalSector, numSectors, g->blocksize, data);
 	};
 
 	g->handleError = m_pfsError;
@@ -75,8 +75,8 @@ public:
 	virtual const uint8_t MaxNameLength() = 0;
 	
 	static IPFS3* createInstance(const struct DriveInfo& drive, const struct PartitionInfo& partition, 
-		const std::function<bool(uint32_t physicalSector, uint32_t readSize, void* data)> readSector, 
-		const std::function<bool(uint32_t physicalSector, uint32_t readSize, const void* data)> writeSector,
+		const std::function<bool(uint32_t physicalSector, uint32_t numSectors, uint32_t sectorSize, void* data, bool metadata)> readSector, 
+		const std::function<bool(uint32_t physicalSector, uint32_t numSectors, uint32_t sectorSize, const void* data)> writeSector,
 		const std::function<void(const std::string& message)> pfsError,
 		const bool readOnly);
 
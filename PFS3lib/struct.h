@@ -342,8 +342,8 @@ struct globaldata
 
 	bool largeDiskSafeOS;
 
-	std::function<bool(uint32_t logicalSector, void* data)> readSector;
-	std::function<bool(uint32_t logicalSector, void* data)> writeSector;
+	std::function<bool(uint32_t logicalSector, uint32_t numSectors, void* data, bool metadata)> readSector;
+	std::function<bool(uint32_t logicalSector, uint32_t numSectors, void* data)> writeSector;
 	std::function<void(const std::string& message)> handleError;
 };
 
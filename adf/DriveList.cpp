@@ -1029,10 +1029,13 @@ CDriveAccess::CDriveAccess() : SectorCacheEngine(512*40), m_drive(INVALID_HANDLE
 }
 
 CDriveAccess::~CDriveAccess() {
+	setReadAhead(false, 0, 0);
+	flushWriteCache();
 	closeDrive();
 }
 
 void CDriveAccess::closeDrive() {
+	closeAsyncHandle();
 	for (HANDLE h : m_lockedVolumes) CloseHandle(h);
 	m_lockedVolumes.clear();
 	if (m_dontFreeHandle) return;
@@ -1070,7 +1073,10 @@ bool CDriveAccess::openDrive(const CDriveList::CDevice& device, bool readOnly, b
 		}
 	}
 
-	if (!lockDrive) return true;
+	if (!lockDrive) {
+		openAsyncHandle();
+		return true;
+	}
 
 	// Next up, attempt to lock the drive
 	DWORD written;
@@ -1082,7 +1088,10 @@ bool CDriveAccess::openDrive(const CDriveList::CDevice& device, bool readOnly, b
 	}
 
 	DWORD signature, partitionStyle;
-	if (!getSignatureFromHandle(m_drive, signature, partitionStyle)) return true;	
+	if (!getSignatureFromHandle(m_drive, signature, partitionStyle)) {
+		openAsyncHandle();
+		return true;
+	}
 	
 	bool ntfs_found = false;
 	WCHAR volName[MAX_PATH];
@@ -1139,19 +1148,132 @@ bool CDriveAccess::openDrive(const CDriveList::CDevice& device, bool readOnly, b
 				DeviceIoControl(d, FSCTL_DISMOUNT_VOLUME, NULL, 0, NULL, 0, &written, NULL);
 	}
 	
+	openAsyncHandle();
 	return true;
 }
 
-bool CDriveAccess::seek(uint64_t offset) {
-	if (m_drive == INVALID_HANDLE_VALUE) return false;
-	DWORD ret;
+// Open a second handle for overlapped I/O. Not done if m_drive holds a volume lock as other handles are locked out
+void CDriveAccess::openAsyncHandle() {
+	closeAsyncHandle();
+	if ((m_drive == INVALID_HANDLE_VALUE) || (m_dismounted)) return;
+
+	const DWORD access = GENERIC_READ | (m_device.readOnly && !m_device.chsDetected ? 0 : GENERIC_WRITE);
+	m_asyncDrive = ReOpenFile(m_drive, access, FILE_SHARE_READ | FILE_SHARE_WRITE, FILE_FLAG_OVERLAPPED | FILE_FLAG_RANDOM_ACCESS);
+	if (m_asyncDrive == INVALID_HANDLE_VALUE) return;
+
+	for (HANDLE& event : m_asyncEvents) {
+		event = CreateEvent(NULL, TRUE, FALSE, NULL);
+		if (!event) {
+			closeAsyncHandle();
+			return;
+		}
+	}
+}
+
+void CDriveAccess::closeAsyncHandle() {
+	if (m_asyncDrive != INVALID_HANDLE_VALUE) {
+		CancelIo(m_asyncDrive);
+		CloseHandle(m_asyncDrive);
+		m_asyncDrive = INVALID_HANDLE_VALUE;
+	}
+	for (HANDLE& event : m_asyncEvents)
+		if (event) {
+			CloseHandle(event);
+			event = NULL;
+		}
+}
+
+// Read or write several runs with up to ASYNC_QUEUE_DEPTH of them in progress at once
+bool CDriveAccess::asyncTransfer(const std::vector<SectorRun>& runs, const uint32_t sectorSize, const bool write) {
+	struct AsyncRequest {
+		OVERLAPPED overlapped;
+		DWORD size;
+		bool active;
+	};
+	AsyncRequest requests[ASYNC_QUEUE_DEPTH] = {};
+	HANDLE waitList[ASYNC_QUEUE_DEPTH];
+	uint32_t waitIndex[ASYNC_QUEUE_DEPTH];
+	uint32_t numActive = 0;
+	size_t next = 0;
+	bool success = true;
+
+	while (((success) && (next < runs.size())) || (numActive)) {
+		// Keep the queue full
+		for (uint32_t index = 0; (index < ASYNC_QUEUE_DEPTH) && (success) && (next < runs.size()); index++) {
+			AsyncRequest& request = requests[index];
+			if (request.active) continue;
+
+			const SectorRun& run = runs[next++];
+			uint64_t start;
+			request.size = run.count * sectorSize;
+			if (!deviceOffset((uint64_t)run.firstSector * sectorSize, request.size, start)) {
+				success = false;
+				break;
+			}
+
+			memset(&request.overlapped, 0, sizeof(request.overlapped));
+			request.overlapped.Offset = (DWORD)(start & 0xFFFFFFFF);
+			request.overlapped.OffsetHigh = (DWORD)(start >> 32);
+			request.overlapped.hEvent = m_asyncEvents[index];
+			ResetEvent(m_asyncEvents[index]);
+
+			BOOL ok = write ? WriteFile(m_asyncDrive, run.data, request.size, NULL, &request.overlapped) : ReadFile(m_asyncDrive, run.data, request.size, NULL, &request.overlapped);
+			if ((!ok) && (GetLastError() != ERROR_IO_PENDING)) {
+				success = false;
+				break;
+			}
+			request.active = true;
+			numActive++;
+		}
+		if (!numActive) break;
+
+		// Wait for any of them to finish
+		uint32_t numWaiting = 0;
+		for (uint32_t index = 0; index < ASYNC_QUEUE_DEPTH; index++)
+			if (requests[index].active) {
+				waitList[numWaiting] = m_asyncEvents[index];
+				waitIndex[numWaiting++] = index;
+			}
+		const DWORD result = WaitForMultipleObjects(numWaiting, waitList, FALSE, INFINITE);
+		if (result >= WAIT_OBJECT_0 + numWaiting) {
+			// Something has gone badly wrong, so give up on everything outstanding
+			CancelIo(m_asyncDrive);
+			for (uint32_t index = 0; index < ASYNC_QUEUE_DEPTH; index++)
+				if (requests[index].active) {
+					DWORD transferred;
+					GetOverlappedResult(m_asyncDrive, &requests[index].overlapped, &transferred, TRUE);
+					requests[index].active = false;
+				}
+			return false;
+		}
+
+		AsyncRequest& request = requests[waitIndex[result - WAIT_OBJECT_0]];
+		DWORD transferred = 0;
+		if ((!GetOverlappedResult(m_asyncDrive, &request.overlapped, &transferred, FALSE)) || (transferred != request.size)) success = false;
+		request.active = false;
+		numActive--;
+	}
 
+	return success;
+}
+
+// Works out where on the device length bytes at offset start. Used for both the normal and the overlapped handle so they always agree
+bool CDriveAccess::deviceOffset(uint64_t offset, const uint64_t length, uint64_t& position) {
 	if (m_device.size) {
-		if (offset >= m_device.size) return false;
+		if (offset + length > m_device.size) return false;
 		offset += m_device.offset;
 		// Offset must be multiple of sector size
 		if (offset & (m_device.bytesPerSector - 1)) return false;
 	}
+	position = offset;
+	return true;
+}
+
+bool CDriveAccess::seek(uint64_t offset, const uint64_t length) {
+	if (m_drive == INVALID_HANDLE_VALUE) return false;
+	DWORD ret;
+
+	if (!deviceOffset(offset, length, offset)) return false;
 
 	LARGE_INTEGER fppos;
 	fppos.QuadPart = offset;
@@ -1163,7 +1285,7 @@ bool CDriveAccess::seek(uint64_t offset) {
 
 // Data must be at least getSectorSize() size
 bool CDriveAccess::internalReadData(const uint32_t sectorNumber, const uint32_t sectorSize, void* data) {
-	if (!seek(sectorNumber * sectorSize)) return false;
+	if (!seek((uint64_t)sectorNumber * sectorSize, sectorSize)) return false;
 	DWORD bytesRead = 0;
 	if (!ReadFile(m_drive, data, sectorSize, &bytesRead, NULL)) bytesRead = 0;
 	return bytesRead == sectorSize;
@@ -1171,13 +1293,47 @@ bool CDriveAccess::internalReadData(const uint32_t sectorNumber, const uint32_t
 
 bool CDriveAccess::internalWriteData(const uint32_t sectorNumber, const uint32_t sectorSize, const void* data) {
 	if (m_device.readOnly) return false;
-	if (!seek(sectorNumber * sectorSize)) return false;
+	if (!seek((uint64_t)sectorNumber * sectorSize, sectorSize)) return false;
 
 	DWORD bytesWritten = 0;
 	if (!WriteFile(m_drive, data, sectorSize, &bytesWritten, NULL)) bytesWritten = 0;
 	return bytesWritten == sectorSize;
 }
 
+// Read a run of sectors with a single read. Data must be at least count * getSectorSize() size
+bool CDriveAccess::internalReadSectors(const uint32_t firstSector, const uint32_t count, const uint32_t sectorSize, void* data) {
+	const DWORD totalSize = count * sectorSize;
+	if (!seek((uint64_t)firstSector * sectorSize, totalSize)) return false;
+
+	DWORD bytesRead = 0;
+	if (!ReadFile(m_drive, data, totalSize, &bytesRead, NULL)) bytesRead = 0;
+	return bytesRead == totalSize;
+}
+
+// Write a run of sectors with a single write
+bool CDriveAccess::internalWriteSectors(const uint32_t firstSector, const uint32_t count, const uint32_t sectorSize, const void* data) {
+	if (m_device.readOnly) return false;
+	const DWORD totalSize = count * sectorSize;
+	if (!seek((uint64_t)firstSector * sectorSize, totalSize)) return false;
+
+	DWORD bytesWritten = 0;
+	if (!WriteFile(m_drive, data, totalSize, &bytesWritten, NULL)) bytesWritten = 0;
+	return bytesWritten == totalSize;
+}
+
+// Read several runs, queued on the device together if possible
+bool CDriveAccess::internalReadRuns(const std::vector<SectorRun>& runs, const uint32_t sectorSize) {
+	if ((m_asyncDrive == INVALID_HANDLE_VALUE) || (runs.size() < 2)) return SectorCacheEngine::internalReadRuns(runs, sectorSize);
+	return asyncTransfer(runs, sectorSize, false);
+}
+
+// Write several runs, queued on the device together if possible
+bool CDriveAccess::internalWriteRuns(const std::vector<SectorRun>& runs, const uint32_t sectorSize) {
+	if (m_device.readOnly) return false;
+	if ((m_asyncDrive == INVALID_HANDLE_VALUE) || (runs.size() < 2)) return SectorCacheEngine::internalWriteRuns(runs, sectorSize);
+	return asyncTransfer(runs, sectorSize, true);
+}
+
 bool CDriveAccess::isDiskPresent() {
 	return m_drive != INVALID_HANDLE_VALUE;
 }
@@ -106,16 +106,34 @@ public:
 class CDriveAccess : public SectorCacheEngine {
 	friend class CDriveList;
 private:
+	// Most reads/writes in progress at once on the overlapped handle
+	static constexpr uint32_t ASYNC_QUEUE_DEPTH = 16;
+
 	CDriveList::CDevice m_device;
 	HANDLE m_drive;
+	// Second handle to the drive opened for overlapped I/O, so several runs can be queued on the device at once
+	HANDLE m_asyncDrive = INVALID_HANDLE_VALUE;
+	HANDLE m_asyncEvents[ASYNC_QUEUE_DEPTH] = {};
 	std::vector<HANDLE> m_lockedVolumes;
 	bool m_dismounted = false;
 	bool m_dontFreeHandle = false;
 
-	bool seek(uint64_t offset);
+	// Works out where on the device length bytes at offset start. Returns FALSE if they run off the end or aren't sector aligned
+	bool deviceOffset(uint64_t offset, const uint64_t length, uint64_t& position);
+	bool seek(uint64_t offset, const uint64_t length);
+
+	// Open/Close the overlapped handle. If it can't be opened everything just uses m_drive
+	void openAsyncHandle();
+	void closeAsyncHandle();
+	// Read or write several runs with up to ASYNC_QUEUE_DEPTH of them in progress at once
+	bool asyncTransfer(const std::vector<SectorRun>& runs, const uint32_t sectorSize, const bool write);
 
 	virtual bool internalReadData(const uint32_t sectorNumber, const uint32_t sectorSize, void* data) override;
 	virtual bool internalWriteData(const uint32_t sectorNumber, const uint32_t sectorSize, const void* data) override;
+	virtual bool internalReadSectors(const uint32_t firstSector, const uint32_t count, const uint32_t sectorSize, void* data) override;
+	virtual bool internalWriteSectors(const uint32_t firstSector, const uint32_t count, const uint32_t sectorSize, const void* data) override;
+	virtual bool internalReadRuns(const std::vector<SectorRun>& runs, const uint32_t sectorSize) override;
+	virtual bool internalWriteRuns(const std::vector<SectorRun>& runs, const uint32_t sectorSize) override;
 
 public:
 	CDriveAccess();
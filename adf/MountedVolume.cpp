@@ -323,13 +323,13 @@ IPFS3* createPFS3FromVolume(AdfDevice* device, int partitionIndex, SectorCacheEn
     pinfo.numBuffer = part.numBuffer;
 
     IPFS3* pfs3 = IPFS3::createInstance(drive, pinfo,
-        [io](uint32_t physicalSector, uint32_t readSize, void* data)->bool {
-            // READ SECTOR
-            return io->readData(physicalSector, readSize, data);
+        [io](uint32_t physicalSector, uint32_t numSectors, uint32_t sectorSize, void* data, bool metadata)->bool {
+            // READ SECTORS
+            return io->readSectors(physicalSector, numSectors, sectorSize, data, metadata ? CachePriority::cpMetadata : CachePriority::cpNormal);
         },
-        [io](uint32_t physicalSector, uint32_t readSize, const void* data)->bool {
-            // WRITE SECTOR
-            return io->writeData(physicalSector, readSize, data);
+        [io](uint32_t physicalSector, uint32_t numSectors, uint32_t sectorSize, const void* data)->bool {
+            // WRITE SECTORS
+            return io->writeSectors(physicalSector, numSectors, sectorSize, data);
         },
         [io](const std::string& message) {                
         }
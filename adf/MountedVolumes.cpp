@@ -140,13 +140,8 @@ DRESULT disk_read(BYTE pdrv, BYTE* buff, LBA_t sector, UINT count) {
     if (fatfsSectorCache && (pdrv == 0)) {
         if (!fatfsSectorCache->isDiskPresent()) return RES_NOTRDY;
 
-        while (count) {
-            if (!fatfsSectorCache->hybridReadData(sector, fatfsSectorCache->sectorSize(), buff))
-                return RES_ERROR;
-            count--;
-            sector++;
-            buff += fatfsSectorCache->hybridSectorSize();
-        }
+        if (!fatfsSectorCache->hybridReadSectors((uint32_t)sector, count, fatfsSectorCache->hybridSectorSize(), buff))
+            return RES_ERROR;
         return RES_OK;
     }
     return RES_PARERR;
@@ -155,14 +150,8 @@ DRESULT disk_write(BYTE pdrv, const BYTE* buff, LBA_t sector, UINT count) {
     if (fatfsSectorCache && (pdrv == 0)) {
         if (!fatfsSectorCache->isDiskPresent()) return RES_NOTRDY;
         if (fatfsSectorCache->isDiskWriteProtected()) return RES_WRPRT;
-        while (count) {
-            if (!fatfsSectorCache->writeData(sector, fatfsSectorCache->sectorSize(), buff))
-                return RES_ERROR;
-
-            count--;
-            sector++;
-            buff += fatfsSectorCache->sectorSize();
-        }
+        if (!fatfsSectorCache->writeSectors((uint32_t)sector, count, fatfsSectorCache->sectorSize(), buff))
+            return RES_ERROR;
         return RES_OK;
     }
     return RES_PARERR;
@@ -204,9 +193,8 @@ VolumeManager::VolumeManager(HINSTANCE hInstance, const std::wstring& mainExe, W
     m_currentSectorFormat(SectorType::stUnknown), m_forceReadOnly(forceReadOnly), m_hInstance(hInstance)  {
     DokanInit();
 
-    AppConfig cfg;
-    loadConfiguration(cfg);
-    m_autoRename = cfg.autoRename;
+    loadConfiguration(m_config);
+    m_autoRename = m_config.autoRename;
 
     // Prepare the ADF library
     adfPrepNativeDriver();
@@ -446,6 +434,8 @@ bool VolumeManager::mountRaw(const std::wstring& physicalDrive, bool readOnly) {
     else {
         m_io = drive;
         m_mountMode = COMMANDLINE_MOUNTRAW;
+        if ((m_config.writeBackCache) && (!m_io->isDiskWriteProtected())) m_io->setWriteBackMode(true, m_config.writeBackMaxDirty, m_config.writeBackIdleTime);
+        if (m_config.readAhead) m_io->setReadAhead(true, m_config.readAheadWindow, m_config.readAheadMaxMem);
     }
     return true;
 }
@@ -474,11 +464,25 @@ bool VolumeManager::mountFile(const std::wstring& filename) {
     // DMS file?
     if (strcmp(buffer, "DMS!") == 0) {
         SetFilePointer(fle, 0, NULL, FILE_BEGIN);
-        m_io = new SectorRW_DMS(fle);
-        if (!m_io->available()) {
-            CloseHandle(fle);
-            return false;
-        }        
+        // This takes ownership of the file handle
+        SectorRW_DMS* dms = new SectorRW_DMS(fle);
+        m_io = dms;
+        if (!m_io->available()) return false;
+        if (m_config.verifyDMS) {
+            dms->setVerify(true);
+            if (!dms->verifyArchive()) {
+                std::wstring msg = L"The following tracks in this DMS archive are damaged and may not be readable:\r\n";
+                for (const SectorRW_DMS::TrackIntegrity& track : dms->getIntegrityReport()) {
+                    if ((!track.headerOK) || (!track.packedOK) || (!track.unpackedOK)) {
+                        msg += L"\r\nCylinder " + std::to_wstring(track.cylinder) + L": ";
+                        if (!track.headerOK) msg += L"track header CRC failed, the rest of the archive can't be read";
+                        else if (!track.packedOK) msg += L"packed data CRC failed";
+                        else msg += L"unpacked data checksum failed";
+                    }
+                }
+                MessageBox(m_window.hwnd(), msg.c_str(), L"DMS Verification", MB_OK | MB_ICONEXCLAMATION);
+            }
+        }
         fatfsSectorCache = m_io;
         return true;
     }
@@ -486,19 +490,29 @@ bool VolumeManager::mountFile(const std::wstring& filename) {
         buffer[3] = '\0';
         if (strcmp(buffer, "SCP") == 0) {
             // Assume its some kind of image file
-            m_io = new SCPFile(fle, [this](bool diskInserted, SectorType diskFormat) {
+            SCPFile* scp = new SCPFile(fle, [this](bool diskInserted, SectorType diskFormat) {
                 // push this in the main thread incase its not!
                 triggerRemount();
              });
+            m_io = scp;
             if (!m_io->available()) return false;
+            if (m_config.memoryMapFiles) scp->enableMemoryMapping();
+            if (m_config.scpDecodeThreads) scp->startBackgroundDecode(m_config.scpDecodeThreads);
             fatfsSectorCache = m_io;
             return true;
         }
         else {
 
             // Assume its some kind of image file
-            m_io = new SectorRW_File(filename, fle);
+            SectorRW_File* file = new SectorRW_File(filename, fle);
+            m_io = file;
             if (!m_io->available()) return false;
+            // Memory mapping is only used if it was asked for. Mapped files skip the cache, so they don't get write back or read-ahead
+            const bool mapped = (m_config.memoryMapFiles) && (file->enableMemoryMapping());
+            if (!mapped) {
+                if ((m_config.writeBackCache) && (!m_io->isDiskWriteProtected())) m_io->setWriteBackMode(true, m_config.writeBackMaxDirty, m_config.writeBackIdleTime);
+                if (m_config.readAhead) m_io->setReadAhead(true, m_config.readAheadWindow, m_config.readAheadMaxMem);
+            }
             fatfsSectorCache = m_io;
             return true;
         }
@@ -685,6 +699,7 @@ bool VolumeManager::run(bool triggerExplorer) {
     // Handle TIMER events - for monitoring the filesystem for termination
     m_window.setMessageHandler(WM_TIMER, [this](WPARAM timerID, LPARAM lpUser) -> LRESULT {
         if (timerID == TIMERID_MONITOR_FILESYS) {
+            m_io->flushIfIdle();
             checkRunningFileSystems();            
             return 0;
         }
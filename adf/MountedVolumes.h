@@ -35,6 +35,7 @@ private:
 	bool m_triggerExplorer = false;
 	bool m_ejecting = false;
 	bool m_autoRename;
+	AppConfig m_config;
 
 	// If we have an Amiga disk inserted
 	AdfDevice* m_adfDevice = nullptr;
@@ -82,6 +82,7 @@ bool SCPFile::readSCPFile() {
 		t.lastRev = 0;
 		t.m_fileOffset = trackOffsets[trk];
 		t.m_trackIsBad = false;
+		t.m_decoding = false;
 		m_tracks.insert(std::pair(trk, t));
 	}
 
@@ -92,25 +93,108 @@ bool SCPFile::readSCPFile() {
 	return true;
 } 
 
-// Decode a specific track into MFM
-bool SCPFile::decodeTrack(uint32_t track) {
+// Decode a specific track into MFM. If it's being decoded by someone else this waits for them, unless wait is false
+bool SCPFile::decodeTrack(uint32_t track, bool wait) {
 	if (track < m_firstTrack) return false;
 	if (track > m_lastTrack) return false;
 
+	std::unique_lock<std::mutex> lock(m_trackLock);
 	auto trk = m_tracks.find(track);
 	if (trk == m_tracks.end()) return false;
 
+	// Someone wants this track, so the background decoding moves on to the ones after it
+	if ((wait) && (m_lastRequested != track)) {
+		m_lastRequested = track;
+		m_decodeWanted.notify_all();
+	}
+
+	if (trk->second.m_decoding) {
+		if (!wait) return false;
+		m_trackDecoded.wait(lock, [&trk]() { return !trk->second.m_decoding; });
+	}
+
 	if (!trk->second.revolutions.empty()) return true;
 	if (trk->second.m_trackIsBad) return false;
 
 	// Temporarly mark the track as bad
 	trk->second.m_trackIsBad = true;
+	trk->second.m_decoding = true;
+	const uint32_t fileOffset = trk->second.m_fileOffset;
+	lock.unlock();
+
+	std::vector<Revolution> revolutions;
+	readTrackRevolutions(track, fileOffset, revolutions);
+
+	lock.lock();
+	trk->second.revolutions = std::move(revolutions);
+	trk->second.m_trackIsBad = trk->second.revolutions.empty();
+	trk->second.m_decoding = false;
+	if (!trk->second.m_trackIsBad) touchDecodedTrack(track);
+	m_trackDecoded.notify_all();
+
+	return !trk->second.m_trackIsBad;
+}
+
+// Marks a decoded track as the most recently used, and drops the decoded revolutions of the oldest ones if there's too many. Call with m_trackLock held
+void SCPFile::touchDecodedTrack(uint32_t track) {
+	for (auto it = m_decodedTracks.begin(); it != m_decodedTracks.end(); ++it)
+		if (*it == track) {
+			if (it != m_decodedTracks.begin()) m_decodedTracks.splice(m_decodedTracks.begin(), m_decodedTracks, it);
+			return;
+		}
+
+	m_decodedTracks.push_front(track);
+	while (m_decodedTracks.size() > SCP_TRACK_CACHE) {
+		// They can be decoded again from the flux if they're needed
+		auto trk = m_tracks.find(m_decodedTracks.back());
+		if (trk != m_tracks.end()) std::vector<Revolution>().swap(trk->second.revolutions);
+		m_decodedTracks.pop_back();
+	}
+}
+
+// Copy memory out of the mapped file.  If the file can't be paged in (eg: the drive its on vanished) Windows raises an exception rather than failing
+static bool safeMappedCopy(void* dest, const void* src, const size_t size) {
+	__try {
+		memcpy(dest, src, size);
+		return true;
+	}
+	__except (GetExceptionCode() == EXCEPTION_IN_PAGE_ERROR ? EXCEPTION_EXECUTE_HANDLER : EXCEPTION_CONTINUE_SEARCH) {
+		return false;
+	}
+}
 
+// Reads the flux for a track and runs it through the PLL
+bool SCPFile::readTrackRevolutions(uint32_t track, uint32_t fileOffset, std::vector<Revolution>& output) {
 	// This means no data
-	if (trk->second.m_fileOffset == 0) return false;
+	if (fileOffset == 0) return false;
+	if (m_mapView) return decodeMappedTrack(track, fileOffset, output);
+
+	std::vector<SCPTrackRevolution> revolutions;
+	std::vector<std::vector<uint16_t>> data;
+	if (!readTrackFlux(track, fileOffset, revolutions, data)) return false;
+
+	// Quick scan for density - can't rely on the header information being correct as it quite often isnt!
+	// This only happens on the first track, before anything is decoded in the background
+	if (!m_density) {
+		uint32_t ns2 = 0;
+		uint32_t ns6 = 0;
+		for (size_t r = 0; r < revolutions.size(); r++) countDensity((const uint8_t*)data[r].data(), revolutions[r].trackLength, ns2, ns6);
+		m_density = ns2 > ns6 ? 2 : 1;
+	}
+
+	// Now decode each track, directly into MFM
+	PLL pll;
+	for (size_t r = 0; r < revolutions.size(); r++) decodeRevolution(pll, revolutions[r], (const uint8_t*)data[r].data(), output);
+	return !output.empty();
+}
+
+// Reads the revolution list and flux for a track from the file
+bool SCPFile::readTrackFlux(uint32_t track, uint32_t fileOffset, std::vector<SCPTrackRevolution>& revolutions, std::vector<std::vector<uint16_t>>& data) {
+	// The file is shared with any other threads decoding, so read everything for the track in one go
+	std::lock_guard<std::mutex> fileLock(m_fileLock);
 
 	// Goto the track data
-	if (SetFilePointer(m_file, trk->second.m_fileOffset, NULL, FILE_BEGIN) == INVALID_SET_FILE_POINTER) return false;
+	if (SetFilePointer(m_file, fileOffset, NULL, FILE_BEGIN) == INVALID_SET_FILE_POINTER) return false;
 
 	// Read track header and validate it
 	SCPTrackHeader header;
@@ -119,7 +203,6 @@ bool SCPFile::decodeTrack(uint32_t track) {
 	if ((read != sizeof(header)) || ((header.headerTRK[0] != 'T') || (header.headerTRK[1] != 'R') || (header.headerTRK[2] != 'K'))) return false;
 	if (header.trackNumber != track) return false;
 
-	std::vector<SCPTrackRevolution> revolutions;
 	// Now read in the track info - the start of each revolution
 	for (uint32_t r = 0; r < m_numRevolutions; r++) {
 		SCPTrackRevolution rev;
@@ -128,78 +211,148 @@ bool SCPFile::decodeTrack(uint32_t track) {
 		revolutions.push_back(rev);
 	}
 
-	// Temp buffer for flux timing data
-	std::vector<uint16_t> data;
+	// Read in the RAW flux timing
+	data.resize(revolutions.size());
+	for (size_t r = 0; r < revolutions.size(); r++) {
+		if (SetFilePointer(m_file, revolutions[r].dataOffset + fileOffset, NULL, FILE_BEGIN) == INVALID_SET_FILE_POINTER) return false;
+		data[r].resize(revolutions[r].trackLength);
+		if (!ReadFile(m_file, (char*)data[r].data(), revolutions[r].trackLength * 2, &read, NULL)) read = 0;
+		if (read != revolutions[r].trackLength * 2) return false;
+	}
+	return true;
+}
 
-	m_pll.reset();
+// Decodes a track from the mapped file. No other threads are held up, as there's no file position to share.  Each revolution is copied
+// into the same buffer and decoded before the next, as the PLL can't be left reading the view if the file can't be paged in
+bool SCPFile::decodeMappedTrack(uint32_t track, uint32_t fileOffset, std::vector<Revolution>& output) {
+	// Read track header and validate it
+	uint64_t pos = fileOffset;
+	if (pos + sizeof(SCPTrackHeader) + (m_numRevolutions * sizeof(SCPTrackRevolution)) > m_mapSize) return false;
+	SCPTrackHeader header;
+	if (!safeMappedCopy(&header, m_mapView + pos, sizeof(header))) return false;
+	if ((header.headerTRK[0] != 'T') || (header.headerTRK[1] != 'R') || (header.headerTRK[2] != 'K')) return false;
+	if (header.trackNumber != track) return false;
+	pos += sizeof(header);
 
-	// Quick scan for density - can't rely on the header information being correct as it quite often isnt!
+	// Now the track info - the start of each revolution
+	std::vector<SCPTrackRevolution> revolutions(m_numRevolutions);
+	if (!safeMappedCopy(revolutions.data(), m_mapView + pos, m_numRevolutions * sizeof(SCPTrackRevolution))) return false;
+
+	// Copy out the RAW flux timing for one revolution
+	std::vector<uint16_t> flux;
+	auto copyRevolution = [this, fileOffset, &flux](const SCPTrackRevolution& revolution) {
+		if ((uint64_t)fileOffset + revolution.dataOffset + ((uint64_t)revolution.trackLength * 2) > m_mapSize) return false;
+		flux.resize(revolution.trackLength);
+		return safeMappedCopy(flux.data(), m_mapView + fileOffset + revolution.dataOffset, (size_t)revolution.trackLength * 2);
+	};
+
+	// Quick scan for density, as above
 	if (!m_density) {
-		// This is for guessing DD vs HD data
 		uint32_t ns2 = 0;
-		uint32_t ns6 = 0;		
-
-		for (const SCPTrackRevolution& rev : revolutions) {
-			if (SetFilePointer(m_file, rev.dataOffset + trk->second.m_fileOffset, NULL, FILE_BEGIN) == INVALID_SET_FILE_POINTER) return false;
-			// Read in the RAW flux timing
-			data.resize(rev.trackLength);
-			if (!ReadFile(m_file, (char*)data.data(), rev.trackLength * 2, &read, NULL)) read = 0;
-			if (read != rev.trackLength * 2) return false;
-
-			uint32_t lastTime = 0;
-			for (const uint16_t t : data) {
-				const uint16_t t2 = htons(t);  // paws naidne
-				if (t2 == 0) lastTime += 65536; else {
-					const uint32_t totalFlux = (lastTime + t2) * m_fluxMultiplier;
-					if (totalFlux < 2500) ns2++;  // High Density 01 would be 2000ns
-					if (totalFlux > 5000) ns6++;  // Double density 001 would be 6000ns
-					lastTime = 0;
-				}
-			}
+		uint32_t ns6 = 0;
+		for (const SCPTrackRevolution& revolution : revolutions) {
+			if (!copyRevolution(revolution)) return false;
+			countDensity((const uint8_t*)flux.data(), revolution.trackLength, ns2, ns6);
 		}
 		m_density = ns2 > ns6 ? 2 : 1;
 	}
 
-	// Now read in and decode each track, directly into MFM
-	for (const SCPTrackRevolution& rev : revolutions) {
-		m_pll.newTrack();
-
-		if (SetFilePointer(m_file, rev.dataOffset + trk->second.m_fileOffset, NULL, FILE_BEGIN) == INVALID_SET_FILE_POINTER) return false;
-
-		// Read in the RAW flux timing
-		data.resize(rev.trackLength);
-		if (!ReadFile(m_file, (char*)data.data(), rev.trackLength * 2, &read, NULL)) read = 0;
-		if (read != rev.trackLength * 2) return false;
-
-		// Convert data into MFM
-		uint32_t lastTime = 0;
-		for (const uint16_t t : data) {
-			const uint16_t t2 = htons(t);  // paws naidne
-			if (t2 == 0) lastTime += 65536; else {
-				const uint32_t totalFlux = (lastTime + t2) * m_fluxMultiplier;
-				m_pll.decodeFlux(totalFlux * m_density);
-				lastTime = 0;
-			}
+	PLL pll;
+	for (const SCPTrackRevolution& revolution : revolutions) {
+		if (!copyRevolution(revolution)) {
+			output.clear();
+			return false;
+		}
+		decodeRevolution(pll, revolution, (const uint8_t*)flux.data(), output);
+	}
+	return !output.empty();
+}
+
+// Counts the flux times that look HD and DD, for guessing the density
+void SCPFile::countDensity(const uint8_t* cells, uint32_t numCells, uint32_t& ns2, uint32_t& ns6) {
+	uint32_t lastTime = 0;
+	for (uint32_t c = 0; c < numCells; c++) {
+		const uint32_t t2 = (cells[c * 2] << 8) | cells[(c * 2) + 1];  // paws naidne
+		if (t2 == 0) lastTime += 65536; else {
+			const uint32_t totalFlux = (lastTime + t2) * m_fluxMultiplier;
+			if (totalFlux < 2500) ns2++;  // High Density 01 would be 2000ns
+			if (totalFlux > 5000) ns6++;  // Double density 001 would be 6000ns
+			lastTime = 0;
 		}
+	}
+}
+
+// Runs the flux for one revolution through the PLL
+void SCPFile::decodeRevolution(PLL& pll, const SCPTrackRevolution& revolution, const uint8_t* cells, std::vector<Revolution>& output) {
+	// indexTime is in 25ns units, and the PLL sees flux scaled by the density
+	pll.newTrack((uint64_t)revolution.indexTime * 25 * m_density);
+
+	// Convert data into MFM
+	pll.decodeFluxCells(cells, revolution.trackLength, m_fluxMultiplier * m_density);
 
-		// Have a look at what we got
-		void* memory = nullptr;
-		uint32_t sizeInBits = m_pll.finaliseTrack(&memory);
+	// Have a look at what we got
+	void* memory = nullptr;
+	uint32_t sizeInBits = pll.finaliseTrack(&memory);
 
-		// Make enough memory
-		trk->second.revolutions.push_back(Revolution());		
-		trk->second.revolutions.back().sizeInBits = sizeInBits;
-		trk->second.revolutions.back().mfmData.resize((sizeInBits + 7) / 8);
+	// Make enough memory
+	output.push_back(Revolution());
+	output.back().sizeInBits = sizeInBits;
+	output.back().mfmData.resize((sizeInBits + 7) / 8);
 
-		// Save it
-		memcpy_s(&trk->second.revolutions.back().mfmData[0], trk->second.revolutions.back().mfmData.size(), memory, (sizeInBits + 7) / 8);
+	// Save it
+	memcpy_s(&output.back().mfmData[0], output.back().mfmData.size(), memory, (sizeInBits + 7) / 8);
+}
+
+// Finds a track after the last one asked for that needs decoding. Call with m_trackLock held
+bool SCPFile::nextTrackToDecode(uint32_t& track) {
+	for (uint32_t trk = m_lastRequested + 1; (trk <= m_lastTrack) && (trk <= m_lastRequested + SCP_DECODE_AHEAD); trk++) {
+		auto it = m_tracks.find(trk);
+		if ((it != m_tracks.end()) && (it->second.revolutions.empty()) && (!it->second.m_decoding) && (!it->second.m_trackIsBad)) {
+			track = trk;
+			return true;
+		}
 	}
+	return false;
+}
 
-	trk->second.m_trackIsBad = trk->second.revolutions.empty();
+// Decode the SCP_DECODE_AHEAD tracks after the last one asked for in the background, using up to numThreads threads.  Going no further
+// than that keeps what they decode inside SCP_TRACK_CACHE, rather than the workers throwing away each others tracks
+void SCPFile::startBackgroundDecode(uint32_t numThreads) {
+	if ((!numThreads) || (!m_workers.empty()) || (m_tracks.empty())) return;
 
-	return !trk->second.m_trackIsBad;
+	{
+		// Nothing's been read yet, so start at the beginning of the disk
+		std::lock_guard<std::mutex> lock(m_trackLock);
+		m_lastRequested = m_firstTrack;
+	}
+
+	numThreads = min(numThreads, max(1U, std::thread::hardware_concurrency()));
+	for (uint32_t t = 0; t < numThreads; t++)
+		m_workers.push_back(std::thread([this]() {
+			std::unique_lock<std::mutex> lock(m_trackLock);
+			for (;;) {
+				uint32_t track = 0;
+				m_decodeWanted.wait(lock, [this, &track]() { return (m_stopWorkers) || (nextTrackToDecode(track)); });
+				if (m_stopWorkers) return;
+				lock.unlock();
+				// Tracks being done by whoever asked for them are just skipped
+				decodeTrack(track, false);
+				lock.lock();
+			}
+		}));
 }
 
+// Waits for, and shuts down the background decoding
+void SCPFile::stopWorkers() {
+	{
+		std::lock_guard<std::mutex> lock(m_trackLock);
+		m_stopWorkers = true;
+	}
+	m_decodeWanted.notify_all();
+	for (std::thread& worker : m_workers)
+		if (worker.joinable()) worker.join();
+	m_workers.clear();
+}
 
 // Flags from WINUAE
 SCPFile::SCPFile(HANDLE file, std::function<void(bool diskInserted, SectorType diskFormat)> diskChangeCallback) 
@@ -217,6 +370,15 @@ SCPFile::~SCPFile() {
 
 // Rapid shutdown
 void SCPFile::quickClose() {
+	stopWorkers();
+	if (m_mapView) {
+		UnmapViewOfFile(m_mapView);
+		m_mapView = nullptr;
+	}
+	if (m_mapping) {
+		CloseHandle(m_mapping);
+		m_mapping = NULL;
+	}
 	if (m_file != INVALID_HANDLE_VALUE) {
 		CloseHandle(m_file);
 		m_file = INVALID_HANDLE_VALUE;
@@ -224,6 +386,28 @@ void SCPFile::quickClose() {
 }
 
 
+// Copy the flux out of a memory mapped view of the file rather than reading it in, so decoding threads don't queue on the file
+bool SCPFile::enableMemoryMapping() {
+	if ((m_file == INVALID_HANDLE_VALUE) || (m_mapView) || (!m_workers.empty())) return false;
+
+	LARGE_INTEGER size;
+	if ((!GetFileSizeEx(m_file, &size)) || (size.QuadPart <= 0)) return false;
+	// Too big for the address space (32-bit builds) so leave it to normal file access
+	if ((uint64_t)size.QuadPart > (uint64_t)SIZE_MAX) return false;
+
+	m_mapping = CreateFileMapping(m_file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (!m_mapping) return false;
+
+	m_mapView = (const uint8_t*)MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+	if (!m_mapView) {
+		CloseHandle(m_mapping);
+		m_mapping = NULL;
+		return false;
+	}
+	m_mapSize = (uint64_t)size.QuadPart;
+	return true;
+}
+
 // Return TRUE if it loaded OK
 bool SCPFile::isDiskInDrive() {
 	return !m_tracks.empty();
@@ -232,11 +416,15 @@ bool SCPFile::isDiskInDrive() {
 // Extract (and decode)
 uint32_t SCPFile::mfmRead(uint32_t track, bool retryMode, void* data, uint32_t maxLength) {
 	if (!decodeTrack(track)) return 0;
+
+	// Hold this so the revolutions can't be dropped while they're copied
+	std::lock_guard<std::mutex> lock(m_trackLock);
 	
 	// Does the track exist?
 	auto i = m_tracks.find(track);
 	if (i == m_tracks.end()) return 0;
 	if (i->second.revolutions.size() < 1) return 0;
+	touchDecodedTrack(track);
 
 	uint32_t rev = i->second.lastRev;
 	// Goto the next revolution next time
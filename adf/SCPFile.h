@@ -17,6 +17,17 @@
 #include "pll.h"
 #include "mfminterface.h"
 #include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <list>
+
+// Most tracks kept decoded at once.  Evicted ones are decoded again from the flux when they're needed
+#define SCP_TRACK_CACHE 20
+// How many tracks past the last one asked for are decoded in the background, well inside SCP_TRACK_CACHE so they're still there when they're read
+#define SCP_DECODE_AHEAD (SCP_TRACK_CACHE / 2)
+
+struct SCPTrackRevolution;
 
 
 class SCPFile : public SectorCacheMFM {
@@ -31,6 +42,7 @@ private:
         uint32_t lastRev;
 
         bool m_trackIsBad;        
+        bool m_decoding;          // Being decoded right now, wait for m_trackDecoded
         std::vector<Revolution> revolutions;
     };
 
@@ -40,15 +52,51 @@ private:
     uint32_t m_numRevolutions = 1;
 
     std::unordered_map<uint32_t, Track> m_tracks;
+    // Protects the state of everything in m_tracks
+    std::mutex m_trackLock;
+    std::condition_variable m_trackDecoded;
+
+    // Tracks with decoded revolutions, most recently used first
+    std::list<uint32_t> m_decodedTracks;
 
-    PLL m_pll;
     uint8_t m_density = 0;  // 0=Unknown, 1=DD, 2=HD
     HANDLE m_file;
+    std::mutex m_fileLock;
+    // Memory mapped view of the whole file, if enabled
+    HANDLE m_mapping = NULL;
+    const uint8_t* m_mapView = nullptr;
+    uint64_t m_mapSize = 0;
+
+    // Background decoding of the tracks after the last one asked for. Protected by m_trackLock
+    std::vector<std::thread> m_workers;
+    std::condition_variable m_decodeWanted;
+    uint32_t m_lastRequested = 0;
+    bool m_stopWorkers = false;
 
     void checkHD();
 
-    // Decode a specific track into MFM
-    bool decodeTrack(uint32_t track);
+    // Decode a specific track into MFM. If it's being decoded by someone else this waits for them, unless wait is false
+    bool decodeTrack(uint32_t track, bool wait = true);
+
+    // Reads the flux for a track and runs it through the PLL
+    bool readTrackRevolutions(uint32_t track, uint32_t fileOffset, std::vector<Revolution>& revolutions);
+    // Reads the revolution list and flux for a track from the file
+    bool readTrackFlux(uint32_t track, uint32_t fileOffset, std::vector<SCPTrackRevolution>& revolutions, std::vector<std::vector<uint16_t>>& data);
+    // Decodes a track from the mapped file, copying out one revolution at a time
+    bool decodeMappedTrack(uint32_t track, uint32_t fileOffset, std::vector<Revolution>& output);
+    // Counts the flux times that look HD and DD, for guessing the density
+    void countDensity(const uint8_t* cells, uint32_t numCells, uint32_t& ns2, uint32_t& ns6);
+    // Runs the flux for one revolution through the PLL
+    void decodeRevolution(PLL& pll, const SCPTrackRevolution& revolution, const uint8_t* cells, std::vector<Revolution>& output);
+
+    // Finds a track after the last one asked for that needs decoding. Call with m_trackLock held
+    bool nextTrackToDecode(uint32_t& track);
+
+    // Marks a decoded track as the most recently used, and drops the decoded revolutions of the oldest ones if there's too many. Call with m_trackLock held
+    void touchDecodedTrack(uint32_t track);
+
+    // Waits for, and shuts down the background decoding
+    void stopWorkers();
 protected:
     virtual bool restoreDrive() override { return isDiskInDrive(); };
     virtual void releaseDrive() override {};
@@ -79,6 +127,12 @@ public:
     // Return an ID to identify this with
     virtual uint32_t id() override { return 0x53435020; }
 
+    // Decode the SCP_DECODE_AHEAD tracks after the last one asked for in the background, using up to numThreads threads
+    void startBackgroundDecode(uint32_t numThreads);
+
+    // Copy the flux out of a memory mapped view of the file, a revolution at a time, rather than reading it in
+    bool enableMemoryMapping();
+
     // Returns TRUE if the inserted disk is HD
     virtual bool isHD() override { return m_density == 2; };
 
@@ -124,22 +124,40 @@ static ADF_RETCODE dfbRelease(struct AdfDevice* const dev) {
 }
 
 
-static ADF_RETCODE dfbReadSector(struct AdfDevice* const dev, const uint32_t n, const unsigned size, uint8_t* const buf) {    
+// Read sectors, telling the cache how important they are to keep
+static ADF_RETCODE dfbReadWithPriority(struct AdfDevice* const dev, const uint32_t n, const unsigned size, uint8_t* const buf, const CachePriority priority) {
     SectorCacheEngine* d = (SectorCacheEngine*)dev->drvData;
 
+    // Multi-block requests go through as a single read
+    if ((size > 512) && ((size % 512) == 0))
+        return d->readSectors(n, size / 512, 512, buf, priority) ? ADF_RC_OK : ADF_RC_ERROR;
+
     if (size != 512) {
         uint8_t buffer[512];
-        if (!d->readData(n, 512, buffer)) return ADF_RC_ERROR;
+        if (!d->readData(n, 512, buffer, priority)) return ADF_RC_ERROR;
         memcpy_s(buf, size, buffer, min(size, 512));
         return ADF_RC_OK;
     }
 
-    return d->readData(n, size, buf) ? ADF_RC_OK : ADF_RC_ERROR;
+    return d->readData(n, size, buf, priority) ? ADF_RC_OK : ADF_RC_ERROR;
+}
+
+// Everything except file data is filesystem structure, which gets read again and again
+static ADF_RETCODE dfbReadSector(struct AdfDevice* const dev, const uint32_t n, const unsigned size, uint8_t* const buf) {    
+    return dfbReadWithPriority(dev, n, size, buf, CachePriority::cpMetadata);
+}
+
+static ADF_RETCODE dfbReadDataSector(struct AdfDevice* const dev, const uint32_t n, const unsigned size, uint8_t* const buf) {
+    return dfbReadWithPriority(dev, n, size, buf, CachePriority::cpNormal);
 }
 
 static ADF_RETCODE dfbWriteSector(struct AdfDevice* const dev, const uint32_t n, const unsigned size, const uint8_t* const    buf) {
     SectorCacheEngine* d = (SectorCacheEngine*)dev->drvData;
 
+    // Multi-block requests go through as a single write
+    if ((size > 512) && ((size % 512) == 0))
+        return d->writeSectors(n, size / 512, 512, buf) ? ADF_RC_OK : ADF_RC_ERROR;
+
     if (size != 512) {
         uint8_t buffer[512];
         if (!d->readData(n, 512, buffer)) return ADF_RC_ERROR;
@@ -165,5 +183,6 @@ const struct AdfDeviceDriver adfDeviceDriverDiskFlashback = {
     .readSector = dfbReadSector,
     .writeSector = dfbWriteSector,
     .isNative = dfbIsDevNative,
-    .isDevice = NULL
+    .isDevice = NULL,
+    .readDataSector = dfbReadDataSector
 };
@@ -15,6 +15,8 @@
 
 
 #include "amiga_sectors.h"
+#include <array>
+#include <vector>
 
 #define NUM_SECTORS_PER_TRACK_DD	11			// Number of sectors per track
 #define NUM_SECTORS_PER_TRACK_HD	22			// Same but for HD disks
@@ -78,27 +80,7 @@ void getTrackDetails_AMIGA(const bool isHD, uint32_t& sectorsPerTrack, uint32_t&
 
 // Copys the data from inTrack into outSector so that it is aligned to byte properly
 void extractRawSector(const unsigned char* inTrack, const uint32_t dataLengthInBits, const uint32_t bitPos, RawEncodedSector& outSector) {
-	unsigned char byteOut = 0;
-	unsigned int byteOutPosition = 0;
-
-	uint32_t realBitPos = bitPos;
-		
-	unsigned char* memOut = outSector;
-
-	// This is mis-aligned.  So we need to shift the data into byte boundarys
-	for (uint32_t byteOutPos=0; byteOutPos < RAW_SECTOR_SIZE; byteOutPos++) {
-		for (uint32_t bit=0; bit<=7; bit++) {
-			*memOut <<= 1;
-			const uint32_t trackBytePos = realBitPos >> 3;
-			const uint32_t trackBitPos = 7 - (realBitPos & 7);
-
-			if (inTrack[trackBytePos] & (1 << trackBitPos)) *memOut |= 1;
-			realBitPos = (realBitPos + 1) % dataLengthInBits;
-		}
-
-		// Move along and reset
-		memOut++;
-	}
+	extractTrackBits(inTrack, dataLengthInBits, bitPos, RAW_SECTOR_SIZE * 8, outSector);
 }
 
 // MFM decoding algorithm
@@ -127,9 +109,8 @@ uint32_t decodeMFMdata(const uint32_t* input, uint32_t* output, const unsigned i
 
 // Decode the sector.  Returns the number of checksum/errors found
 void decodeSector(const RawEncodedSector& rawSector, const uint32_t trackNumber, const uint32_t expectedNumSectors, DecodedTrack& decodedTrack) {
-	DecodedSector sector;
 	SectorHeader header;
-	sector.numErrors = 0;
+	uint32_t numErrors = 0;
 
 	// Easier to operate on
 	const unsigned char* sectorData = rawSector;
@@ -144,94 +125,154 @@ void decodeSector(const RawEncodedSector& rawSector, const uint32_t trackNumber,
 	decodeMFMdata((uint32_t*)(sectorData + 40), (uint32_t*)&headerChecksum, 4);  // (computed on mfm longs, longs between offsets 8 and 44 == 2 * (1 + 4) longs)
 	
 	// If the header checksum fails we just cant trust anything we received
-	if (headerChecksum != headerChecksumCalculated) sector.numErrors+= 10;
+	if (headerChecksum != headerChecksumCalculated) numErrors+= 10;
 
 	// Check if the header contains valid fields
 	if (header.trackFormat != 0xFF) return;  // this also blocks IBM sectors from being detected incorrectly
 	// Can't use this sector anyway
 	if (header.sectorNumber > (expectedNumSectors - 1)) return;
-	if (header.trackNumber > 166) sector.numErrors++;
-	if (header.sectorsRemaining > expectedNumSectors) sector.numErrors++;
-	if (header.sectorsRemaining < 1) sector.numErrors++;
+	if (header.trackNumber > 166) numErrors++;
+	if (header.sectorsRemaining > expectedNumSectors) numErrors++;
+	if (header.sectorsRemaining < 1) numErrors++;
 
 	// And is it from the track we expected?
-	if (header.trackNumber != trackNumber) sector.numErrors++;
+	if (header.trackNumber != trackNumber) numErrors++;
 
 	// Get the checksum for the data
 	uint32_t dataChecksum;
 	decodeMFMdata((uint32_t*)(sectorData + 48), (uint32_t*)&dataChecksum, 4);
 
-	// Decode the data and receive it's checksum
-	sector.data.resize(SECTOR_BYTES);
-	uint32_t dataChecksumCalculated = decodeMFMdata((uint32_t*)(sectorData + 56), (uint32_t*)&sector.data[0], SECTOR_BYTES); // (from 64 to 1088 == 2*512 bytes)
+	// Decode the data and receive it's checksum. This is followed by the checksum, so a failed read can be kept as it is for voting
+	alignas(4) uint8_t decoded[SECTOR_BYTES + sizeof(dataChecksum)];
+	uint32_t dataChecksumCalculated = decodeMFMdata((uint32_t*)(sectorData + 56), (uint32_t*)decoded, SECTOR_BYTES); // (from 64 to 1088 == 2*512 bytes)
+	memcpy(decoded + SECTOR_BYTES, &dataChecksum, sizeof(dataChecksum));
+
+	const bool dataValid = dataChecksum == dataChecksumCalculated;
+	if (!dataValid) 
+		numErrors++;
 
-	if (dataChecksum != dataChecksumCalculated) 
-		sector.numErrors++;
+	// Keep this if the header is good but the data isn't, as it could be voted on with other reads
+	const bool keepFailedRead = (!dataValid) && (headerChecksum == headerChecksumCalculated) && (header.trackNumber == trackNumber);
 
 	// Store the one with the least errors if there's duplicates
-	auto it = decodedTrack.sectors.find(header.sectorNumber);
+	DecodedSector* it = decodedTrack.find(header.sectorNumber);
+	if ((!it) || (numErrors < it->numErrors))
+		it = decodedTrack.set(header.sectorNumber, decoded, SECTOR_BYTES, numErrors);
+	if (!it) return;
+
+	if (it->numErrors == 0) it->numVotes = 0;
+	else
+		if (keepFailedRead) {
+			// See if a vote between all the bad reads gives a good copy
+			uint8_t voted[sizeof(decoded)];
+			if (voteSectorCopies(decodedTrack, *it, decoded, sizeof(decoded), voted)) {
+				uint32_t votedChecksum = 0;
+				for (uint32_t i = 0; i < SECTOR_BYTES; i += 4) {
+					uint32_t data;
+					memcpy(&data, &voted[i], sizeof(data));
+					votedChecksum ^= data ^ (data >> 1);
+				}
+				memcpy(&dataChecksum, &voted[SECTOR_BYTES], sizeof(dataChecksum));
+				// This would have been the number of errors without the data checksum failing
+				const uint32_t headerErrors = numErrors - 1;
+				if (((votedChecksum & MFM_MASK) == dataChecksum) && (headerErrors <= it->numErrors)) {
+					memcpy(decodedTrack.data(*it), voted, SECTOR_BYTES);
+					it->numErrors = headerErrors;
+					if (!headerErrors) it->numVotes = 0;
+				}
+			}
+		}
+}
 
-	if (it == decodedTrack.sectors.end())
-		decodedTrack.sectors.insert(std::make_pair(header.sectorNumber, sector));
-	else {
-		// See which one has less errors and overwrite if needed
-		if (sector.numErrors < it->second.numErrors)
-			it->second = sector;
+// Lays the track out as one run of bits so it can be searched a byte at a time.  The output starts with 32 zero bits (as the search
+// used to start with an empty shift register) followed by the track, repeated from its start for as many bits as are needed to cover
+// the wrap around.  dataLengthInBits doesn't have to be a multiple of 8.
+static void linearizeTrack(const uint8_t* track, const uint32_t dataLengthInBits, const uint32_t totalBits, std::vector<uint8_t>& output) {
+	output.assign(((32 + totalBits + 7) >> 3) + 8, 0);   // +8 so a 64-bit window can always be loaded
+
+	const uint32_t trackBytes = (dataLengthInBits + 7) >> 3;
+	const uint8_t lastByteMask = (dataLengthInBits & 7) ? (uint8_t)(0xFF << (8 - (dataLengthInBits & 7))) : 0xFF;
+
+	// Copy the track as many times as needed, each copy starting where the last one ended
+	for (uint32_t outBit = 32; outBit < 32 + totalBits; outBit += dataLengthInBits) {
+		uint8_t* out = &output[outBit >> 3];
+		const uint32_t shift = outBit & 7;
+		const uint32_t bytesToCopy = min(trackBytes, (uint32_t)(output.size() - (outBit >> 3) - 1));
+		for (uint32_t i = 0; i < bytesToCopy; i++) {
+			const uint8_t b = (i == trackBytes - 1) ? (track[i] & lastByteMask) : track[i];
+			out[i] |= b >> shift;
+			if (shift) out[i + 1] |= (uint8_t)(b << (8 - shift));
+		}
 	}
 }
 
+// For each byte value, which of the 8 bit alignments of the sync it could be the second byte of
+static const std::array<uint8_t, 256> syncSecondByteTable = []() {
+	std::array<uint8_t, 256> table = {};
+	const uint32_t search = (AMIGA_WORD_SYNC | (((uint32_t)AMIGA_WORD_SYNC) << 16));
+	for (uint32_t offset = 0; offset < 8; offset++)
+		table[(search >> (16 + offset)) & 0xFF] |= (uint8_t)(1 << offset);
+	return table;
+}();
+
 // Search for sectors in the data supplied
 void findSectors_AMIGA(const uint8_t* track, const uint32_t dataLengthInBits, const bool isHD, const uint32_t trackNumber, const uint32_t expectedNumSectors, DecodedTrack& decodedTrack) {
 	// Work out what we need to search for which is syncsync
 	const uint32_t search = (AMIGA_WORD_SYNC | (((uint32_t)AMIGA_WORD_SYNC) << 16));
 
-	// Prepare our test buffer
-	uint32_t decoded = 0;
-
 	// Search with an overlap of approx 3 raw sectors worth of data
 	const uint32_t totalBitsToSearch = dataLengthInBits + (RAW_SECTOR_SIZE * 8 * 3);
 	const uint32_t expectedSectors = expectedNumSectors ? expectedNumSectors : (isHD ? NUM_SECTORS_PER_TRACK_HD : NUM_SECTORS_PER_TRACK_DD);
 
-	int nextTrackBitCount = 0;
-
 	RawEncodedSector alignedSector;
-
-	// run the entire track length with some space to wrap around
-	for (uint32_t bit = 0; bit< totalBitsToSearch; bit++) {
-		const uint32_t realBitPos = bit % dataLengthInBits;
-		const uint32_t trackBytePos = realBitPos >> 3;
-		const uint32_t trackBitPos =  7- (realBitPos & 7);
-		decoded <<= 1;   // shift off one bit to make room for the new bit
-		if (track[trackBytePos] & (1 << trackBitPos)) decoded |= 1;
-
-		if (decoded == search) {
-			// Extract the sector and skip past the data
-			extractRawSector(track, dataLengthInBits, (bit + 1) % dataLengthInBits, alignedSector);
-
-			// Now see if there's a valid sector there.  We now only skip the sector if its valid, incase rogue data gets in there
-			decodeSector(alignedSector, trackNumber, expectedSectors, decodedTrack);			
+	decodedTrack.reserve(expectedSectors, SECTOR_BYTES);
+
+	if (dataLengthInBits) {
+		std::vector<uint8_t> bits;
+		linearizeTrack(track, dataLengthInBits, totalBitsToSearch, bits);
+
+		// A sync starting at bit 'start' of the linear buffer would have been found by the bit-by-bit search after reading bit start+31-32,
+		// so the starts that search covered are 1 to totalBitsToSearch. Every sync has a whole byte in its second 8 bits, which is
+		// checked first so most bytes are skipped after one table lookup.
+		const uint32_t lastByte = totalBitsToSearch >> 3;
+		for (uint32_t byte = 0; byte <= lastByte; byte++) {
+			uint32_t candidates = syncSecondByteTable[bits[byte + 1]];
+			if (!candidates) continue;
+
+			uint64_t window = 0;
+			for (uint32_t i = 0; i < 8; i++) window = (window << 8) | bits[byte + i];
+
+			for (; candidates; candidates &= candidates - 1) {
+				uint32_t offset = 0;
+				while (!(candidates & (1 << offset))) offset++;
+				const uint32_t start = (byte << 3) + offset;
+				if ((start < 1) || (start > totalBitsToSearch)) continue;
+
+				if ((uint32_t)(window >> (32 - offset)) == search) {
+					// Extract the sector and skip past the data
+					extractRawSector(track, dataLengthInBits, start % dataLengthInBits, alignedSector);
+
+					// Now see if there's a valid sector there.  We now only skip the sector if its valid, incase rogue data gets in there
+					decodeSector(alignedSector, trackNumber, expectedSectors, decodedTrack);
+				}
+			}
 		}
 	}
 
 	// Fill in the missing ones
 	decodedTrack.sectorsWithErrors = 0;
 	for (uint32_t sec = 0; sec < expectedSectors; sec++) {
-		auto it = decodedTrack.sectors.find(sec);
+		const DecodedSector* it = decodedTrack.find(sec);
 
 		// Does a sector with this number exist?
-		if (it == decodedTrack.sectors.end()) {
+		if (!it) {
 			if (expectedNumSectors) {
 				// No. Create a dummy one - VERY NOT IDEAL!
-				DecodedSector tmp;
-				tmp.data.resize(SECTOR_BYTES);
-				memset(&tmp.data[0], 0, sizeof(tmp));
-				tmp.numErrors = 0xFFFF;
-				decodedTrack.sectors.insert(std::make_pair(sec, tmp));
-				decodedTrack.sectorsWithErrors++;
+				if (decodedTrack.add(sec, SECTOR_BYTES, 0xFFFF)) decodedTrack.sectorsWithErrors++;
 			}
 		}
 		else
-			if (it->second.numErrors) decodedTrack.sectorsWithErrors++;
+			if (it->numErrors) decodedTrack.sectorsWithErrors++;
 	}
 }
 
@@ -246,27 +287,43 @@ uint32_t encodeMFMdata(const uint32_t* input, uint32_t* output, const unsigned i
 	uint32_t* outputOdd = output;
 	uint32_t* outputEven = (uint32_t*)(((unsigned char*)output) + data_size);
 
-	// Encode over two passes.  First split out the odd and even data, then encode the MFM values, the /4 is because we're working in longs, not bytes
+	// Split out the odd and even data, and build the checksum at the same time. The /4 is because we're working in longs, not bytes
 	for (count = 0; count < data_size / 4; count++) {
-		*outputEven = *input & MFM_MASK;
-		*outputOdd = ((*input) >> 1) & MFM_MASK;
+		const uint32_t even = *input & MFM_MASK;
+		const uint32_t odd = ((*input) >> 1) & MFM_MASK;
+		*outputEven = even;
+		*outputOdd = odd;
+		chksum ^= even ^ odd;
 		outputEven++;
 		outputOdd++;
 		input++;
 	}
 
-	// Checksum calculator
-	// Encode over two passes.  First split out the odd and even data, then encode the MFM values, the /4 is because we're working in longs, not bytes
-	for (count = 0; count < (data_size / 4) * 2; count++) {
-		chksum ^= *output;
-		output++;
-	}
-
 	return chksum & MFM_MASK;
 }
 
+// Fills in the MFM clock bits for data that only has its data bits set.  A clock bit is set when the data bits either side of it
+// are both zero. previousBit is the data bit just before the buffer. This works on 64 bits at a time, read as big endian
+static void fillClockBits(unsigned char* data, uint32_t numBytes, bool previousBit) {
+	const uint64_t clockMask = 0xAAAAAAAAAAAAAAAAULL;
+	uint64_t previous = previousBit ? 1 : 0;
+
+	for (; numBytes >= 8; numBytes -= 8, data += 8) {
+		uint64_t w = 0;
+		for (uint32_t i = 0; i < 8; i++) w = (w << 8) | data[i];
+		w |= ~((w >> 1) | (w << 1) | (previous << 63)) & clockMask;
+		previous = w & 1;
+		for (uint32_t i = 0; i < 8; i++) data[i] = (unsigned char)(w >> (56 - (i * 8)));
+	}
+	for (; numBytes; numBytes--, data++) {
+		const uint32_t b = *data;
+		*data = (unsigned char)(b | (~((b >> 1) | (b << 1) | (uint32_t)(previous << 7)) & 0xAA));
+		previous = b & 1;
+	}
+}
+
 // Encode a sector into the correct format for disk
-void encodeSector(const uint32_t trackNumber, const uint32_t sectorNumber, const uint32_t totalSectors, const RawDecodedSector& input, RawEncodedSector& encodedSector, unsigned char& lastByte) {
+void encodeSector(const uint32_t trackNumber, const uint32_t sectorNumber, const uint32_t totalSectors, const uint8_t* input, const uint32_t inputSize, RawEncodedSector& encodedSector, unsigned char& lastByte) {
 	// Sector Start
 	encodedSector[0] = (lastByte & 1) ? 0x2A : 0xAA;
 	encodedSector[1] = 0xAA;
@@ -288,7 +345,7 @@ void encodeSector(const uint32_t trackNumber, const uint32_t sectorNumber, const
 	header.sectorsRemaining = totalSectors - sectorNumber;  //1..11
 
 	// Shouldnt happen but important
-	if (input.size() != SECTOR_BYTES) return;
+	if (inputSize != SECTOR_BYTES) return;
 
 	uint32_t sectorLabel[4] = { 0,0,0,0 };
 	uint32_t headerChecksumCalculated = encodeMFMdata((const uint32_t*)&header, (uint32_t*)&encodedSector[8], 4);
@@ -297,27 +354,12 @@ void encodeSector(const uint32_t trackNumber, const uint32_t sectorNumber, const
 	// Thats 40 bytes written as everything doubles (8+4+4+16+16). - Encode the header checksum
 	encodeMFMdata((const uint32_t*)&headerChecksumCalculated, (uint32_t*)&encodedSector[48], 4);
 	// And move on to the data section.  Next should be the checksum, but we cant encode that until we actually know its value!
-	uint32_t dataChecksumCalculated = encodeMFMdata((const uint32_t*)&input[0], (uint32_t*)&encodedSector[64], SECTOR_BYTES);
+	uint32_t dataChecksumCalculated = encodeMFMdata((const uint32_t*)input, (uint32_t*)&encodedSector[64], SECTOR_BYTES);
 	// And add the checksum
 	encodeMFMdata((const uint32_t*)&dataChecksumCalculated, (uint32_t*)&encodedSector[56], 4);
 
-	// Now fill in the MFM clock bits
-	bool lastBit = encodedSector[7] & (1 << 0);
-	bool thisBit = lastBit;
-
-	// Clock bits are bits 7, 5, 3 and 1
-	// Data is 6, 4, 2, 0
-	for (int count = 8; count < RAW_SECTOR_SIZE; count++) {
-		for (int bit = 7; bit >= 1; bit -= 2) {
-			lastBit = thisBit;
-			thisBit = encodedSector[count] & (1 << (bit - 1));
-
-			if (!(lastBit || thisBit)) {
-				// Encode a 1!
-				encodedSector[count] |= (1 << bit);
-			}
-		}
-	}
+	// Now fill in the MFM clock bits. Clock bits are bits 7, 5, 3 and 1, data is 6, 4, 2, 0
+	fillClockBits(&encodedSector[8], RAW_SECTOR_SIZE - 8, encodedSector[7] & (1 << 0));
 
 	lastByte = encodedSector[RAW_SECTOR_SIZE - 1];
 }
@@ -329,7 +371,8 @@ uint32_t encodeSectorsIntoMFM_AMIGA(const bool isHD, const DecodedTrack& decoded
 	const uint32_t fillerSize = PRE_FILLER + (isHD ? PRE_FILLER : 0);
 
 	// Calculate total bytes we want to write - the extra 8 bytes is for post padding to clean up clock bits
-	const uint32_t bytesRequired = (uint32_t)((sizeof(RawEncodedSector) * decodedTrack.sectors.size()) + fillerSize + 8);
+	const uint32_t numSectors = decodedTrack.size();
+	const uint32_t bytesRequired = (uint32_t)((sizeof(RawEncodedSector) * numSectors) + fillerSize + 8);
 
 	// Not enough space?
 	if (mfmBufferSizeBytes < bytesRequired) return 0;
@@ -340,9 +383,11 @@ uint32_t encodeSectorsIntoMFM_AMIGA(const bool isHD, const DecodedTrack& decoded
 	output += fillerSize;
 
 	// The order of the sectors does not matter
-	for (const auto& sec : decodedTrack.sectors) {
+	for (uint32_t sec = 0; sec < MAX_SECTORS_PER_TRACK; sec++) {
+		const DecodedSector* sector = decodedTrack.find(sec);
+		if (!sector) continue;
 		RawEncodedSector* out = (RawEncodedSector*)output;			
-		encodeSector(trackNumber, (uint32_t)sec.first, (uint32_t)decodedTrack.sectors.size(), sec.second.data, *out, lastByte);
+		encodeSector(trackNumber, sec, numSectors, decodedTrack.data(*sector), sector->dataSize, *out, lastByte);
 		output += sizeof(RawEncodedSector);
 	}
 
@@ -33,6 +33,15 @@
 #define KEY_DRIVE_LETTER			"driveletter"
 #define KEY_LAST_UPDATE_CHECK		"lastcheck"
 #define KEY_AUTO_RENAME				"autorename"
+#define KEY_WRITEBACK_CACHE			"writebackcache"
+#define KEY_WRITEBACK_MAXDIRTY		"writebackmaxdirty"
+#define KEY_WRITEBACK_IDLETIME		"writebackidletime"
+#define KEY_READAHEAD				"readahead"
+#define KEY_READAHEAD_WINDOW		"readaheadwindow"
+#define KEY_READAHEAD_MAXMEM		"readaheadmaxmem"
+#define KEY_MEMORY_MAP_FILES		"memorymapfiles"
+#define KEY_VERIFY_DMS				"verifydms"
+#define KEY_SCP_DECODE_THREADS		"scpdecodethreads"
 
 // A bit hacky but enough for what I need
 uint32_t getStamp() {
@@ -49,6 +58,15 @@ bool loadConfiguration(AppConfig& config) {
 	config.driveLetter = 'A';
 	config.lastCheck = getStamp() - 5;
 	config.autoRename = false;
+	config.writeBackCache = false;
+	config.writeBackMaxDirty = 256 * 1024;
+	config.writeBackIdleTime = 2000;
+	config.readAhead = true;
+	config.readAheadWindow = 128 * 1024;
+	config.readAheadMaxMem = 512 * 1024;
+	config.memoryMapFiles = false;
+	config.verifyDMS = false;
+	config.scpDecodeThreads = 0;
 
 	HKEY key;
 	DWORD disp = 0;
@@ -84,6 +102,42 @@ bool loadConfiguration(AppConfig& config) {
 	if (RegQueryValueExA(key, KEY_AUTO_RENAME, NULL, NULL, (LPBYTE)&dTemp, &dataSize) != ERROR_SUCCESS) dataSize = 0;
 	if (dataSize == sizeof(dTemp)) config.autoRename = dTemp != 0;
 
+	dataSize = sizeof(dTemp);
+	if (RegQueryValueExA(key, KEY_WRITEBACK_CACHE, NULL, NULL, (LPBYTE)&dTemp, &dataSize) != ERROR_SUCCESS) dataSize = 0;
+	if (dataSize == sizeof(dTemp)) config.writeBackCache = dTemp != 0;
+
+	dataSize = sizeof(dTemp);
+	if (RegQueryValueExA(key, KEY_WRITEBACK_MAXDIRTY, NULL, NULL, (LPBYTE)&dTemp, &dataSize) != ERROR_SUCCESS) dataSize = 0;
+	if (dataSize == sizeof(dTemp)) config.writeBackMaxDirty = dTemp;
+
+	dataSize = sizeof(dTemp);
+	if (RegQueryValueExA(key, KEY_WRITEBACK_IDLETIME, NULL, NULL, (LPBYTE)&dTemp, &dataSize) != ERROR_SUCCESS) dataSize = 0;
+	if (dataSize == sizeof(dTemp)) config.writeBackIdleTime = dTemp;
+
+	dataSize = sizeof(dTemp);
+	if (RegQueryValueExA(key, KEY_READAHEAD, NULL, NULL, (LPBYTE)&dTemp, &dataSize) != ERROR_SUCCESS) dataSize = 0;
+	if (dataSize == sizeof(dTemp)) config.readAhead = dTemp != 0;
+
+	dataSize = sizeof(dTemp);
+	if (RegQueryValueExA(key, KEY_READAHEAD_WINDOW, NULL, NULL, (LPBYTE)&dTemp, &dataSize) != ERROR_SUCCESS) dataSize = 0;
+	if (dataSize == sizeof(dTemp)) config.readAheadWindow = dTemp;
+
+	dataSize = sizeof(dTemp);
+	if (RegQueryValueExA(key, KEY_READAHEAD_MAXMEM, NULL, NULL, (LPBYTE)&dTemp, &dataSize) != ERROR_SUCCESS) dataSize = 0;
+	if (dataSize == sizeof(dTemp)) config.readAheadMaxMem = dTemp;
+
+	dataSize = sizeof(dTemp);
+	if (RegQueryValueExA(key, KEY_MEMORY_MAP_FILES, NULL, NULL, (LPBYTE)&dTemp, &dataSize) != ERROR_SUCCESS) dataSize = 0;
+	if (dataSize == sizeof(dTemp)) config.memoryMapFiles = dTemp != 0;
+
+	dataSize = sizeof(dTemp);
+	if (RegQueryValueExA(key, KEY_VERIFY_DMS, NULL, NULL, (LPBYTE)&dTemp, &dataSize) != ERROR_SUCCESS) dataSize = 0;
+	if (dataSize == sizeof(dTemp)) config.verifyDMS = dTemp != 0;
+
+	dataSize = sizeof(dTemp);
+	if (RegQueryValueExA(key, KEY_SCP_DECODE_THREADS, NULL, NULL, (LPBYTE)&dTemp, &dataSize) != ERROR_SUCCESS) dataSize = 0;
+	if (dataSize == sizeof(dTemp)) config.scpDecodeThreads = dTemp;
+
 	RegCloseKey(key);
 	return true;
 }
@@ -106,6 +160,19 @@ bool saveConfiguration(const AppConfig& config) {
 	RegSetValueExA(key, KEY_UPDATE_CHECK, 0, REG_DWORD, (const BYTE*)&dTemp, sizeof(dTemp));
 	dTemp = config.autoRename ? 1 : 0;
 	RegSetValueExA(key, KEY_AUTO_RENAME, 0, REG_DWORD, (const BYTE*)&dTemp, sizeof(dTemp));
+	dTemp = config.writeBackCache ? 1 : 0;
+	RegSetValueExA(key, KEY_WRITEBACK_CACHE, 0, REG_DWORD, (const BYTE*)&dTemp, sizeof(dTemp));
+	RegSetValueExA(key, KEY_WRITEBACK_MAXDIRTY, 0, REG_DWORD, (const BYTE*)&config.writeBackMaxDirty, sizeof(config.writeBackMaxDirty));
+	RegSetValueExA(key, KEY_WRITEBACK_IDLETIME, 0, REG_DWORD, (const BYTE*)&config.writeBackIdleTime, sizeof(config.writeBackIdleTime));
+	dTemp = config.readAhead ? 1 : 0;
+	RegSetValueExA(key, KEY_READAHEAD, 0, REG_DWORD, (const BYTE*)&dTemp, sizeof(dTemp));
+	RegSetValueExA(key, KEY_READAHEAD_WINDOW, 0, REG_DWORD, (const BYTE*)&config.readAheadWindow, sizeof(config.readAheadWindow));
+	RegSetValueExA(key, KEY_READAHEAD_MAXMEM, 0, REG_DWORD, (const BYTE*)&config.readAheadMaxMem, sizeof(config.readAheadMaxMem));
+	dTemp = config.memoryMapFiles ? 1 : 0;
+	RegSetValueExA(key, KEY_MEMORY_MAP_FILES, 0, REG_DWORD, (const BYTE*)&dTemp, sizeof(dTemp));
+	dTemp = config.verifyDMS ? 1 : 0;
+	RegSetValueExA(key, KEY_VERIFY_DMS, 0, REG_DWORD, (const BYTE*)&dTemp, sizeof(dTemp));
+	RegSetValueExA(key, KEY_SCP_DECODE_THREADS, 0, REG_DWORD, (const BYTE*)&config.scpDecodeThreads, sizeof(config.scpDecodeThreads));
 	RegSetValueExA(key, KEY_LAST_UPDATE_CHECK, 0, REG_DWORD, (const BYTE*)&config.lastCheck, sizeof(config.lastCheck));
 
 	RegCloseKey(key);
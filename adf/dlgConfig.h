@@ -28,6 +28,15 @@ struct AppConfig {
 	bool		checkForUpdates;
 	uint32_t	lastCheck;
 	bool		autoRename;
+	bool		writeBackCache;			// Hold writes to image files/drives in memory and write them in batches
+	uint32_t	writeBackMaxDirty;		// Flush once this many bytes are waiting
+	uint32_t	writeBackIdleTime;		// Flush once nothing has been written for this many ms
+	bool		readAhead;				// Fetch ahead in the background when reading image files/drives sequentially
+	uint32_t	readAheadWindow;		// Largest amount fetched ahead in one go, in bytes
+	uint32_t	readAheadMaxMem;		// Most memory used for data fetched ahead, in bytes
+	bool		memoryMapFiles;			// Access plain image files through a memory mapped view instead of the sector cache, and copy SCP flux straight out of one
+	bool		verifyDMS;				// Check every CRC and checksum in DMS archives when they're mounted and decoded
+	uint32_t	scpDecodeThreads;		// Decode SCP tracks ahead of the one being read on this many threads, 0 decodes tracks only when needed
 };
 
 
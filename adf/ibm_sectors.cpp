@@ -15,6 +15,7 @@
 #include <dokan/dokan.h>
 #include <iostream>
 #include <vector>
+#include <array>
 #include <unordered_map>
 #include "ibm_sectors.h"
 
@@ -149,52 +150,80 @@ uint32_t encodeMFMdata(const uint8_t* input, uint8_t* output, const uint32_t inp
 	return inputSize << 1; 
 }
 
-// CRC16
+// CRC16 (CCITT) tables. crc16Table[0] is the usual byte table, crc16Table[n] gives the CRC of a byte followed by n zero bytes
+static const std::array<std::array<uint16_t, 256>, 8> crc16Table = []() {
+	std::array<std::array<uint16_t, 256>, 8> table = {};
+	for (uint32_t b = 0; b < 256; b++) {
+		uint32_t crc = b << 8;
+		for (uint32_t i = 0; i < 8; i++)
+			crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+		table[0][b] = (uint16_t)crc;
+	}
+	for (uint32_t n = 1; n < 8; n++)
+		for (uint32_t b = 0; b < 256; b++)
+			table[n][b] = (uint16_t)((table[n - 1][b] << 8) ^ table[0][table[n - 1][b] >> 8]);
+	return table;
+}();
+
+// CRC16. Pass the result back in as wCrc to carry on over more data. Works on 8 bytes at a time
 uint16_t crc16(char* pData, int length, uint32_t wCrc = 0xFFFF) {
-	uint8_t i;
-	while (length--) {
-		wCrc ^= *(unsigned char*)pData++ << 8;
-		for (i = 0; i < 8; i++)
-			wCrc = wCrc & 0x8000 ? (wCrc << 1) ^ 0x1021 : wCrc << 1;
+	const uint8_t* data = (const uint8_t*)pData;
+	uint16_t crc = (uint16_t)wCrc;
+
+	for (; length >= 8; length -= 8, data += 8) {
+		crc ^= (uint16_t)((data[0] << 8) | data[1]);
+		crc = crc16Table[7][crc >> 8] ^ crc16Table[6][crc & 0xFF] ^ crc16Table[5][data[2]] ^ crc16Table[4][data[3]] ^
+			  crc16Table[3][data[4]] ^ crc16Table[2][data[5]] ^ crc16Table[1][data[6]] ^ crc16Table[0][data[7]];
 	}
-	return wCrc & 0xffff;
+	for (; length > 0; length--)
+		crc = (uint16_t)((crc << 8) ^ crc16Table[0][(crc >> 8) ^ *data++]);
+
+	return crc;
 }
 
+// For each raw MFM byte, its data bits (7, 5, 3 and 1) packed into 4 bits
+static const std::array<uint8_t, 256> mfmDataBitsTable = []() {
+	std::array<uint8_t, 256> table = {};
+	for (uint32_t b = 0; b < 256; b++)
+		table[b] = (uint8_t)(((b >> 4) & 8) | ((b >> 3) & 4) | ((b >> 2) & 2) | ((b >> 1) & 1));
+	return table;
+}();
+
 // Extract the data, properly aligned into the output
 void extractMFMDecodeRaw(const unsigned char* inTrack, const uint32_t dataLengthInBits, const uint32_t bitPos, uint32_t outputBytes, uint8_t* output) {
-	unsigned char byteOut = 0;
-	unsigned int byteOutPosition = 0;
-
-	uint32_t realBitPos = bitPos+1;  // the +1 skips past the clock bit
-
-	unsigned char* memOut = output;
+	// Copy the raw bits in chunks, then drop the clock bits from each one
+	uint8_t raw[512];
+	uint32_t realBitPos = (bitPos + 1) % dataLengthInBits;  // the +1 skips past the clock bit
 
 	while (outputBytes) {
-		for (uint32_t bit = 0; bit <= 7; bit++) {
-			*memOut <<= 1;
-			const uint32_t trackBytePos = realBitPos >> 3;
-			const uint32_t trackBitPos = 7 - (realBitPos & 7);
-			if (inTrack[trackBytePos] & (1 << trackBitPos)) *memOut |= 1;
-			realBitPos = (realBitPos + 2) % dataLengthInBits;  // skip those clock bits
-		}
-		// Move along and reset
-		memOut++;
-		outputBytes--;
+		const uint32_t chunk = min(outputBytes, (uint32_t)(sizeof(raw) / 2));
+		extractTrackBits(inTrack, dataLengthInBits, realBitPos, chunk * 16, raw);
+		for (uint32_t i = 0; i < chunk; i++)
+			output[i] = (uint8_t)((mfmDataBitsTable[raw[i * 2]] << 4) | mfmDataBitsTable[raw[i * 2 + 1]]);
+		realBitPos = (uint32_t)((realBitPos + (uint64_t)chunk * 16) % dataLengthInBits);
+		output += chunk;
+		outputBytes -= chunk;
 	}
 }
 
+// For each byte value, which of the 8 bit alignments of any of the sync marks it could be the second byte of
+static const std::array<uint8_t, 256> ibmSyncSecondByteTable = []() {
+	std::array<uint8_t, 256> table = {};
+	for (const uint64_t sync : { MFM_SYNC_TRACK_HEADER, MFM_SYNC_SECTOR_HEADER, MFM_SYNC_SECTOR_DATA, MFM_SYNC_DELETED_SECTOR_DATA })
+		for (uint32_t offset = 0; offset < 8; offset++)
+			table[(sync >> (48 + offset)) & 0xFF] |= (uint8_t)(1 << offset);
+	return table;
+}();
+
 // Searches for sectors - you can re-call this and it will update decodedTrack rather than replace it
 // nonstandardTimings is set to true if this uses non-standard timings like those used by Atari etc
 void findSectors_IBM(const uint8_t* track, const uint32_t dataLengthInBits, const bool isHD, const uint32_t trackNumber, const uint32_t expectedNumSectors, DecodedTrack& decodedTrack, bool& nonstandardTimings) {
 	const uint32_t cylinder = trackNumber / 2;
 	const bool upperSide = trackNumber & 1;
 
-	// Prepare our test buffer
-	uint64_t decoded = 0;
-
-	int nextTrackBitCount = 0;
-	int i = 0;
 	IBMSector sector;
+	std::vector<uint8_t> field;   // data mark, data and CRC of the sector being read
+	std::vector<uint8_t> voted;   // the same, voted from failed reads
 
 	bool headerFound = false;
 	sector.headerErrors = 0xFFFF;
@@ -203,6 +232,7 @@ void findSectors_IBM(const uint8_t* track, const uint32_t dataLengthInBits, cons
 	nonstandardTimings = false;
 
 	uint32_t expectedSectors = expectedNumSectors ? expectedNumSectors : (isHD ? IBM_HD_SECTORS : IBM_DD_SECTORS);
+	decodedTrack.reserve(expectedSectors, DEFAULT_SECTOR_BYTES);
 	uint32_t sectorEndPoint = 0;
 
 	uint32_t gapTotal = 0;
@@ -210,91 +240,110 @@ void findSectors_IBM(const uint8_t* track, const uint32_t dataLengthInBits, cons
 
 	uint32_t unknownNumber = 0;
 
-	// run the entire track length with some space to wrap around
-	for (uint32_t bit = 0; bit < dataLengthInBits; bit++) {
-		const uint32_t realBitPos = bit % dataLengthInBits;
-		const uint32_t trackBytePos = realBitPos >> 3;
-		const uint32_t trackBitPos = 7 - (realBitPos & 7);
-		decoded <<= 1ULL;   // shift off one bit to make room for the new bit
-		if (track[trackBytePos] & (1 << trackBitPos)) decoded |= 1;
-
-		switch (decoded) {
-		case MFM_SYNC_SECTOR_HEADER: {
-			// Grab sector header
-			if (sectorEndPoint) {
-				uint32_t markerStart = bit + 1 - 64;
-				uint32_t bytesBetweenSectors = (markerStart - sectorEndPoint) / 16;
-				bytesBetweenSectors = max(0, (int32_t)bytesBetweenSectors - (12 * 2));   // these would be the SYNC AA or 55
-				if (bytesBetweenSectors > 200) bytesBetweenSectors = 200; // shouldnt get this high
-				// For a PC disk this should be around 84
-				gapTotal += bytesBetweenSectors;
-				numGaps++;
-			}
+	// Lay the track out after 64 zero bits (as the search used to start with an empty shift register), with the bits past the end cleared
+	const uint32_t trackBytes = (dataLengthInBits + 7) >> 3;
+	std::vector<uint8_t> bits(8 + trackBytes + 9, 0);
+	if (trackBytes) {
+		memcpy(&bits[8], track, trackBytes);
+		if (dataLengthInBits & 7) bits[8 + trackBytes - 1] &= (uint8_t)(0xFF << (8 - (dataLengthInBits & 7)));
+	}
 
-			extractMFMDecodeRaw(track, dataLengthInBits, bit + 1 - 64, sizeof(sector.header), (uint8_t*)&sector.header);
-			uint16_t crc = crc16((char*)&sector.header, sizeof(sector.header) - 2);
-			sector.headerErrors = 0;
-			headerFound = true;
-			if (sector.header.sector < 1) {
-				sector.header.sector = 1;
-				sector.headerErrors++;
-			}
+	// run the entire track length. A sync starting at bit 'start' of that buffer is the same as the old bit-by-bit search matching
+	// after reading track bit start-1, so the starts it covered are 1 to dataLengthInBits.
+	for (uint32_t byte = 0; byte <= (dataLengthInBits >> 3); byte++) {
+		uint32_t candidates = ibmSyncSecondByteTable[bits[byte + 1]];
+		if (!candidates) continue;
+
+		uint64_t window = 0;
+		for (uint32_t b = 0; b < 8; b++) window = (window << 8) | bits[byte + b];
+
+		for (; candidates; candidates &= candidates - 1) {
+			uint32_t offset = 0;
+			while (!(candidates & (1 << offset))) offset++;
+			const uint32_t start = (byte << 3) + offset;
+			if ((start < 1) || (start > dataLengthInBits)) continue;
+			const uint32_t bit = start - 1;
+			const uint64_t decoded = offset ? (window << offset) | (bits[byte + 8] >> (8 - offset)) : window;
+
+			switch (decoded) {
+			case MFM_SYNC_SECTOR_HEADER: {
+				// Grab sector header
+				if (sectorEndPoint) {
+					uint32_t markerStart = bit + 1 - 64;
+					uint32_t bytesBetweenSectors = (markerStart - sectorEndPoint) / 16;
+					bytesBetweenSectors = max(0, (int32_t)bytesBetweenSectors - (12 * 2));   // these would be the SYNC AA or 55
+					if (bytesBetweenSectors > 200) bytesBetweenSectors = 200; // shouldnt get this high
+					// For a PC disk this should be around 84
+					gapTotal += bytesBetweenSectors;
+					numGaps++;
+				}
 
-			if (crc != wordSwap(*(uint16_t*)sector.header.crc)) sector.headerErrors++;
-			if (!sector.headerErrors) sectorSize = sector.header.length;
-			if (sector.header.cylinder != cylinder) sector.headerErrors++;
-			if (sector.header.head != (upperSide ? 1 : 0)) sector.headerErrors++;
-		}
-		break;
-		case MFM_SYNC_DELETED_SECTOR_DATA:
-		case MFM_SYNC_SECTOR_DATA: {
-			if (headerFound) {
-				const uint32_t sectorDataSize = 1 << (7 + sector.header.length);
-				if (sector.data.data.size() != sectorDataSize) sector.data.data.resize(sectorDataSize);
-				uint32_t bitStart = bit + 1 - 64;
-				// Extract the header section
-				extractMFMDecodeRaw(track, dataLengthInBits, bitStart, 4, (uint8_t*)&sector.data.dataMark);
-				// Extract the sector data
-				bitStart += 4 * 8 * 2;
-				extractMFMDecodeRaw(track, dataLengthInBits, bitStart, (uint32_t)sector.data.data.size(), (uint8_t*)&sector.data.data[0]);
-				// Extract the sector CRC
-				bitStart += sectorDataSize * 8 * 2;
-				extractMFMDecodeRaw(track, dataLengthInBits, bitStart, 2, (uint8_t*)&sector.data.crc);
-				// Validate
-				uint16_t crc = crc16((char*)&sector.data.dataMark, 4);
-				crc = crc16((char*)sector.data.data.data(), (uint32_t)sector.data.data.size(), crc);
-				sector.dataValid = crc == wordSwap(*(uint16_t*)sector.data.crc);
-
-				// Standardize the sector
-				DecodedSector sec;
-				sec.data = sector.data.data;
-				sec.numErrors = sector.headerErrors + sector.dataValid ? 0 : 1;
-
-				// See if this already exists 
-				auto it = decodedTrack.sectors.find(sector.header.sector - 1);
-				if (it == decodedTrack.sectors.end()) {
-					if (sector.header.sector <= 22)
-						decodedTrack.sectors.insert(std::make_pair(sector.header.sector - 1, sec));
+				extractMFMDecodeRaw(track, dataLengthInBits, bit + 1 - 64, sizeof(sector.header), (uint8_t*)&sector.header);
+				uint16_t crc = crc16((char*)&sector.header, sizeof(sector.header) - 2);
+				sector.headerErrors = 0;
+				headerFound = true;
+				if (sector.header.sector < 1) {
+					sector.header.sector = 1;
+					sector.headerErrors++;
 				}
-				else {
-					// Does exist. Keep the better copy
-					if (it->second.numErrors > sec.numErrors) {
-						it->second.data = sec.data;
-						it->second.numErrors = sec.numErrors;
-					}
+				if (sector.header.length > 7) {
+					// Bigger than 16k, and too big for a track, so must be damaged
+					sector.header.length = sectorSize;
+					sector.headerErrors++;
 				}
 
-				// Reset for next sector
-				sector.dataValid = false;
-				headerFound = false;
-				sectorEndPoint = bitStart + (4 * 8);  // mark the end of the sector
+				if (crc != wordSwap(*(uint16_t*)sector.header.crc)) sector.headerErrors++;
+				if (!sector.headerErrors) sectorSize = sector.header.length;
+				if (sector.header.cylinder != cylinder) sector.headerErrors++;
+				if (sector.header.head != (upperSide ? 1 : 0)) sector.headerErrors++;
 			}
-		} break;
-		case MFM_SYNC_TRACK_HEADER:
-			// Reset here, not reqally required, but why not!
-			headerFound = false;
-			sector.dataValid = false;
 			break;
+			case MFM_SYNC_DELETED_SECTOR_DATA:
+			case MFM_SYNC_SECTOR_DATA: {
+				if (headerFound) {
+					const uint32_t sectorDataSize = 1 << (7 + sector.header.length);
+					uint32_t bitStart = bit + 1 - 64;
+					// Extract the data mark, sector data and CRC in one go, and check it
+					field.resize(4 + sectorDataSize + 2);
+					extractMFMDecodeRaw(track, dataLengthInBits, bitStart, (uint32_t)field.size(), field.data());
+					bitStart += (4 + sectorDataSize) * 8 * 2;
+					const uint16_t crc = crc16((char*)field.data(), 4 + sectorDataSize);
+					sector.dataValid = crc == ((field[4 + sectorDataSize] << 8) | field[4 + sectorDataSize + 1]);
+
+					// Standardize the sector
+					const uint32_t numErrors = sector.headerErrors + (sector.dataValid ? 0 : 1);
+
+					// See if this already exists. If not, or if this is a better copy, keep it
+					DecodedSector* it = decodedTrack.find(sector.header.sector - 1);
+					if ((!it) || (it->numErrors > numErrors))
+						it = decodedTrack.set(sector.header.sector - 1, field.data() + 4, sectorDataSize, numErrors);
+
+					if (it) {
+						if (it->numErrors == 0) it->numVotes = 0;
+						else
+							// A good header but bad data. Keep it, and see if a vote between all the bad reads gives a good copy
+							if ((!sector.headerErrors) && (!sector.dataValid)) {
+								voted.resize(field.size());
+								if ((voteSectorCopies(decodedTrack, *it, field.data(), (uint32_t)field.size(), voted.data())) &&
+									(crc16((char*)voted.data(), 4 + sectorDataSize) == ((voted[4 + sectorDataSize] << 8) | voted[4 + sectorDataSize + 1]))) {
+									decodedTrack.set(sector.header.sector - 1, voted.data() + 4, sectorDataSize, 0);
+									it->numVotes = 0;
+								}
+							}
+					}
+
+					// Reset for next sector
+					sector.dataValid = false;
+					headerFound = false;
+					sectorEndPoint = bitStart + (4 * 8);  // mark the end of the sector
+				}
+			} break;
+			case MFM_SYNC_TRACK_HEADER:
+				// Reset here, not reqally required, but why not!
+				headerFound = false;
+				sector.dataValid = false;
+				break;
+			}
 		}
 	}
 
@@ -310,22 +359,17 @@ void findSectors_IBM(const uint8_t* track, const uint32_t dataLengthInBits, cons
 	// Add dummy sectors upto expectedSectors
 	decodedTrack.sectorsWithErrors = 0;
 	for (uint32_t sec = 0; sec <expectedSectors; sec++) {
-		auto it = decodedTrack.sectors.find(sec);
+		const DecodedSector* it = decodedTrack.find(sec);
 
 		// Does a sector with this number exist?
-		if (it == decodedTrack.sectors.end()) {
+		if (!it) {
 			if (expectedNumSectors) {
 				// No. Create a dummy one - VERY NOT IDEAL!
-				DecodedSector tmp;
-				tmp.data.resize(sectorDataSize);
-				memset(&tmp.data[0], 0, sizeof(tmp));
-				tmp.numErrors = 0xFFFF;
-				decodedTrack.sectors.insert(std::make_pair(sec, tmp));
-				decodedTrack.sectorsWithErrors++;
+				if (decodedTrack.add(sec, sectorDataSize, 0xFFFF)) decodedTrack.sectorsWithErrors++;
 			}
 		}
 		else
-			if (it->second.numErrors) decodedTrack.sectorsWithErrors++;
+			if (it->numErrors) decodedTrack.sectorsWithErrors++;
 	}
 }
 // Find sectors (one less parameter)
@@ -336,10 +380,17 @@ void findSectors_IBM(const uint8_t* track, const uint32_t dataLengthInBits, cons
 
 // The fill is 0x4E, which endoded as MFM is
 uint32_t gapFillMFM(uint8_t* mem, const uint32_t size, const uint8_t value, uint8_t& lastByte, uint8_t* memOverflow) {
-	std::vector<uint8_t> data;
-	if (size < 1) return 0;
-	data.resize(size, value);
-	return encodeMFMdata(data.data(), mem, (uint32_t)data.size(), lastByte, memOverflow);
+	uint8_t data[256];
+	memset(data, value, sizeof(data));
+	uint32_t written = 0;
+	for (uint32_t remaining = size; remaining; ) {
+		const uint32_t count = min(remaining, (uint32_t)sizeof(data));
+		const uint32_t encoded = encodeMFMdata(data, mem + written, count, lastByte, memOverflow);
+		written += encoded;
+		if (encoded != count * 2) break;  // out of space
+		remaining -= count;
+	}
+	return written;
 }
 
 // The fill is 0x4E, which endoded as MFM is
@@ -374,7 +425,7 @@ uint32_t writeMarkerMFM(uint8_t* mem, const uint64_t value, uint8_t& lastByte, u
 }
 
 // Encode the track supplied into a raw MFM bit-stream
-uint32_t encodeSectorsIntoMFM_IBM(const bool isHD, bool forceAtariTiming, DecodedTrack* decodedTrack, const uint32_t trackNumber, uint32_t mfmBufferSizeBytes, void* trackData) {
+uint32_t encodeSectorsIntoMFM_IBM(const bool isHD, bool forceAtariTiming, const DecodedTrack* decodedTrack, const uint32_t trackNumber, uint32_t mfmBufferSizeBytes, void* trackData) {
 	uint8_t lastByte = 0x55;
 	const uint32_t cylinder = trackNumber / 2;
 	const bool upperSide = trackNumber & 1;
@@ -387,7 +438,8 @@ uint32_t encodeSectorsIntoMFM_IBM(const bool isHD, bool forceAtariTiming, Decode
 	uint8_t gap4bSize = 182;   // 0x4E - after all sectors
 	bool writeTrackHeader = true;
 	
-	if (decodedTrack->sectors.size() > 21) return 0;
+	const uint32_t numSectors = decodedTrack->size();
+	if (numSectors > 21) return 0;
 
 	// NOTE: ALL OF THE ATARI TIMINGS NEED CHECKING!
 	if (forceAtariTiming) {
@@ -397,7 +449,7 @@ uint32_t encodeSectorsIntoMFM_IBM(const bool isHD, bool forceAtariTiming, Decode
 		gap4bSize = 60;  
 	}
 
-	switch (decodedTrack->sectors.size()) {
+	switch (numSectors) {
 	case 10: // double density atari
 		gap3Size = 40;
 		forceAtariTiming = true;
@@ -440,8 +492,10 @@ uint32_t encodeSectorsIntoMFM_IBM(const bool isHD, bool forceAtariTiming, Decode
 		mem += writeMarkerMFM(mem, MFM_SYNC_TRACK_HEADER, lastByte, memOverflow);
 	}
 	mem += gapFillMFM(mem, gap1Size, 0x4E, lastByte, memOverflow);
-	for (uint32_t sec = 0; sec < decodedTrack->sectors.size(); sec++) {
-		const DecodedSector& sector = decodedTrack->sectors[sec];
+	for (uint32_t sec = 0; sec < MAX_SECTORS_PER_TRACK; sec++) {
+		const DecodedSector* sector = decodedTrack->find(sec);
+		if (!sector) continue;
+		const uint8_t* sectorData = decodedTrack->data(*sector);
 
 		mem += writeRawMFM(mem, 24, 0xAA, lastByte, memOverflow);
 
@@ -453,7 +507,7 @@ uint32_t encodeSectorsIntoMFM_IBM(const bool isHD, bool forceAtariTiming, Decode
 		header.cylinder = cylinder;
 		header.head = upperSide ? 1 : 0;
 		header.sector = sec + 1;
-		header.length = (unsigned char)(max(0,(int)log2(sector.data.size()) - 7));
+		header.length = (unsigned char)(max(0,(int)log2(sector->dataSize) - 7));
 		*((uint16_t*)header.crc) = wordSwap(crc16((char*)&header, sizeof(header) - 2));
 
 		mem += writeMarkerMFM(mem, MFM_SYNC_SECTOR_HEADER, lastByte, memOverflow);
@@ -464,10 +518,10 @@ uint32_t encodeSectorsIntoMFM_IBM(const bool isHD, bool forceAtariTiming, Decode
 		// Need this just for the CRC
 		const uint8_t dataMark[4] = { 0xA1, 0xA1, 0xA1, 0xFB };
 		uint16_t crc = crc16((char*)&dataMark, 4);
-		crc = wordSwap(crc16((char*)sector.data.data(), (int)sector.data.size(), crc));
+		crc = wordSwap(crc16((char*)sectorData, (int)sector->dataSize, crc));
 
 		mem += writeMarkerMFM(mem, MFM_SYNC_SECTOR_DATA, lastByte, memOverflow);
-		mem += encodeMFMdata(sector.data.data(), mem, (uint32_t)sector.data.size(), lastByte, memOverflow);
+		mem += encodeMFMdata(sectorData, mem, sector->dataSize, lastByte, memOverflow);
 		mem += encodeMFMdata((uint8_t*)&crc, mem, sizeof(crc), lastByte, memOverflow);
 
 		mem += gapFillMFM(mem, gap3Size, 0x4E, lastByte, memOverflow);
@@ -504,10 +558,10 @@ bool getTrackDetails_IBM(const DecodedTrack* decodedTrack, uint32_t& serialNumbe
 	serialNumber = 0;
 
 	if (!decodedTrack) return false;
-	auto it = decodedTrack->sectors.find(0);
-	if (it == decodedTrack->sectors.end()) return false;
-	if (it->second.data.size() < 128) return false;
-	return getTrackDetails_IBM(it->second.data.data(), serialNumber, numHeads, totalSectors, sectorsPerTrack, bytesPerSector);
+	const DecodedSector* it = decodedTrack->find(0);
+	if (!it) return false;
+	if (it->dataSize < 128) return false;
+	return getTrackDetails_IBM(decodedTrack->data(*it), serialNumber, numHeads, totalSectors, sectorsPerTrack, bytesPerSector);
 }
 
 // Creates a basic disk image with a number of *strange* values suitable for Atari ST
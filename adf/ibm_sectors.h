@@ -32,7 +32,7 @@ void findSectors_IBM(const uint8_t* track, const uint32_t dataLengthInBits, cons
 void findSectors_IBM(const uint8_t* track, const uint32_t dataLengthInBits, const bool isHD, const uint32_t trackNumber, const uint32_t expectedNumSectors, DecodedTrack& decodedTrack);
 
 // Encode the track supplied into a raw MFM bit-stream
-uint32_t encodeSectorsIntoMFM_IBM(const bool isHD, const bool forceAtariTiming, DecodedTrack* decodedTrack, const uint32_t trackNumber, uint32_t mfmBufferSizeBytes, void* trackData);
+uint32_t encodeSectorsIntoMFM_IBM(const bool isHD, const bool forceAtariTiming, const DecodedTrack* decodedTrack, const uint32_t trackNumber, uint32_t mfmBufferSizeBytes, void* trackData);
 
 // Get the parameter settings for creating an IBM style fs
 void getMkFsParams(bool isHD, SectorType format, MKFS_PARM& params);
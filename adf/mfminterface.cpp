@@ -70,6 +70,7 @@ void SectorCacheMFM::releaseDrive() {
         m_diskInDrive = false;
         if (m_diskChangeCallback) m_diskChangeCallback(false, SectorType::stUnknown);
         m_diskType = SectorType::stUnknown;
+        updatePositionGeometry();
     }
 }
 
@@ -77,6 +78,7 @@ void SectorCacheMFM::releaseDrive() {
 bool SectorCacheMFM::initDrive() {
     std::lock_guard<std::mutex> bridgeLock(m_motorTimerProtect);
     m_diskType = SectorType::stUnknown;
+    updatePositionGeometry();
     m_motorTurnOnTime = 0;
     m_diskInDrive = false;
     m_alwaysIgnore = false;
@@ -94,7 +96,7 @@ void SectorCacheMFM::resetCache() {
     std::lock_guard<std::mutex> bridgeLock(m_motorTimerProtect);
     m_tracksToFlush.clear();
     for (uint32_t systems = 0; systems < 2; systems++)
-        for (DecodedTrack& trk : m_trackCache[systems]) trk.sectors.clear();
+        for (DecodedTrack& trk : m_trackCache[systems]) trk.clear();
 }
 
 // Flush changes to disk
@@ -136,6 +138,7 @@ void SectorCacheMFM::identifyFileSystem() {
     m_alwaysIgnore = false;
     std::lock_guard<std::mutex> bridgeLock(m_motorTimerProtect);
     m_diskType = SectorType::stUnknown;
+    updatePositionGeometry();
     cylinderSeek(0, false);
     motorInUse(true);
     if (waitForMotor(false)) {
@@ -198,6 +201,7 @@ void SectorCacheMFM::overwriteSectorSettings(const SectorType systemType, const
         m_totalCylinders[0] = min(totalCylinders, MAX_TRACKS / 2);
         m_numHeads[0] = totalHeads;
         m_diskType = systemType;
+        updatePositionGeometry();
         m_tracksToFlush.clear();
     }
     resetCache();
@@ -207,20 +211,17 @@ void SectorCacheMFM::overwriteSectorSettings(const SectorType systemType, const
 void SectorCacheMFM::triggerNewDiskMount() {
     resetCache();
     m_diskType = SectorType::stUnknown;
+    updatePositionGeometry();
     m_diskInDrive = false;
 }
 
 // Pre-populate with blank sectors
 void SectorCacheMFM::createBlankSectors() {
-    DecodedSector blankSector;
-    blankSector.numErrors = 0;
-    blankSector.data.resize(m_bytesPerSector[0]);
-
     for (uint32_t trk = 0; trk < m_totalCylinders[0] * m_numHeads[0]; trk++) {
-        m_trackCache[0][trk].sectorsWithErrors = 0;
-        m_trackCache[0][trk].sectors.clear();
+        m_trackCache[0][trk].clear();
+        m_trackCache[0][trk].reserve(m_sectorsPerTrack[0], m_bytesPerSector[0]);
         for (uint32_t sec = 0; sec < m_sectorsPerTrack[0]; sec++)
-            m_trackCache[0][trk].sectors.insert(std::make_pair(sec, blankSector));
+            m_trackCache[0][trk].add(sec, m_bytesPerSector[0], 0);
     }
 }
 
@@ -257,8 +258,8 @@ void SectorCacheMFM::motorMonitor() {
                 // cache really needs to be cleared!
                 if (m_tracksToFlush.size() < 1) {
                     for (uint32_t trk = 0; trk < MAX_TRACKS; trk++) {
-                        m_trackCache[0][trk].sectors.clear();
-                        m_trackCache[0][trk].sectors.clear();
+                        m_trackCache[0][trk].clear();
+                        m_trackCache[0][trk].clear();
                     }
                 }
             }
@@ -270,11 +271,14 @@ void SectorCacheMFM::motorMonitor() {
     if (sendNotify) {
         if (!m_fileSystemID) return;
         if (m_diskChangeCallback) {
-            for (DecodedTrack& trk : m_trackCache[0]) trk.sectors.clear();
-            for (DecodedTrack& trk : m_trackCache[1]) trk.sectors.clear();
+            for (DecodedTrack& trk : m_trackCache[0]) trk.clear();
+            for (DecodedTrack& trk : m_trackCache[1]) trk.clear();
             if (m_diskInDrive) 
                 identifyFileSystem(); 
-            else m_diskType = SectorType::stUnknown;
+            else {
+                m_diskType = SectorType::stUnknown;
+                updatePositionGeometry();
+            }
             m_diskChangeCallback(m_diskInDrive, m_diskInDrive ? m_diskType : SectorType::stUnknown);
         }
     }
@@ -349,12 +353,12 @@ bool SectorCacheMFM::readDataAllFS(const uint32_t fileSystem, const uint32_t sec
     uint32_t retries = 0;
     for (;;) {
         // First, see if we have a perfect sector already
-        auto it = m_trackCache[fileSystem][track].sectors.find(trackBlock);
+        const DecodedSector* it = m_trackCache[fileSystem][track].find(trackBlock);
 
-        if (it != m_trackCache[fileSystem][track].sectors.end()) {
+        if (it) {
             // No errors? (or are we skipping them?)
-            if ((it->second.numErrors == 0) || (m_ignoreErrors)) {
-                memcpy_s(data, sectorSize, it->second.data.data(), min(it->second.data.size(), sectorSize));
+            if ((it->numErrors == 0) || (m_ignoreErrors)) {
+                memcpy_s(data, sectorSize, m_trackCache[fileSystem][track].data(*it), min(it->dataSize, sectorSize));
                 return true;
             }
         }
@@ -416,6 +420,19 @@ bool SectorCacheMFM::readDataAllFS(const uint32_t fileSystem, const uint32_t sec
     return true;
 }
 
+// Updates m_positionSectorsPerTrack after the disk type or geometry changes
+void SectorCacheMFM::updatePositionGeometry() {
+    m_positionSectorsPerTrack = (m_diskType == SectorType::stUnknown) ? 0 : m_sectorsPerTrack[0];
+}
+
+// Reads are ordered by track.  This is called before the elevator lock is taken, while another thread can be reading the disk
+// with m_motorTimerProtect held, so it only looks at the atomic copy of the geometry
+uint32_t SectorCacheMFM::devicePosition(const uint32_t sectorNumber) {
+    const uint32_t sectorsPerTrack = m_positionSectorsPerTrack;
+    if (!sectorsPerTrack) return ElevatorLock::ANY_POSITION;
+    return sectorNumber / sectorsPerTrack;
+}
+
 // Do reading
 bool SectorCacheMFM::internalReadData(const uint32_t sectorNumber, const uint32_t sectorSize, void* data) {
     if (sectorSize != m_bytesPerSector[0]) return false;
@@ -451,6 +468,7 @@ bool SectorCacheMFM::doTrackReading(const uint32_t fileSystem, const uint32_t tr
             else Sleep(50);
         }
     } while (!bitsReceived);
+    m_headCylinder = track / m_numHeads[fileSystem];
 
     // Try to identify the file system
     if (m_diskType == SectorType::stUnknown) {
@@ -469,19 +487,19 @@ bool SectorCacheMFM::doTrackReading(const uint32_t fileSystem, const uint32_t tr
         uint32_t sectorsPerTrack;
         uint32_t bytesPerSector;
 
-        if (trAmiga.sectors.size()) {
+        if (trAmiga.size()) {
             m_diskType = SectorType::stAmiga;
-            m_sectorsPerTrack[0] = max(m_sectorsPerTrack[0], (uint32_t)trAmiga.sectors.size());
+            m_sectorsPerTrack[0] = max(m_sectorsPerTrack[0], trAmiga.size());
             m_serialNumber[0] = 0x414D4644; // AMFD
         }
         else m_diskType = SectorType::stUnknown;
 
-        if (trIBM.sectors.size() >= 5) {
+        if (trIBM.size() >= 5) {
             m_diskType = SectorType::stIBM;
             uint32_t totalSectors;
             uint32_t numHeads;
             if (getTrackDetails_IBM(&trIBM, serialNumber, numHeads, totalSectors, sectorsPerTrack, bytesPerSector)) {
-                if ((trIBM.sectors.size() >= 5) && (trAmiga.sectors.size() > 1)) {
+                if ((trIBM.size() >= 5) && (trAmiga.size() > 1)) {
                     m_diskType = SectorType::stHybrid;
                 }
                 else
@@ -501,6 +519,7 @@ bool SectorCacheMFM::doTrackReading(const uint32_t fileSystem, const uint32_t tr
                 m_numHeads[0] = 2;
             }
         }
+        updatePositionGeometry();
     }
     if (m_diskType == SectorType::stHybrid) {
 
@@ -543,25 +562,24 @@ bool SectorCacheMFM::internalWriteData(const uint32_t sectorNumber, const uint32
     std::lock_guard<std::mutex> bridgeLock(m_motorTimerProtect);
 
     // Now replace the sector we're overwriting, just in memory at this point
-    auto it = m_trackCache[0][track].sectors.find(trackBlock);
-    if (it != m_trackCache[0][track].sectors.end()) {
-        if (memcmp(it->second.data.data(), data, min(sectorSize, it->second.data.size())) == 0) {
-            if (it->second.numErrors == 0) return true;
-            it->second.numErrors = 0;                
+    DecodedTrack& decodedTrack = m_trackCache[0][track];
+    DecodedSector* it = decodedTrack.find(trackBlock);
+    if (it) {
+        if (memcmp(decodedTrack.data(*it), data, min(sectorSize, it->dataSize)) == 0) {
+            if (it->numErrors == 0) return true;
+            it->numErrors = 0;                
         }
         else {
             // No errors? (or are we skipping them?)
-            memcpy_s(it->second.data.data(), it->second.data.size(), data, min(sectorSize, it->second.data.size()));
-            it->second.numErrors = 0;
+            memcpy_s(decodedTrack.data(*it), it->dataSize, data, min(sectorSize, it->dataSize));
+            it->numErrors = 0;
         }
     }
     else {
         // Add the track
-        DecodedSector sector;
-        sector.data.resize(m_bytesPerSector[0]);
-        memcpy_s(sector.data.data(), sector.data.size(), data, min(sector.data.size(), sectorSize));
-        sector.numErrors = 0;
-        m_trackCache[0][track].sectors.insert(std::make_pair(trackBlock, sector));
+        it = decodedTrack.add(trackBlock, m_bytesPerSector[0], 0);
+        if (!it) return false;
+        memcpy_s(decodedTrack.data(*it), it->dataSize, data, min(it->dataSize, sectorSize));
     }
 
     auto i = m_tracksToFlush.find(track);
@@ -585,7 +603,7 @@ void SectorCacheMFM::checkFlushPendingWrites() {
 void SectorCacheMFM::removeFailedWritesFromCache() {
     for (auto& trk : m_tracksToFlush)
         if (trk.second)
-            m_trackCache[0][trk.first].sectors.clear();
+            m_trackCache[0][trk.first].clear();
     m_tracksToFlush.clear();
 }
 
@@ -593,8 +611,11 @@ void SectorCacheMFM::removeFailedWritesFromCache() {
 bool SectorCacheMFM::flushPendingWrites() {
     if (m_blockWriting) return false;
 
-    for (auto& trk : m_tracksToFlush) {
-        const uint32_t track = trk.first;
+    // Write them in the order the head reaches them, sweeping up from where it is and then back round from the lowest (C-LOOK)
+    auto trk = m_tracksToFlush.lower_bound(m_headCylinder * m_numHeads[0]);
+    for (size_t remaining = m_tracksToFlush.size(); remaining; remaining--, trk++) {
+        if (trk == m_tracksToFlush.end()) trk = m_tracksToFlush.begin();
+        const uint32_t track = trk->first;
         const bool upperSurface = track % m_numHeads[0];
         const int cylinder = track / m_numHeads[0];
 
@@ -608,47 +629,43 @@ bool SectorCacheMFM::flushPendingWrites() {
         cylinderSeek(cylinder, upperSurface);
 
         // Assemble and commit an entire track.  First see if any data is missing
-        bool fillData = m_trackCache[0][track].sectors.size() < m_sectorsPerTrack[0];
+        DecodedTrack& decodedTrack = m_trackCache[0][track];
+        bool fillData = decodedTrack.size() < m_sectorsPerTrack[0];
         if (!fillData)
-            for (const auto& it : m_trackCache[0][track].sectors)
-                if (it.second.numErrors) {
+            for (uint32_t sec = 0; sec < MAX_SECTORS_PER_TRACK; sec++) {
+                const DecodedSector* it = decodedTrack.find(sec);
+                if ((it) && (it->numErrors)) {
                     fillData = true;
                     break;
                 }
+            }
 
         // Theres some missing data. We we'll request the track again and fill in the gaps
         if (fillData) {
             // 1. Take a copy
-            const std::map<int, DecodedSector> backup = m_trackCache[0][track].sectors;
+            m_trackBackup = decodedTrack;
             if (m_writeOnly) {
-                for (uint32_t sec = 0; sec < m_sectorsPerTrack[0]; sec++) {
-                    auto it = m_trackCache[0][track].sectors.find(sec);
-                    // Does a sector with this number exist?
-                    if (it == m_trackCache[0][track].sectors.end()) {
-                        DecodedSector tmp;
-                        tmp.numErrors = 0;
-                        tmp.data.resize(m_bytesPerSector[0]);;
-                        m_trackCache[0][track].sectors.insert(std::make_pair(sec, tmp));
-                    }
-                }
+                // Add any sectors that don't exist
+                for (uint32_t sec = 0; sec < m_sectorsPerTrack[0]; sec++)
+                    if (!decodedTrack.find(sec)) decodedTrack.add(sec, m_bytesPerSector[0], 0);
             }
             else {
                 // 2. *try* to read the track (but dont care if it fails)
                 doTrackReading(0, track, false);
             }
             // 3. Replace any tracks now read with any we have in our backup that have errors = 0
-            for (const auto& sec : backup) {
-                if (sec.second.numErrors == 0) {
-                    auto it = m_trackCache[0][track].sectors.find(sec.first);
-                    if (it != m_trackCache[0][track].sectors.end())
-                        it->second = sec.second;
+            for (uint32_t sec = 0; sec < MAX_SECTORS_PER_TRACK; sec++) {
+                const DecodedSector* backup = m_trackBackup.find(sec);
+                if ((backup) && (backup->numErrors == 0) && (decodedTrack.find(sec))) {
+                    DecodedSector* it = decodedTrack.set(sec, m_trackBackup.data(*backup), backup->dataSize, 0);
+                    it->numVotes = 0;
                 }
             }
         }
 
         // Remove sectors that shouldn't be there
-        while (m_trackCache[0][track].sectors.size() > m_sectorsPerTrack[0]) 
-            m_trackCache[0][track].sectors.erase(m_trackCache[0][track].sectors.rbegin()->first);
+        while (decodedTrack.size() > m_sectorsPerTrack[0]) 
+            decodedTrack.erase(decodedTrack.lastSector());
 
         // We will now have a complete track worth of sectors so we can now finally commit this to disk (hopefully) plus we will verify it
         uint32_t numBytes;
@@ -659,7 +676,7 @@ bool SectorCacheMFM::flushPendingWrites() {
         case SectorType::stAtari: numBytes = encodeSectorsIntoMFM_IBM(isHD(), true, &m_trackCache[0][track], track, MAX_TRACK_SIZE, m_mfmBuffer); break;
         case SectorType::stHybrid:
             // Need to work out which type of track it is although technically hybrid isnt supported for writing
-            if ((m_trackCache[0][track].sectors.size() == 11) || (m_trackCache[0][track].sectors.size() == 22))
+            if ((decodedTrack.size() == 11) || (decodedTrack.size() == 22))
                 numBytes = encodeSectorsIntoMFM_AMIGA(isHD(), m_trackCache[0][track], track, MAX_TRACK_SIZE, m_mfmBuffer);
             else numBytes = encodeSectorsIntoMFM_IBM(isHD(), true, &m_trackCache[0][track], track, MAX_TRACK_SIZE, m_mfmBuffer);
             break;
@@ -750,7 +767,7 @@ bool SectorCacheMFM::flushPendingWrites() {
                 }
                 else {
                     // Writing succeeded. Now to do a verify!
-                    const std::map<int, DecodedSector> backup = m_trackCache[0][track].sectors;
+                    m_trackBackup = decodedTrack;
                     for (;;) {
                         if (!doTrackReading(0, track, retries > 1)) {
                             if (m_dokanfileinfo) DokanResetTimeout(30000, m_dokanfileinfo);
@@ -786,28 +803,30 @@ bool SectorCacheMFM::flushPendingWrites() {
 
                     // Check what was read back matches what we wrote
                     bool errors = false;
-                    for (const auto& sec : backup) {
-                        auto search = m_trackCache[0][track].sectors.find(sec.first);
+                    for (uint32_t sec = 0; sec < MAX_SECTORS_PER_TRACK; sec++) {
+                        const DecodedSector* backup = m_trackBackup.find(sec);
+                        if (!backup) continue;
+                        const DecodedSector* search = decodedTrack.find(sec);
                         // Sector no longer exists.  ERROR!
-                        if (search == m_trackCache[0][track].sectors.end()) {
+                        if (!search) {
                             errors = true;
                             break;
                         }
                         else {
                             // Did it reac back with errors!?
-                            if (search->second.numErrors) {
+                            if (search->numErrors) {
                                 errors = true;
                                 break;
                             }
                             else {
                                 // Finally, compare the data and see if its identical
-                                if (search->second.data.size() != sec.second.data.size()) {
+                                if (search->dataSize != backup->dataSize) {
                                     // BAD read back wrong sector size
                                     errors = true;
                                     break;
                                 }
                                 else
-                                    if (memcmp(search->second.data.data(), sec.second.data.data(), search->second.data.size()) != 0) {
+                                    if (memcmp(decodedTrack.data(*search), m_trackBackup.data(*backup), search->dataSize) != 0) {
                                         // BAD read back even though there were no errors
                                         errors = true;
                                         break;
@@ -829,7 +848,8 @@ bool SectorCacheMFM::flushPendingWrites() {
         }
 
         // Mark that its done!
-        trk.second = 0;
+        trk->second = 0;
+        m_headCylinder = cylinder;
     }
 
     removeFailedWritesFromCache();
@@ -22,6 +22,7 @@
 #include "sectorCommon.h"
 #include "mfminterface.h"
 #include <mutex>
+#include <atomic>
 
 #define MAX_TRACKS                          168
 #define MOTOR_TIMEOUT_TIME                  2500ULL // Timeout to wait for the motor to spin up
@@ -52,16 +53,22 @@ private:
     uint32_t m_totalCylinders[2] = { 0, 0 };
     uint32_t m_serialNumber[2] = { 0x554E4B4E, 0 };
     uint32_t m_numHeads[2] = { 2, 2 };
+    // Copy of m_sectorsPerTrack[0] for devicePosition, which is called without m_motorTimerProtect. Zero until the disk type is known
+    std::atomic<uint32_t> m_positionSectorsPerTrack = 0;
 
     bool m_alwaysIgnore = false;
     bool m_fileSystemID = true;
 
     // Tracks that need committing to disk
-    // NOTE: Using MAP not UNORDERED_MAP. This *should* make the disk head stepping fairly sequential and faster
+    // NOTE: Using MAP not UNORDERED_MAP. They're written in order sweeping up from the head, so the stepping is fairly sequential and faster
     std::map<uint32_t, uint32_t> m_tracksToFlush; // mapping of track -> number of hits
+    // Cylinder the head was last used on
+    uint32_t m_headCylinder = 0;
 
     // Cache for previous tracks read
     DecodedTrack m_trackCache[2][MAX_TRACKS];
+    // Copy of a track taken while it's written, so it can be compared with what's read back.  Kept so its buffers are reused
+    DecodedTrack m_trackBackup;
 
     // Flush any writing thats still pending
     bool flushPendingWrites();
@@ -81,6 +88,9 @@ private:
     // Reads some data to see what kind of disk it is
     void identifyFileSystem();
 
+    // Updates m_positionSectorsPerTrack after the disk type or geometry changes
+    void updatePositionGeometry();
+
     // Read all sector data regarding of the mode
     bool readDataAllFS(const uint32_t fileSystem, const uint32_t sectorNumber, const uint32_t sectorSize, void* data);
 
@@ -95,6 +105,8 @@ protected:
     virtual bool internalReadData(const uint32_t sectorNumber, const uint32_t sectorSize, void* data) override final;
     virtual bool internalWriteData(const uint32_t sectorNumber, const uint32_t sectorSize, const void* data) override final;
     virtual bool internalHybridReadData(const uint32_t sectorNumber, const uint32_t sectorSize, void* data) override final;
+    // Reads are ordered by track
+    virtual uint32_t devicePosition(const uint32_t sectorNumber) override;
 
     virtual bool restoreDrive() = 0;
     virtual void releaseDrive() = 0;
@@ -13,11 +13,13 @@
  */
 
 #include "pll.h"
+#include <algorithm>
 
 #define CLOCK_CENTRE  2000   /* 2000ns = 2us */
 #define CLOCK_MAX_ADJ 10     /* +/- 10% adjustment */
 #define CLOCK_MIN ((CLOCK_CENTRE * (100 - CLOCK_MAX_ADJ)) / 100)
 #define CLOCK_MAX ((CLOCK_CENTRE * (100 + CLOCK_MAX_ADJ)) / 100)
+#define MAX_PRESIZE_BYTES (1024 * 1024)  /* don't trust a track length hint beyond this */
 
 // Constructor
 PLL::PLL() {
@@ -30,42 +32,71 @@ void PLL::reset() {
     m_clock = CLOCK_CENTRE;
     m_nFluxSoFar = 0;
 
-    m_bitsRemaining = 0;
-    m_mfmData.clear();
+    newTrack();
 }
 
 // Reset the track buffer
-void PLL::newTrack() {
-    m_bitsRemaining = 0;
-    m_mfmData.clear();
+void PLL::newTrack(const uint64_t expectedFluxTime) {
+    m_bytesUsed = 0;
+    m_pendingBits = 0;
+    m_numPendingBits = 0;
+    m_cellOverflow = 0;
+
+    // Size the buffer for the fastest clock the PLL can run at, so it shouldn't need to grow while decoding
+    const uint64_t expectedBytes = std::min<uint64_t>((expectedFluxTime / CLOCK_MIN) / 8, MAX_PRESIZE_BYTES) + 64;
+    if (m_mfmData.size() < expectedBytes) m_mfmData.resize((size_t)expectedBytes);
+}
+
+// Moves the oldest 32 bits out of m_pendingBits into m_mfmData once there are enough
+void PLL::flushBits() {
+    if (m_numPendingBits < 32) return;
+    if (m_bytesUsed + 4 > m_mfmData.size()) m_mfmData.resize(m_mfmData.size() * 2 + 64);
+
+    const uint32_t word = (uint32_t)(m_pendingBits >> (m_numPendingBits - 32));
+    uint8_t* out = &m_mfmData[m_bytesUsed];
+    out[0] = (uint8_t)(word >> 24);
+    out[1] = (uint8_t)(word >> 16);
+    out[2] = (uint8_t)(word >> 8);
+    out[3] = (uint8_t)word;
+    m_bytesUsed += 4;
+    m_numPendingBits -= 32;
 }
 
-// Add the bit
-void PLL::addBit(const uint8_t& bit) {
-    if (m_bitsRemaining == 0) {
-        m_mfmData.push_back(bit);
-        m_bitsRemaining = 7;
+// Adds 'count' zeros followed by a one
+void PLL::addBits(uint32_t count) {
+    // Very long gaps (no flux at all) go in 32 zeros at a time
+    while (count >= 32) {
+        m_pendingBits <<= 32;
+        m_numPendingBits += 32;
+        flushBits();
+        count -= 32;
     }
-    else {
-        m_bitsRemaining--;
-        m_mfmData.back() <<= 1;
-        m_mfmData.back() |= bit;
-    }    
+    m_pendingBits = (m_pendingBits << (count + 1)) | 1;
+    m_numPendingBits += count + 1;
+    flushBits();
 }
 
-// Submit flux to the PLL
-void PLL::decodeFlux(const uint32_t fluxTime) {
+// Runs the PLL on one flux time
+void PLL::clockFlux(const uint32_t fluxTime) {
     m_nFluxSoFar += fluxTime;
     if (m_nFluxSoFar < (m_clock / 2)) return;
 
-    // Work out how many zeros, and remaining flux
-    int32_t clockedZeros = (m_nFluxSoFar - (m_clock / 2)) / m_clock;
+    // Work out how many zeros, and remaining flux. Normal MFM is only a few clocks long, so count those rather than divide
+    const int32_t flux = m_nFluxSoFar - (m_clock / 2);
+    int32_t clockedZeros = 0;
+    if (flux < m_clock * 4)
+        clockedZeros = (flux >= m_clock) + (flux >= m_clock * 2) + (flux >= m_clock * 3);
+    else clockedZeros = flux / m_clock;
     m_nFluxSoFar -= ((clockedZeros + 1) * m_clock);
 
     // PLL: Adjust clock frequency according to phase mismatch.
     if ((clockedZeros >= 1) && (clockedZeros <= 3)) {
-        // In sync: adjust base clock by 10% of phase mismatch.
-        m_clock += (m_nFluxSoFar / (int)(clockedZeros + 1)) / 10;
+        // In sync: adjust base clock by 10% of phase mismatch. (constant divisors are much cheaper than m_nFluxSoFar / (clockedZeros + 1))
+        switch (clockedZeros) {
+            case 1: m_clock += (m_nFluxSoFar / 2) / 10; break;
+            case 2: m_clock += (m_nFluxSoFar / 3) / 10; break;
+            default: m_clock += (m_nFluxSoFar / 4) / 10; break;
+        }
     }
     else {
         // Out of sync: adjust base clock towards centre.
@@ -79,20 +110,41 @@ void PLL::decodeFlux(const uint32_t fluxTime) {
     m_nFluxSoFar /= 2;
 
     // Convert flux time into MFM
-    while (clockedZeros) {
-        addBit(0);
-        clockedZeros--;
+    addBits((uint32_t)clockedZeros);
+}
+
+// Submit flux to the PLL
+void PLL::decodeFlux(const uint32_t fluxTime) {
+    clockFlux(fluxTime);
+}
+
+// Submit a block of SCP style flux cells to the PLL. These are 16-bit big-endian, where 0 means add 65536 to the next cell.
+void PLL::decodeFluxCells(const void* cells, const uint32_t numCells, const uint32_t multiplier) {
+    const uint8_t* cell = (const uint8_t*)cells;
+    const uint8_t* end = cell + (numCells * 2);
+    uint32_t overflow = m_cellOverflow;
+
+    for (; cell < end; cell += 2) {
+        const uint32_t t = ((uint32_t)cell[0] << 8) | cell[1];
+        if (t == 0) overflow += 65536; else {
+            clockFlux((overflow + t) * multiplier);
+            overflow = 0;
+        }
     }
-    addBit(1);
+
+    m_cellOverflow = overflow;
 }
 
 // Finishes the track, returns its size in BITS and a pointer to the buffer containing it which you should copy
 uint32_t PLL::finaliseTrack(void** buffer) {
     if (!buffer) return 0;
 
-    // First we need to shift the remaining bits in the last byte to be the most significiant
-    if (m_bitsRemaining) m_mfmData.back() <<= m_bitsRemaining;
-    
+    // Write out what's left, with the remaining bits in the last byte being the most significiant
+    if (m_bytesUsed + 8 > m_mfmData.size()) m_mfmData.resize(m_bytesUsed + 8);
+    uint32_t bytes = m_bytesUsed;
+    for (int32_t bits = (int32_t)m_numPendingBits; bits > 0; bits -= 8)
+        m_mfmData[bytes++] = (uint8_t)(bits >= 8 ? m_pendingBits >> (bits - 8) : m_pendingBits << (8 - bits));
+
     *buffer = (void*)m_mfmData.data();
-    return ((uint32_t)m_mfmData.size() * 8) - m_bitsRemaining;
+    return (m_bytesUsed * 8) + m_numPendingBits;
 }
@@ -23,24 +23,37 @@ private:
 	int32_t m_clock = 0;
 	int32_t m_nFluxSoFar = 0;
 
-	// Decoded buffer 
+	// Decoded buffer. It is kept sized ahead of the data, m_bytesUsed says how much of it is real
 	std::vector<uint8_t> m_mfmData;
-	// How many bits remaining until we need a new byte
-	uint32_t m_bitsRemaining = 0;
-
-	inline void addBit(const uint8_t& bit);
+	uint32_t m_bytesUsed = 0;
+	// Bits not yet written to m_mfmData, right aligned
+	uint64_t m_pendingBits = 0;
+	uint32_t m_numPendingBits = 0;
+	// Flux carried over from overflow cells in decodeFluxCells
+	uint32_t m_cellOverflow = 0;
+
+	// Adds 'count' zeros followed by a one
+	inline void addBits(uint32_t count);
+	// Moves the oldest 32 bits out of m_pendingBits into m_mfmData once there are enough
+	inline void flushBits();
+	// Runs the PLL on one flux time
+	inline void clockFlux(const uint32_t fluxTime);
 public:
 	PLL();
 
 	// Reset the PLL
 	void reset();
 
-	// Reset the track buffer
-	void newTrack();
+	// Reset the track buffer. expectedFluxTime is roughly how long the track is, in the same units as the flux, and is used to size the buffer
+	void newTrack(const uint64_t expectedFluxTime = 0);
 
 	// Submit flux to the PLL
 	void decodeFlux(const uint32_t fluxTime);
 
+	// Submit a block of SCP style flux cells to the PLL. These are 16-bit big-endian, where 0 means add 65536 to the next cell.
+	// Each cell is scaled by multiplier before being decoded. cells doesn't need to be aligned
+	void decodeFluxCells(const void* cells, const uint32_t numCells, const uint32_t multiplier);
+
 	// Finishes the track, returns its size in BITS and a pointer to the buffer containing it which you should copy
 	uint32_t finaliseTrack(void** buffer);
 };
@@ -18,12 +18,16 @@
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <map>
+#include <algorithm>
 #include "readwrite_file.h"
 
 #define HEADLEN 56
 #define THLEN 20
 #define TRACK_BUFFER_LEN 32000
-#define TEMP_BUFFER_LEN 32000
 
 #define SECTORSIZE 512
 
@@ -40,6 +44,19 @@ extern "C" {
 
 // This uses code from the "pfile" files in a more suitable form
 
+// The decrunchers keep their state in here rather than globals, so each thread needs its own
+struct SectorRW_DMS::Decoder {
+    DECRUNCH_STATE state;
+    std::vector<uint8_t> b1;
+    std::vector<uint8_t> b2;
+    // Track the decrunchers are ready to decode next without starting the chain again
+    uint32_t nextInChain = 0xFFFFFFFF;
+
+    Decoder() : b1(TRACK_BUFFER_LEN), b2(TRACK_BUFFER_LEN) {
+        Init_Decrunchers(&state);
+    }
+};
+
 /*  DMS uses a lame encryption  */
 /*static void dms_decrypt(UCHAR* p, USHORT len) {
     USHORT t;
@@ -58,99 +75,165 @@ uint32_t SectorRW_DMS::sectorSize() {
 }
 
 
-// We force the cache size so the entire DMS file fits into memory
-SectorRW_DMS::SectorRW_DMS(HANDLE fle) : SectorCacheEngine(512 * 84 * 2 * 2 * 11) {
+// Tracks are unpacked when they're needed, and can be unpacked again if they drop out of the cache
+SectorRW_DMS::SectorRW_DMS(HANDLE fle) : SectorCacheEngine(512 * 84 * 2 * 2 * 11), m_file(fle), m_decoder(std::make_unique<Decoder>()) {
     m_sectorsPerTrack = 11;
-    // Buffers needs internally by DMS
-    uint8_t* b1 = (uint8_t*)malloc((size_t)TRACK_BUFFER_LEN);
-    uint8_t* b2 = (uint8_t*)malloc((size_t)TRACK_BUFFER_LEN);
-    uint8_t* text = (uint8_t*)malloc((size_t)TEMP_BUFFER_LEN);
-
-    if (b1 && b2 && text) {
-        m_validFile = parseDMSHeader(fle, b1, b2, text);
-        if (m_validFile) unpackCylinders(fle, b1, b2, text);
-    }
 
-    if (b1) free(b1);
-    if (b2) free(b2);
-    if (text) free(text);
-    CloseHandle(fle);
+    m_validFile = parseDMSHeader(fle, m_decoder->b1.data());
+    if (m_validFile) buildTrackIndex();
+    if (!m_validFile) quickClose();
 }
 
-// Unpack the track with random (ish) access to the track 
-// DMS sometimes needs to be extracted in order!?
-bool SectorRW_DMS::unpackCylinders(HANDLE fle, uint8_t* b1, uint8_t* b2, uint8_t* text) {
-    DWORD read;    
+// Read just the track headers, recording where each track is and how it's packed
+bool SectorRW_DMS::buildTrackIndex() {
+    DWORD read;
+    uint8_t header[THLEN];
+    uint32_t filePos = HEADLEN;
     m_totalTracks = 0;
 
     // Run until we run out of data
-    for (size_t c = 0; c < 81; c++) {
-        if (!ReadFile(fle, b1, THLEN, &read, NULL)) 
+    for (size_t c = 0; c < 256; c++) {
+        if (SetFilePointer(m_file, filePos, NULL, FILE_BEGIN) == INVALID_SET_FILE_POINTER) return false;
+        if (!ReadFile(m_file, header, THLEN, &read, NULL)) 
             return false;
         if (read != THLEN) 
             return false;
 
-        if ((b1[0] != 'T') || (b1[1] != 'R')) return false;
-        USHORT hcrc = (USHORT)((b1[THLEN - 2] << 8) | b1[THLEN - 1]);
-        if (CreateCRC(b1, (ULONG)(THLEN - 2)) != hcrc) return false;
-        USHORT pklen1 = (USHORT)((b1[6] << 8) | b1[7]);	    /*  Length of packed track data as in archive  */
-        USHORT pklen2 = (USHORT)((b1[8] << 8) | b1[9]);	    /*  Length of data after first unpacking  */
-        USHORT number = (USHORT)((b1[2] << 8) | b1[3]);     /*  Number of cylinder  */
-        USHORT unpklen = (USHORT)((b1[10] << 8) | b1[11]);	/*  Length of data after subsequent rle unpacking */
-        USHORT dcrc = (USHORT)((b1[16] << 8) | b1[17]);	    /*  Track Data CRC BEFORE unpacking  */
-        USHORT flags = b1[12];		                        /*  control flags  */
-        USHORT cmode = b1[13];		                        /*  compression mode used  */
-        USHORT usum = (USHORT)((b1[14] << 8) | b1[15]);	/*  Track Data CheckSum AFTER unpacking  */
-
-        if ((pklen1 > TRACK_BUFFER_LEN) || (pklen2 > TRACK_BUFFER_LEN) || (unpklen > TRACK_BUFFER_LEN)) 
+        if ((header[0] != 'T') || (header[1] != 'R')) return false;
+        USHORT hcrc = (USHORT)((header[THLEN - 2] << 8) | header[THLEN - 1]);
+        if (CreateCRC(header, (ULONG)(THLEN - 2)) != hcrc) {
+            // Nothing after this can be found, so note where it happened
+            std::lock_guard lock(m_integrityLock);
+            m_integrity.push_back({ (uint16_t)((header[2] << 8) | header[3]), false, false, false, false });
             return false;
-        
-        // Skip fake boot block advert
-        if (((number == 0) && (unpklen == 1024)) || (number >= 83)) {
-           //
         }
-        else {
-            // Read the buffer
-            if (!ReadFile(fle, b1, pklen1, &read, NULL)) 
-                return false;
-            if (read != pklen1) 
-                return false;
-
-            // Check track CRC
-            if (CreateCRC(b1, (ULONG)pklen1) == dcrc) {
-                // dms_decrypt(b1,pklen1);
-
-                // Try to unpack it
-                if (unpklen > 2048) {
-                    memset(b2, 0, unpklen);
-                    if (decompressTrack(b1, b2, text, pklen2, unpklen, cmode, flags)) {
-                        //if (usum != Calc_CheckSum(b2, (ULONG)unpklen)) {
-                         //   OutputDebugStringA("CHGECKFAIL");
-                       // }
-
-                        // Save sectors into cache
-                        uint32_t sectorStart = number * 2 * m_sectorsPerTrack;
-                        char* src = (char*)b2;
-                        int32_t remaining = (int32_t)unpklen;
-                        while (remaining >= SECTORSIZE) {
-                            writeCache(sectorStart++, SECTORSIZE, src);
-                            src += SECTORSIZE;
-                            remaining -= SECTORSIZE;
-                        }
-                    }
-                }
-            }
-            else {
 
-            }
-            m_totalTracks = max(m_totalTracks, (uint32_t)((number + 1) * 2));
+        TrackIndex track;
+        track.filePos = filePos + THLEN;
+        track.cylinder = (USHORT)((header[2] << 8) | header[3]);
+        track.pklen1 = (USHORT)((header[6] << 8) | header[7]);
+        track.pklen2 = (USHORT)((header[8] << 8) | header[9]);
+        track.unpklen = (USHORT)((header[10] << 8) | header[11]);
+        track.flags = header[12];
+        track.cmode = header[13];
+        track.usum = (USHORT)((header[14] << 8) | header[15]);
+        track.dcrc = (USHORT)((header[16] << 8) | header[17]);
+        filePos = track.filePos + track.pklen1;
+
+        if ((track.pklen1 > TRACK_BUFFER_LEN) || (track.pklen2 > TRACK_BUFFER_LEN) || (track.unpklen > TRACK_BUFFER_LEN)) 
+            return false;
+
+        // Skip fake boot block advert
+        if (((track.cylinder == 0) && (track.unpklen == 1024)) || (track.cylinder >= 83)) continue;
+
+        // Tracks that don't clear the decruncher state afterwards have to be decoded before the next one
+        const uint32_t index = (uint32_t)m_tracks.size();
+        track.chainStart = index;
+        if (index) {
+            const TrackIndex& previous = m_tracks[index - 1];
+            if ((previous.flags & 1) || (previous.unpklen <= 2048)) track.chainStart = previous.chainStart;
+        }
+        m_tracks.push_back(track);
+        {
+            std::lock_guard lock(m_integrityLock);
+            m_integrity.push_back({ track.cylinder, true, false, false, false });
         }
+        m_cylinders[track.cylinder] = index;
+        m_totalTracks = max(m_totalTracks, (uint32_t)((track.cylinder + 1) * 2));
     } 
     return true;
 }
 
+// Read and unpack one track into the decoder's b2, returns FALSE if it couldn't be read. decoded is set if there's data
+bool SectorRW_DMS::unpackTrack(Decoder& decoder, const uint32_t index, const bool verify, bool& decoded) {
+    const TrackIndex& track = m_tracks[index];
+    DWORD read;
+    decoded = false;
+
+    // Read the buffer. Other decoders may be using the file at the same time
+    {
+        std::lock_guard lock(m_fileLock);
+        if (SetFilePointer(m_file, track.filePos, NULL, FILE_BEGIN) == INVALID_SET_FILE_POINTER) return false;
+        if (!ReadFile(m_file, decoder.b1.data(), track.pklen1, &read, NULL)) 
+            return false;
+        if (read != track.pklen1) 
+            return false;
+    }
+
+    // Check track CRC
+    const bool packedOK = CreateCRC(decoder.b1.data(), (ULONG)track.pklen1) == track.dcrc;
+    bool unpackedOK = false;
+
+    // Try to unpack it
+    if ((packedOK) && (track.unpklen > 2048)) {
+        memset(decoder.b2.data(), 0, track.unpklen);
+        decoded = decompressTrack(decoder, track.pklen2, track.unpklen, track.cmode, track.flags);
+        if ((decoded) && (verify)) decoded = Calc_CheckSum(decoder.b2.data(), (ULONG)track.unpklen) == track.usum;
+        unpackedOK = decoded;
+    }
+    else unpackedOK = packedOK;
+
+    std::lock_guard lock(m_integrityLock);
+    TrackIntegrity& integrity = m_integrity[index];
+    integrity.checked = true;
+    integrity.packedOK = packedOK;
+    integrity.unpackedOK = unpackedOK;
+    return true;
+}
+
+// Decode track 'target' into data, along with anything in its chain that has to be decoded before it
+bool SectorRW_DMS::decodeTrack(Decoder& decoder, const uint32_t target, std::vector<uint8_t>& data) {
+    // Carry on from the last track decoded if it's in the same chain, otherwise start the chain again
+    uint32_t index = m_tracks[target].chainStart;
+    if ((decoder.nextInChain <= target) && (decoder.nextInChain < m_tracks.size()) && (m_tracks[decoder.nextInChain].chainStart == index)) index = decoder.nextInChain;
+    else Init_Decrunchers(&decoder.state);
+
+    bool found = false;
+    for (; index <= target; index++) {
+        const TrackIndex& track = m_tracks[index];
+        bool decoded;
+        if (!unpackTrack(decoder, index, m_verify, decoded)) {
+            decoder.nextInChain = 0xFFFFFFFF;
+            return false;
+        }
+        if (!decoded) continue;
+
+        // Save sectors into cache, including tracks that had to be decoded on the way
+        uint32_t sectorStart = track.cylinder * 2 * m_sectorsPerTrack;
+        const uint8_t* src = decoder.b2.data();
+        int32_t remaining = (int32_t)track.unpklen;
+        while (remaining >= SECTORSIZE) {
+            writeCache(sectorStart++, SECTORSIZE, src);
+            src += SECTORSIZE;
+            remaining -= SECTORSIZE;
+        }
+        if (index == target) {
+            data.assign(decoder.b2.data(), decoder.b2.data() + track.unpklen);
+            found = true;
+        }
+    }
+    decoder.nextInChain = target + 1;
+
+    return found;
+}
+
+// Decode the cylinder into m_lastCylinderData
+bool SectorRW_DMS::decodeCylinder(const uint32_t cylinder) {
+    auto it = m_cylinders.find(cylinder);
+    if (it == m_cylinders.end()) return false;
+
+    m_lastCylinder = 0xFFFFFFFF;
+    if (!decodeTrack(*m_decoder, it->second, m_lastCylinderData)) return false;
+    m_lastCylinder = cylinder;
+    return true;
+}
+
 // Decompress the track!
-bool SectorRW_DMS::decompressTrack(uint8_t* b1, uint8_t* b2, uint8_t* text, uint16_t pklen2, uint16_t unpklen, uint16_t cmode, uint16_t flags) {
+bool SectorRW_DMS::decompressTrack(Decoder& decoder, uint16_t pklen2, uint16_t unpklen, uint16_t cmode, uint16_t flags) {
+    UCHAR* b1 = decoder.b1.data();
+    UCHAR* b2 = decoder.b2.data();
+    DECRUNCH_STATE* state = &decoder.state;
+
     switch (cmode) {
     case 0:
         /*   No Compression   */
@@ -162,19 +245,19 @@ bool SectorRW_DMS::decompressTrack(uint8_t* b1, uint8_t* b2, uint8_t* text, uint
         break;
     case 2:
         /*   Quick Compression   */
-        if (Unpack_QUICK(b1, b2, pklen2, text)) return false;
+        if (Unpack_QUICK(state, b1, b2, pklen2)) return false;
         if (Unpack_RLE(b2, b1, unpklen)) return false;
         memcpy(b2, b1, (size_t)unpklen);
         break;
     case 3:
         /*   Medium Compression   */
-        if (Unpack_MEDIUM(b1, b2, pklen2, text)) return false;
+        if (Unpack_MEDIUM(state, b1, b2, pklen2)) return false;
         if (Unpack_RLE(b2, b1, unpklen)) return false;
         memcpy(b2, b1, (size_t)unpklen);
         break;
     case 4:
         /*   Deep Compression   */
-        if (Unpack_DEEP(b1, b2, pklen2, text)) return false;
+        if (Unpack_DEEP(state, b1, b2, pklen2)) return false;
         if (Unpack_RLE(b2, b1, unpklen)) return false;
         memcpy(b2, b1, (size_t)unpklen);
         break;
@@ -183,11 +266,11 @@ bool SectorRW_DMS::decompressTrack(uint8_t* b1, uint8_t* b2, uint8_t* text, uint
         /*   Heavy Compression   */
         if (cmode == 5) {
             /*   Heavy 1   */
-            if (Unpack_HEAVY(b1, b2, flags & 7, pklen2, text)) return false;
+            if (Unpack_HEAVY(state, b1, b2, flags & 7, pklen2)) return false;
         }
         else {
             /*   Heavy 2   */
-            if (Unpack_HEAVY(b1, b2, flags | 8, pklen2, text)) return false;
+            if (Unpack_HEAVY(state, b1, b2, flags | 8, pklen2)) return false;
         }
         if (flags & 4) {
             /*  Unpack with RLE only if this flag is set  */
@@ -199,13 +282,13 @@ bool SectorRW_DMS::decompressTrack(uint8_t* b1, uint8_t* b2, uint8_t* text, uint
         return false;
     }
 
-    if (!(flags & 1)) Init_Decrunchers((UCHAR*)text);
+    if (!(flags & 1)) Init_Decrunchers(state);
 
     return true;
 }
 
 // Parse the DMS
-bool SectorRW_DMS::parseDMSHeader(HANDLE fle, uint8_t* b1, uint8_t* b2, uint8_t* text) {
+bool SectorRW_DMS::parseDMSHeader(HANDLE fle, uint8_t* b1) {
     // Read header and validate
     DWORD read;
     if (!ReadFile(fle, b1, HEADLEN, &read, NULL)) return false;
@@ -225,12 +308,99 @@ bool SectorRW_DMS::parseDMSHeader(HANDLE fle, uint8_t* b1, uint8_t* b2, uint8_t*
     // Password required!?
     if (m_geninfo & 2) return false;
 
-    Init_Decrunchers((UCHAR*)text);
-
     return true;
 }
 
 SectorRW_DMS::~SectorRW_DMS() {
+    stopWorkers();
+    quickClose();
+}
+
+// Run work on numDecoders decoders at once, this thread doing its share too. Returns when they've all finished
+void SectorRW_DMS::runOnWorkers(const uint32_t numDecoders, const std::function<void(Decoder&)>& work) {
+    while (m_workers.size() < numDecoders) m_workers.push_back(std::make_unique<Decoder>());
+    {
+        std::lock_guard lock(m_workLock);
+        while (m_workerThreads.size() + 1 < numDecoders) {
+            const uint32_t index = (uint32_t)m_workerThreads.size() + 1;
+            m_workerThreads.emplace_back([this, index]() { workerThread(index); });
+        }
+        m_work = &work;
+        m_workDecoders = numDecoders;
+        m_workPending = numDecoders - 1;
+        m_workGeneration++;
+    }
+    m_workReady.notify_all();
+
+    work(*m_workers[0]);
+
+    std::unique_lock lock(m_workLock);
+    m_workDone.wait(lock, [this]() { return m_workPending == 0; });
+    m_work = nullptr;
+}
+
+// Waits for work for the decoder at index
+void SectorRW_DMS::workerThread(const uint32_t index) {
+    uint32_t generation = 0;
+    std::unique_lock lock(m_workLock);
+    for (;;) {
+        m_workReady.wait(lock, [this, &generation]() { return m_workersQuit || (m_workGeneration != generation); });
+        if (m_workersQuit) return;
+        generation = m_workGeneration;
+        if (index >= m_workDecoders) continue;
+
+        const std::function<void(Decoder&)>& work = *m_work;
+        Decoder& decoder = *m_workers[index];
+        lock.unlock();
+        work(decoder);
+        lock.lock();
+        if (--m_workPending == 0) m_workDone.notify_all();
+    }
+}
+
+// Stop and wait for the worker threads
+void SectorRW_DMS::stopWorkers() {
+    {
+        std::lock_guard lock(m_workLock);
+        m_workersQuit = true;
+    }
+    m_workReady.notify_all();
+    for (std::thread& thread : m_workerThreads) thread.join();
+    m_workerThreads.clear();
+}
+
+// Unpack every track now, checking all of the CRCs and checksums. Returns FALSE if any are damaged
+bool SectorRW_DMS::verifyArchive() {
+    if (!m_validFile) return false;
+
+    // Run through the whole archive in order with a decoder of its own, so readers aren't held up
+    Decoder decoder;
+    for (uint32_t index = 0; index < m_tracks.size(); index++) {
+        bool decoded;
+        if (!unpackTrack(decoder, index, true, decoded)) {
+            std::lock_guard lock(m_integrityLock);
+            m_integrity[index].checked = true;
+        }
+    }
+
+    std::lock_guard lock(m_integrityLock);
+    for (const TrackIntegrity& track : m_integrity)
+        if ((!track.headerOK) || (!track.packedOK) || (!track.unpackedOK)) return false;
+    return true;
+}
+
+// Fetch what's been found out about each track so far
+std::vector<SectorRW_DMS::TrackIntegrity> SectorRW_DMS::getIntegrityReport() {
+    std::lock_guard lock(m_integrityLock);
+    return m_integrity;
+}
+
+// Rapid shutdown
+void SectorRW_DMS::quickClose() {
+    if (m_file != INVALID_HANDLE_VALUE) {
+        CloseHandle(m_file);
+        m_file = INVALID_HANDLE_VALUE;
+    }
 }
 
 bool SectorRW_DMS::isDiskPresent() {
@@ -241,8 +411,95 @@ bool SectorRW_DMS::available() {
     return m_validFile;
 }
 
+// Only called when the sector isn't in the cache, so it gets decoded (again)
 bool SectorRW_DMS::internalReadData(const uint32_t sectorNumber, const uint32_t sectorSize, void* data) {
-    return false;
+    if ((!m_validFile) || (sectorSize > SECTORSIZE)) return false;
+
+    const uint32_t sectorsPerCylinder = 2 * m_sectorsPerTrack;
+    const uint32_t cylinder = sectorNumber / sectorsPerCylinder;
+    if ((cylinder != m_lastCylinder) && (!decodeCylinder(cylinder))) return false;
+
+    const size_t offset = (size_t)(sectorNumber % sectorsPerCylinder) * SECTORSIZE;
+    if (offset + SECTORSIZE > m_lastCylinderData.size()) return false;
+    memcpy_s(data, sectorSize, &m_lastCylinderData[offset], sectorSize);
+    return true;
 }
 
+// Cylinders from different decruncher chains are unpacked in parallel
+bool SectorRW_DMS::internalReadRuns(const std::vector<SectorRun>& runs, const uint32_t sectorSize) {
+    if ((!m_validFile) || (sectorSize > SECTORSIZE)) return false;
+
+    // Group the tracks needed by the chain they're in, in file order
+    const uint32_t sectorsPerCylinder = 2 * m_sectorsPerTrack;
+    std::map<uint32_t, std::vector<uint32_t>> chains;
+    for (const SectorRun& run : runs) {
+        const uint32_t lastCylinder = (run.firstSector + run.count - 1) / sectorsPerCylinder;
+        for (uint32_t cylinder = run.firstSector / sectorsPerCylinder; cylinder <= lastCylinder; cylinder++) {
+            if (cylinder == m_lastCylinder) continue;
+            auto it = m_cylinders.find(cylinder);
+            if (it == m_cylinders.end()) continue;
+            std::vector<uint32_t>& chain = chains[m_tracks[it->second].chainStart];
+            if ((chain.empty()) || (chain.back() < it->second)) chain.push_back(it->second);
+            else if (std::find(chain.begin(), chain.end(), it->second) == chain.end()) {
+                chain.push_back(it->second);
+                std::sort(chain.begin(), chain.end());
+            }
+        }
+    }
 
+    // Nothing to gain unless there's more than one chain
+    if (chains.size() < 2) return readRunsBySector(runs, sectorSize);
+
+    std::vector<const std::vector<uint32_t>*> work;
+    for (const auto& chain : chains) work.push_back(&chain.second);
+    const uint32_t numThreads = min((uint32_t)work.size(), max(1U, std::thread::hardware_concurrency()));
+
+    // Each worker takes whole chains, so the decruncher state never has to move between threads. A damaged track only
+    // stops the rest of its own chain, everything else is still decoded
+    std::vector<std::vector<uint8_t>> trackData(m_tracks.size());
+    std::atomic<size_t> nextChain = 0;
+    runOnWorkers(numThreads, [&](Decoder& decoder) {
+        for (size_t chain = nextChain++; chain < work.size(); chain = nextChain++)
+            for (const uint32_t track : *work[chain])
+                if (!decodeTrack(decoder, track, trackData[track])) break;
+    });
+
+    // Copy the sectors out. Anything that didn't decode is tried again on its own
+    std::vector<SectorRun> retry;
+    for (const SectorRun& run : runs) {
+        for (uint32_t sector = 0; sector < run.count; sector++) {
+            const uint32_t sectorNumber = run.firstSector + sector;
+            const uint32_t cylinder = sectorNumber / sectorsPerCylinder;
+            uint8_t* dest = run.data + ((size_t)sector * sectorSize);
+            const size_t offset = (size_t)(sectorNumber % sectorsPerCylinder) * SECTORSIZE;
+            const std::vector<uint8_t>* source = &m_lastCylinderData;
+            if (cylinder != m_lastCylinder) {
+                auto it = m_cylinders.find(cylinder);
+                source = (it == m_cylinders.end()) ? nullptr : &trackData[it->second];
+            }
+            if ((source) && (offset + SECTORSIZE <= source->size())) memcpy_s(dest, sectorSize, &(*source)[offset], sectorSize);
+            else if ((!retry.empty()) && (retry.back().firstSector + retry.back().count == sectorNumber)) retry.back().count++;
+            else retry.push_back({ sectorNumber, 1, dest });
+        }
+    }
+    return readRunsBySector(retry, sectorSize);
+}
+
+// Read the runs a sector at a time, carrying on past any that can't be read so the rest are still decoded (and cached)
+bool SectorRW_DMS::readRunsBySector(const std::vector<SectorRun>& runs, const uint32_t sectorSize) {
+    const uint32_t sectorsPerCylinder = 2 * m_sectorsPerTrack;
+    uint32_t badCylinder = 0xFFFFFFFF;
+    bool success = true;
+
+    for (const SectorRun& run : runs)
+        for (uint32_t sector = 0; sector < run.count; sector++) {
+            const uint32_t sectorNumber = run.firstSector + sector;
+            // No point decoding a damaged cylinder again for each of its sectors
+            if (sectorNumber / sectorsPerCylinder == badCylinder) continue;
+            if (!internalReadData(sectorNumber, sectorSize, run.data + ((size_t)sector * sectorSize))) {
+                badCylinder = sectorNumber / sectorsPerCylinder;
+                success = false;
+            }
+        }
+    return success;
+}
@@ -17,10 +17,71 @@
 // Handles reading and writing to a file, with sector cache for improved speed
 #include <dokan/dokan.h>
 #include <unordered_map>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <functional>
 #include "sectorCache.h"
 
 class SectorRW_DMS : public SectorCacheEngine {
+public:
+    // Result of checking one track in the archive
+    struct TrackIntegrity {
+        uint16_t cylinder;
+        bool headerOK;          // Track header CRC matched
+        bool checked;           // Track data has been read and checked
+        bool packedOK;          // Packed data CRC matched
+        bool unpackedOK;        // Unpacked without error, and the checksum matched if verifying
+    };
+
 private:
+    // Where each track is in the file and how to unpack it
+    struct TrackIndex {
+        uint32_t filePos;       // Where the packed data starts
+        uint16_t cylinder;
+        uint16_t pklen1;        // Length of packed track data as in archive
+        uint16_t pklen2;        // Length of data after first unpacking
+        uint16_t unpklen;       // Length of data after subsequent rle unpacking
+        uint16_t dcrc;          // Track Data CRC BEFORE unpacking
+        uint16_t usum;          // Track Data CheckSum AFTER unpacking
+        uint8_t flags;
+        uint8_t cmode;
+        uint32_t chainStart;    // The decrunchers carry state from track to track, so decoding has to start from this track
+    };
+
+    // Decruncher state and buffers, one per thread unpacking at once
+    struct Decoder;
+
+    HANDLE m_file;
+    std::mutex m_fileLock;
+    std::vector<TrackIndex> m_tracks;
+    // Index into m_tracks for each cylinder
+    std::unordered_map<uint32_t, uint32_t> m_cylinders;
+    // Used for single cylinder requests
+    std::unique_ptr<Decoder> m_decoder;
+    // Used when several chains are decoded in parallel. The first is used by the thread asking, the rest by m_workerThreads
+    std::vector<std::unique_ptr<Decoder>> m_workers;
+    // Threads kept running to unpack chains, started the first time they're needed. Protected by m_workLock
+    std::vector<std::thread> m_workerThreads;
+    std::mutex m_workLock;
+    std::condition_variable m_workReady;
+    std::condition_variable m_workDone;
+    const std::function<void(Decoder&)>* m_work = nullptr;
+    uint32_t m_workGeneration = 0;      // Changes each time there's new work
+    uint32_t m_workDecoders = 0;        // How many of m_workers the current work needs
+    uint32_t m_workPending = 0;         // Threads that haven't finished the current work yet
+    bool m_workersQuit = false;
+    // Check the unpacked checksum of each track as it's decoded
+    bool m_verify = false;
+    // What's been found out about each track, in the same order as m_tracks
+    std::mutex m_integrityLock;
+    std::vector<TrackIntegrity> m_integrity;
+    // The most recently requested cylinder, so the rest of its sectors don't need decoding again
+    uint32_t m_lastCylinder = 0xFFFFFFFF;
+    std::vector<uint8_t> m_lastCylinderData;
+
     uint64_t m_diskSize = 0;
     uint16_t m_diskType = 0; // type of archive
     uint16_t m_geninfo = 0; // flags
@@ -28,12 +89,29 @@ private:
     uint32_t m_totalTracks = 0;
     bool m_validFile = false;
     
-    bool parseDMSHeader(HANDLE fle, uint8_t* b1, uint8_t* b2, uint8_t* text);
-    bool unpackCylinders(HANDLE fle, uint8_t* b1, uint8_t* b2, uint8_t* text);
-    bool decompressTrack(uint8_t* b1, uint8_t* b2, uint8_t* text, uint16_t pklen2, uint16_t unpklen, uint16_t cmode, uint16_t flags);
+    bool parseDMSHeader(HANDLE fle, uint8_t* buffer);
+    // Read just the track headers, recording where each track is and how it's packed
+    bool buildTrackIndex();
+    // Read and unpack one track into the decoder's b2, returns FALSE if it couldn't be read. decoded is set if there's data
+    bool unpackTrack(Decoder& decoder, const uint32_t index, const bool verify, bool& decoded);
+    // Decode track 'target' into data, along with anything in its chain that has to be decoded before it
+    bool decodeTrack(Decoder& decoder, const uint32_t target, std::vector<uint8_t>& data);
+    // Decode the cylinder into m_lastCylinderData
+    bool decodeCylinder(const uint32_t cylinder);
+    bool decompressTrack(Decoder& decoder, uint16_t pklen2, uint16_t unpklen, uint16_t cmode, uint16_t flags);
+    // Read the runs a sector at a time, carrying on past any that can't be read
+    bool readRunsBySector(const std::vector<SectorRun>& runs, const uint32_t sectorSize);
+    // Run work on numDecoders decoders at once, this thread doing its share too. Returns when they've all finished
+    void runOnWorkers(const uint32_t numDecoders, const std::function<void(Decoder&)>& work);
+    // Waits for work for the decoder at index
+    void workerThread(const uint32_t index);
+    // Stop and wait for the worker threads
+    void stopWorkers();
     
 protected:
     virtual bool internalReadData(const uint32_t sectorNumber, const uint32_t sectorSize, void* data) override;
+    // Cylinders from different decruncher chains are unpacked in parallel
+    virtual bool internalReadRuns(const std::vector<SectorRun>& runs, const uint32_t sectorSize) override;
     virtual bool internalWriteData(const uint32_t sectorNumber, const uint32_t sectorSize, const void* data) override { return false; };
 
 public:
@@ -72,6 +150,13 @@ public:
     virtual bool available() override;
 
     // Raid shutdown to release resource
-    virtual void quickClose() override {};
+    virtual void quickClose() override;
+
+    // Check the unpacked checksum of every track as it's decoded, treating tracks that fail as unreadable
+    void setVerify(const bool enable) { m_verify = enable; };
+    // Unpack every track now, checking all of the CRCs and checksums. Returns FALSE if any are damaged
+    bool verifyArchive();
+    // Fetch what's been found out about each track so far
+    std::vector<TrackIntegrity> getIntegrityReport();
 
 };
@@ -116,6 +116,7 @@ SectorRW_File::SectorRW_File(const std::wstring& filename, HANDLE fle) : SectorC
             m_fileType = SectorType::stAtari;
             m_serialNumber = 0x4D534120;
             m_mode = SectorMode::smMSA;
+            buildMSAIndex();
         }
 
         if ((m_fileType == SectorType::stIBM) || (m_fileType == SectorType::stAtari)) {
@@ -134,53 +135,176 @@ SectorRW_File::SectorRW_File(const std::wstring& filename, HANDLE fle) : SectorC
 
     if (!m_sectorsPerTrack) m_sectorsPerTrack = SectorRW_File::GuessSectorsPerTrackFromImageSize(GetFileSize(fle, NULL));
     if (!m_totalTracks) m_totalTracks = m_sectorsPerTrack ? (GetFileSize(fle, NULL) / m_sectorsPerTrack) / m_bytesPerSector : 80;
+
+    // Tracks decoded while working out the geometry might have been decoded with the wrong size
+    m_decodedTracks.clear();
+}
+
+// Find where each track is in the MSA file by reading just the length before each one
+void SectorRW_File::buildMSAIndex() {
+    m_trackIndex.clear();
+    m_trackIndex.reserve(m_totalTracks);
+    uint32_t seekPos = sizeof(ATARTST_MSA_Header);
+
+    for (uint32_t track = 0; track < m_totalTracks; track++) {
+        if (SetFilePointer(m_file, seekPos, NULL, FILE_BEGIN) == INVALID_SET_FILE_POINTER) return;
+        uint16_t dataSize;
+        DWORD read;
+        if (!ReadFile(m_file, &dataSize, sizeof(dataSize), &read, NULL)) read = 0;
+        if (read != sizeof(dataSize)) return;
+
+        TrackIndex index;
+        index.dataSize = BYTESWAP(dataSize);
+        index.seekPos = seekPos + sizeof(dataSize);
+        m_trackIndex.push_back(index);
+        seekPos = index.seekPos + index.dataSize;
+    }
 }
 
-// Decode the track from this point in the file
-bool SectorRW_File::decodeMSATrack(DecodedTrack& track) {
+// Decode a track from the MSA file
+bool SectorRW_File::decodeMSATrack(const TrackIndex& index, std::vector<uint8_t>& data) {
     const uint32_t uncompressedTrackSize = m_bytesPerSector * m_sectorsPerTrack;
     DWORD read;
+    if (SetFilePointer(m_file, index.seekPos, NULL, FILE_BEGIN) == INVALID_SET_FILE_POINTER) return false;
 
     // Read in the data
-    if (track.dataSize == uncompressedTrackSize) {
+    if (index.dataSize == uncompressedTrackSize) {
         // Read straight in, its not compressed
-        track.data.resize(uncompressedTrackSize);
-        if (!ReadFile(m_file, &track.data[0], track.dataSize, &read, NULL)) read = 0;
-        return read == track.dataSize;
+        data.resize(uncompressedTrackSize);
+        if (!ReadFile(m_file, &data[0], index.dataSize, &read, NULL)) read = 0;
+        return read == index.dataSize;
     }
-    else {
-        // Read in, and then decompress it
-        std::vector<uint8_t> temp;
-        temp.resize(track.dataSize);
-        if (!ReadFile(m_file, (LPVOID)&temp[0], track.dataSize, &read, NULL)) read = 0;
-        if (read != track.dataSize) return false;
-
-        // Decode the data
-        for (size_t pos = 0; pos < temp.size(); pos++) {
-            if (temp[pos] == 0xE5) {
-                // Decompress - basic RLE
-                uint16_t numBytes = (temp[pos + 2] << 8) | temp[pos + 3];
-                size_t currentSize = track.data.size();
-                track.data.resize(currentSize + numBytes);
-                memset(&track.data[currentSize], temp[pos + 1], numBytes);
-                pos += 3;
-            }
-            else track.data.push_back(temp[pos]);
+
+    // Read in, and then decompress it
+    std::vector<uint8_t> temp;
+    temp.resize(index.dataSize);
+    if (!ReadFile(m_file, (LPVOID)temp.data(), index.dataSize, &read, NULL)) read = 0;
+    if (read != index.dataSize) return false;
+
+    // Decode the data - basic RLE. The output size is known so it's written straight into place
+    data.resize(uncompressedTrackSize);
+    size_t out = 0;
+    size_t pos = 0;
+    while ((pos < temp.size()) && (out < uncompressedTrackSize)) {
+        if (temp[pos] == 0xE5) {
+            if (pos + 3 >= temp.size()) return false;
+            const size_t numBytes = min((size_t)((temp[pos + 2] << 8) | temp[pos + 3]), uncompressedTrackSize - out);
+            memset(&data[out], temp[pos + 1], numBytes);
+            out += numBytes;
+            pos += 4;
+        }
+        else {
+            // Copy up to the next run in one go
+            const uint8_t* runStart = &temp[pos];
+            const uint8_t* runEnd = (const uint8_t*)memchr(runStart, 0xE5, temp.size() - pos);
+            const size_t numBytes = min((size_t)(runEnd ? runEnd - runStart : temp.size() - pos), uncompressedTrackSize - out);
+            memcpy_s(&data[out], uncompressedTrackSize - out, runStart, numBytes);
+            out += numBytes;
+            pos += numBytes;
+        }
+    }
+
+    return out >= uncompressedTrackSize;
+}
+
+// Return the decoded track, decoding it if it isn't in m_decodedTracks already
+const std::vector<uint8_t>* SectorRW_File::getMSATrack(const uint32_t track) {
+    for (auto it = m_decodedTracks.begin(); it != m_decodedTracks.end(); ++it)
+        if (it->track == track) {
+            if (it != m_decodedTracks.begin()) m_decodedTracks.splice(m_decodedTracks.begin(), m_decodedTracks, it);
+            return &m_decodedTracks.front().data;
         }
 
-        return track.data.size() >= uncompressedTrackSize;
+    if ((track < m_firstTrack) || (track - m_firstTrack >= m_trackIndex.size())) return nullptr;
+
+    // Re-use the oldest one once there are enough
+    if (m_decodedTracks.size() >= MSA_TRACK_CACHE) m_decodedTracks.splice(m_decodedTracks.begin(), m_decodedTracks, --m_decodedTracks.end());
+    else m_decodedTracks.emplace_front();
+
+    DecodedTrack& decoded = m_decodedTracks.front();
+    decoded.track = track;
+    if (!decodeMSATrack(m_trackIndex[track - m_firstTrack], decoded.data)) {
+        m_decodedTracks.pop_front();
+        return nullptr;
+    }
+    return &decoded.data;
+}
+
+// Switch to reading and writing the file through a memory mapped view rather than the sector cache
+bool SectorRW_File::enableMemoryMapping() {
+    // Only plain images can be mapped. MSA is compressed
+    if ((m_mode != SectorMode::smNormal) || (m_file == INVALID_HANDLE_VALUE) || (m_mapView)) return false;
+
+    LARGE_INTEGER size;
+    if ((!GetFileSizeEx(m_file, &size)) || (size.QuadPart <= 0)) return false;
+    // Too big for the address space (32-bit builds) so leave it to normal file access
+    if ((uint64_t)size.QuadPart > (uint64_t)SIZE_MAX) return false;
+
+    // The file might only have been opened for reading
+    m_mapping = CreateFileMapping(m_file, NULL, PAGE_READWRITE, 0, 0, NULL);
+    m_mapWritable = m_mapping != NULL;
+    if (!m_mapping) m_mapping = CreateFileMapping(m_file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!m_mapping) return false;
+
+    m_mapView = (uint8_t*)MapViewOfFile(m_mapping, m_mapWritable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, 0);
+    if (!m_mapView) {
+        CloseHandle(m_mapping);
+        m_mapping = NULL;
+        return false;
+    }
+    m_mapSize = (uint64_t)size.QuadPart;
+
+    // Reads now come straight from the mapping, so there's no point keeping another copy
+    disableCache();
+    return true;
+}
+
+// Copy memory to/from the mapped file.  If the file can't be paged in (eg: the drive its on vanished) Windows raises an exception rather than failing
+static bool safeMappedCopy(void* dest, const void* src, const size_t size) {
+    __try {
+        memcpy(dest, src, size);
+        return true;
+    }
+    __except (GetExceptionCode() == EXCEPTION_IN_PAGE_ERROR ? EXCEPTION_EXECUTE_HANDLER : EXCEPTION_CONTINUE_SEARCH) {
+        return false;
     }
+}
 
+// Copy data out of the mapped file
+bool SectorRW_File::mappedRead(const uint64_t offset, const uint32_t size, void* data) {
+    if (offset + size > m_mapSize) return false;
+    return safeMappedCopy(data, m_mapView + offset, size);
+}
 
-    return false;
+// Copy data into the mapped file
+bool SectorRW_File::mappedWrite(const uint64_t offset, const uint32_t size, const void* data) {
+    if ((!m_mapWritable) || (offset + size > m_mapSize)) return false;
+    return safeMappedCopy(m_mapView + offset, data, size);
+}
+
+// Flush changes to disk
+bool SectorRW_File::flushWriteCache() {
+    bool success = SectorCacheEngine::flushWriteCache();
+    if ((m_mapView) && (m_mapWritable)) success &= FlushViewOfFile(m_mapView, 0) != 0;
+    return success;
 }
 
 SectorRW_File::~SectorRW_File() {
+    setReadAhead(false, 0, 0);
+    flushWriteCache();
     quickClose();
 }
 
 // Rapid shutdown
 void SectorRW_File::quickClose() {
+    if (m_mapView) {
+        UnmapViewOfFile(m_mapView);
+        m_mapView = nullptr;
+    }
+    if (m_mapping) {
+        CloseHandle(m_mapping);
+        m_mapping = NULL;
+    }
     if (m_file != INVALID_HANDLE_VALUE) {
         CloseHandle(m_file);
         m_file = INVALID_HANDLE_VALUE;
@@ -215,6 +339,7 @@ bool SectorRW_File::internalReadData(const uint32_t sectorNumber, const uint32_t
     case SectorMode::smNormal: {
             LARGE_INTEGER pos;
             pos.QuadPart = (uint64_t)sectorNumber * (uint64_t)sectorSize;
+            if (m_mapView) return mappedRead(pos.QuadPart, sectorSize, data);
             if (SetFilePointerEx(m_file, pos, NULL, FILE_BEGIN) == INVALID_SET_FILE_POINTER) return false;
             if (!ReadFile(m_file, data, sectorSize, &read, NULL)) return false;
         }
@@ -222,42 +347,13 @@ bool SectorRW_File::internalReadData(const uint32_t sectorNumber, const uint32_t
 
     case SectorMode::smMSA: 
     {
-        uint32_t trackSeek = sectorNumber / m_sectorsPerTrack;
-        auto i = m_trackSearch.find(trackSeek);
-        if (i == m_trackSearch.end()) {
-            // Search for it. 
-            uint32_t startSeekPos = sizeof(ATARTST_MSA_Header);
-            uint32_t track = m_firstTrack;
-
-            if (m_trackSearch.size()) {
-                // Kickstart the search point rather than start from the first track we'll skip past the highest found so far
-                auto trk = --m_trackSearch.end();
-                track = trk->first + 1;
-                startSeekPos = trk->second.seekPos + trk->second.dataSize;
-            }
-            if (SetFilePointer(m_file, startSeekPos, NULL, FILE_BEGIN) == INVALID_SET_FILE_POINTER) return false;
-
-            while (track <= trackSeek) {
-                DecodedTrack newTrack;
-                DWORD read;
-                if (!ReadFile(m_file, &newTrack.dataSize, sizeof(newTrack.dataSize), &read, NULL)) read = 0;
-                if (read != sizeof(newTrack.dataSize)) return false;
-                newTrack.dataSize = BYTESWAP(newTrack.dataSize);  // byte swap
-                startSeekPos += sizeof(newTrack.dataSize);
-                newTrack.seekPos = startSeekPos;
-                if (!decodeMSATrack(newTrack)) return false;
-
-                // Save the data
-                m_trackSearch.insert(std::pair(track, newTrack));
-                track++;
-            }
-            i = m_trackSearch.find(trackSeek);
-            if (i == m_trackSearch.end()) return false;
-        }
+        const std::vector<uint8_t>* track = getMSATrack(sectorNumber / m_sectorsPerTrack);
+        if (!track) return false;
+
         // If we get here then the track exists and we can just pull the data out
         uint32_t memPos = (sectorNumber % m_sectorsPerTrack) * sectorSize;
-        if (memPos + sectorSize > i->second.data.size()) return false;
-        memcpy_s(data, sectorSize, &i->second.data[memPos], sectorSize);
+        if (memPos + sectorSize > track->size()) return false;
+        memcpy_s(data, sectorSize, track->data() + memPos, sectorSize);
         return true;
     }
     break;
@@ -271,6 +367,7 @@ bool SectorRW_File::internalWriteData(const uint32_t sectorNumber, const uint32_
 
     switch (m_mode) {
     case SectorMode::smNormal:
+        if (m_mapView) return mappedWrite((uint64_t)sectorNumber * (uint64_t)sectorSize, sectorSize, data);
         if (SetFilePointer(m_file, sectorNumber * sectorSize, NULL, FILE_BEGIN) == INVALID_SET_FILE_POINTER) return false;
         if (!WriteFile(m_file, data, sectorSize, &write, NULL)) return false;
         return write == sectorSize;
@@ -280,3 +377,31 @@ bool SectorRW_File::internalWriteData(const uint32_t sectorNumber, const uint32_
     }
 }
 
+// Read a run of sectors with a single read
+bool SectorRW_File::internalReadSectors(const uint32_t firstSector, const uint32_t count, const uint32_t sectorSize, void* data) {
+    if (m_mode != SectorMode::smNormal) return SectorCacheEngine::internalReadSectors(firstSector, count, sectorSize, data);
+
+    const DWORD totalSize = count * sectorSize;
+    DWORD read = 0;
+    LARGE_INTEGER pos;
+    pos.QuadPart = (uint64_t)firstSector * (uint64_t)sectorSize;
+    if (m_mapView) return mappedRead(pos.QuadPart, totalSize, data);
+    if (!SetFilePointerEx(m_file, pos, NULL, FILE_BEGIN)) return false;
+    if (!ReadFile(m_file, data, totalSize, &read, NULL)) return false;
+    return read == totalSize;
+}
+
+// Write a run of sectors with a single write
+bool SectorRW_File::internalWriteSectors(const uint32_t firstSector, const uint32_t count, const uint32_t sectorSize, const void* data) {
+    if (m_mode != SectorMode::smNormal) return false;
+
+    const DWORD totalSize = count * sectorSize;
+    DWORD write = 0;
+    LARGE_INTEGER pos;
+    pos.QuadPart = (uint64_t)firstSector * (uint64_t)sectorSize;
+    if (m_mapView) return mappedWrite(pos.QuadPart, totalSize, data);
+    if (!SetFilePointerEx(m_file, pos, NULL, FILE_BEGIN)) return false;
+    if (!WriteFile(m_file, data, totalSize, &write, NULL)) return false;
+    return write == totalSize;
+}
+
@@ -18,7 +18,7 @@
 #include <dokan/dokan.h>
 #include <unordered_map>
 #include "sectorCache.h"
-#include <map>
+#include <list>
 
 class SectorRW_File : public SectorCacheEngine {
 private:
@@ -26,13 +26,26 @@ private:
                      smMSA  // MSA Compressed disk image
     };
 
-    struct DecodedTrack {
+    // Most MSA tracks kept decoded at once
+    static constexpr uint32_t MSA_TRACK_CACHE = 16;
+
+    // Where each MSA track is in the file
+    struct TrackIndex {
         uint32_t seekPos;   // Where the actual data starts
         uint16_t dataSize;
+    };
+
+    struct DecodedTrack {
+        uint32_t track;
         std::vector<uint8_t> data;
     };
 
     HANDLE m_file;
+    // Memory mapped view of the whole file, if enabled
+    HANDLE m_mapping = NULL;
+    uint8_t* m_mapView = nullptr;
+    uint64_t m_mapSize = 0;
+    bool m_mapWritable = false;
     uint32_t m_sectorsPerTrack;
     SectorType m_fileType;
     uint32_t m_serialNumber;
@@ -42,18 +55,36 @@ private:
     uint32_t m_numHeads;
     SectorMode m_mode;
 
-    // MAP as I want the track numbers in order
-    std::map<uint32_t, DecodedTrack> m_trackSearch;
+    // Index of the MSA tracks, built when the file is opened.  Entry 0 is m_firstTrack
+    std::vector<TrackIndex> m_trackIndex;
+    // Recently decoded MSA tracks, most recently used first
+    std::list<DecodedTrack> m_decodedTracks;
 protected:
     virtual bool internalReadData(const uint32_t sectorNumber, const uint32_t sectorSize, void* data) override;
     virtual bool internalWriteData(const uint32_t sectorNumber, const uint32_t sectorSize, const void* data) override;
-
-    // Decode the track from this point in the file
-    bool decodeMSATrack(DecodedTrack& track);
+    virtual bool internalReadSectors(const uint32_t firstSector, const uint32_t count, const uint32_t sectorSize, void* data) override;
+    virtual bool internalWriteSectors(const uint32_t firstSector, const uint32_t count, const uint32_t sectorSize, const void* data) override;
+
+    // Find where each track is in the MSA file by reading just the length before each one
+    void buildMSAIndex();
+    // Decode a track from the MSA file
+    bool decodeMSATrack(const TrackIndex& index, std::vector<uint8_t>& data);
+    // Return the decoded track, decoding it if it isn't in m_decodedTracks already
+    const std::vector<uint8_t>* getMSATrack(const uint32_t track);
+
+    // Copy data in/out of the mapped file
+    bool mappedRead(const uint64_t offset, const uint32_t size, void* data);
+    bool mappedWrite(const uint64_t offset, const uint32_t size, const void* data);
 public:
     SectorRW_File(const std::wstring& filename, HANDLE fle);
     ~SectorRW_File();
 
+    // Switch to reading and writing the file through a memory mapped view rather than the sector cache. Returns FALSE if it can't be mapped
+    bool enableMemoryMapping();
+
+    // Flush changes to disk
+    virtual bool flushWriteCache() override;
+
     virtual bool isDiskPresent() override;
     virtual bool isDiskWriteProtected() override;
 
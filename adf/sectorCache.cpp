@@ -14,86 +14,571 @@
 
 
 #include "sectorCache.h"
+#include <algorithm>
 
 
-// Get oldest sector we've cached and remove it, but don't free it!
-SectorCacheEngine::SectorData* SectorCacheEngine::getAndReleaseOldestSector() {
-    SectorData* result = nullptr;
-    uint32_t sectorNumber = 0;
+// Wait for the device. position is where on the disk the request is going, or ANY_POSITION
+void ElevatorLock::lock(const uint32_t position) {
+    std::unique_lock lock(m_lock);
+    if (!m_busy) {
+        m_busy = true;
+        if (position != ANY_POSITION) m_position = position;
+        return;
+    }
 
-    for (auto cache : m_cache)
-        if ((!result) || (cache.second->lastUse < result->lastUse)) {
-            result = cache.second;
-            sectorNumber = cache.first;
-        }
-    if (!result) return nullptr;
+    Waiter waiter = { position, 0, false };
+    m_waiters.push_back(&waiter);
+    m_granted.wait(lock, [&waiter]() { return waiter.granted; });
+}
 
-    m_cache.erase(sectorNumber);
-    return result;
+// Take the device only if nobody is using it or waiting for it
+bool ElevatorLock::try_lock() {
+    std::lock_guard lock(m_lock);
+    if (m_busy) return false;
+    m_busy = true;
+    return true;
 }
 
+// Finished with the device, hand it straight to whoever should go next
+void ElevatorLock::unlock() {
+    std::lock_guard lock(m_lock);
+    if (m_waiters.empty()) {
+        m_busy = false;
+        return;
+    }
 
-// Write data to the cache
-void SectorCacheEngine::writeCache(const uint32_t sectorNumber, const uint32_t sectorSize, const void* data) {
-    if (!m_cacheMaxMem) return;
-
-    auto f = m_cache.find(sectorNumber);
-    SectorData* secData;
-
-    if (f == m_cache.end()) {
-        if (m_maxCacheEntries == 0) m_maxCacheEntries = m_cacheMaxMem / sectorSize; // approx
-
-        // If cache size is ZERO it means cache everything
-        if (m_cache.size() > m_maxCacheEntries) {
-            secData = getAndReleaseOldestSector();
-            if (!secData) return;
-            if (secData->sectorSize != sectorSize) {
-                free(secData->data);
-                secData->data = malloc(sectorSize);
-                secData->sectorSize = sectorSize;
-            }
+    // Anything without a position, or that has been overtaken too often, goes first, oldest first
+    size_t next = m_waiters.size();
+    for (size_t i = 0; i < m_waiters.size(); i++)
+        if ((m_waiters[i]->position == ANY_POSITION) || (m_waiters[i]->passes >= MAX_PASSES)) {
+            next = i;
+            break;
+        }
+
+    // Otherwise the nearest at or beyond where the last one was, or if there's nothing further along, the lowest
+    if (next == m_waiters.size()) {
+        size_t lowest = 0;
+        for (size_t i = 0; i < m_waiters.size(); i++) {
+            const uint32_t position = m_waiters[i]->position;
+            if (position < m_waiters[lowest]->position) lowest = i;
+            if ((position >= m_position) && ((next == m_waiters.size()) || (position < m_waiters[next]->position))) next = i;
         }
-        else {
-            secData = new SectorData();
-            if (!secData) return;
-            secData->data = malloc(sectorSize);
-            secData->sectorSize = sectorSize;
-            if (!secData->data) {
-                delete secData;
-                return;
+        if (next == m_waiters.size()) next = lowest;
+    }
+
+    // Everything that was waiting longer has just been overtaken
+    Waiter* waiter = m_waiters[next];
+    for (size_t i = 0; i < next; i++) m_waiters[i]->passes++;
+    m_waiters.erase(m_waiters.begin() + next);
+
+    if (waiter->position != ANY_POSITION) m_position = waiter->position;
+    waiter->granted = true;
+    m_granted.notify_all();
+}
+
+// Number of requests waiting for the device
+size_t ElevatorLock::numWaiting() {
+    std::lock_guard lock(m_lock);
+    return m_waiters.size();
+}
+
+// Prepare the cache for sectors of this size, returns FALSE if they cant be cached
+bool SectorCacheEngine::prepareCache(const uint32_t sectorSize) {
+    if (!m_cacheMaxMem) return false;
+
+    if (!m_slotSize) {
+        if ((!sectorSize) || (sectorSize > m_cacheMaxMem)) return false;
+        m_slotSize = sectorSize;
+        m_maxCacheEntries = m_cacheMaxMem / sectorSize;
+        resizeBuckets();
+        m_slots.reserve(m_maxCacheEntries);
+    }
+
+    // Anything bigger than the slot size just doesnt get cached
+    return sectorSize <= m_slotSize;
+}
+
+// Find the slot holding a sector, or INVALID_SLOT
+uint32_t SectorCacheEngine::findSlot(const uint32_t sectorNumber) {
+    if (m_buckets.empty()) return INVALID_SLOT;
+
+    uint32_t slot = m_buckets[sectorNumber & m_bucketMask];
+    while ((slot != INVALID_SLOT) && (m_slots[slot].sectorNumber != sectorNumber))
+        slot = m_slots[slot].hashNext;
+    return slot;
+}
+
+// Add a slot to the hash bucket for its sector
+void SectorCacheEngine::linkHash(const uint32_t slot) {
+    uint32_t& bucket = m_buckets[m_slots[slot].sectorNumber & m_bucketMask];
+    m_slots[slot].hashNext = bucket;
+    bucket = slot;
+}
+
+// Size the hash buckets to suit m_maxCacheEntries and re-add everything cached
+void SectorCacheEngine::resizeBuckets() {
+    // Buckets are a power of two so we can just mask the sector number
+    uint32_t numBuckets = 1;
+    while (numBuckets < m_maxCacheEntries) numBuckets <<= 1;
+    m_buckets.assign(numBuckets, INVALID_SLOT);
+    m_bucketMask = numBuckets - 1;
+
+    for (uint32_t list = clProbation; list <= clProtected; list++)
+        for (uint32_t slot = m_lruHead[list]; slot != INVALID_SLOT; slot = m_slots[slot].lruNext)
+            linkHash(slot);
+}
+
+// Remove a slot from the hash bucket its in
+void SectorCacheEngine::unlinkHash(const uint32_t slot) {
+    uint32_t* link = &m_buckets[m_slots[slot].sectorNumber & m_bucketMask];
+    while (*link != slot) link = &m_slots[*link].hashNext;
+    *link = m_slots[slot].hashNext;
+    m_slots[slot].hashNext = INVALID_SLOT;
+}
+
+// Remove a slot from the LRU list its on
+void SectorCacheEngine::unlinkLRU(const uint32_t slot) {
+    CacheSlot& s = m_slots[slot];
+    if (s.lruPrev != INVALID_SLOT) m_slots[s.lruPrev].lruNext = s.lruNext; else m_lruHead[s.list] = s.lruNext;
+    if (s.lruNext != INVALID_SLOT) m_slots[s.lruNext].lruPrev = s.lruPrev; else m_lruTail[s.list] = s.lruPrev;
+    s.lruPrev = INVALID_SLOT;
+    s.lruNext = INVALID_SLOT;
+    m_lruCount[s.list]--;
+}
+
+// Add a slot to the front (most recently used) of an LRU list
+void SectorCacheEngine::linkLRUHead(const uint32_t slot, const CacheList list) {
+    CacheSlot& s = m_slots[slot];
+    s.list = list;
+    s.lruPrev = INVALID_SLOT;
+    s.lruNext = m_lruHead[list];
+    if (m_lruHead[list] != INVALID_SLOT) m_slots[m_lruHead[list]].lruPrev = slot; else m_lruTail[list] = slot;
+    m_lruHead[list] = slot;
+    m_lruCount[list]++;
+}
+
+// Get a slot to store a new sector in, evicting the oldest if needed
+uint32_t SectorCacheEngine::allocateSlot() {
+    // Re-use a slot that was released
+    if (m_freeSlots != INVALID_SLOT) {
+        const uint32_t slot = m_freeSlots;
+        m_freeSlots = m_slots[slot].hashNext;
+        m_slots[slot].hashNext = INVALID_SLOT;
+        return slot;
+    }
+
+    // Grow the arena until we reach the limit
+    if (m_slots.size() < m_maxCacheEntries) {
+        const uint32_t slot = (uint32_t)m_slots.size();
+        if ((slot >= m_arenaSlots) && (!growArena())) return INVALID_SLOT;
+        m_slots.push_back({ 0, 0, INVALID_SLOT, INVALID_SLOT, INVALID_SLOT, false, clProbation, false });
+        return slot;
+    }
+
+    // Otherwise re-use the least useful one
+    return evictSlot();
+}
+
+// Make room in the arena for another slot, returns FALSE if out of memory
+bool SectorCacheEngine::growArena() {
+    // Slabs are SLOTS_PER_SLAB in size, except the last which is only as big as the limit allows
+    const uint32_t slabSlots = min(SLOTS_PER_SLAB, m_maxCacheEntries - m_arenaSlots);
+    if (!slabSlots) return false;
+
+    uint8_t* slab = new (std::nothrow) uint8_t[(size_t)slabSlots * m_slotSize];
+    if (!slab) return false;
+    m_slabs.emplace_back(slab);
+    m_arenaSlots += slabSlots;
+    return true;
+}
+
+// Remove the least useful clean sector from the cache. Returns its slot or INVALID_SLOT if everything is dirty
+uint32_t SectorCacheEngine::evictSlot() {
+    // Take the least recently used one, from probation unless it has shrunk below its share
+    CacheList list = (m_lruCount[clProbation] > (m_maxCacheEntries * PROBATION_PERCENT) / 100) ? clProbation : clProtected;
+    for (uint32_t attempt = 0; attempt < 2; attempt++, list = (list == clProbation) ? clProtected : clProbation) {
+        // Dirty sectors can't be written out from here as the cache is locked, so they wait for flushDirtySectors. They go back to
+        // the head of the list so the next eviction doesn't have to step over them again
+        for (uint32_t count = m_lruCount[list]; count; count--) {
+            const uint32_t slot = m_lruTail[list];
+            unlinkLRU(slot);
+            if (m_slots[slot].dirty) linkLRUHead(slot, list);
+            else {
+                unlinkHash(slot);
+                return slot;
             }
         }
-        m_cache.insert(std::make_pair(sectorNumber, secData));
+    }
+    return INVALID_SLOT;
+}
+
+// Remove a sector from the cache if its there
+void SectorCacheEngine::removeSector(const uint32_t sectorNumber) {
+    const uint32_t slot = findSlot(sectorNumber);
+    if (slot == INVALID_SLOT) return;
+
+    if (m_slots[slot].dirty) {
+        m_slots[slot].dirty = false;
+        m_dirtyBytes -= m_slots[slot].dataSize;
+    }
+    unlinkLRU(slot);
+    unlinkHash(slot);
+    m_slots[slot].hashNext = m_freeSlots;
+    m_freeSlots = slot;
+}
+
+// Store a sector in the cache, returns FALSE if it couldn't be. m_cacheLock must be held, and m_multithreadLock too if write back mode is enabled
+bool SectorCacheEngine::storeSector(const uint32_t sectorNumber, const uint32_t sectorSize, const void* data, const bool dirty, const CachePriority priority) {
+    if (!prepareCache(sectorSize)) {
+        // Make sure we dont leave an out of date copy behind
+        removeSector(sectorNumber);
+        return false;
+    }
+
+    // New sectors start on probation, metadata goes straight to the protected list
+    CacheList list = (priority == CachePriority::cpMetadata) ? clProtected : clProbation;
+    uint32_t slot = findSlot(sectorNumber);
+    if (slot == INVALID_SLOT) {
+        slot = allocateSlot();
+        if (slot == INVALID_SLOT) return false;
+
+        CacheSlot& s = m_slots[slot];
+        s.sectorNumber = sectorNumber;
+        s.readAhead = priority == CachePriority::cpReadAhead;
+        linkHash(slot);
     }
     else {
-        secData = f->second;
+        if (m_slots[slot].list == clProtected) list = clProtected;
+        unlinkLRU(slot);
     }
 
     // Make a copy
-    memcpy_s(secData->data, sectorSize, data, sectorSize);
-    secData->lastUse = GetTickCount64();
+    CacheSlot& s = m_slots[slot];
+    if (s.dirty) m_dirtyBytes -= s.dataSize;
+    memcpy_s(slotData(slot), m_slotSize, data, sectorSize);
+    s.dataSize = sectorSize;
+    s.dirty = dirty;
+    if (dirty) m_dirtyBytes += sectorSize;
+    linkLRUHead(slot, list);
+    return true;
 }
 
-// Read data from the cache
-bool SectorCacheEngine::readCache(const uint32_t sectorNumber, const uint32_t sectorSize, void* data) {
+// Store a sector just read from the device. If the cache has a newer unwritten copy, that is copied into data instead
+void SectorCacheEngine::storeReadSector(const uint32_t sectorNumber, const uint32_t sectorSize, void* data, const CachePriority priority) {
+    const uint32_t slot = findSlot(sectorNumber);
+    if ((slot != INVALID_SLOT) && (m_slots[slot].dirty)) {
+        memcpy_s(data, sectorSize, slotData(slot), min(sectorSize, m_slots[slot].dataSize));
+        return;
+    }
+    storeSector(sectorNumber, sectorSize, data, false, priority);
+}
+
+// Copy any unwritten sectors in this range over the data
+void SectorCacheEngine::overlayDirtySectors(const uint32_t firstSector, const uint32_t count, const uint32_t sectorSize, void* data) {
+    if (!m_dirtyBytes) return;
+
+    uint8_t* buffer = (uint8_t*)data;
+    std::lock_guard cacheLock(m_cacheLock);
+    for (uint32_t index = 0; index < count; index++) {
+        const uint32_t slot = findSlot(firstSector + index);
+        if ((slot != INVALID_SLOT) && (m_slots[slot].dirty))
+            memcpy_s(buffer + ((size_t)index * sectorSize), sectorSize, slotData(slot), min(sectorSize, m_slots[slot].dataSize));
+    }
+}
+
+// Write all dirty sectors to the device in order. m_multithreadLock must be held
+bool SectorCacheEngine::flushDirtySectors() {
+    if (!m_dirtyBytes) return true;
+
+    // Collect everything waiting to be written, sorted so it goes out in one sweep
+    std::vector<std::pair<uint32_t, uint32_t>> dirty;
+    {
+        std::lock_guard cacheLock(m_cacheLock);
+        for (const CacheSlot& slot : m_slots)
+            if (slot.dirty) dirty.push_back(std::make_pair(slot.sectorNumber, slot.dataSize));
+    }
+    std::sort(dirty.begin(), dirty.end());
+
+    std::vector<uint8_t> buffer;
+    std::vector<SectorRun> runs;
+    bool success = true;
+    size_t index = 0;
+    while (index < dirty.size()) {
+        // Find runs of consecutive sectors of the same size, and batch them up so the device can work on them together
+        const uint32_t sectorSize = dirty[index].second;
+        uint32_t totalSectors = 0;
+        runs.clear();
+        while ((index < dirty.size()) && (runs.size() < MAX_FLUSH_BATCH) && (dirty[index].second == sectorSize)) {
+            const uint32_t firstSector = dirty[index].first;
+            uint32_t count = 1;
+            while ((index + count < dirty.size()) && (count < MAX_FLUSH_RUN) &&
+                   (dirty[index + count].first == firstSector + count) && (dirty[index + count].second == sectorSize)) count++;
+            runs.push_back({ firstSector, count, nullptr });
+            totalSectors += count;
+            index += count;
+        }
+
+        // Copy them out and write them in one go
+        buffer.resize((size_t)totalSectors * sectorSize);
+        {
+            std::lock_guard cacheLock(m_cacheLock);
+            uint8_t* data = buffer.data();
+            for (SectorRun& run : runs) {
+                run.data = data;
+                for (uint32_t sector = 0; sector < run.count; sector++)
+                    memcpy_s(run.data + ((size_t)sector * sectorSize), sectorSize, slotData(findSlot(run.firstSector + sector)), sectorSize);
+                data += (size_t)run.count * sectorSize;
+            }
+        }
+
+        if (internalWriteRuns(runs, sectorSize)) {
+            std::lock_guard cacheLock(m_cacheLock);
+            for (const SectorRun& run : runs)
+                for (uint32_t sector = 0; sector < run.count; sector++) {
+                    CacheSlot& slot = m_slots[findSlot(run.firstSector + sector)];
+                    slot.dirty = false;
+                    m_dirtyBytes -= slot.dataSize;
+                }
+        }
+        else success = false;
+    }
+
+    return success;
+}
+
+// Fetch a sector from the cache. m_cacheLock must be held
+bool SectorCacheEngine::fetchSector(const uint32_t sectorNumber, const uint32_t sectorSize, void* data, const CachePriority priority) {
     if (!m_cacheMaxMem) return false;
 
-    auto f = m_cache.find(sectorNumber);
-    if (f == m_cache.end()) return false;
-    if (m_maxCacheEntries == 0) m_maxCacheEntries = m_cacheMaxMem / sectorSize;
+    const uint32_t slot = findSlot(sectorNumber);
+    if (slot == INVALID_SLOT) return false;
+    if (m_slots[slot].dataSize < sectorSize) return false;
+
+    memcpy_s(data, sectorSize, slotData(slot), sectorSize);
 
-    memcpy_s(data, sectorSize, f->second->data, min(sectorSize, f->second->sectorSize));
-    f->second->lastUse = GetTickCount64();
+    // Being used again earns a place on the protected list, except the first use of something read-ahead fetched
+    CacheSlot& s = m_slots[slot];
+    CacheList list = clProtected;
+    if ((s.readAhead) && (priority != CachePriority::cpMetadata)) list = s.list;
+    s.readAhead = false;
+    if ((s.list != list) || (m_lruHead[list] != slot)) {
+        unlinkLRU(slot);
+        linkLRUHead(slot, list);
+    }
     return true;
 }
 
+// Returns TRUE if the sector is in the cache. m_cacheLock must be held
+bool SectorCacheEngine::isCached(const uint32_t sectorNumber, const uint32_t sectorSize) {
+    const uint32_t slot = findSlot(sectorNumber);
+    return (slot != INVALID_SLOT) && (m_slots[slot].dataSize >= sectorSize);
+}
+
+// Write data to the cache
+void SectorCacheEngine::writeCache(const uint32_t sectorNumber, const uint32_t sectorSize, const void* data) {
+    std::lock_guard cacheLock(m_cacheLock);
+    storeSector(sectorNumber, sectorSize, data);
+}
+
+// Read data from the cache
+bool SectorCacheEngine::readCache(const uint32_t sectorNumber, const uint32_t sectorSize, void* data) {
+    std::lock_guard cacheLock(m_cacheLock);
+    return fetchSector(sectorNumber, sectorSize, data);
+}
+
+// Turn the cache off for good
+void SectorCacheEngine::disableCache() {
+    setReadAhead(false, 0, 0);
+
+    std::lock_guard lock(m_multithreadLock);
+    flushDirtySectors();
+    clearCache();
+    m_writeBack = false;
+
+    std::lock_guard cacheLock(m_cacheLock);
+    m_cacheMaxMem = 0;
+}
+
+// Enable write back mode
+void SectorCacheEngine::setWriteBackMode(const bool enabled, const uint32_t maxDirtyBytes, const uint32_t idleFlushTime) {
+    std::lock_guard lock(m_multithreadLock);
+    if (!enabled) flushDirtySectors();
+
+    // Never let dirty sectors take more than half of the cache
+    m_writeBack = enabled && (m_cacheMaxMem != 0);
+    m_maxDirtyBytes = min(maxDirtyBytes, m_cacheMaxMem / 2);
+    m_idleFlushTime = idleFlushTime;
+}
+
+// Flushes waiting writes once the disk has been idle long enough
+void SectorCacheEngine::flushIfIdle() {
+    if ((!m_writeBack) || (!m_dirtyBytes)) return;
+    if (GetTickCount64() - m_lastWrite < m_idleFlushTime) return;
+
+    // If something else is using the device then it isn't idle
+    std::unique_lock lock(m_multithreadLock, std::try_to_lock);
+    if (lock.owns_lock()) flushDirtySectors();
+}
+
+// Flush changes to disk
+bool SectorCacheEngine::flushWriteCache() {
+    std::lock_guard lock(m_multithreadLock);
+    return flushDirtySectors();
+}
+
+// Enable read-ahead
+void SectorCacheEngine::setReadAhead(const bool enabled, const uint32_t maxWindow, const uint32_t maxMemory) {
+    {
+        std::lock_guard cacheLock(m_cacheLock);
+        m_readAhead = enabled && (m_cacheMaxMem != 0);
+        m_readAheadMaxWindow = maxWindow;
+        // Never let it take more than a quarter of the cache or it will just push out what it fetched
+        m_readAheadMaxMem = min(maxMemory, m_cacheMaxMem / 4);
+        m_streamRun = 0;
+        m_streamFetched = 0;
+        m_readAheadCount = 0;
+        m_streamGeneration++;
+        m_readAheadQuit = !m_readAhead;
+    }
+
+    if (m_readAhead) {
+        if (!m_readAheadThread.joinable()) m_readAheadThread = std::thread([this]() { readAheadThread(); });
+    }
+    else if (m_readAheadThread.joinable()) {
+        m_readAheadSignal.notify_all();
+        m_readAheadThread.join();
+    }
+}
+
+// Watch for sequential reading and request read-ahead. m_cacheLock must be held
+void SectorCacheEngine::trackStream(const uint32_t firstSector, const uint32_t count, const uint32_t sectorSize) {
+    if (!m_readAhead) return;
+
+    if ((firstSector == m_streamNext) && (sectorSize == m_streamSectorSize)) m_streamRun += count;
+    else {
+        // Not sequential any more, so cancel anything being fetched for the old stream
+        if (m_streamFetched) m_streamGeneration++;
+        m_streamRun = count;
+        m_streamWindow = READAHEAD_MIN_WINDOW;
+        m_streamFetched = 0;
+        m_readAheadCount = 0;
+    }
+    m_streamNext = firstSector + count;
+    m_streamSectorSize = sectorSize;
+    if ((m_streamRun < READAHEAD_TRIGGER) || (!sectorSize)) return;
+
+    // Top up once the reader is half way through what has been fetched, doubling the window each time
+    if (m_streamFetched >= m_streamNext + (m_streamWindow / 2)) return;
+    const uint32_t maxWindow = max(1U, min(m_readAheadMaxWindow, m_readAheadMaxMem) / sectorSize);
+    if (m_streamFetched) m_streamWindow = min(m_streamWindow * 2, maxWindow); else m_streamWindow = min(m_streamWindow, maxWindow);
+
+    const uint32_t start = max(m_streamFetched, m_streamNext);
+    const uint32_t end = m_streamNext + m_streamWindow;
+    if (end <= start) return;
+
+    // Extend a request the thread hasn't picked up yet, otherwise start a new one
+    if (m_readAheadCount) m_readAheadCount = end - m_readAheadFirst;
+    else {
+        m_readAheadFirst = start;
+        m_readAheadCount = end - start;
+    }
+    m_streamFetched = end;
+    m_readAheadSignal.notify_one();
+}
+
+// Background thread that services read-ahead requests
+void SectorCacheEngine::readAheadThread() {
+    std::vector<uint8_t> buffer;
+    std::vector<SectorRun> runs;
+    std::unique_lock cacheLock(m_cacheLock);
+
+    for (;;) {
+        m_readAheadSignal.wait(cacheLock, [this]() { return m_readAheadQuit || m_readAheadCount; });
+        if (m_readAheadQuit) return;
+
+        const uint32_t generation = m_streamGeneration;
+        const uint32_t sectorSize = m_streamSectorSize;
+        uint32_t sectorNumber = m_readAheadFirst;
+        uint32_t count = m_readAheadCount;
+        m_readAheadCount = 0;
+
+        while ((count) && (generation == m_streamGeneration) && (!m_readAheadQuit)) {
+            // Claim a few chunks of missing sectors so readers wait for us rather than reading them again, skipping
+            // anything already cached or being read by someone else
+            buffer.resize((size_t)READAHEAD_CHUNK * READAHEAD_QUEUE * sectorSize);
+            uint32_t claimed = 0;
+            runs.clear();
+            while ((count) && (runs.size() < READAHEAD_QUEUE)) {
+                if ((isCached(sectorNumber, sectorSize)) || (m_inFlight.find(sectorNumber) != m_inFlight.end())) {
+                    sectorNumber++;
+                    count--;
+                    continue;
+                }
+                SectorRun run = { sectorNumber, 0, &buffer[(size_t)claimed * sectorSize] };
+                while ((count) && (run.count < READAHEAD_CHUNK) && (!isCached(sectorNumber, sectorSize)) && (m_inFlight.find(sectorNumber) == m_inFlight.end())) {
+                    m_inFlight.insert(sectorNumber);
+                    run.count++;
+                    sectorNumber++;
+                    count--;
+                }
+                claimed += run.count;
+                runs.push_back(run);
+            }
+            if (runs.empty()) continue;
+            cacheLock.unlock();
+
+            bool success;
+            {
+                m_multithreadLock.lock(devicePosition(runs.front().firstSector));
+                std::lock_guard lock(m_multithreadLock, std::adopt_lock);
+                success = internalReadRuns(runs, sectorSize);
+                if (success) {
+                    std::lock_guard storeLock(m_cacheLock);
+                    for (const SectorRun& run : runs)
+                        for (uint32_t index = 0; index < run.count; index++)
+                            storeReadSector(run.firstSector + index, sectorSize, run.data + ((size_t)index * sectorSize), CachePriority::cpReadAhead);
+                }
+            }
+
+            cacheLock.lock();
+            for (const SectorRun& run : runs)
+                for (uint32_t index = 0; index < run.count; index++) m_inFlight.erase(run.firstSector + index);
+            m_inFlightDone.notify_all();
+
+            // Probably ran off the end of the disk
+            if (!success) break;
+        }
+    }
+}
+
+// Empty the cache without writing anything
+void SectorCacheEngine::clearCache() {
+    std::lock_guard cacheLock(m_cacheLock);
+    m_slots.clear();
+    m_slabs.clear();
+    m_buckets.clear();
+    m_bucketMask = 0;
+    m_slotSize = 0;
+    m_maxCacheEntries = 0;
+    for (uint32_t list = clProbation; list <= clProtected; list++) {
+        m_lruHead[list] = INVALID_SLOT;
+        m_lruTail[list] = INVALID_SLOT;
+        m_lruCount[list] = 0;
+    }
+    m_freeSlots = INVALID_SLOT;
+    m_arenaSlots = 0;
+    m_dirtyBytes = 0;
+}
+
 // Reset the cache
 void SectorCacheEngine::resetCache() {
-    for (auto it : m_cache) {
-        if (it.second->data) free(it.second->data);
-        delete it.second;
+    // Anything not written yet has to go out first
+    if (m_writeBack) {
+        std::lock_guard lock(m_multithreadLock);
+        flushDirtySectors();
+        clearCache();
     }
-    m_cache.clear();
+    else clearCache();
 }
 
 SectorCacheEngine::SectorCacheEngine(const uint32_t maxCacheMem) : m_maxCacheEntries(0), m_cacheMaxMem(maxCacheMem) {
@@ -101,30 +586,71 @@ SectorCacheEngine::SectorCacheEngine(const uint32_t maxCacheMem) : m_maxCacheEnt
 }
 
 SectorCacheEngine::~SectorCacheEngine() {
-    resetCache();
+    // Too late to read or write anything here, derived classes must stop read-ahead and flush before they close
+    setReadAhead(false, 0, 0);
+    clearCache();
 }
 
 bool SectorCacheEngine::hybridReadData(const uint32_t sectorNumber, const uint32_t sectorSize, void* data) { 
     std::lock_guard lock(m_multithreadLock);
-    return internalHybridReadData(sectorNumber, sectorSize, data); 
+    if (!internalHybridReadData(sectorNumber, sectorSize, data)) return false;
+    if (m_writeBack) overlayDirtySectors(sectorNumber, 1, sectorSize, data);
+    return true;
 };
 
-bool SectorCacheEngine::readData(const uint32_t sectorNumber, const uint32_t sectorSize, void* data) {
-    std::lock_guard lock(m_multithreadLock);
+bool SectorCacheEngine::readData(const uint32_t sectorNumber, const uint32_t sectorSize, void* data, const CachePriority priority) {
+    // Cache hits never wait for the device.  If another thread is already reading this sector, wait for it rather than reading it twice
+    {
+        std::unique_lock cacheLock(m_cacheLock);
+        trackStream(sectorNumber, 1, sectorSize);
+        for (;;) {
+            if (fetchSector(sectorNumber, sectorSize, data, priority)) return true;
+            if (m_inFlight.find(sectorNumber) == m_inFlight.end()) break;
+            m_inFlightDone.wait(cacheLock);
+        }
+        if (m_cacheMaxMem) m_inFlight.insert(sectorNumber);
+    }
 
-    if (readCache(sectorNumber, sectorSize, data)) return true;
+    bool success;
+    {
+        m_multithreadLock.lock(devicePosition(sectorNumber));
+        std::lock_guard lock(m_multithreadLock, std::adopt_lock);
+        success = internalReadData(sectorNumber, sectorSize, data);
+        // Added while still holding the device lock so a write can't sneak in and leave this out of date
+        if ((success) && (m_cacheMaxMem)) {
+            std::lock_guard cacheLock(m_cacheLock);
+            storeReadSector(sectorNumber, sectorSize, data, priority);
+        }
+    }
 
-    if (internalReadData(sectorNumber, sectorSize, data)) {
-        writeCache(sectorNumber, sectorSize, data);
-        return true;
+    if (m_cacheMaxMem) {
+        {
+            std::lock_guard cacheLock(m_cacheLock);
+            m_inFlight.erase(sectorNumber);
+        }
+        m_inFlightDone.notify_all();
     }
 
-    return false;
+    return success;
 }
 
 bool SectorCacheEngine::writeData(const uint32_t sectorNumber, const uint32_t sectorSize, const void* data) {
     std::lock_guard lock(m_multithreadLock);
 
+    // In write back mode it just sits in the cache until it's flushed
+    if (m_writeBack) {
+        bool stored;
+        {
+            std::lock_guard cacheLock(m_cacheLock);
+            stored = storeSector(sectorNumber, sectorSize, data, true);
+        }
+        if (stored) {
+            m_lastWrite = GetTickCount64();
+            if (m_dirtyBytes >= m_maxDirtyBytes) return flushDirtySectors();
+            return true;
+        }
+    }
+
     if (internalWriteData(sectorNumber, sectorSize, data)) {
         writeCache(sectorNumber, sectorSize, data);
         return true;
@@ -132,3 +658,142 @@ bool SectorCacheEngine::writeData(const uint32_t sectorNumber, const uint32_t se
     return false;
 }
 
+
+// Default multi-sector handlers, one sector at a time
+bool SectorCacheEngine::internalReadSectors(const uint32_t firstSector, const uint32_t count, const uint32_t sectorSize, void* data) {
+    uint8_t* buffer = (uint8_t*)data;
+    for (uint32_t index = 0; index < count; index++)
+        if (!internalReadData(firstSector + index, sectorSize, buffer + ((size_t)index * sectorSize))) return false;
+    return true;
+}
+
+bool SectorCacheEngine::internalWriteSectors(const uint32_t firstSector, const uint32_t count, const uint32_t sectorSize, const void* data) {
+    const uint8_t* buffer = (const uint8_t*)data;
+    for (uint32_t index = 0; index < count; index++)
+        if (!internalWriteData(firstSector + index, sectorSize, buffer + ((size_t)index * sectorSize))) return false;
+    return true;
+}
+
+// Default batch handlers, one run at a time
+bool SectorCacheEngine::internalReadRuns(const std::vector<SectorRun>& runs, const uint32_t sectorSize) {
+    for (const SectorRun& run : runs)
+        if (!internalReadSectors(run.firstSector, run.count, sectorSize, run.data)) return false;
+    return true;
+}
+
+bool SectorCacheEngine::internalWriteRuns(const std::vector<SectorRun>& runs, const uint32_t sectorSize) {
+    for (const SectorRun& run : runs)
+        if (!internalWriteSectors(run.firstSector, run.count, sectorSize, run.data)) return false;
+    return true;
+}
+
+// Read a run of consecutive sectors. Cached sectors are copied out, and all of the missing runs are read from the device together
+bool SectorCacheEngine::readSectors(const uint32_t firstSector, const uint32_t count, const uint32_t sectorSize, void* data, const CachePriority priority) {
+    uint8_t* buffer = (uint8_t*)data;
+    std::vector<bool> done(count, false);
+    std::vector<SectorRun> runs;
+    uint32_t remaining = count;
+
+    std::unique_lock cacheLock(m_cacheLock);
+    trackStream(firstSector, count, sectorSize);
+
+    while (remaining) {
+        // Copy out whatever is cached, and claim every missing run that nobody else is already reading
+        bool waiting = false;
+        runs.clear();
+        uint32_t index = 0;
+        while (index < count) {
+            const uint32_t sectorNumber = firstSector + index;
+            if (done[index]) index++;
+            else if (fetchSector(sectorNumber, sectorSize, buffer + ((size_t)index * sectorSize), priority)) {
+                done[index++] = true;
+                remaining--;
+            }
+            else if (m_inFlight.find(sectorNumber) != m_inFlight.end()) {
+                waiting = true;
+                index++;
+            }
+            else {
+                SectorRun run = { sectorNumber, 0, buffer + ((size_t)index * sectorSize) };
+                while ((index < count) && (!done[index]) && (m_inFlight.find(firstSector + index) == m_inFlight.end()) && (!isCached(firstSector + index, sectorSize))) {
+                    if (m_cacheMaxMem) m_inFlight.insert(firstSector + index);
+                    run.count++;
+                    index++;
+                }
+                runs.push_back(run);
+            }
+        }
+
+        // Everything left is being read by another thread
+        if (runs.empty()) {
+            if (waiting) m_inFlightDone.wait(cacheLock);
+            continue;
+        }
+        cacheLock.unlock();
+
+        bool success;
+        {
+            m_multithreadLock.lock(devicePosition(runs.front().firstSector));
+            std::lock_guard lock(m_multithreadLock, std::adopt_lock);
+            success = internalReadRuns(runs, sectorSize);
+            if ((success) && (m_cacheMaxMem)) {
+                std::lock_guard storeLock(m_cacheLock);
+                for (const SectorRun& run : runs)
+                    for (uint32_t sector = 0; sector < run.count; sector++)
+                        storeReadSector(run.firstSector + sector, sectorSize, run.data + ((size_t)sector * sectorSize), priority);
+            }
+        }
+
+        cacheLock.lock();
+        for (const SectorRun& run : runs) {
+            for (uint32_t sector = 0; sector < run.count; sector++) {
+                if (m_cacheMaxMem) m_inFlight.erase(run.firstSector + sector);
+                done[(run.firstSector - firstSector) + sector] = true;
+            }
+            remaining -= run.count;
+        }
+        m_inFlightDone.notify_all();
+        if (!success) return false;
+    }
+
+    return true;
+}
+
+// Write a run of consecutive sectors
+bool SectorCacheEngine::writeSectors(const uint32_t firstSector, const uint32_t count, const uint32_t sectorSize, const void* data) {
+    std::lock_guard lock(m_multithreadLock);
+    const uint8_t* buffer = (const uint8_t*)data;
+
+    // In write back mode they just sit in the cache until they're flushed.  Anything that can't be cached is written now
+    if (m_writeBack) {
+        for (uint32_t index = 0; index < count; index++) {
+            const uint8_t* sector = buffer + ((size_t)index * sectorSize);
+            bool stored;
+            {
+                std::lock_guard cacheLock(m_cacheLock);
+                stored = storeSector(firstSector + index, sectorSize, sector, true);
+            }
+            if ((!stored) && (!internalWriteData(firstSector + index, sectorSize, sector))) return false;
+        }
+        m_lastWrite = GetTickCount64();
+        if (m_dirtyBytes >= m_maxDirtyBytes) return flushDirtySectors();
+        return true;
+    }
+
+    if (!internalWriteSectors(firstSector, count, sectorSize, data)) return false;
+
+    if (m_cacheMaxMem) {
+        std::lock_guard cacheLock(m_cacheLock);
+        for (uint32_t index = 0; index < count; index++)
+            storeSector(firstSector + index, sectorSize, buffer + ((size_t)index * sectorSize));
+    }
+    return true;
+}
+
+// Read a run of consecutive sectors from the hybrid part of the disk
+bool SectorCacheEngine::hybridReadSectors(const uint32_t firstSector, const uint32_t count, const uint32_t sectorSize, void* data) {
+    std::lock_guard lock(m_multithreadLock);
+    if (!internalHybridReadSectors(firstSector, count, sectorSize, data)) return false;
+    if (m_writeBack) overlayDirtySectors(firstSector, count, sectorSize, data);
+    return true;
+}
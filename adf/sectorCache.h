@@ -17,43 +17,216 @@
 
 #include <dokan/dokan.h>
 #include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <memory>
 #include <atomic>
 #include <mutex>
+#include <condition_variable>
+#include <thread>
 
 
 // Possible types of sector / file
 enum class SectorType  {stAmiga, stIBM, stAtari, stHybrid, stUnknown };
 
+// How hard the cache should try to keep a sector
+enum class CachePriority {
+    cpNormal,       // File data etc. Only kept long term if it's read again
+    cpMetadata,     // Filesystem structures (root, bitmap, directory blocks etc) that get read over and over
+    cpReadAhead     // Fetched by read-ahead and not actually asked for yet
+};
+
+// The lock held while talking to a device.  Threads that say where on the disk they're going are let in the order the head
+// would reach them (C-LOOK: sweeping up the disk, then jumping back to the lowest), rather than the order they arrived, so a
+// drive isn't sent back and forth between distant tracks when several files are read at once.  Requests for the same place go one
+// after the other.  Anyone that doesn't give a position, or that has waited too long, goes first.  This works with std::lock_guard
+// and std::unique_lock
+class ElevatorLock {
+private:
+    // Most times a request can be overtaken by ones that arrived after it before it has to go next
+    static constexpr uint32_t MAX_PASSES = 8;
+
+    struct Waiter {
+        uint32_t position;
+        uint32_t passes;        // Number of times a later request went first
+        bool granted;
+    };
+
+    std::mutex m_lock;
+    std::condition_variable m_granted;
+    std::vector<Waiter*> m_waiters;     // In the order they arrived
+    bool m_busy = false;
+    uint32_t m_position = 0;            // Where the last request that gave a position was
+public:
+    // Position for a request that doesn't care where the head is
+    static constexpr uint32_t ANY_POSITION = 0xFFFFFFFF;
+
+    void lock(const uint32_t position = ANY_POSITION);
+    bool try_lock();
+    void unlock();
+
+    // Number of requests waiting for the device
+    size_t numWaiting();
+};
+
 class SectorCacheEngine {
 private:
-    struct SectorData {
-        void* data;
-        ULONGLONG lastUse;
-        uint32_t sectorSize;
+    // Marks the end of a list or an empty bucket
+    static constexpr uint32_t INVALID_SLOT = 0xFFFFFFFF;
+    // Number of sector slots allocated together as one block of memory
+    static constexpr uint32_t SLOTS_PER_SLAB = 256;
+    // Most sectors written back to the device in one go when flushing
+    static constexpr uint32_t MAX_FLUSH_RUN = 128;
+    // Most runs handed to the device together when flushing
+    static constexpr uint32_t MAX_FLUSH_BATCH = 16;
+    // Number of sequential sectors read before read-ahead kicks in
+    static constexpr uint32_t READAHEAD_TRIGGER = 8;
+    // Starting read-ahead window, in sectors.  This doubles each time it's used up to the maximum
+    static constexpr uint32_t READAHEAD_MIN_WINDOW = 16;
+    // Most sectors the read-ahead thread reads in one go, so it doesn't hog the device
+    static constexpr uint32_t READAHEAD_CHUNK = 32;
+    // Number of chunks the read-ahead thread asks the device for at once
+    static constexpr uint32_t READAHEAD_QUEUE = 4;
+
+    // Sectors start on probation and are only protected once they are used again (or are metadata). A large scan
+    // therefore only cycles through the probation list and can't push out the sectors that keep getting used
+    enum CacheList : uint8_t { clProbation = 0, clProtected = 1 };
+    // Percentage of the cache the probation list is allowed to keep before it gets evicted from first
+    static constexpr uint32_t PROBATION_PERCENT = 25;
+
+    // A single cached sector.  The data lives in the slab arena, these just link it together
+    struct CacheSlot {
+        uint32_t sectorNumber;
+        uint32_t dataSize;
+        uint32_t lruPrev;       // Towards the most recently used
+        uint32_t lruNext;       // Towards the least recently used
+        uint32_t hashNext;      // Next slot in the same bucket, or next free slot
+        bool dirty;             // Changed but not written to the device yet (write back mode only)
+        CacheList list;         // Which LRU list this is on
+        bool readAhead;         // Fetched by read-ahead and not used yet
     };
 
     uint32_t m_maxCacheEntries;
-    const uint32_t m_cacheMaxMem;
+    uint32_t m_cacheMaxMem;
 
-    std::mutex m_multithreadLock;
+    // Held while talking to the underlying device.  Reads say where they are on the disk so they can be let in in a sensible order
+    ElevatorLock m_multithreadLock;
     std::atomic<bool> m_isLocked = false;
 
-    // Sector disk cache for speed
-    std::unordered_map<uint32_t, SectorData*> m_cache;
-
-    SectorData* getAndReleaseOldestSector();
+    // Held only while the cache index is being used, never during device access
+    std::mutex m_cacheLock;
+    // Sectors currently being read from the device, and a signal when one completes
+    std::unordered_set<uint32_t> m_inFlight;
+    std::condition_variable m_inFlightDone;
+
+    // Sector disk cache for speed.  Slots are fixed size, set by the first sector cached
+    uint32_t m_slotSize = 0;
+    std::vector<CacheSlot> m_slots;
+    std::vector<std::unique_ptr<uint8_t[]>> m_slabs;
+    std::vector<uint32_t> m_buckets;
+    uint32_t m_bucketMask = 0;
+    uint32_t m_lruHead[2] = { INVALID_SLOT, INVALID_SLOT };
+    uint32_t m_lruTail[2] = { INVALID_SLOT, INVALID_SLOT };
+    uint32_t m_lruCount[2] = { 0, 0 };
+    uint32_t m_freeSlots = INVALID_SLOT;
+    // Number of slots the slabs have room for. The last slab is only as big as the limit allows
+    uint32_t m_arenaSlots = 0;
+
+    // Write back mode.  Dirty sectors are held in the cache until flushed
+    bool m_writeBack = false;
+    uint32_t m_maxDirtyBytes = 0;
+    uint32_t m_idleFlushTime = 0;
+    std::atomic<uint32_t> m_dirtyBytes = 0;
+    std::atomic<ULONGLONG> m_lastWrite = 0;
+
+    // Sequential read detection and read-ahead. All protected by m_cacheLock
+    bool m_readAhead = false;
+    bool m_readAheadQuit = false;
+    uint32_t m_readAheadMaxWindow = 0;      // Largest window in bytes
+    uint32_t m_readAheadMaxMem = 0;         // Most bytes fetched ahead of the reader at once
+    uint32_t m_streamNext = 0;              // Sector expected next if the access is sequential
+    uint32_t m_streamRun = 0;               // How many sequential sectors have been read
+    uint32_t m_streamWindow = 0;            // Current window in sectors
+    uint32_t m_streamFetched = 0;           // Read-ahead has been requested up to (but not including) this sector
+    uint32_t m_streamSectorSize = 0;
+    uint32_t m_streamGeneration = 0;        // Changes when the stream is broken, cancelling read-ahead
+    uint32_t m_readAheadFirst = 0;          // Pending request for the read-ahead thread
+    uint32_t m_readAheadCount = 0;
+    std::condition_variable m_readAheadSignal;
+    std::thread m_readAheadThread;
+
+    // Prepare the cache for sectors of this size, returns FALSE if they cant be cached
+    bool prepareCache(const uint32_t sectorSize);
+    // Returns a pointer to the data for a slot
+    uint8_t* slotData(const uint32_t slot) { return m_slabs[slot / SLOTS_PER_SLAB].get() + ((size_t)(slot % SLOTS_PER_SLAB) * m_slotSize); };
+    // Find the slot holding a sector, or INVALID_SLOT
+    uint32_t findSlot(const uint32_t sectorNumber);
+    // Add/Remove a slot from the hash bucket for its sector
+    void linkHash(const uint32_t slot);
+    void unlinkHash(const uint32_t slot);
+    // Size the hash buckets to suit m_maxCacheEntries and re-add everything cached
+    void resizeBuckets();
+    // Remove/Add slots to the LRU lists
+    void unlinkLRU(const uint32_t slot);
+    void linkLRUHead(const uint32_t slot, const CacheList list);
+    // Get a slot to store a new sector in, evicting the oldest if needed
+    uint32_t allocateSlot();
+    // Make room in the arena for another slot, returns FALSE if out of memory
+    bool growArena();
+    // Remove the least useful clean sector from the cache. Returns its slot or INVALID_SLOT if everything is dirty
+    uint32_t evictSlot();
+    // Remove a sector from the cache if its there
+    void removeSector(const uint32_t sectorNumber);
+    // Store/Fetch a sector. m_cacheLock must be held, and m_multithreadLock too if write back mode is enabled
+    bool storeSector(const uint32_t sectorNumber, const uint32_t sectorSize, const void* data, const bool dirty = false, const CachePriority priority = CachePriority::cpNormal);
+    bool fetchSector(const uint32_t sectorNumber, const uint32_t sectorSize, void* data, const CachePriority priority = CachePriority::cpNormal);
+    // Store a sector just read from the device. If the cache has a newer unwritten copy, that is copied into data instead
+    void storeReadSector(const uint32_t sectorNumber, const uint32_t sectorSize, void* data, const CachePriority priority);
+    // Copy any unwritten sectors in this range over the data
+    void overlayDirtySectors(const uint32_t firstSector, const uint32_t count, const uint32_t sectorSize, void* data);
+    // Write all dirty sectors to the device in order. m_multithreadLock must be held
+    bool flushDirtySectors();
+    // Empty the cache without writing anything
+    void clearCache();
+    // Watch for sequential reading and request read-ahead. m_cacheLock must be held
+    void trackStream(const uint32_t firstSector, const uint32_t count, const uint32_t sectorSize);
+    // Background thread that services read-ahead requests
+    void readAheadThread();
+    // Returns TRUE if the sector is in the cache. m_cacheLock must be held
+    bool isCached(const uint32_t sectorNumber, const uint32_t sectorSize);
 
 protected:
+    // A run of consecutive sectors, for handing several to the device at once
+    struct SectorRun {
+        uint32_t firstSector;
+        uint32_t count;
+        uint8_t* data;
+    };
+
     // Write data to the cache
     void writeCache(const uint32_t sectorNumber, const uint32_t sectorSize, const void* data);
     // Read data from the cache
     bool readCache(const uint32_t sectorNumber, const uint32_t sectorSize, void* data);
+    // Turn the cache off for good. For devices that are already as quick as the cache, eg: memory mapped files, so data isn't held twice
+    void disableCache();
 
 
     // Override.  
     virtual bool internalReadData(const uint32_t sectorNumber, const uint32_t sectorSize, void* data) = 0;
     virtual bool internalHybridReadData(const uint32_t sectorNumber, const uint32_t sectorSize, void* data) { return internalReadData(sectorNumber, sectorSize, data); };
     virtual bool internalWriteData(const uint32_t sectorNumber, const uint32_t sectorSize, const void* data) = 0;
+
+    // Override to read/write a run of consecutive sectors in one go.  The default just does them one at a time
+    virtual bool internalReadSectors(const uint32_t firstSector, const uint32_t count, const uint32_t sectorSize, void* data);
+    virtual bool internalHybridReadSectors(const uint32_t firstSector, const uint32_t count, const uint32_t sectorSize, void* data) { return internalReadSectors(firstSector, count, sectorSize, data); };
+    virtual bool internalWriteSectors(const uint32_t firstSector, const uint32_t count, const uint32_t sectorSize, const void* data);
+
+    // Override to have several runs in progress on the device at once. The default does them one after the other
+    virtual bool internalReadRuns(const std::vector<SectorRun>& runs, const uint32_t sectorSize);
+    virtual bool internalWriteRuns(const std::vector<SectorRun>& runs, const uint32_t sectorSize);
+
+    // Where a sector is on the disk, used to order reads from the device.  ElevatorLock::ANY_POSITION if it doesn't matter
+    virtual uint32_t devicePosition(const uint32_t sectorNumber) { UNREFERENCED_PARAMETER(sectorNumber); return ElevatorLock::ANY_POSITION; };
 public:
     // Create cache engine, setting maxCacheMem to zero disables the cache
     SectorCacheEngine(const uint32_t maxCacheMem);
@@ -62,14 +235,31 @@ public:
     // Reset the cache
     virtual void resetCache();
 
+    // Enable write back mode. Writes are held in the cache and written in order when flushed, when more than maxDirtyBytes are waiting, or idleFlushTime ms after the last write
+    void setWriteBackMode(const bool enabled, const uint32_t maxDirtyBytes, const uint32_t idleFlushTime);
+    bool isWriteBackMode() const { return m_writeBack; };
+    // Call periodically. Flushes waiting writes once the disk has been idle long enough
+    void flushIfIdle();
+
+    // Enable read-ahead. When sequential reading is spotted, up to maxWindow bytes are fetched in the background, never more than maxMemory ahead of the reader
+    void setReadAhead(const bool enabled, const uint32_t maxWindow, const uint32_t maxMemory);
+
+    // Returns TRUE if this has a sector cache at all
+    bool isCacheEnabled() const { return m_cacheMaxMem != 0; };
+
     // Special lock flag that locks out Dokan while we're doing low-level stuff
     bool isAccessLocked() { return m_isLocked; };
     void setLocked(bool locked) { m_isLocked = locked; };
 
-    bool readData(const uint32_t sectorNumber, const uint32_t sectorSize, void* data);
+    bool readData(const uint32_t sectorNumber, const uint32_t sectorSize, void* data, const CachePriority priority = CachePriority::cpNormal);
     bool writeData(const uint32_t sectorNumber, const uint32_t sectorSize, const void* data);
     bool hybridReadData(const uint32_t sectorNumber, const uint32_t sectorSize, void* data);
 
+    // Read/write a run of consecutive sectors. Any sectors not in the cache are fetched together with as few device reads as possible
+    bool readSectors(const uint32_t firstSector, const uint32_t count, const uint32_t sectorSize, void* data, const CachePriority priority = CachePriority::cpNormal);
+    bool writeSectors(const uint32_t firstSector, const uint32_t count, const uint32_t sectorSize, const void* data);
+    bool hybridReadSectors(const uint32_t firstSector, const uint32_t count, const uint32_t sectorSize, void* data);
+
     virtual bool isDiskPresent() = 0;
     virtual bool isDiskWriteProtected() = 0;
 
@@ -81,7 +271,7 @@ public:
     virtual uint32_t hybridTotalNumTracks() { return totalNumTracks(); };
 
     // Flush changes to disk
-    virtual bool flushWriteCache() { return true; };
+    virtual bool flushWriteCache();
 
     // Force writing only, so no read-by back first - useful for formatting disks
     virtual void setWritingOnlyMode(bool only) {  };
@@ -3,22 +3,186 @@
 #define MFM_MASK					0x55555555L		
 #define DEFAULT_SECTOR_BYTES		512				// Number of bytes in a decoded sector - the default, but NOT always
 #define MAX_TRACK_SIZE				(0x3A00 * 2)	// used for MFM encoding etc
+#define MAX_SECTOR_VOTES			9				// Most failed reads of a sector kept for voting on
+#define MAX_SECTORS_PER_TRACK		22				// Highest sector number (+1) a DecodedTrack can hold
 
-#include <map>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
 
-typedef std::vector<uint8_t> RawDecodedSector;
-
-// Structure to hold data while we decode it
+// A sector held in a DecodedTrack. The data itself lives in the track's payload buffer
 typedef struct {
 	uint32_t numErrors;					// Number of decoding errors found
-	RawDecodedSector data;          // decoded sector data
+	uint32_t dataOffset;				// where the decoded sector data starts in the track's payload
+	uint32_t dataSize;					// size of the decoded sector data
+	uint32_t votesOffset;				// where the failed reads kept for voting start in the track's votes buffer
+	uint32_t voteSize;					// size of each failed read (including its checksum), or 0 if there's no room for them yet
+	uint32_t numVotes;					// number of failed reads kept, while there's no good copy
+	uint32_t oldestVote;				// which one of them is replaced next when there's MAX_SECTOR_VOTES
 } DecodedSector;
 
-// To hold a list of valid and checksum failed sectors
+// To hold a list of valid and checksum failed sectors. The sectors are kept in an array indexed by sector number, with all their data
+// in one buffer, so a track can be cleared and decoded again without allocating anything once its buffers have grown to size.
+// Pointers to sector data are only valid until the next sector is added
 struct DecodedTrack {
-	// A map of sector number to valid sectors 
-	std::map<int, DecodedSector> sectors;
+	DecodedSector sectors[MAX_SECTORS_PER_TRACK];
+	uint32_t present = 0;				// Bit n is set if sector n is in the track
+	uint32_t sectorsWithErrors = 0;
+	std::vector<uint8_t> payload;		// Decoded data of all of the sectors
+	std::vector<uint8_t> votes;			// Failed reads of the sectors that don't have a good copy
+
+	// Removes all sectors, but keeps the buffers
+	void clear() {
+		present = 0;
+		sectorsWithErrors = 0;
+		payload.clear();
+		votes.clear();
+	}
+
+	// Makes room for numSectors sectors of sectorSize bytes
+	void reserve(const uint32_t numSectors, const uint32_t sectorSize) {
+		payload.reserve(numSectors * sectorSize);
+	}
+
+	// Number of sectors in the track
+	uint32_t size() const {
+		uint32_t count = 0;
+		for (uint32_t bits = present; bits; bits &= bits - 1) count++;
+		return count;
+	}
+
+	// Highest sector number in the track. The track must not be empty
+	uint32_t lastSector() const {
+		uint32_t sector = MAX_SECTORS_PER_TRACK - 1;
+		while (!(present & (1U << sector))) sector--;
+		return sector;
+	}
+
+	// Returns the sector, or nullptr if it's not in the track
+	DecodedSector* find(const uint32_t sectorNumber) {
+		return ((sectorNumber < MAX_SECTORS_PER_TRACK) && (present & (1U << sectorNumber))) ? &sectors[sectorNumber] : nullptr;
+	}
+	const DecodedSector* find(const uint32_t sectorNumber) const {
+		return ((sectorNumber < MAX_SECTORS_PER_TRACK) && (present & (1U << sectorNumber))) ? &sectors[sectorNumber] : nullptr;
+	}
+
+	// Access to a sector's data
+	uint8_t* data(const DecodedSector& sector) { return payload.data() + sector.dataOffset; }
+	const uint8_t* data(const DecodedSector& sector) const { return payload.data() + sector.dataOffset; }
 
-	uint32_t sectorsWithErrors;
+	// Adds a sector with dataSize bytes of zeroed data, or returns the existing one, moving its data if it's a different size.
+	// numErrors is only set if the sector is new. Returns nullptr if the sector number is too high to be stored
+	DecodedSector* add(const uint32_t sectorNumber, const uint32_t dataSize, const uint32_t numErrors) {
+		if (sectorNumber >= MAX_SECTORS_PER_TRACK) return nullptr;
+		DecodedSector& sector = sectors[sectorNumber];
+		if (!(present & (1U << sectorNumber))) {
+			present |= 1U << sectorNumber;
+			sector.numErrors = numErrors;
+			sector.dataSize = 0;
+			sector.voteSize = 0;
+			sector.numVotes = 0;
+			sector.oldestVote = 0;
+		}
+		if (sector.dataSize != dataSize) {
+			sector.dataOffset = (uint32_t)payload.size();
+			sector.dataSize = dataSize;
+			payload.resize(payload.size() + dataSize, 0);
+		}
+		return &sector;
+	}
+
+	// Adds or replaces a sector's data and number of errors. Returns nullptr if the sector number is too high to be stored
+	DecodedSector* set(const uint32_t sectorNumber, const uint8_t* sectorData, const uint32_t dataSize, const uint32_t numErrors) {
+		DecodedSector* sector = add(sectorNumber, dataSize, numErrors);
+		if (!sector) return nullptr;
+		sector->numErrors = numErrors;
+		memcpy(data(*sector), sectorData, dataSize);
+		return sector;
+	}
+
+	// Removes a sector. Its data stays in the buffer until the track is cleared
+	void erase(const uint32_t sectorNumber) {
+		if (sectorNumber < MAX_SECTORS_PER_TRACK) present &= ~(1U << sectorNumber);
+	}
 };
 
+// Adds a failed read of a sector (the decoded data including its checksum, so it can be checked) to the copies kept for it, and
+// builds the bit-by-bit majority of all of them into output, which must hold size bytes. Each copy is aligned to its sync mark, so this
+// is the same as voting on the data bits of the MFM. Ties go to the newest copy. Returns false if there aren't yet enough copies for a vote
+inline bool voteSectorCopies(DecodedTrack& track, DecodedSector& sector, const uint8_t* copy, const uint32_t size, uint8_t* output) {
+	// A copy of a different size means the earlier ones weren't the same thing
+	if (sector.voteSize != size) {
+		sector.votesOffset = (uint32_t)track.votes.size();
+		sector.voteSize = size;
+		sector.numVotes = 0;
+		sector.oldestVote = 0;
+		track.votes.resize(track.votes.size() + (size * MAX_SECTOR_VOTES));
+	}
+	uint8_t* reads = track.votes.data() + sector.votesOffset;
+	uint32_t newest;
+	if (sector.numVotes < MAX_SECTOR_VOTES) newest = (sector.oldestVote + sector.numVotes++) % MAX_SECTOR_VOTES;
+	else {
+		newest = sector.oldestVote;
+		sector.oldestVote = (sector.oldestVote + 1) % MAX_SECTOR_VOTES;
+	}
+	memcpy(reads + (newest * size), copy, size);
+	if (sector.numVotes < 3) return false;
+
+	const uint32_t numCopies = sector.numVotes;
+	for (uint32_t i = 0; i < size; i++) {
+		uint32_t counts[8] = { 0 };
+		for (uint32_t read = 0; read < numCopies; read++)
+			for (uint32_t bit = 0; bit < 8; bit++) counts[bit] += (reads[(read * size) + i] >> bit) & 1;
+		const uint8_t newestByte = reads[(newest * size) + i];
+		uint8_t result = 0;
+		for (uint32_t bit = 0; bit < 8; bit++) {
+			const uint32_t votes = counts[bit] * 2;
+			if ((votes > numCopies) || ((votes == numCopies) && (newestByte & (1 << bit)))) result |= (uint8_t)(1 << bit);
+		}
+		output[i] = result;
+	}
+	return true;
+}
+
+// Copies numBits bits of an MFM track, starting at startBit, into output so they're byte aligned (most significant bit first).
+// The read wraps back to the start of the track at dataLengthInBits, which doesn't need to be a multiple of 8.
+// Bits after the last one copied in the final output byte are set to zero.
+inline void extractTrackBits(const uint8_t* track, const uint32_t dataLengthInBits, uint32_t startBit, uint32_t numBits, uint8_t* output) {
+	const uint32_t trackBytes = (dataLengthInBits + 7) >> 3;
+	uint32_t outBit = 0;
+
+	startBit %= dataLengthInBits;
+	while (numBits) {
+		// Copy up to the end of the track in one go
+		const uint32_t count = (numBits < dataLengthInBits - startBit) ? numBits : dataLengthInBits - startBit;
+		const uint32_t srcByte = startBit >> 3;
+		const uint32_t srcShift = startBit & 7;
+		const uint32_t dstByte = outBit >> 3;
+		const uint32_t dstShift = outBit & 7;
+		const uint32_t numBytes = (count + 7) >> 3;
+		const uint32_t endByte = (outBit + count + 7) >> 3;
+		uint8_t* out = output + dstByte;
+
+		if ((srcShift == 0) && (dstShift == 0)) memcpy(out, track + srcByte, numBytes);
+		else {
+			if (dstShift) *out &= (uint8_t)(0xFF << (8 - dstShift));
+			for (uint32_t i = 0; i < numBytes; i++) {
+				// Funnel the next 8 bits of the track into one byte
+				const uint32_t src = srcByte + i;
+				uint32_t v = ((uint32_t)track[src] << 8) | ((src + 1 < trackBytes) ? track[src + 1] : 0);
+				const uint8_t b = (uint8_t)(v >> (8 - srcShift));
+				if (dstShift) {
+					out[i] |= b >> dstShift;
+					if (dstByte + i + 1 < endByte) out[i + 1] = (uint8_t)(b << (8 - dstShift));
+				}
+				else out[i] = b;
+			}
+		}
+		// Clear anything copied past the end of the track or the request
+		if ((outBit + count) & 7) output[endByte - 1] &= (uint8_t)(0xFF << (8 - ((outBit + count) & 7)));
+
+		numBits -= count;
+		outBit += count;
+		startBit = 0;
+	}
+}
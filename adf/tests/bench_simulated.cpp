@@ -0,0 +1,217 @@
+/* DiskFlashback, Copyright (C) 2021-2024 Robert Smith (@RobSmithDev)
+ * https://robsmithdev.co.uk/diskflashback
+ *
+ * This file is multi-licensed under the terms of the Mozilla Public
+ * License Version 2.0 as published by Mozilla Corporation and the
+ * GNU General Public License, version 2 or later, as published by the
+ * Free Software Foundation.
+ *
+ * MPL2: https://www.mozilla.org/en-US/MPL/2.0/
+ * GPL2: https://www.gnu.org/licenses/old-licenses/gpl-2.0.en.html
+ *
+ * This file is maintained at https://github.com/RobSmithDev/DiskFlashback
+ */
+
+// Runs SectorCacheMFM against the simulated drive and reports how long a real drive would have taken, and how much it had to move,
+// for the usual ways a disk gets used.  The data is checked too, so this also runs as a test
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <vector>
+#include "readwrite_simulated.h"
+#include "testUtil.h"
+
+#define BENCH_TRACKS        (SIM_CYLINDERS * 2)
+#define BENCH_SECTOR_SIZE   512
+
+// Print what the drive did since the stats were last reset
+static void report(const char* name, SectorRW_Simulated& drive, const std::chrono::steady_clock::time_point start) {
+    const SimulatedDriveStats stats = drive.getStats();
+    const double wallMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    printf("  %-26s drive %8.2fs  wall %7.1fms  spin-ups %u  seeks %4u  stepped %5u  reads %4u  writes %3u\n", name, stats.driveTimeUs / 1e6, wallMs,
+        stats.spinUps, stats.seeks, stats.cylindersStepped, stats.trackReads, stats.trackWrites);
+}
+
+// Reads every sector in order, returning how many didn't match the image
+static uint32_t readAll(SectorRW_Simulated& drive, const std::vector<uint8_t>& image) {
+    std::vector<uint8_t> buffer(BENCH_SECTOR_SIZE);
+    const uint32_t numSectors = (uint32_t)(image.size() / BENCH_SECTOR_SIZE);
+    uint32_t mismatches = 0;
+    for (uint32_t sector = 0; sector < numSectors; sector++)
+        if ((!drive.readData(sector, BENCH_SECTOR_SIZE, buffer.data())) || (memcmp(buffer.data(), &image[(size_t)sector * BENCH_SECTOR_SIZE], BENCH_SECTOR_SIZE))) mismatches++;
+    return mismatches;
+}
+
+// Reading a whole disk, scattered writes then a flush, and reading it all back, for one disk format
+static void benchFormat(const char* name, const SectorType diskType, const uint32_t sectorsPerTrack) {
+    std::mt19937 random(7);
+    std::vector<uint8_t> image((size_t)BENCH_TRACKS * sectorsPerTrack * BENCH_SECTOR_SIZE);
+    for (uint8_t& b : image) b = (uint8_t)random();
+
+    SectorRW_Simulated drive(diskType, false, image, SimulatedDriveSettings(), [](bool, SectorType) {});
+    printf("%s\n", name);
+    TEST_CHECK(drive.numSectorsPerTrack() == sectorsPerTrack);
+
+    drive.resetStats();
+    auto start = std::chrono::steady_clock::now();
+    TEST_CHECK(readAll(drive, image) == 0);
+    report("sequential read", drive, start);
+
+    drive.resetStats();
+    start = std::chrono::steady_clock::now();
+    std::vector<uint8_t> buffer(BENCH_SECTOR_SIZE);
+    for (uint32_t write = 0; write < 200; write++) {
+        const uint32_t sector = random() % (BENCH_TRACKS * sectorsPerTrack);
+        memset(buffer.data(), write, BENCH_SECTOR_SIZE);
+        memset(&image[(size_t)sector * BENCH_SECTOR_SIZE], write, BENCH_SECTOR_SIZE);
+        TEST_CHECK(drive.writeData(sector, BENCH_SECTOR_SIZE, buffer.data()));
+    }
+    TEST_CHECK(drive.flushWriteCache());
+    report("200 random writes + flush", drive, start);
+    TEST_CHECK(drive.getImage() == image);
+
+    // Nothing from the cache, so it all comes off the "disk" again
+    drive.resetCache();
+    drive.resetStats();
+    start = std::chrono::steady_clock::now();
+    TEST_CHECK(readAll(drive, image) == 0);
+    report("read back after writes", drive, start);
+}
+
+static void AmigaDisk() {
+    benchFormat("Amiga DD", SectorType::stAmiga, 11);
+}
+
+static void IBMDisk() {
+    benchFormat("IBM DD", SectorType::stIBM, 9);
+}
+
+// A weak sector still reads correctly once enough revolutions have been tried
+static void WeakSector() {
+    std::mt19937 random(8);
+    std::vector<uint8_t> image((size_t)BENCH_TRACKS * 11 * BENCH_SECTOR_SIZE);
+    for (uint8_t& b : image) b = (uint8_t)random();
+
+    SectorRW_Simulated drive(SectorType::stAmiga, false, image, SimulatedDriveSettings(), [](bool, SectorType) {});
+    drive.addWeakSector(10, 3, 4, 20);
+    printf("Amiga DD, weak sector\n");
+
+    drive.resetStats();
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<uint8_t> buffer(BENCH_SECTOR_SIZE);
+    const uint32_t sector = 10 * 11 + 3;
+    TEST_CHECK(drive.readData(sector, BENCH_SECTOR_SIZE, buffer.data()));
+    report("weak sector read", drive, start);
+    TEST_CHECK(memcmp(buffer.data(), &image[(size_t)sector * BENCH_SECTOR_SIZE], BENCH_SECTOR_SIZE) == 0);
+}
+
+// Two threads reading different ends of the disk at once, so the reads are ordered while the geometry is being looked up
+static void ConcurrentReads() {
+    std::mt19937 random(9);
+    std::vector<uint8_t> image((size_t)BENCH_TRACKS * 11 * BENCH_SECTOR_SIZE);
+    for (uint8_t& b : image) b = (uint8_t)random();
+
+    SectorRW_Simulated drive(SectorType::stAmiga, false, image, SimulatedDriveSettings(), [](bool, SectorType) {});
+    printf("Amiga DD, two readers\n");
+
+    drive.resetStats();
+    const auto start = std::chrono::steady_clock::now();
+    const uint32_t half = BENCH_TRACKS * 11 / 2;
+    std::atomic<uint32_t> mismatches = 0;
+    auto reader = [&](const uint32_t firstSector) {
+        std::vector<uint8_t> buffer(BENCH_SECTOR_SIZE);
+        for (uint32_t sector = firstSector; sector < firstSector + half; sector++)
+            if ((!drive.readData(sector, BENCH_SECTOR_SIZE, buffer.data())) || (memcmp(buffer.data(), &image[(size_t)sector * BENCH_SECTOR_SIZE], BENCH_SECTOR_SIZE))) mismatches++;
+    };
+    std::thread lower(reader, 0);
+    std::thread upper(reader, half);
+    lower.join();
+    upper.join();
+    report("two readers", drive, start);
+    TEST_CHECK(mismatches == 0);
+}
+
+// Clients sharing the drive at once: one reading the first tracks in order, three reading anywhere in the first half of the disk,
+// and one writing anywhere in the second half. The drive really waits for a fraction of each revolution so the requests queue up
+static void mixedWorkload(const char* name, const bool orderByTrack) {
+    std::mt19937 random(10);
+    const uint32_t numSectors = BENCH_TRACKS * 11;
+    const uint32_t half = numSectors / 2;
+    std::vector<uint8_t> image((size_t)numSectors * BENCH_SECTOR_SIZE);
+    for (uint8_t& b : image) b = (uint8_t)random();
+
+    SimulatedDriveSettings settings;
+    settings.realTimeScale = 0.02;
+    settings.orderByTrack = orderByTrack;
+    SectorRW_Simulated drive(SectorType::stAmiga, false, image, settings, [](bool, SectorType) {});
+
+    // Work out what everyone will do, and what the disk will end up as, before starting
+    std::vector<std::vector<uint32_t>> randomReads(3, std::vector<uint32_t>(20));
+    std::vector<uint32_t> writes(40);
+    for (std::vector<uint32_t>& reads : randomReads)
+        for (uint32_t& sector : reads) sector = random() % half;
+    for (uint32_t& sector : writes) sector = half + random() % half;
+    std::vector<uint8_t> expected = image;
+    for (uint32_t write = 0; write < writes.size(); write++)
+        memset(&expected[(size_t)writes[write] * BENCH_SECTOR_SIZE], write, BENCH_SECTOR_SIZE);
+
+    drive.resetStats();
+    const auto start = std::chrono::steady_clock::now();
+    std::atomic<uint32_t> failures = 0;
+    double sequentialMs = 0, writerMs = 0;
+    std::vector<double> randomMs(randomReads.size());
+    auto elapsed = [&start]() { return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count(); };
+    auto readSector = [&](const uint32_t sector, uint8_t* buffer) {
+        if ((!drive.readData(sector, BENCH_SECTOR_SIZE, buffer)) || (memcmp(buffer, &image[(size_t)sector * BENCH_SECTOR_SIZE], BENCH_SECTOR_SIZE))) failures++;
+    };
+
+    std::thread sequential([&]() {
+        uint8_t buffer[BENCH_SECTOR_SIZE];
+        for (uint32_t sector = 0; sector < 20 * 11; sector++) readSector(sector, buffer);
+        sequentialMs = elapsed();
+    });
+    std::vector<std::thread> randomReaders;
+    for (size_t reader = 0; reader < randomReads.size(); reader++)
+        randomReaders.emplace_back([&, reader]() {
+            uint8_t buffer[BENCH_SECTOR_SIZE];
+            for (const uint32_t sector : randomReads[reader]) readSector(sector, buffer);
+            randomMs[reader] = elapsed();
+        });
+    std::thread writer([&]() {
+        uint8_t buffer[BENCH_SECTOR_SIZE];
+        for (uint32_t write = 0; write < writes.size(); write++) {
+            memset(buffer, write, BENCH_SECTOR_SIZE);
+            if (!drive.writeData(writes[write], BENCH_SECTOR_SIZE, buffer)) failures++;
+        }
+        if (!drive.flushWriteCache()) failures++;
+        writerMs = elapsed();
+    });
+    sequential.join();
+    for (std::thread& reader : randomReaders) reader.join();
+    writer.join();
+
+    const SimulatedDriveStats stats = drive.getStats();
+    printf("  %-26s drive %8.2fs  stepped %5u  seeks %4u  done after: sequential %7.1fms  random %7.1fms  writer %7.1fms\n", name,
+        stats.driveTimeUs / 1e6, stats.cylindersStepped, stats.seeks, sequentialMs, *std::max_element(randomMs.begin(), randomMs.end()), writerMs);
+    TEST_CHECK(failures == 0);
+    TEST_CHECK(drive.getImage() == expected);
+}
+
+// The mixed workload with reads ordered by track, and in the order they arrive to compare it with
+static void MixedWorkload() {
+    printf("Amiga DD, sequential reader + 3 random readers + writer\n");
+    mixedWorkload("elevator", true);
+    mixedWorkload("arrival order (baseline)", false);
+}
+
+int main() {
+    TEST_RUN(AmigaDisk);
+    TEST_RUN(IBMDisk);
+    TEST_RUN(WeakSector);
+    TEST_RUN(ConcurrentReads);
+    TEST_RUN(MixedWorkload);
+    return TEST_RESULT();
+}
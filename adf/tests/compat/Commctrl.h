@@ -0,0 +1,49 @@
+/* DiskFlashback, Copyright (C) 2021-2024 Robert Smith (@RobSmithDev)
+ * https://robsmithdev.co.uk/diskflashback
+ *
+ * This file is multi-licensed under the terms of the Mozilla Public
+ * License Version 2.0 as published by Mozilla Corporation and the
+ * GNU General Public License, version 2 or later, as published by the
+ * Free Software Foundation.
+ *
+ * MPL2: https://www.mozilla.org/en-US/MPL/2.0/
+ * GPL2: https://www.gnu.org/licenses/old-licenses/gpl-2.0.en.html
+ *
+ * This file is maintained at https://github.com/RobSmithDev/DiskFlashback
+ */
+
+#pragma once
+
+// Only used by the tests when building away from Windows.  Task dialogs always pick the first button
+#include <dokan/dokan.h>
+
+#define TD_WARNING_ICON ((PCWSTR)nullptr)
+#define TD_ERROR_ICON ((PCWSTR)nullptr)
+#define TDF_ALLOW_DIALOG_CANCELLATION 0x0008
+#define TDF_USE_COMMAND_LINKS 0x0010
+#define TDF_POSITION_RELATIVE_TO_WINDOW 0x1000
+#define TDF_SIZE_TO_CONTENT 0x01000000
+
+struct TASKDIALOG_BUTTON {
+    int nButtonID;
+    PCWSTR pszButtonText;
+};
+
+struct TASKDIALOGCONFIG {
+    unsigned int cbSize;
+    HWND hwndParent;
+    HINSTANCE hInstance;
+    unsigned int dwFlags;
+    PCWSTR pszMainIcon;
+    PCWSTR pszWindowTitle;
+    PCWSTR pszMainInstruction;
+    PCWSTR pszContent;
+    unsigned int cButtons;
+    int nDefaultButton;
+    const TASKDIALOG_BUTTON* pButtons;
+};
+
+inline HRESULT TaskDialogIndirect(const TASKDIALOGCONFIG* config, int* button, int*, BOOL*) {
+    if (button) *button = (config && config->cButtons) ? config->pButtons[0].nButtonID : 0;
+    return S_OK;
+}
@@ -0,0 +1,23 @@
+/* DiskFlashback, Copyright (C) 2021-2024 Robert Smith (@RobSmithDev)
+ * https://robsmithdev.co.uk/diskflashback
+ *
+ * This file is multi-licensed under the terms of the Mozilla Public
+ * License Version 2.0 as published by Mozilla Corporation and the
+ * GNU General Public License, version 2 or later, as published by the
+ * Free Software Foundation.
+ *
+ * MPL2: https://www.mozilla.org/en-US/MPL/2.0/
+ * GPL2: https://www.gnu.org/licenses/old-licenses/gpl-2.0.en.html
+ *
+ * This file is maintained at https://github.com/RobSmithDev/DiskFlashback
+ */
+
+#pragma once
+
+// Only used by the tests.  The Visual Studio project finds FatFS next to the repository, here it's the copy inside it.
+// Away from Windows FatFS defines its own DWORD and WCHAR, which would clash with the ones in compat/dokan
+#define DWORD FF_DWORD
+#define WCHAR FF_WCHAR
+#include "../../../../../fatfs/source/ff.h"
+#undef DWORD
+#undef WCHAR
@@ -0,0 +1,214 @@
+/* DiskFlashback, Copyright (C) 2021-2024 Robert Smith (@RobSmithDev)
+ * https://robsmithdev.co.uk/diskflashback
+ *
+ * This file is multi-licensed under the terms of the Mozilla Public
+ * License Version 2.0 as published by Mozilla Corporation and the
+ * GNU General Public License, version 2 or later, as published by the
+ * Free Software Foundation.
+ *
+ * MPL2: https://www.mozilla.org/en-US/MPL/2.0/
+ * GPL2: https://www.gnu.org/licenses/old-licenses/gpl-2.0.en.html
+ *
+ * This file is maintained at https://github.com/RobSmithDev/DiskFlashback
+ */
+
+#pragma once
+
+// Only used by the tests when building away from Windows.  Provides just enough of Win32 and Dokan for the
+// parts of DiskFlashback that don't actually talk to Windows (the sector cache, decoders, DMS etc) to build.
+// Like windows.h this defines min and max, so the standard headers that would trip over them come first
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <array>
+#include <map>
+#include <set>
+#include <list>
+#include <deque>
+#include <unordered_map>
+#include <unordered_set>
+#include <memory>
+#include <functional>
+#include <algorithm>
+#include <random>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <iostream>
+
+typedef int BOOL;
+typedef unsigned char BOOLEAN;
+typedef unsigned long DWORD;
+typedef unsigned long ULONG;
+typedef long LONG;
+typedef long HRESULT;
+typedef unsigned long long ULONGLONG;
+typedef long long LONGLONG;
+typedef void* HANDLE;
+typedef void* PVOID;
+typedef void* LPVOID;
+typedef void* HWND;
+typedef void* HINSTANCE;
+typedef wchar_t WCHAR;
+typedef const wchar_t* PCWSTR;
+typedef const wchar_t* LPCWSTR;
+typedef void* PDOKAN_FILE_INFO;
+
+#define VOID void
+#define CALLBACK
+#define _In_
+#define S_OK 0
+#define TRUE 1
+#define FALSE 0
+#define UNREFERENCED_PARAMETER(x) (void)(x)
+
+#ifndef min
+#define min(a,b) (((a) < (b)) ? (a) : (b))
+#endif
+#ifndef max
+#define max(a,b) (((a) > (b)) ? (a) : (b))
+#endif
+
+inline int memcpy_s(void* dest, size_t destSize, const void* src, size_t count) {
+    if (count > destSize) abort();
+    memcpy(dest, src, count);
+    return 0;
+}
+
+inline ULONGLONG GetTickCount64() {
+    return (ULONGLONG)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+inline void Sleep(DWORD ms) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+// Files are just stdio underneath
+#define INVALID_HANDLE_VALUE ((HANDLE)(intptr_t)-1)
+#define INVALID_SET_FILE_POINTER ((DWORD)-1)
+#define GENERIC_READ 0x80000000UL
+#define GENERIC_WRITE 0x40000000UL
+#define CREATE_ALWAYS 2
+#define OPEN_EXISTING 3
+#define FILE_ATTRIBUTE_NORMAL 0x80
+#define FILE_BEGIN SEEK_SET
+#define FILE_CURRENT SEEK_CUR
+#define FILE_END SEEK_END
+
+inline HANDLE CreateFile(LPCWSTR filename, DWORD access, DWORD, void*, DWORD creation, DWORD, HANDLE) {
+    const std::wstring wide(filename);
+    const std::string name(wide.begin(), wide.end());
+    FILE* fle = fopen(name.c_str(), creation == CREATE_ALWAYS ? "w+b" : ((access & GENERIC_WRITE) ? "r+b" : "rb"));
+    return fle ? (HANDLE)fle : INVALID_HANDLE_VALUE;
+}
+inline BOOL ReadFile(HANDLE fle, void* buffer, DWORD size, DWORD* read, void*) {
+    *read = (DWORD)fread(buffer, 1, size, (FILE*)fle);
+    return !ferror((FILE*)fle);
+}
+inline BOOL WriteFile(HANDLE fle, const void* buffer, DWORD size, DWORD* written, void*) {
+    *written = (DWORD)fwrite(buffer, 1, size, (FILE*)fle);
+    return *written == size;
+}
+inline DWORD SetFilePointer(HANDLE fle, LONG distance, LONG*, DWORD method) {
+    if (fseek((FILE*)fle, distance, (int)method)) return INVALID_SET_FILE_POINTER;
+    return (DWORD)ftell((FILE*)fle);
+}
+inline BOOL CloseHandle(HANDLE fle) {
+    return fclose((FILE*)fle) == 0;
+}
+
+union LARGE_INTEGER {
+    LONGLONG QuadPart;
+};
+inline BOOL SetFilePointerEx(HANDLE fle, LARGE_INTEGER distance, LARGE_INTEGER* newPos, DWORD method) {
+    if (fseek((FILE*)fle, (long)distance.QuadPart, (int)method)) return FALSE;
+    if (newPos) newPos->QuadPart = ftell((FILE*)fle);
+    return TRUE;
+}
+inline BOOL GetFileSizeEx(HANDLE fle, LARGE_INTEGER* size) {
+    const long pos = ftell((FILE*)fle);
+    if (fseek((FILE*)fle, 0, SEEK_END)) return FALSE;
+    size->QuadPart = ftell((FILE*)fle);
+    fseek((FILE*)fle, pos, SEEK_SET);
+    return TRUE;
+}
+inline DWORD GetFileSize(HANDLE fle, DWORD*) {
+    LARGE_INTEGER size;
+    return GetFileSizeEx(fle, &size) ? (DWORD)size.QuadPart : 0;
+}
+
+// No memory mapping, so everything falls back to normal file access
+#define PAGE_READONLY 0x02
+#define PAGE_READWRITE 0x04
+#define FILE_MAP_WRITE 0x02
+#define FILE_MAP_READ 0x04
+inline HANDLE CreateFileMapping(HANDLE, void*, DWORD, DWORD, DWORD, LPCWSTR) {
+    return NULL;
+}
+inline LPVOID MapViewOfFile(HANDLE, DWORD, DWORD, DWORD, size_t) {
+    return NULL;
+}
+inline BOOL UnmapViewOfFile(const void*) {
+    return TRUE;
+}
+inline BOOL FlushViewOfFile(const void*, size_t) {
+    return TRUE;
+}
+
+// Nothing is ever mapped, so there are no page faults to catch. libstdc++ already defines __try as try
+#ifndef __try
+#define __try try
+#endif
+#define __except(filter) catch (...)
+
+// Timer queues, each timer is just a thread
+typedef void (*WAITORTIMERCALLBACK)(PVOID, BOOLEAN);
+#define WT_EXECUTEDEFAULT 0
+#define WT_EXECUTELONGFUNCTION 0
+
+struct CompatTimer {
+    std::thread thread;
+    std::atomic<bool> quit{ false };
+};
+
+inline HANDLE CreateTimerQueue() {
+    return (HANDLE)1;
+}
+inline BOOL CreateTimerQueueTimer(HANDLE* timer, HANDLE, WAITORTIMERCALLBACK callback, PVOID param, DWORD dueTime, DWORD period, DWORD) {
+    CompatTimer* t = new CompatTimer();
+    *timer = t;
+    t->thread = std::thread([t, callback, param, dueTime, period]() {
+        Sleep(dueTime);
+        while (!t->quit) {
+            callback(param, TRUE);
+            Sleep(period);
+        }
+    });
+    return TRUE;
+}
+inline BOOL DeleteTimerQueueTimer(HANDLE, HANDLE timer, HANDLE) {
+    CompatTimer* t = (CompatTimer*)timer;
+    t->quit = true;
+    t->thread.join();
+    delete t;
+    return TRUE;
+}
+inline BOOL DeleteTimerQueueEx(HANDLE, HANDLE) {
+    return TRUE;
+}
+
+// No windows to show anything in
+inline HWND GetDesktopWindow() {
+    return nullptr;
+}
+inline HINSTANCE GetModuleHandle(const void*) {
+    return nullptr;
+}
+
+inline void DokanResetTimeout(ULONG, PDOKAN_FILE_INFO) {}
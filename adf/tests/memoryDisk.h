@@ -0,0 +1,124 @@
+/* DiskFlashback, Copyright (C) 2021-2024 Robert Smith (@RobSmithDev)
+ * https://robsmithdev.co.uk/diskflashback
+ *
+ * This file is multi-licensed under the terms of the Mozilla Public
+ * License Version 2.0 as published by Mozilla Corporation and the
+ * GNU General Public License, version 2 or later, as published by the
+ * Free Software Foundation.
+ *
+ * MPL2: https://www.mozilla.org/en-US/MPL/2.0/
+ * GPL2: https://www.gnu.org/licenses/old-licenses/gpl-2.0.en.html
+ *
+ * This file is maintained at https://github.com/RobSmithDev/DiskFlashback
+ */
+
+#pragma once
+
+// A disk held in memory that counts how it's used, for testing SectorCacheEngine
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include "sectorCache.h"
+
+class MemoryDisk : public SectorCacheEngine {
+private:
+    std::vector<uint8_t> m_data;
+
+    // When blocked, device access waits until it's released
+    std::mutex m_blockLock;
+    std::condition_variable m_blockChanged;
+    bool m_blocked = false;
+
+    // Wait here while the device is blocked
+    void waitIfBlocked() {
+        std::unique_lock lock(m_blockLock);
+        m_deviceWaiting = m_blocked;
+        m_blockChanged.wait(lock, [this]() { return !m_blocked; });
+        m_deviceWaiting = false;
+    }
+
+protected:
+    bool internalReadData(const uint32_t sectorNumber, const uint32_t sectorSize, void* data) override {
+        waitIfBlocked();
+        if ((uint64_t)(sectorNumber + 1) * sectorSize > m_data.size()) return false;
+        memcpy(data, &m_data[(size_t)sectorNumber * sectorSize], sectorSize);
+        m_sectorsRead++;
+        return true;
+    }
+
+    bool internalWriteData(const uint32_t sectorNumber, const uint32_t sectorSize, const void* data) override {
+        waitIfBlocked();
+        if ((uint64_t)(sectorNumber + 1) * sectorSize > m_data.size()) return false;
+        memcpy(&m_data[(size_t)sectorNumber * sectorSize], data, sectorSize);
+        m_sectorsWritten++;
+        return true;
+    }
+
+    bool internalReadRuns(const std::vector<SectorRun>& runs, const uint32_t sectorSize) override {
+        m_readBatches++;
+        {
+            std::lock_guard lock(m_blockLock);
+            m_lastReadRuns.clear();
+            for (const SectorRun& run : runs) {
+                m_lastReadRuns.push_back(std::make_pair(run.firstSector, run.count));
+                m_sectorsReadInBatches += run.count;
+            }
+        }
+        return SectorCacheEngine::internalReadRuns(runs, sectorSize);
+    }
+
+    bool internalWriteRuns(const std::vector<SectorRun>& runs, const uint32_t sectorSize) override {
+        m_writeBatches++;
+        return SectorCacheEngine::internalWriteRuns(runs, sectorSize);
+    }
+
+public:
+    // Usage counters
+    std::atomic<uint32_t> m_sectorsRead = 0;
+    std::atomic<uint32_t> m_sectorsWritten = 0;
+    std::atomic<uint32_t> m_readBatches = 0;
+    std::atomic<uint32_t> m_sectorsReadInBatches = 0;
+    std::atomic<uint32_t> m_writeBatches = 0;
+    // First sector and count of each run in the last batch read
+    std::vector<std::pair<uint32_t, uint32_t>> m_lastReadRuns;
+    // TRUE while something is stuck waiting for the device to be released
+    std::atomic<bool> m_deviceWaiting = false;
+
+    MemoryDisk(const uint32_t numSectors, const uint32_t maxCacheMem) : SectorCacheEngine(maxCacheMem), m_data((size_t)numSectors * 512) {
+        // Every sector starts with a pattern that says which one it is
+        for (size_t index = 0; index < m_data.size(); index++) m_data[index] = (uint8_t)((index / 512) * 7 + index);
+    }
+
+    ~MemoryDisk() {
+        setReadAhead(false, 0, 0);
+        flushWriteCache();
+    }
+
+    // Turn the cache off, as a memory mapped file does
+    void turnOffCache() { disableCache(); }
+
+    // Direct access to what's actually on the "device"
+    uint8_t* deviceSector(const uint32_t sectorNumber) { return &m_data[(size_t)sectorNumber * 512]; }
+
+    // Stop/Start the device responding
+    void setBlocked(const bool blocked) {
+        {
+            std::lock_guard lock(m_blockLock);
+            m_blocked = blocked;
+        }
+        m_blockChanged.notify_all();
+    }
+
+    bool isDiskPresent() override { return true; }
+    bool isDiskWriteProtected() override { return false; }
+    uint32_t totalNumTracks() override { return (uint32_t)(m_data.size() / (512 * 11)); }
+    uint64_t getDiskDataSize() override { return m_data.size(); }
+    uint32_t getNumHeads() override { return 2; }
+    std::wstring getDriverName() override { return L"Memory"; }
+    uint32_t numSectorsPerTrack() override { return 11; }
+    SectorType getSystemType() override { return SectorType::stAmiga; }
+    uint32_t serialNumber() override { return 0; }
+    bool available() override { return true; }
+    void quickClose() override {}
+};
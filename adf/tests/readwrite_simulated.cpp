@@ -0,0 +1,283 @@
+/* DiskFlashback, Copyright (C) 2021-2024 Robert Smith (@RobSmithDev)
+ * https://robsmithdev.co.uk/diskflashback
+ *
+ * This file is multi-licensed under the terms of the Mozilla Public
+ * License Version 2.0 as published by Mozilla Corporation and the
+ * GNU General Public License, version 2 or later, as published by the
+ * Free Software Foundation.
+ *
+ * MPL2: https://www.mozilla.org/en-US/MPL/2.0/
+ * GPL2: https://www.gnu.org/licenses/old-licenses/gpl-2.0.en.html
+ *
+ * This file is maintained at https://github.com/RobSmithDev/DiskFlashback
+ */
+
+#include "readwrite_simulated.h"
+#include "amiga_sectors.h"
+#include "ibm_sectors.h"
+
+// Constructor
+SectorRW_Simulated::SectorRW_Simulated(const SectorType diskType, const bool isHD, const std::vector<uint8_t>& image, const SimulatedDriveSettings& settings, std::function<void(bool diskInserted, SectorType diskFormat)> diskChangeCallback) :
+    SectorCacheMFM(diskChangeCallback), m_settings(settings), m_diskType(diskType), m_isHD(isHD), m_random(settings.randomSeed) {
+    encodeImage(image);
+    setReady();
+}
+
+// Builds the MFM for every track from a disk image
+void SectorRW_Simulated::encodeImage(const std::vector<uint8_t>& image) {
+    const uint32_t numTracks = SIM_CYLINDERS * 2;
+    m_imageSectorsPerTrack = (uint32_t)(image.size() / (numTracks * DEFAULT_SECTOR_BYTES));
+    if (m_imageSectorsPerTrack > MAX_SECTORS_PER_TRACK) m_imageSectorsPerTrack = 0;
+
+    // A revolution at 500kbit/s (DD) or 1Mbit/s (HD), unless the encoded tracks need more room than that
+    m_trackBytes = (uint32_t)(((uint64_t)(m_isHD ? 1000000 : 500000) * m_settings.revolutionTimeUs) / 8000000ULL);
+
+    std::vector<uint8_t> buffer(MAX_TRACK_SIZE);
+    DecodedTrack decodedTrack;
+    m_tracks.resize(numTracks);
+    for (uint32_t track = 0; track < numTracks; track++) {
+        uint32_t numBytes = 0;
+        if (m_imageSectorsPerTrack) {
+            decodedTrack.clear();
+            for (uint32_t sec = 0; sec < m_imageSectorsPerTrack; sec++)
+                decodedTrack.set(sec, image.data() + (((track * m_imageSectorsPerTrack) + sec) * DEFAULT_SECTOR_BYTES), DEFAULT_SECTOR_BYTES, 0);
+            if (m_diskType == SectorType::stAmiga)
+                numBytes = encodeSectorsIntoMFM_AMIGA(m_isHD, decodedTrack, track, MAX_TRACK_SIZE, buffer.data());
+            else numBytes = encodeSectorsIntoMFM_IBM(m_isHD, m_diskType == SectorType::stAtari, &decodedTrack, track, MAX_TRACK_SIZE, buffer.data());
+        }
+        m_tracks[track].assign(buffer.begin(), buffer.begin() + numBytes);
+        m_trackBytes = max(m_trackBytes, numBytes);
+    }
+
+    // Fill the rest of each revolution with gap
+    for (std::vector<uint8_t>& track : m_tracks)
+        track.resize(m_trackBytes, 0xAA);
+}
+
+// Where a sector is on the disk, or nowhere in particular if reads aren't being ordered
+uint32_t SectorRW_Simulated::devicePosition(const uint32_t sectorNumber) {
+    return m_settings.orderByTrack ? SectorCacheMFM::devicePosition(sectorNumber) : ElevatorLock::ANY_POSITION;
+}
+
+// Moves the drive's clock on
+void SectorRW_Simulated::spendTime(uint64_t timeUs) {
+    m_stats.driveTimeUs += timeUs;
+    if (m_settings.realTimeScale > 0.0) Sleep((DWORD)((timeUs * m_settings.realTimeScale) / 1000.0));
+}
+
+// Move the head to a cylinder
+void SectorRW_Simulated::stepTo(uint32_t cylinder) {
+    if (cylinder == m_cylinder) return;
+    const uint32_t steps = (cylinder > m_cylinder) ? cylinder - m_cylinder : m_cylinder - cylinder;
+    spendTime(((uint64_t)steps * m_settings.stepTimeUs) + m_settings.settleTimeUs);
+    m_stats.seeks++;
+    m_stats.cylindersStepped += steps;
+    m_cylinder = cylinder;
+}
+
+// Waits for the motor to finish spinning up. Returns FALSE if it's not on
+bool SectorRW_Simulated::waitForSpinUp() {
+    if (!m_motorOn) return false;
+    if (m_spinUpRemaining) {
+        spendTime(m_spinUpRemaining);
+        m_spinUpRemaining = 0;
+    }
+    return true;
+}
+
+// Waits for the index to come round
+void SectorRW_Simulated::waitForIndex() {
+    const uint64_t timeIntoRevolution = m_stats.driveTimeUs % m_settings.revolutionTimeUs;
+    if (timeIntoRevolution) spendTime(m_settings.revolutionTimeUs - timeIntoRevolution);
+}
+
+// Where the disk is under the head right now, in bits from the index
+uint32_t SectorRW_Simulated::currentBitPosition() {
+    const uint64_t timeIntoRevolution = m_stats.driveTimeUs % m_settings.revolutionTimeUs;
+    return (uint32_t)((timeIntoRevolution * m_trackBytes * 8) / m_settings.revolutionTimeUs);
+}
+
+// Returns the byte offset of each sector's data in the MFM of a track, in order from the index.  The sync marks are always
+// written byte aligned, so this only needs to look at whole bytes
+std::vector<uint32_t> SectorRW_Simulated::findSectorData(const std::vector<uint8_t>& track) {
+    static const uint8_t amigaSync[4] = { 0x44, 0x89, 0x44, 0x89 };
+    static const uint8_t ibmDataMark[8] = { 0x44, 0x89, 0x44, 0x89, 0x44, 0x89, 0x55, 0x45 };
+    std::vector<uint32_t> sectors;
+
+    for (uint32_t i = 0; i + sizeof(ibmDataMark) <= track.size(); i++) {
+        if (m_diskType == SectorType::stAmiga) {
+            // The data starts 56 bytes after the sync
+            if (memcmp(&track[i], amigaSync, sizeof(amigaSync)) == 0) {
+                sectors.push_back(i + sizeof(amigaSync) + 56);
+                i += sizeof(amigaSync) - 1;
+            }
+        }
+        else
+            if (memcmp(&track[i], ibmDataMark, sizeof(ibmDataMark)) == 0) {
+                sectors.push_back(i + sizeof(ibmDataMark));
+                i += sizeof(ibmDataMark) - 1;
+            }
+    }
+    return sectors;
+}
+
+bool SectorRW_Simulated::isDiskInDrive() {
+    std::lock_guard<std::mutex> lock(m_driveLock);
+    return m_diskInDrive;
+}
+
+bool SectorRW_Simulated::isDriveWriteProtected() {
+    std::lock_guard<std::mutex> lock(m_driveLock);
+    return m_writeProtected;
+}
+
+bool SectorRW_Simulated::motorEnable(bool enable, bool upperSide) {
+    UNREFERENCED_PARAMETER(upperSide);
+    std::lock_guard<std::mutex> lock(m_driveLock);
+    if (enable && (!m_motorOn)) {
+        m_spinUpRemaining = m_settings.spinUpTimeUs;
+        m_stats.spinUps++;
+    }
+    if (!enable) m_spinUpRemaining = 0;
+    m_motorOn = enable;
+    return true;
+}
+
+bool SectorRW_Simulated::motorReady() {
+    std::lock_guard<std::mutex> lock(m_driveLock);
+    return m_diskInDrive && waitForSpinUp();
+}
+
+bool SectorRW_Simulated::resetDrive(uint32_t cylinder) {
+    std::lock_guard<std::mutex> lock(m_driveLock);
+    stepTo(0);
+    stepTo(cylinder);
+    return true;
+}
+
+bool SectorRW_Simulated::cylinderSeek(uint32_t cylinder, bool upperSide) {
+    UNREFERENCED_PARAMETER(upperSide);
+    std::lock_guard<std::mutex> lock(m_driveLock);
+    stepTo(cylinder);
+    return true;
+}
+
+// Reads one revolution of the track from the index, plus a little of the next one so a sector written across the index is seen whole
+uint32_t SectorRW_Simulated::mfmRead(uint32_t cylinder, bool upperSide, bool retryMode, void* data, uint32_t maxLength) {
+    UNREFERENCED_PARAMETER(retryMode);
+    std::lock_guard<std::mutex> lock(m_driveLock);
+    const uint32_t track = (cylinder * 2) + (upperSide ? 1 : 0);
+    if ((!m_diskInDrive) || (track >= m_tracks.size()) || (!waitForSpinUp())) return 0;
+    stepTo(cylinder);
+    waitForIndex();
+
+    const uint32_t numBytes = min(m_trackBytes + SIM_READ_OVERLAP_BYTES, maxLength);
+    uint8_t* output = (uint8_t*)data;
+    extractTrackBits(m_tracks[track].data(), m_trackBytes * 8, 0, numBytes * 8, output);
+
+    // Weak bits read back differently each time
+    std::vector<uint32_t> sectors;
+    for (const WeakSector& weak : m_weakSectors) {
+        if (weak.track != track) continue;
+        if (sectors.empty()) sectors = findSectorData(m_tracks[track]);
+        if (weak.sector >= sectors.size()) continue;
+        for (const uint32_t bit : weak.bits) {
+            if ((m_random() % 100) >= weak.flipChance) continue;
+            for (uint32_t position = (((sectors[weak.sector] * 8) + bit) % (m_trackBytes * 8)); position < numBytes * 8; position += m_trackBytes * 8)
+                output[position >> 3] ^= (uint8_t)(0x80 >> (position & 7));
+        }
+    }
+
+    spendTime(((uint64_t)numBytes * m_settings.revolutionTimeUs) / m_trackBytes);
+    m_stats.trackReads++;
+    return numBytes * 8;
+}
+
+// Writes the track, either from the index or from wherever the disk happens to be
+bool SectorRW_Simulated::mfmWrite(uint32_t cylinder, bool upperSide, bool fromIndex, void* data, uint32_t maxLength) {
+    std::lock_guard<std::mutex> lock(m_driveLock);
+    const uint32_t track = (cylinder * 2) + (upperSide ? 1 : 0);
+    if ((!m_diskInDrive) || (m_writeProtected) || (track >= m_tracks.size()) || (!waitForSpinUp())) return false;
+    stepTo(cylinder);
+
+    if (fromIndex) waitForIndex();
+
+    // Anything longer than a revolution overwrites the start of what was just written, as it would on a real disk
+    const uint32_t startByte = currentBitPosition() >> 3;
+    const uint8_t* input = (const uint8_t*)data;
+    std::vector<uint8_t>& mfm = m_tracks[track];
+    for (uint32_t i = 0; i < maxLength; i++)
+        mfm[(startByte + i) % m_trackBytes] = input[i];
+
+    spendTime(((uint64_t)maxLength * m_settings.revolutionTimeUs) / m_trackBytes);
+    m_stats.trackWrites++;
+    return true;
+}
+
+// Makes a sector weak
+void SectorRW_Simulated::addWeakSector(uint32_t track, uint32_t sector, uint32_t numBits, uint32_t flipChance) {
+    std::lock_guard<std::mutex> lock(m_driveLock);
+    WeakSector weak;
+    weak.track = track;
+    weak.sector = sector;
+    weak.flipChance = flipChance;
+    // Only data bits (the odd ones of each MFM byte) are picked, within the first 512 bytes of data
+    for (uint32_t i = 0; i < numBits; i++)
+        weak.bits.push_back(((m_random() % (DEFAULT_SECTOR_BYTES * 2)) * 8) + 1 + ((m_random() % 4) * 2));
+    m_weakSectors.push_back(weak);
+}
+
+// Simulate removing or inserting the disk
+void SectorRW_Simulated::setDiskInDrive(bool inserted) {
+    std::lock_guard<std::mutex> lock(m_driveLock);
+    m_diskInDrive = inserted;
+}
+
+// Simulate flipping the write protect tab
+void SectorRW_Simulated::setWriteProtected(bool writeProtected) {
+    std::lock_guard<std::mutex> lock(m_driveLock);
+    m_writeProtected = writeProtected;
+}
+
+// Fetch what the drive has done so far
+SimulatedDriveStats SectorRW_Simulated::getStats() {
+    std::lock_guard<std::mutex> lock(m_driveLock);
+    return m_stats;
+}
+
+void SectorRW_Simulated::resetStats() {
+    std::lock_guard<std::mutex> lock(m_driveLock);
+    const uint64_t timeIntoRevolution = m_stats.driveTimeUs % m_settings.revolutionTimeUs;
+    m_stats = {};
+    // Keep the disk where it was
+    m_stats.driveTimeUs = timeIntoRevolution;
+}
+
+// Decodes the disk as it is now back into an image, as it would be read by a perfect drive
+std::vector<uint8_t> SectorRW_Simulated::getImage() {
+    std::vector<std::vector<uint8_t>> tracks;
+    {
+        std::lock_guard<std::mutex> lock(m_driveLock);
+        tracks = m_tracks;
+    }
+
+    std::vector<uint8_t> image(tracks.size() * m_imageSectorsPerTrack * DEFAULT_SECTOR_BYTES, 0);
+    std::vector<uint8_t> revolutions(m_trackBytes * 2);
+    DecodedTrack decodedTrack;
+    for (uint32_t track = 0; track < tracks.size(); track++) {
+        // Tracks not written from the index can have a sector across the end of the revolution, so decode two of them back to back
+        memcpy(revolutions.data(), tracks[track].data(), m_trackBytes);
+        memcpy(revolutions.data() + m_trackBytes, tracks[track].data(), m_trackBytes);
+        decodedTrack.clear();
+        if (m_diskType == SectorType::stAmiga)
+            findSectors_AMIGA(revolutions.data(), m_trackBytes * 16, m_isHD, track, m_imageSectorsPerTrack, decodedTrack);
+        else findSectors_IBM(revolutions.data(), m_trackBytes * 16, m_isHD, track, m_imageSectorsPerTrack, decodedTrack);
+
+        for (uint32_t sec = 0; sec < m_imageSectorsPerTrack; sec++) {
+            const DecodedSector* sector = decodedTrack.find(sec);
+            if ((sector) && (sector->numErrors == 0))
+                memcpy(image.data() + (((track * m_imageSectorsPerTrack) + sec) * DEFAULT_SECTOR_BYTES), decodedTrack.data(*sector), min(sector->dataSize, (uint32_t)DEFAULT_SECTOR_BYTES));
+        }
+    }
+    return image;
+}
@@ -0,0 +1,157 @@
+/* DiskFlashback, Copyright (C) 2021-2024 Robert Smith (@RobSmithDev)
+ * https://robsmithdev.co.uk/diskflashback
+ *
+ * This file is multi-licensed under the terms of the Mozilla Public
+ * License Version 2.0 as published by Mozilla Corporation and the
+ * GNU General Public License, version 2 or later, as published by the
+ * Free Software Foundation.
+ *
+ * MPL2: https://www.mozilla.org/en-US/MPL/2.0/
+ * GPL2: https://www.gnu.org/licenses/old-licenses/gpl-2.0.en.html
+ *
+ * This file is maintained at https://github.com/RobSmithDev/DiskFlashback
+ */
+
+#pragma once
+
+// A floppy drive simulated in memory, with a simple model of how long a real drive takes to do things. This lets the caching, retry and
+// write-back logic in SectorCacheMFM be timed and tested without any hardware
+#include <dokan/dokan.h>
+#include <vector>
+#include <random>
+#include <mutex>
+#include "sectorCache.h"
+#include "sectorCommon.h"
+#include "mfminterface.h"
+
+#define SIM_CYLINDERS                       80
+#define SIM_STEP_TIME_US                    3000        // Time to step the head one cylinder
+#define SIM_SETTLE_TIME_US                  15000       // Time for the head to settle after stepping
+#define SIM_SPINUP_TIME_US                  500000      // Time for the motor to get up to speed
+#define SIM_REVOLUTION_TIME_US              200000      // One revolution at 300 RPM
+#define SIM_READ_OVERLAP_BYTES              1100        // Extra MFM returned after each revolution, enough for an Amiga sector
+
+// How the simulated drive behaves
+struct SimulatedDriveSettings {
+    uint32_t stepTimeUs = SIM_STEP_TIME_US;
+    uint32_t settleTimeUs = SIM_SETTLE_TIME_US;
+    uint32_t spinUpTimeUs = SIM_SPINUP_TIME_US;
+    uint32_t revolutionTimeUs = SIM_REVOLUTION_TIME_US;
+    // If not zero, really wait this fraction of the simulated time, so the timeouts in SectorCacheMFM see it happen
+    double realTimeScale = 0.0;
+    // Seed for the weak bits, so runs can be repeated
+    uint32_t randomSeed = 1;
+    // If false, reads get the drive in the order they asked for it rather than being ordered by track, as a baseline to compare with
+    bool orderByTrack = true;
+};
+
+// What the simulated drive has done so far
+struct SimulatedDriveStats {
+    uint64_t driveTimeUs;       // Time the drive would have taken to do all of this
+    uint32_t spinUps;           // Number of times the motor was started
+    uint32_t seeks;             // Number of times the head moved
+    uint32_t cylindersStepped;  // Total distance it moved
+    uint32_t trackReads;        // Number of revolutions read
+    uint32_t trackWrites;       // Number of tracks written
+};
+
+class SectorRW_Simulated : public SectorCacheMFM {
+private:
+    // A sector that reads differently each time
+    struct WeakSector {
+        uint32_t track;
+        uint32_t sector;                    // Which sector on the track this is, in the order they're found after the index
+        uint32_t flipChance;                // Percentage chance of each weak bit reading wrong on each revolution
+        std::vector<uint32_t> bits;         // Weak bits, counted from the start of the sector's MFM data
+    };
+
+    SimulatedDriveSettings m_settings;
+    SectorType m_diskType;
+    bool m_isHD;
+    bool m_diskInDrive = true;
+    bool m_writeProtected = false;
+
+    // MFM data of each track, all the same number of bytes (one revolution)
+    std::vector<std::vector<uint8_t>> m_tracks;
+    uint32_t m_trackBytes = 0;
+    uint32_t m_imageSectorsPerTrack = 0;
+
+    // State of the drive
+    uint32_t m_cylinder = 0;
+    bool m_motorOn = false;
+    uint64_t m_spinUpRemaining = 0;
+
+    std::vector<WeakSector> m_weakSectors;
+    std::mt19937 m_random;
+
+    SimulatedDriveStats m_stats = {};
+    // Protects the state above, as the stats can be read from anywhere
+    std::mutex m_driveLock;
+
+    // Moves the drive's clock on.  Call with m_driveLock held
+    void spendTime(uint64_t timeUs);
+    // Move the head to a cylinder.  Call with m_driveLock held
+    void stepTo(uint32_t cylinder);
+    // Waits for the motor to finish spinning up. Returns FALSE if it's not on.  Call with m_driveLock held
+    bool waitForSpinUp();
+    // Waits for the index to come round.  Call with m_driveLock held
+    void waitForIndex();
+    // Where the disk is under the head right now, in bits from the index.  Call with m_driveLock held
+    uint32_t currentBitPosition();
+    // Returns the byte offset of each sector's data in the MFM of a track, in order from the index
+    std::vector<uint32_t> findSectorData(const std::vector<uint8_t>& track);
+    // Builds the MFM for every track from a disk image
+    void encodeImage(const std::vector<uint8_t>& image);
+protected:
+    virtual bool restoreDrive() override { return true; };
+    virtual void releaseDrive() override { SectorCacheMFM::releaseDrive(); };
+    virtual bool isDiskInDrive() override;
+    virtual bool isDriveWriteProtected() override;
+
+    virtual bool motorEnable(bool enable, bool upperSide) override;
+    virtual bool motorReady() override;
+    virtual bool resetDrive(uint32_t cylinder) override;
+    virtual bool writeCompleted() override { return true; };
+    virtual bool cylinderSeek(uint32_t cylinder, bool upperSide) override;
+    virtual uint32_t mfmRead(uint32_t cylinder, bool upperSide, bool retryMode, void* data, uint32_t maxLength) override;
+    virtual bool mfmWrite(uint32_t cylinder, bool upperSide, bool fromIndex, void* data, uint32_t maxLength) override;
+    virtual bool shouldPrompt() override { return false; };
+    virtual uint32_t devicePosition(const uint32_t sectorNumber) override;
+
+public:
+    // Creates a drive with the disk image (sectors in order, as an ADF or IMG file) inserted. diskType picks how the tracks are encoded,
+    // stAmiga, stIBM or stAtari. An empty image gives an unformatted disk
+    SectorRW_Simulated(const SectorType diskType, const bool isHD, const std::vector<uint8_t>& image, const SimulatedDriveSettings& settings, std::function<void(bool diskInserted, SectorType diskFormat)> diskChangeCallback);
+
+    // Return TRUE if this is actually a physical "REAL" drive
+    virtual bool isPhysicalDisk() override { return true; };
+
+    // Return an ID to identify this with
+    virtual uint32_t id() override { return 0x53494D20; };
+
+    // Returns TRUE if the inserted disk is HD
+    virtual bool isHD() override { return m_isHD; };
+
+    // Is it working?
+    virtual bool available() override { return true; };
+
+    // Returns the name of the driver providing access
+    virtual std::wstring getDriverName() override { return L"Simulated Drive"; };
+
+    // Rapid shutdown
+    virtual void quickClose() override {};
+
+    // Makes a sector weak.  numBits of its data bits are picked at random, and each one has flipChance percent chance of reading wrong
+    void addWeakSector(uint32_t track, uint32_t sector, uint32_t numBits, uint32_t flipChance);
+
+    // Simulate removing or inserting the disk, or flipping its write protect tab
+    void setDiskInDrive(bool inserted);
+    void setWriteProtected(bool writeProtected);
+
+    // Fetch what the drive has done so far
+    SimulatedDriveStats getStats();
+    void resetStats();
+
+    // Decodes the disk as it is now back into an image, as it would be read by a perfect drive
+    std::vector<uint8_t> getImage();
+};
@@ -0,0 +1,31 @@
+/* DiskFlashback, Copyright (C) 2021-2024 Robert Smith (@RobSmithDev)
+ * https://robsmithdev.co.uk/diskflashback
+ *
+ * This file is multi-licensed under the terms of the Mozilla Public
+ * License Version 2.0 as published by Mozilla Corporation and the
+ * GNU General Public License, version 2 or later, as published by the
+ * Free Software Foundation.
+ *
+ * MPL2: https://www.mozilla.org/en-US/MPL/2.0/
+ * GPL2: https://www.gnu.org/licenses/old-licenses/gpl-2.0.en.html
+ *
+ * This file is maintained at https://github.com/RobSmithDev/DiskFlashback
+ */
+
+#pragma once
+
+// Tiny test helpers.  Each test program runs its tests and returns non-zero if any check failed
+#include <stdio.h>
+#include <atomic>
+
+// Checks can fail on other threads too
+inline std::atomic<int> g_testFailures = 0;
+
+// Record a failure but keep going so one run shows everything that's wrong
+#define TEST_CHECK(cond) do { if (!(cond)) { fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); g_testFailures++; } } while (0)
+
+// Run one test function and report it
+#define TEST_RUN(fn) do { const int failuresBefore = g_testFailures; fn(); printf("%s %s\n", (g_testFailures == failuresBefore) ? "PASS" : "FAIL", #fn); } while (0)
+
+// Value to return from main
+#define TEST_RESULT() (g_testFailures ? 1 : 0)
@@ -0,0 +1,327 @@
+/* DiskFlashback, Copyright (C) 2021-2024 Robert Smith (@RobSmithDev)
+ * https://robsmithdev.co.uk/diskflashback
+ *
+ * This file is multi-licensed under the terms of the Mozilla Public
+ * License Version 2.0 as published by Mozilla Corporation and the
+ * GNU General Public License, version 2 or later, as published by the
+ * Free Software Foundation.
+ *
+ * MPL2: https://www.mozilla.org/en-US/MPL/2.0/
+ * GPL2: https://www.gnu.org/licenses/old-licenses/gpl-2.0.en.html
+ *
+ * This file is maintained at https://github.com/RobSmithDev/DiskFlashback
+ */
+
+// Tests for reading DMS archives, using small archives built here with uncompressed tracks
+#include <memory>
+#include <random>
+#include "readwrite_dms.h"
+#include "testUtil.h"
+
+extern "C" {
+#include "xdms/src/cdata.h"
+#include "xdms/src/crc_csum.h"
+}
+
+#define NUM_CYLINDERS 80
+#define SECTORS_PER_CYLINDER 22
+#define TRACK_SIZE (SECTORS_PER_CYLINDER * 512)
+#define DMS_HEADER_SIZE 56
+#define DMS_TRACK_HEADER_SIZE 20
+
+// What each byte of the disk should contain
+static uint8_t expectedByte(const uint32_t sectorNumber, const uint32_t offset) {
+    return (uint8_t)(sectorNumber * 7 + offset * 3);
+}
+
+static void putWord(std::vector<uint8_t>& data, const size_t pos, const uint16_t value) {
+    data[pos] = (uint8_t)(value >> 8);
+    data[pos + 1] = (uint8_t)value;
+}
+
+// An archive and where each cylinder's data is in it
+struct DMSArchive {
+    std::vector<uint8_t> file;
+    std::vector<size_t> trackHeader;
+    std::vector<size_t> trackData;
+};
+
+// Build an archive of a whole disk with every track stored uncompressed
+static DMSArchive buildArchive() {
+    DMSArchive archive;
+    archive.file.resize(DMS_HEADER_SIZE);
+    memcpy(archive.file.data(), "DMS!", 4);
+    const uint32_t diskSize = NUM_CYLINDERS * TRACK_SIZE;
+    archive.file[25] = (uint8_t)(diskSize >> 16);
+    archive.file[26] = (uint8_t)(diskSize >> 8);
+    archive.file[27] = (uint8_t)diskSize;
+    putWord(archive.file, DMS_HEADER_SIZE - 2, CreateCRC(archive.file.data() + 4, DMS_HEADER_SIZE - 6));
+
+    for (uint32_t cylinder = 0; cylinder < NUM_CYLINDERS; cylinder++) {
+        std::vector<uint8_t> track(TRACK_SIZE);
+        for (uint32_t index = 0; index < TRACK_SIZE; index++) track[index] = expectedByte(cylinder * SECTORS_PER_CYLINDER + index / 512, index % 512);
+
+        std::vector<uint8_t> header(DMS_TRACK_HEADER_SIZE, 0);
+        header[0] = 'T';
+        header[1] = 'R';
+        putWord(header, 2, (uint16_t)cylinder);
+        putWord(header, 6, TRACK_SIZE);
+        putWord(header, 8, TRACK_SIZE);
+        putWord(header, 10, TRACK_SIZE);
+        putWord(header, 14, Calc_CheckSum(track.data(), TRACK_SIZE));
+        putWord(header, 16, CreateCRC(track.data(), TRACK_SIZE));
+        putWord(header, 18, CreateCRC(header.data(), DMS_TRACK_HEADER_SIZE - 2));
+
+        archive.trackHeader.push_back(archive.file.size());
+        archive.file.insert(archive.file.end(), header.begin(), header.end());
+        archive.trackData.push_back(archive.file.size());
+        archive.file.insert(archive.file.end(), track.begin(), track.end());
+    }
+    return archive;
+}
+
+// Counts how often the cache had to go to the archive for sectors
+class CountingDMS : public SectorRW_DMS {
+protected:
+    bool internalReadData(const uint32_t sectorNumber, const uint32_t sectorSize, void* data) override {
+        m_archiveReads++;
+        return SectorRW_DMS::internalReadData(sectorNumber, sectorSize, data);
+    }
+    bool internalReadRuns(const std::vector<SectorRun>& runs, const uint32_t sectorSize) override {
+        m_archiveReads++;
+        return SectorRW_DMS::internalReadRuns(runs, sectorSize);
+    }
+public:
+    std::atomic<uint32_t> m_archiveReads = 0;
+
+    CountingDMS(HANDLE fle) : SectorRW_DMS(fle) {}
+};
+
+// Save the archive and open it
+static std::unique_ptr<CountingDMS> openArchive(const DMSArchive& archive, const char* filename) {
+    FILE* fle = fopen(filename, "wb");
+    if (!fle) return nullptr;
+    fwrite(archive.file.data(), 1, archive.file.size(), fle);
+    fclose(fle);
+
+    const std::string name(filename);
+    HANDLE file = CreateFile(std::wstring(name.begin(), name.end()).c_str(), GENERIC_READ, 0, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) return nullptr;
+    return std::make_unique<CountingDMS>(file);
+}
+
+// Returns TRUE if the sectors hold what was archived
+static bool sectorsMatch(const uint32_t firstSector, const uint32_t count, const uint8_t* data) {
+    for (uint32_t sector = 0; sector < count; sector++)
+        for (uint32_t offset = 0; offset < 512; offset++)
+            if (data[sector * 512 + offset] != expectedByte(firstSector + sector, offset)) return false;
+    return true;
+}
+
+// Sectors that have dropped out of the cache are decoded from the archive again
+static void EvictedSectorsAreDecodedAgain() {
+    std::unique_ptr<CountingDMS> dms = openArchive(buildArchive(), "test_dms_evicted.dms");
+    TEST_CHECK(dms && dms->available());
+    if (!dms) return;
+
+    // Read the whole disk, in parallel, then throw the cache away
+    std::vector<uint8_t> disk(NUM_CYLINDERS * TRACK_SIZE);
+    TEST_CHECK(dms->readSectors(0, NUM_CYLINDERS * SECTORS_PER_CYLINDER, 512, disk.data()));
+    TEST_CHECK(sectorsMatch(0, NUM_CYLINDERS * SECTORS_PER_CYLINDER, disk.data()));
+    dms->resetCache();
+
+    // The start of the disk is gone, so it has to be decoded again a sector at a time
+    const uint32_t readsBefore = dms->m_archiveReads;
+    uint8_t sector[512];
+    for (uint32_t sectorNumber = 0; sectorNumber < SECTORS_PER_CYLINDER * 2; sectorNumber += 5) {
+        TEST_CHECK(dms->readData(sectorNumber, 512, sector));
+        TEST_CHECK(sectorsMatch(sectorNumber, 1, sector));
+    }
+    TEST_CHECK(dms->m_archiveReads > readsBefore);
+
+    dms.reset();
+    remove("test_dms_evicted.dms");
+}
+
+// A damaged track fails reads that include it, but everything else in the same read is still decoded and cached
+static void DamagedTrackOnlyFailsItself() {
+    DMSArchive archive = buildArchive();
+    archive.file[archive.trackData[5] + 100] ^= 0xFF;
+    std::unique_ptr<CountingDMS> dms = openArchive(archive, "test_dms_damaged.dms");
+    TEST_CHECK(dms && dms->available());
+    if (!dms) return;
+
+    std::vector<uint8_t> disk(NUM_CYLINDERS * TRACK_SIZE);
+    TEST_CHECK(!dms->readSectors(0, NUM_CYLINDERS * SECTORS_PER_CYLINDER, 512, disk.data()));
+    TEST_CHECK(sectorsMatch(0, 5 * SECTORS_PER_CYLINDER, disk.data()));
+    TEST_CHECK(sectorsMatch(6 * SECTORS_PER_CYLINDER, (NUM_CYLINDERS - 6) * SECTORS_PER_CYLINDER, &disk[6 * TRACK_SIZE]));
+
+    // Everything but the damaged track should now come from the cache
+    const uint32_t readsBefore = dms->m_archiveReads;
+    std::fill(disk.begin(), disk.end(), 0);
+    TEST_CHECK(dms->readSectors(0, 5 * SECTORS_PER_CYLINDER, 512, disk.data()));
+    TEST_CHECK(dms->readSectors(6 * SECTORS_PER_CYLINDER, (NUM_CYLINDERS - 6) * SECTORS_PER_CYLINDER, 512, &disk[6 * TRACK_SIZE]));
+    TEST_CHECK(dms->m_archiveReads == readsBefore);
+    TEST_CHECK(sectorsMatch(0, 5 * SECTORS_PER_CYLINDER, disk.data()));
+    TEST_CHECK(sectorsMatch(6 * SECTORS_PER_CYLINDER, (NUM_CYLINDERS - 6) * SECTORS_PER_CYLINDER, &disk[6 * TRACK_SIZE]));
+
+    uint8_t sector[512];
+    TEST_CHECK(!dms->readData(5 * SECTORS_PER_CYLINDER + 3, 512, sector));
+
+    dms.reset();
+    remove("test_dms_damaged.dms");
+}
+
+// Change a track's header, keeping its CRC right so only the change is wrong
+static void patchTrackHeader(DMSArchive& archive, const uint32_t cylinder, const size_t pos, const uint16_t value) {
+    const size_t header = archive.trackHeader[cylinder];
+    putWord(archive.file, header + pos, value);
+    putWord(archive.file, header + DMS_TRACK_HEADER_SIZE - 2, CreateCRC(&archive.file[header], DMS_TRACK_HEADER_SIZE - 2));
+}
+
+// The original xDMS CRC, a bit at a time
+static uint16_t referenceCRC(const uint8_t* mem, size_t size) {
+    uint16_t crc = 0;
+    while (size--) {
+        crc ^= *mem++;
+        for (uint32_t bit = 0; bit < 8; bit++) crc = (crc & 1) ? (uint16_t)((crc >> 1) ^ 0xA001) : (uint16_t)(crc >> 1);
+    }
+    return crc;
+}
+
+// The original xDMS checksum, a byte at a time
+static uint16_t referenceCheckSum(const uint8_t* mem, size_t size) {
+    uint16_t sum = 0;
+    while (size--) sum += *mem++;
+    return sum;
+}
+
+// CreateCRC and Calc_CheckSum work 8 bytes at a time, which has to give the same answer for any length and alignment
+static void CRCMatchesReference() {
+    uint8_t check[] = "123456789";
+    TEST_CHECK(CreateCRC(check, 9) == 0xBB3D);
+
+    std::mt19937 random(1234);
+    std::vector<uint8_t> buffer(TRACK_SIZE + 16);
+    for (uint8_t& byte : buffer) byte = (uint8_t)random();
+    for (uint32_t start = 0; start < 8; start++)
+        for (uint32_t size = 0; size < 80; size++)
+            TEST_CHECK(CreateCRC(&buffer[start], size) == referenceCRC(&buffer[start], size));
+    for (uint32_t test = 0; test < 200; test++) {
+        const uint32_t start = random() % 16;
+        const uint32_t size = random() % TRACK_SIZE;
+        TEST_CHECK(CreateCRC(&buffer[start], size) == referenceCRC(&buffer[start], size));
+    }
+}
+
+static void CheckSumMatchesReference() {
+    std::mt19937 random(5678);
+    std::vector<uint8_t> buffer(TRACK_SIZE + 16);
+    for (uint8_t& byte : buffer) byte = (uint8_t)random();
+    for (uint32_t start = 0; start < 8; start++)
+        for (uint32_t size = 0; size < 80; size++)
+            TEST_CHECK(Calc_CheckSum(&buffer[start], size) == referenceCheckSum(&buffer[start], size));
+    for (uint32_t test = 0; test < 200; test++) {
+        const uint32_t start = random() % 16;
+        const uint32_t size = random() % TRACK_SIZE;
+        TEST_CHECK(Calc_CheckSum(&buffer[start], size) == referenceCheckSum(&buffer[start], size));
+    }
+
+    // Worst case for the lanes overflowing
+    std::fill(buffer.begin(), buffer.end(), 0xFF);
+    TEST_CHECK(Calc_CheckSum(buffer.data(), TRACK_SIZE) == referenceCheckSum(buffer.data(), TRACK_SIZE));
+}
+
+// A track whose packed data doesn't match its CRC is reported and can't be read
+static void BadDataCRCIsReported() {
+    DMSArchive archive = buildArchive();
+    archive.file[archive.trackData[12] + 3000] ^= 0x01;
+    std::unique_ptr<SectorRW_DMS> dms = openArchive(archive, "test_dms_crc.dms");
+    TEST_CHECK(dms && dms->available());
+    if (!dms) return;
+
+    TEST_CHECK(!dms->verifyArchive());
+    const std::vector<SectorRW_DMS::TrackIntegrity> report = dms->getIntegrityReport();
+    TEST_CHECK(report.size() == NUM_CYLINDERS);
+    for (const SectorRW_DMS::TrackIntegrity& track : report) {
+        TEST_CHECK(track.headerOK && track.checked);
+        TEST_CHECK(track.packedOK == (track.cylinder != 12));
+        TEST_CHECK(track.unpackedOK == (track.cylinder != 12));
+    }
+
+    uint8_t sector[512];
+    TEST_CHECK(!dms->readData(12 * SECTORS_PER_CYLINDER, 512, sector));
+    TEST_CHECK(dms->readData(13 * SECTORS_PER_CYLINDER, 512, sector));
+    TEST_CHECK(sectorsMatch(13 * SECTORS_PER_CYLINDER, 1, sector));
+
+    dms.reset();
+    remove("test_dms_crc.dms");
+}
+
+// A track that unpacks to the wrong checksum is only refused when verifying
+static void BadCheckSumOnlyRefusedWhenVerifying() {
+    DMSArchive archive = buildArchive();
+    patchTrackHeader(archive, 7, 14, 0x1234);
+    std::unique_ptr<SectorRW_DMS> dms = openArchive(archive, "test_dms_checksum.dms");
+    TEST_CHECK(dms && dms->available());
+    if (!dms) return;
+
+    uint8_t sector[512];
+    TEST_CHECK(dms->readData(7 * SECTORS_PER_CYLINDER + 1, 512, sector));
+    TEST_CHECK(sectorsMatch(7 * SECTORS_PER_CYLINDER + 1, 1, sector));
+    dms.reset();
+
+    dms = openArchive(archive, "test_dms_checksum.dms");
+    TEST_CHECK(dms && dms->available());
+    if (!dms) return;
+    dms->setVerify(true);
+    TEST_CHECK(!dms->readData(7 * SECTORS_PER_CYLINDER + 1, 512, sector));
+    TEST_CHECK(dms->readData(8 * SECTORS_PER_CYLINDER + 1, 512, sector));
+    TEST_CHECK(!dms->verifyArchive());
+    const std::vector<SectorRW_DMS::TrackIntegrity> report = dms->getIntegrityReport();
+    TEST_CHECK(report.size() == NUM_CYLINDERS);
+    for (const SectorRW_DMS::TrackIntegrity& track : report) {
+        TEST_CHECK(track.headerOK && track.checked && track.packedOK);
+        TEST_CHECK(track.unpackedOK == (track.cylinder != 7));
+    }
+
+    dms.reset();
+    remove("test_dms_checksum.dms");
+}
+
+// Nothing after a damaged track header can be found, so the disk ends there
+static void BadHeaderEndsIndex() {
+    DMSArchive archive = buildArchive();
+    archive.file[archive.trackHeader[60] + 6] ^= 0x01;
+    std::unique_ptr<SectorRW_DMS> dms = openArchive(archive, "test_dms_header.dms");
+    TEST_CHECK(dms && dms->available());
+    if (!dms) return;
+
+    TEST_CHECK(dms->totalNumTracks() == 60 * 2);
+    const std::vector<SectorRW_DMS::TrackIntegrity> report = dms->getIntegrityReport();
+    TEST_CHECK(report.size() == 61);
+    if (report.size() == 61) {
+        TEST_CHECK(report.back().cylinder == 60);
+        TEST_CHECK(!report.back().headerOK);
+        TEST_CHECK(report[59].headerOK);
+    }
+
+    uint8_t sector[512];
+    TEST_CHECK(dms->readData(59 * SECTORS_PER_CYLINDER, 512, sector));
+    TEST_CHECK(!dms->readData(61 * SECTORS_PER_CYLINDER, 512, sector));
+    TEST_CHECK(!dms->verifyArchive());
+
+    dms.reset();
+    remove("test_dms_header.dms");
+}
+
+int main() {
+    TEST_RUN(EvictedSectorsAreDecodedAgain);
+    TEST_RUN(DamagedTrackOnlyFailsItself);
+    TEST_RUN(CRCMatchesReference);
+    TEST_RUN(CheckSumMatchesReference);
+    TEST_RUN(BadDataCRCIsReported);
+    TEST_RUN(BadCheckSumOnlyRefusedWhenVerifying);
+    TEST_RUN(BadHeaderEndsIndex);
+    return TEST_RESULT();
+}
@@ -0,0 +1,527 @@
+/* DiskFlashback, Copyright (C) 2021-2024 Robert Smith (@RobSmithDev)
+ * https://robsmithdev.co.uk/diskflashback
+ *
+ * This file is multi-licensed under the terms of the Mozilla Public
+ * License Version 2.0 as published by Mozilla Corporation and the
+ * GNU General Public License, version 2 or later, as published by the
+ * Free Software Foundation.
+ *
+ * MPL2: https://www.mozilla.org/en-US/MPL/2.0/
+ * GPL2: https://www.gnu.org/licenses/old-licenses/gpl-2.0.en.html
+ *
+ * This file is maintained at https://github.com/RobSmithDev/DiskFlashback
+ */
+
+// Tests for the MFM helpers used by the Amiga and IBM decoders, checked against simple bit-at-a-time versions
+#include <random>
+#include "ibm_sectors.h"
+#include "amiga_sectors.h"
+#include "testUtil.h"
+
+// Not in a header, only the IBM decoder uses them
+void extractMFMDecodeRaw(const unsigned char* inTrack, const uint32_t dataLengthInBits, const uint32_t bitPos, uint32_t outputBytes, uint8_t* output);
+uint16_t crc16(char* pData, int length, uint32_t wCrc);
+
+// Bit n of an MFM track, most significant bit first
+static uint32_t trackBit(const uint8_t* track, const uint32_t bitPos) {
+    return (track[bitPos >> 3] >> (7 - (bitPos & 7))) & 1;
+}
+
+// A random track of the given length, with whatever is after the last bit left random too
+static std::vector<uint8_t> randomTrack(std::mt19937& random, const uint32_t lengthInBits) {
+    std::vector<uint8_t> track((lengthInBits + 7) / 8);
+    for (uint8_t& byte : track) byte = (uint8_t)random();
+    return track;
+}
+
+// extractTrackBits copies whole runs at once, which has to give the same as copying a bit at a time for every alignment and wrap
+static void ExtractTrackBitsMatchesBitLoop() {
+    std::mt19937 random(42);
+    const uint32_t lengths[] = { 64, 101, 1000, 1003, 12671, 100000 };
+    for (const uint32_t length : lengths) {
+        const std::vector<uint8_t> track = randomTrack(random, length);
+        for (uint32_t test = 0; test < 300; test++) {
+            // Every alignment of the start near the end of the track, and some anywhere
+            const uint32_t startBit = (test < 64) ? length - 1 - (test % min(length, 64U)) : random() % (length * 2);
+            const uint32_t numBits = 1 + random() % min(length * 2, 9000U);
+            std::vector<uint8_t> output((numBits + 7) / 8 + 1, 0xAA);
+            extractTrackBits(track.data(), length, startBit, numBits, output.data());
+
+            std::vector<uint8_t> expected((numBits + 7) / 8 + 1, 0xAA);
+            std::fill(expected.begin(), expected.begin() + (numBits + 7) / 8, 0);
+            for (uint32_t bit = 0; bit < numBits; bit++)
+                if (trackBit(track.data(), (startBit + bit) % length)) expected[bit >> 3] |= (uint8_t)(0x80 >> (bit & 7));
+            TEST_CHECK(output == expected);
+        }
+    }
+}
+
+// extractMFMDecodeRaw takes every other bit after the clock bit, wrapping around the track
+static void ExtractIBMDataBitsMatchesBitLoop() {
+    std::mt19937 random(43);
+    const uint32_t lengths[] = { 1001, 12671, 100000 };
+    for (const uint32_t length : lengths) {
+        const std::vector<uint8_t> track = randomTrack(random, length);
+        for (uint32_t test = 0; test < 200; test++) {
+            const uint32_t bitPos = (test < 32) ? length - 1 - test : random() % length;
+            const uint32_t numBytes = 1 + random() % 1100;
+            std::vector<uint8_t> output(numBytes);
+            extractMFMDecodeRaw(track.data(), length, bitPos, numBytes, output.data());
+
+            std::vector<uint8_t> expected(numBytes, 0);
+            uint32_t pos = (bitPos + 1) % length;
+            for (uint32_t bit = 0; bit < numBytes * 8; bit++) {
+                expected[bit >> 3] = (uint8_t)((expected[bit >> 3] << 1) | trackBit(track.data(), pos));
+                pos = (pos + 2) % length;
+            }
+            TEST_CHECK(output == expected);
+        }
+    }
+}
+
+#define AMIGA_FILLER_BYTES 1654
+#define AMIGA_RAW_SECTOR_SIZE (8 + 56 + 512 + 512)
+
+// The original clock bit loop, a bit at a time
+static void referenceClockBits(uint8_t* sector) {
+    bool lastBit = sector[7] & 1;
+    bool thisBit = lastBit;
+    for (uint32_t count = 8; count < AMIGA_RAW_SECTOR_SIZE; count++)
+        for (int bit = 7; bit >= 1; bit -= 2) {
+            lastBit = thisBit;
+            thisBit = sector[count] & (1 << (bit - 1));
+            if (!(lastBit || thisBit)) sector[count] |= (uint8_t)(1 << bit);
+        }
+}
+
+// Amiga sectors have their clock bits filled in a word at a time, which should give exactly what the old loop did and decode again
+static void AmigaClockBitsMatchBitLoop() {
+    std::mt19937 random(44);
+    for (uint32_t pattern = 0; pattern < 6; pattern++) {
+        DecodedTrack track;
+        for (uint32_t sectorNumber = 0; sectorNumber < 11; sectorNumber++) {
+            uint8_t data[512];
+            for (uint32_t i = 0; i < 512; i++) {
+                switch (pattern) {
+                case 0: data[i] = 0x00; break;
+                case 1: data[i] = 0xFF; break;
+                case 2: data[i] = 0xAA; break;
+                case 3: data[i] = 0x55; break;
+                default: data[i] = (uint8_t)random(); break;
+                }
+            }
+            track.set(sectorNumber, data, 512, 0);
+        }
+
+        const uint32_t trackNumber = 17 + pattern;
+        std::vector<uint8_t> mfm(MAX_TRACK_SIZE);
+        const uint32_t size = encodeSectorsIntoMFM_AMIGA(false, track, trackNumber, (uint32_t)mfm.size(), mfm.data());
+        TEST_CHECK(size == AMIGA_FILLER_BYTES + (11 * AMIGA_RAW_SECTOR_SIZE) + 8);
+
+        for (uint32_t sectorNumber = 0; sectorNumber < 11; sectorNumber++) {
+            const uint8_t* encoded = &mfm[AMIGA_FILLER_BYTES + (sectorNumber * AMIGA_RAW_SECTOR_SIZE)];
+            uint8_t expected[AMIGA_RAW_SECTOR_SIZE];
+            memcpy(expected, encoded, sizeof(expected));
+            for (uint32_t i = 8; i < AMIGA_RAW_SECTOR_SIZE; i++) expected[i] &= 0x55;
+            referenceClockBits(expected);
+            TEST_CHECK(memcmp(expected, encoded, sizeof(expected)) == 0);
+        }
+
+        DecodedTrack decoded;
+        findSectors_AMIGA(mfm.data(), size * 8, false, trackNumber, 11, decoded);
+        TEST_CHECK(decoded.size() == 11);
+        for (uint32_t sectorNumber = 0; sectorNumber < 11; sectorNumber++) {
+            const DecodedSector* original = track.find(sectorNumber);
+            const DecodedSector* sector = decoded.find(sectorNumber);
+            TEST_CHECK(sector && sector->numErrors == 0);
+            if (sector) TEST_CHECK((sector->dataSize == 512) && (memcmp(decoded.data(*sector), track.data(*original), 512) == 0));
+        }
+    }
+}
+
+// The original IBM CRC16, a bit at a time
+static uint16_t referenceCRC16(const uint8_t* data, int length, uint32_t crc) {
+    while (length--) {
+        crc ^= *data++ << 8;
+        for (uint32_t i = 0; i < 8; i++) crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+    return crc & 0xFFFF;
+}
+
+// crc16 works 8 bytes at a time, which has to give the same answer for any length and alignment, and when carried on from an earlier CRC
+static void CRC16MatchesBitLoop() {
+    char check[] = "123456789";
+    TEST_CHECK(crc16(check, 9, 0xFFFF) == 0x29B1);
+
+    std::mt19937 random(45);
+    std::vector<uint8_t> buffer(2048 + 16);
+    for (uint8_t& byte : buffer) byte = (uint8_t)random();
+    for (uint32_t start = 0; start < 8; start++)
+        for (int length = 0; length < 80; length++)
+            TEST_CHECK(crc16((char*)&buffer[start], length, 0xFFFF) == referenceCRC16(&buffer[start], length, 0xFFFF));
+    for (uint32_t test = 0; test < 200; test++) {
+        const uint32_t start = random() % 16;
+        const int length = (int)(random() % 2048);
+        const uint32_t initial = random() & 0xFFFF;
+        TEST_CHECK(crc16((char*)&buffer[start], length, initial) == referenceCRC16(&buffer[start], length, initial));
+    }
+
+    // The IBM decoder does the sync marks first, then carries on over the sector
+    const uint16_t marks = crc16((char*)buffer.data(), 4, 0xFFFF);
+    TEST_CHECK(crc16((char*)&buffer[4], 512, marks) == referenceCRC16(buffer.data(), 516, 0xFFFF));
+}
+
+// A DD IBM track of random sectors, and its MFM
+// Not in a header, only the Amiga decoder uses them
+typedef unsigned char RawEncodedSector[AMIGA_RAW_SECTOR_SIZE];
+void extractRawSector(const unsigned char* inTrack, const uint32_t dataLengthInBits, const uint32_t bitPos, RawEncodedSector& outSector);
+void decodeSector(const RawEncodedSector& rawSector, const uint32_t trackNumber, const uint32_t expectedNumSectors, DecodedTrack& decodedTrack);
+
+// The track moved along by 'shift' bits of 0xAA filler, then started 'rotate' bits later so the end wraps around to the start
+static std::vector<uint8_t> shiftTrack(const uint8_t* mfm, const uint32_t lengthInBits, const uint32_t shift, const uint32_t rotate, uint32_t& newLengthInBits) {
+    newLengthInBits = lengthInBits + shift;
+    std::vector<uint8_t> output((newLengthInBits + 7) / 8, 0);
+    for (uint32_t bit = 0; bit < newLengthInBits; bit++) {
+        const uint32_t source = (bit + rotate) % newLengthInBits;
+        const uint32_t value = (source < shift) ? ((source & 1) ^ 1) : trackBit(mfm, source - shift);
+        if (value) output[bit >> 3] |= (uint8_t)(0x80 >> (bit & 7));
+    }
+    return output;
+}
+
+// TRUE if both tracks have the same sectors, errors and data
+static bool sameSectors(const DecodedTrack& a, const DecodedTrack& b) {
+    if ((a.present != b.present) || (a.sectorsWithErrors != b.sectorsWithErrors)) return false;
+    for (uint32_t sectorNumber = 0; sectorNumber < MAX_SECTORS_PER_TRACK; sectorNumber++) {
+        const DecodedSector* sa = a.find(sectorNumber);
+        const DecodedSector* sb = b.find(sectorNumber);
+        if (!sa) continue;
+        if ((sa->numErrors != sb->numErrors) || (sa->dataSize != sb->dataSize)) return false;
+        if (memcmp(a.data(*sa), b.data(*sb), sa->dataSize)) return false;
+    }
+    return true;
+}
+
+// The original Amiga sync search, shifting the track into a register a bit at a time
+static void referenceFindSectors_AMIGA(const uint8_t* track, const uint32_t dataLengthInBits, const uint32_t trackNumber, const uint32_t expectedNumSectors, DecodedTrack& decodedTrack) {
+    const uint32_t search = 0x44894489;
+    const uint32_t totalBitsToSearch = dataLengthInBits + (AMIGA_RAW_SECTOR_SIZE * 8 * 3);
+    RawEncodedSector alignedSector;
+    uint32_t decoded = 0;
+    for (uint32_t bit = 0; bit < totalBitsToSearch; bit++) {
+        decoded = (decoded << 1) | trackBit(track, bit % dataLengthInBits);
+        if (decoded == search) {
+            extractRawSector(track, dataLengthInBits, (bit + 1) % dataLengthInBits, alignedSector);
+            decodeSector(alignedSector, trackNumber, expectedNumSectors, decodedTrack);
+        }
+    }
+
+    decodedTrack.sectorsWithErrors = 0;
+    for (uint32_t sec = 0; sec < expectedNumSectors; sec++) {
+        const DecodedSector* it = decodedTrack.find(sec);
+        if (!it) {
+            if (decodedTrack.add(sec, 512, 0xFFFF)) decodedTrack.sectorsWithErrors++;
+        }
+        else
+            if (it->numErrors) decodedTrack.sectorsWithErrors++;
+    }
+}
+
+// The Amiga search looks for the sync a byte at a time with a table, which has to find the same sectors as shifting a bit at a time,
+// whatever bit the sectors start on, and when a sync is split across the end and start of the track
+static void AmigaSyncSearchMatchesBitLoop() {
+    std::mt19937 random(45);
+    DecodedTrack track;
+    for (uint32_t sectorNumber = 0; sectorNumber < 11; sectorNumber++) {
+        uint8_t data[512];
+        for (uint8_t& byte : data) byte = (uint8_t)random();
+        track.set(sectorNumber, data, 512, 0);
+    }
+    const uint32_t trackNumber = 33;
+    std::vector<uint8_t> mfm(MAX_TRACK_SIZE);
+    const uint32_t size = encodeSectorsIntoMFM_AMIGA(false, track, trackNumber, (uint32_t)mfm.size(), mfm.data());
+    // A data bit in the middle of sector 6, so one sector fails its checksum
+    mfm[AMIGA_FILLER_BYTES + (6 * AMIGA_RAW_SECTOR_SIZE) + 300] ^= 0x10;
+
+    for (uint32_t shift = 0; shift < 16; shift++) {
+        // Starting as written, and starting part way through the sync of sector 4 so it's split across the wrap
+        const uint32_t syncBit = (AMIGA_FILLER_BYTES + (4 * AMIGA_RAW_SECTOR_SIZE) + 4) * 8 + shift;
+        const uint32_t rotations[] = { 0, syncBit + 1 + shift, syncBit + 17, syncBit + 31 };
+        for (const uint32_t rotate : rotations) {
+            uint32_t lengthInBits;
+            const std::vector<uint8_t> shifted = shiftTrack(mfm.data(), size * 8, shift, rotate, lengthInBits);
+
+            DecodedTrack decoded, expected;
+            findSectors_AMIGA(shifted.data(), lengthInBits, false, trackNumber, 11, decoded);
+            referenceFindSectors_AMIGA(shifted.data(), lengthInBits, trackNumber, 11, expected);
+            TEST_CHECK(sameSectors(decoded, expected));
+            TEST_CHECK(decoded.size() == 11);
+            TEST_CHECK(decoded.sectorsWithErrors == 1);
+            for (uint32_t sectorNumber = 0; sectorNumber < 11; sectorNumber++) {
+                const DecodedSector* sector = decoded.find(sectorNumber);
+                if (sectorNumber == 6) TEST_CHECK(sector && sector->numErrors);
+                else TEST_CHECK(sector && (sector->numErrors == 0) && (memcmp(decoded.data(*sector), track.data(*track.find(sectorNumber)), 512) == 0));
+            }
+        }
+    }
+
+    // Noise, with the odd sync dropped in at random, finds whatever the bit loop does
+    for (uint32_t test = 0; test < 20; test++) {
+        const uint32_t lengthInBits = 100000 + random() % 16;
+        std::vector<uint8_t> noise = randomTrack(random, lengthInBits);
+        for (uint32_t sync = 0; sync < 8; sync++) {
+            const uint32_t start = random() % (lengthInBits - 40);
+            for (uint32_t bit = 0; bit < 32; bit++) {
+                const uint32_t pos = start + bit;
+                noise[pos >> 3] = (uint8_t)((noise[pos >> 3] & ~(0x80 >> (pos & 7))) | (((0x44894489U >> (31 - bit)) & 1) ? (0x80 >> (pos & 7)) : 0));
+            }
+        }
+        DecodedTrack decoded, expected;
+        findSectors_AMIGA(noise.data(), lengthInBits, false, 0, 11, decoded);
+        referenceFindSectors_AMIGA(noise.data(), lengthInBits, 0, 11, expected);
+        TEST_CHECK(sameSectors(decoded, expected));
+    }
+}
+
+struct IBMTrack {
+    DecodedTrack sectors;
+    std::vector<uint8_t> mfm;
+    uint32_t sizeInBits = 0;
+};
+
+static IBMTrack buildIBMTrack(std::mt19937& random, const uint32_t trackNumber, const bool isHD = false, const bool atariTiming = false, const uint32_t numSectors = 9) {
+    IBMTrack track;
+    for (uint32_t sectorNumber = 0; sectorNumber < numSectors; sectorNumber++) {
+        uint8_t data[512];
+        for (uint8_t& byte : data) byte = (uint8_t)random();
+        track.sectors.set(sectorNumber, data, 512, 0);
+    }
+    track.mfm.resize(MAX_TRACK_SIZE);
+    track.sizeInBits = encodeSectorsIntoMFM_IBM(isHD, atariTiming, &track.sectors, trackNumber, (uint32_t)track.mfm.size(), track.mfm.data()) * 8;
+    return track;
+}
+
+// Flips data bit 'bit' of byte 'offset' of the sector data that follows the index'th data mark in the MFM
+static void damageIBMData(std::vector<uint8_t>& mfm, const uint32_t index, const uint32_t offset, const uint32_t bit) {
+    const uint8_t dataMark[] = { 0x44, 0x89, 0x44, 0x89, 0x44, 0x89, 0x55, 0x45 };
+    uint32_t found = 0;
+    for (size_t pos = 0; pos + sizeof(dataMark) < mfm.size(); pos++)
+        if ((memcmp(&mfm[pos], dataMark, sizeof(dataMark)) == 0) && (found++ == index)) {
+            // Each data byte is 16 bits of MFM, the data bits being the odd ones
+            const size_t mfmBit = ((pos + sizeof(dataMark)) * 8) + (offset * 16) + ((7 - bit) * 2) + 1;
+            mfm[mfmBit >> 3] ^= (uint8_t)(0x80 >> (mfmBit & 7));
+            return;
+        }
+}
+
+// Which sector in the track has errors, or -1 if there isn't exactly one
+static int sectorWithErrors(const DecodedTrack& track) {
+    int found = -1;
+    for (uint32_t sectorNumber = 0; sectorNumber < 9; sectorNumber++) {
+        const DecodedSector* sector = track.find(sectorNumber);
+        if ((sector) && (sector->numErrors)) {
+            if (found >= 0) return -1;
+            found = (int)sectorNumber;
+        }
+    }
+    return found;
+}
+
+// A sector read with a bad header and bad data counts both errors, so it's never taken as good or kept over a better read
+static void IBMBadHeaderAndDataCountsBoth() {
+    std::mt19937 random(48);
+    IBMTrack track = buildIBMTrack(random, 10);
+    damageIBMData(track.mfm, 4, 100, 3);
+
+    DecodedTrack decoded;
+    findSectors_IBM(track.mfm.data(), track.sizeInBits, false, 10, 9, decoded);
+    const int damaged = sectorWithErrors(decoded);
+    TEST_CHECK(damaged >= 0);
+    if (damaged < 0) return;
+    TEST_CHECK(decoded.find(damaged)->numErrors == 1);
+    TEST_CHECK(decoded.sectorsWithErrors == 1);
+
+    // Read as the wrong cylinder every header is bad, and the damaged sector has bad data as well
+    DecodedTrack wrongCylinder;
+    findSectors_IBM(track.mfm.data(), track.sizeInBits, false, 12, 9, wrongCylinder);
+    for (uint32_t sectorNumber = 0; sectorNumber < 9; sectorNumber++) {
+        const DecodedSector* sector = wrongCylinder.find(sectorNumber);
+        TEST_CHECK(sector && sector->numErrors == (((int)sectorNumber == damaged) ? 2U : 1U));
+    }
+
+    // And it mustn't replace the read that only had bad data
+    findSectors_IBM(track.mfm.data(), track.sizeInBits, false, 12, 9, decoded);
+    TEST_CHECK(decoded.find(damaged)->numErrors == 1);
+    TEST_CHECK(decoded.sectorsWithErrors == 1);
+}
+
+// The original IBM mark search, shifting the track into a register a bit at a time. Sectors are kept the same way, but failed reads
+// aren't voted on
+static void referenceFindSectors_IBM(const uint8_t* track, const uint32_t dataLengthInBits, const uint32_t trackNumber, const uint32_t expectedNumSectors, DecodedTrack& decodedTrack, bool& nonstandardTimings) {
+    uint8_t header[10];       // A1A1A1FE, cylinder, head, sector, length, CRC
+    uint32_t headerErrors = 0;
+    bool headerFound = false;
+    uint8_t sectorSize = 2;
+    uint32_t sectorEndPoint = 0, gapTotal = 0, numGaps = 0;
+    std::vector<uint8_t> field;
+    uint64_t decoded = 0;
+
+    for (uint32_t bit = 0; bit < dataLengthInBits; bit++) {
+        decoded = (decoded << 1) | trackBit(track, bit);
+        if (decoded == 0x4489448944895554ULL) {
+            if (sectorEndPoint) {
+                const int32_t gap = (int32_t)((bit + 1 - 64 - sectorEndPoint) / 16) - 24;
+                gapTotal += min((uint32_t)max(0, gap), 200U);
+                numGaps++;
+            }
+            extractMFMDecodeRaw(track, dataLengthInBits, bit + 1 - 64, sizeof(header), header);
+            headerErrors = 0;
+            headerFound = true;
+            if (header[6] < 1) { header[6] = 1; headerErrors++; }
+            if (header[7] > 7) { header[7] = sectorSize; headerErrors++; }
+            if (crc16((char*)header, 8, 0xFFFF) != ((header[8] << 8) | header[9])) headerErrors++;
+            if (!headerErrors) sectorSize = header[7];
+            if (header[4] != trackNumber / 2) headerErrors++;
+            if (header[5] != (trackNumber & 1)) headerErrors++;
+        }
+        else if (((decoded == 0x4489448944895545ULL) || (decoded == 0x448944894489554AULL)) && headerFound) {
+            const uint32_t sectorDataSize = 1 << (7 + header[7]);
+            field.resize(4 + sectorDataSize + 2);
+            extractMFMDecodeRaw(track, dataLengthInBits, bit + 1 - 64, (uint32_t)field.size(), field.data());
+            const bool dataValid = crc16((char*)field.data(), 4 + sectorDataSize, 0xFFFF) == ((field[4 + sectorDataSize] << 8) | field[5 + sectorDataSize]);
+            const uint32_t numErrors = headerErrors + (dataValid ? 0 : 1);
+            const DecodedSector* existing = decodedTrack.find(header[6] - 1);
+            if ((!existing) || (existing->numErrors > numErrors)) decodedTrack.set(header[6] - 1, field.data() + 4, sectorDataSize, numErrors);
+            headerFound = false;
+            sectorEndPoint = bit + 1 - 64 + ((4 + sectorDataSize) * 16) + 32;
+        }
+        else if (decoded == 0x5224522452245552ULL) headerFound = false;
+    }
+    nonstandardTimings = numGaps && (gapTotal / numGaps < 70);
+
+    decodedTrack.sectorsWithErrors = 0;
+    for (uint32_t sec = 0; sec < expectedNumSectors; sec++) {
+        const DecodedSector* it = decodedTrack.find(sec);
+        if (!it) {
+            if (decodedTrack.add(sec, 1 << (7 + header[7]), 0xFFFF)) decodedTrack.sectorsWithErrors++;
+        }
+        else
+            if (it->numErrors) decodedTrack.sectorsWithErrors++;
+    }
+}
+
+// The IBM search looks for marks a byte at a time with a table, which has to find the same sectors, and work out the same timings, as
+// shifting a bit at a time whatever bit the track starts on. Checked for DD, HD and Atari gaps, with one sector's data damaged
+static void IBMSyncSearchMatchesBitLoop() {
+    std::mt19937 random(50);
+    struct Format { bool isHD; bool atariTiming; uint32_t numSectors; };
+    const Format formats[] = { { false, false, 9 }, { true, false, 18 }, { false, true, 9 }, { false, true, 10 } };
+    for (const Format& format : formats) {
+        const uint32_t trackNumber = 21;
+        IBMTrack track = buildIBMTrack(random, trackNumber, format.isHD, format.atariTiming, format.numSectors);
+        TEST_CHECK(track.sizeInBits > 0);
+        damageIBMData(track.mfm, 4, 100, 3);
+
+        for (uint32_t shift = 0; shift < 16; shift++) {
+            uint32_t lengthInBits;
+            const std::vector<uint8_t> shifted = shiftTrack(track.mfm.data(), track.sizeInBits, shift, 0, lengthInBits);
+
+            DecodedTrack decoded, expected;
+            bool nonstandard = !format.atariTiming, expectedNonstandard = !format.atariTiming;
+            findSectors_IBM(shifted.data(), lengthInBits, format.isHD, trackNumber, format.numSectors, decoded, nonstandard);
+            referenceFindSectors_IBM(shifted.data(), lengthInBits, trackNumber, format.numSectors, expected, expectedNonstandard);
+            TEST_CHECK(sameSectors(decoded, expected));
+            TEST_CHECK(nonstandard == expectedNonstandard);
+            TEST_CHECK(nonstandard == format.atariTiming);
+
+            TEST_CHECK(decoded.size() == format.numSectors);
+            TEST_CHECK(decoded.sectorsWithErrors == 1);
+            for (uint32_t sectorNumber = 0; sectorNumber < format.numSectors; sectorNumber++) {
+                const DecodedSector* sector = decoded.find(sectorNumber);
+                if (sectorNumber == 4) TEST_CHECK(sector && sector->numErrors == 1);
+                else TEST_CHECK(sector && (sector->numErrors == 0) && (memcmp(decoded.data(*sector), track.sectors.data(*track.sectors.find(sectorNumber)), 512) == 0));
+            }
+        }
+    }
+}
+
+// Reads of a sector with different bits wrong are voted on to recover it
+static void IBMVotingRecoversSector() {
+    std::mt19937 random(49);
+    IBMTrack clean = buildIBMTrack(random, 3);
+    DecodedTrack decoded;
+    int damaged = -1;
+    for (uint32_t read = 0; read < 3; read++) {
+        std::vector<uint8_t> mfm = clean.mfm;
+        damageIBMData(mfm, 2, 10 + (read * 50), read);
+        findSectors_IBM(mfm.data(), clean.sizeInBits, false, 3, 9, decoded);
+        if (read == 0) damaged = sectorWithErrors(decoded);
+        // It takes three reads before there's a majority
+        if (read < 2) TEST_CHECK((damaged >= 0) && (sectorWithErrors(decoded) == damaged));
+    }
+    TEST_CHECK(damaged >= 0);
+    if (damaged < 0) return;
+    const DecodedSector* sector = decoded.find(damaged);
+    TEST_CHECK(sector->numErrors == 0);
+    TEST_CHECK(memcmp(decoded.data(*sector), clean.sectors.data(*clean.sectors.find(damaged)), 512) == 0);
+    TEST_CHECK(decoded.sectorsWithErrors == 0);
+}
+
+// voteSectorCopies takes the majority of each bit, with ties going to the newest copy
+static void VoteSectorCopiesTakesMajority() {
+    DecodedTrack track;
+    uint8_t original[16];
+    for (uint32_t i = 0; i < sizeof(original); i++) original[i] = (uint8_t)(i * 37);
+    DecodedSector* sector = track.set(0, original, sizeof(original), 1);
+    TEST_CHECK(sector != nullptr);
+    if (!sector) return;
+
+    // Each copy wrong in a different place
+    uint8_t copy[16], output[16];
+    for (uint32_t read = 0; read < 3; read++) {
+        memcpy(copy, original, sizeof(copy));
+        copy[read * 5] ^= (uint8_t)(1 << read);
+        const bool voted = voteSectorCopies(track, *sector, copy, sizeof(copy), output);
+        TEST_CHECK(voted == (read == 2));
+    }
+    TEST_CHECK(memcmp(output, original, sizeof(output)) == 0);
+
+    // Two copies of 0x00 and two of 0xFF is a tie, which the newest wins
+    DecodedSector* tied = track.set(1, original, sizeof(original), 1);
+    memset(copy, 0x00, sizeof(copy));
+    voteSectorCopies(track, *tied, copy, sizeof(copy), output);
+    voteSectorCopies(track, *tied, copy, sizeof(copy), output);
+    memset(copy, 0xFF, sizeof(copy));
+    voteSectorCopies(track, *tied, copy, sizeof(copy), output);
+    TEST_CHECK(voteSectorCopies(track, *tied, copy, sizeof(copy), output));
+    TEST_CHECK((output[0] == 0xFF) && (output[15] == 0xFF));
+    memset(copy, 0x00, sizeof(copy));
+    voteSectorCopies(track, *tied, copy, sizeof(copy), output);
+    TEST_CHECK((output[0] == 0x00) && (output[15] == 0x00));
+
+    // Only the last MAX_SECTOR_VOTES copies count
+    DecodedSector* replaced = track.set(2, original, sizeof(original), 1);
+    memset(copy, 0x00, sizeof(copy));
+    for (uint32_t read = 0; read < MAX_SECTOR_VOTES; read++) voteSectorCopies(track, *replaced, copy, sizeof(copy), output);
+    memset(copy, 0xFF, sizeof(copy));
+    for (uint32_t read = 0; read < (MAX_SECTOR_VOTES / 2) + 1; read++) voteSectorCopies(track, *replaced, copy, sizeof(copy), output);
+    TEST_CHECK(replaced->numVotes == MAX_SECTOR_VOTES);
+    TEST_CHECK(output[7] == 0xFF);
+
+    // A copy of a different size starts again
+    TEST_CHECK(!voteSectorCopies(track, *replaced, copy, 8, output));
+    TEST_CHECK(replaced->numVotes == 1);
+}
+
+int main() {
+    TEST_RUN(ExtractTrackBitsMatchesBitLoop);
+    TEST_RUN(ExtractIBMDataBitsMatchesBitLoop);
+    TEST_RUN(AmigaClockBitsMatchBitLoop);
+    TEST_RUN(AmigaSyncSearchMatchesBitLoop);
+    TEST_RUN(CRC16MatchesBitLoop);
+    TEST_RUN(IBMBadHeaderAndDataCountsBoth);
+    TEST_RUN(IBMVotingRecoversSector);
+    TEST_RUN(IBMSyncSearchMatchesBitLoop);
+    TEST_RUN(VoteSectorCopiesTakesMajority);
+    return TEST_RESULT();
+}
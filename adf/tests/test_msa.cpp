@@ -0,0 +1,206 @@
+/* DiskFlashback, Copyright (C) 2021-2024 Robert Smith (@RobSmithDev)
+ * https://robsmithdev.co.uk/diskflashback
+ *
+ * This file is multi-licensed under the terms of the Mozilla Public
+ * License Version 2.0 as published by Mozilla Corporation and the
+ * GNU General Public License, version 2 or later, as published by the
+ * Free Software Foundation.
+ *
+ * MPL2: https://www.mozilla.org/en-US/MPL/2.0/
+ * GPL2: https://www.gnu.org/licenses/old-licenses/gpl-2.0.en.html
+ *
+ * This file is maintained at https://github.com/RobSmithDev/DiskFlashback
+ */
+
+// Tests for reading Atari MSA images, using small images built here
+#include <string.h>
+#include <functional>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+#include "readwrite_file.h"
+#include "testUtil.h"
+
+#define NUM_CYLINDERS 80
+#define NUM_HEADS 2
+#define NUM_TRACKS (NUM_CYLINDERS * NUM_HEADS)
+#define SECTORS_PER_TRACK 9
+#define TRACK_SIZE (SECTORS_PER_TRACK * 512)
+#define NUM_SECTORS (NUM_TRACKS * SECTORS_PER_TRACK)
+
+// How each track is stored in the image
+enum class TrackPacking { tpRLE, tpUncompressed, tpTruncated };
+
+// Sends every read through the MSA track cache rather than the sector cache
+class UncachedMSA : public SectorRW_File {
+public:
+    UncachedMSA(const std::wstring& filename, HANDLE fle) : SectorRW_File(filename, fle) { disableCache(); }
+};
+
+static void putWord(std::vector<uint8_t>& data, const size_t pos, const uint16_t value) {
+    data[pos] = (uint8_t)(value >> 8);
+    data[pos + 1] = (uint8_t)value;
+}
+
+// What each byte of the disk should contain.  Each sector starts with a run, there's another at the end of each track, and the
+// rest has plenty of 0xE5 bytes that have to be escaped
+static uint8_t expectedByte(const uint32_t sectorNumber, const uint32_t offset) {
+    if (offset < 40) return (uint8_t)sectorNumber;
+    if ((sectorNumber % SECTORS_PER_TRACK == SECTORS_PER_TRACK - 1) && (offset >= 400)) return 0;
+    return (uint8_t)(sectorNumber * 7 + offset * 3);
+}
+
+// The disk as it should read, with a boot sector that agrees with the MSA header
+static std::vector<uint8_t> buildDisk() {
+    std::vector<uint8_t> disk((size_t)NUM_SECTORS * 512);
+    for (uint32_t index = 0; index < disk.size(); index++) disk[index] = expectedByte(index / 512, index % 512);
+    disk[11] = 0x00; disk[12] = 0x02;                   // 512 bytes per sector
+    disk[19] = (uint8_t)NUM_SECTORS; disk[20] = (uint8_t)(NUM_SECTORS >> 8);
+    disk[24] = SECTORS_PER_TRACK; disk[25] = 0;
+    disk[26] = NUM_HEADS; disk[27] = 0;
+    return disk;
+}
+
+// MSA run length encoding: 0xE5, the byte, then a big endian count.  A literal 0xE5 has to be written as a run
+static std::vector<uint8_t> packTrack(const uint8_t* data) {
+    std::vector<uint8_t> packed;
+    for (uint32_t index = 0; index < TRACK_SIZE;) {
+        uint32_t run = 1;
+        while ((index + run < TRACK_SIZE) && (data[index + run] == data[index])) run++;
+        if ((run >= 4) || (data[index] == 0xE5)) {
+            packed.insert(packed.end(), { 0xE5, data[index], (uint8_t)(run >> 8), (uint8_t)run });
+            index += run;
+        }
+        else packed.push_back(data[index++]);
+    }
+    return packed;
+}
+
+// Build the MSA file for a disk
+static std::vector<uint8_t> buildMSA(const std::vector<uint8_t>& disk, const std::function<TrackPacking(uint32_t)>& packing) {
+    std::vector<uint8_t> file(10);
+    file[0] = 0x0E;
+    file[1] = 0x0F;
+    putWord(file, 2, SECTORS_PER_TRACK);
+    putWord(file, 4, NUM_HEADS - 1);
+    putWord(file, 6, 0);
+    putWord(file, 8, NUM_CYLINDERS - 1);
+
+    for (uint32_t track = 0; track < NUM_TRACKS; track++) {
+        const uint8_t* data = &disk[(size_t)track * TRACK_SIZE];
+        std::vector<uint8_t> stored;
+        switch (packing(track)) {
+        case TrackPacking::tpUncompressed:
+            stored.assign(data, data + TRACK_SIZE);
+            break;
+        case TrackPacking::tpTruncated:
+            // Ends part way through the count of the last run
+            stored = packTrack(data);
+            stored.resize(stored.size() - 2);
+            break;
+        default:
+            stored = packTrack(data);
+            if (stored.size() == TRACK_SIZE) stored.push_back(0);
+            break;
+        }
+        const size_t pos = file.size();
+        file.resize(pos + 2);
+        putWord(file, pos, (uint16_t)stored.size());
+        file.insert(file.end(), stored.begin(), stored.end());
+    }
+    return file;
+}
+
+// Save the image and open it
+static std::unique_ptr<UncachedMSA> openImage(const std::vector<uint8_t>& image, const char* filename) {
+    FILE* fle = fopen(filename, "wb");
+    if (!fle) return nullptr;
+    fwrite(image.data(), 1, image.size(), fle);
+    fclose(fle);
+
+    const std::string name(filename);
+    const std::wstring wideName(name.begin(), name.end());
+    HANDLE file = CreateFile(wideName.c_str(), GENERIC_READ, 0, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) return nullptr;
+    return std::make_unique<UncachedMSA>(wideName, file);
+}
+
+// Returns TRUE if the sector reads back as it should
+static bool sectorMatches(UncachedMSA& msa, const std::vector<uint8_t>& disk, const uint32_t sectorNumber) {
+    uint8_t sector[512];
+    if (!msa.readData(sectorNumber, 512, sector)) return false;
+    return memcmp(sector, &disk[(size_t)sectorNumber * 512], 512) == 0;
+}
+
+// Runs of bytes, escaped 0xE5 bytes and literal data all unpack, as do tracks that were stored without packing
+static void PackedAndUncompressedTracksRead() {
+    const std::vector<uint8_t> disk = buildDisk();
+    std::unique_ptr<UncachedMSA> msa = openImage(buildMSA(disk, [](uint32_t track) { return (track % 3 == 1) ? TrackPacking::tpUncompressed : TrackPacking::tpRLE; }), "test_msa_packing.msa");
+    TEST_CHECK(msa && msa->available());
+    if (!msa) return;
+    TEST_CHECK(msa->numSectorsPerTrack() == SECTORS_PER_TRACK);
+    TEST_CHECK(msa->getNumHeads() == NUM_HEADS);
+    TEST_CHECK(msa->totalNumTracks() == NUM_TRACKS);
+
+    uint32_t mismatches = 0;
+    for (uint32_t sector = 0; sector < NUM_SECTORS; sector++)
+        if (!sectorMatches(*msa, disk, sector)) mismatches++;
+    TEST_CHECK(mismatches == 0);
+
+    msa.reset();
+    remove("test_msa_packing.msa");
+}
+
+// A track whose packed data stops part way through a run can't be read, but the tracks either side of it can
+static void TruncatedRunFailsTrack() {
+    const std::vector<uint8_t> disk = buildDisk();
+    std::unique_ptr<UncachedMSA> msa = openImage(buildMSA(disk, [](uint32_t track) { return (track == 7) ? TrackPacking::tpTruncated : TrackPacking::tpRLE; }), "test_msa_truncated.msa");
+    TEST_CHECK(msa && msa->available());
+    if (!msa) return;
+
+    for (uint32_t sector = 0; sector < SECTORS_PER_TRACK; sector++) {
+        uint8_t buffer[512];
+        TEST_CHECK(!msa->readData(7 * SECTORS_PER_TRACK + sector, 512, buffer));
+        TEST_CHECK(sectorMatches(*msa, disk, 6 * SECTORS_PER_TRACK + sector));
+        TEST_CHECK(sectorMatches(*msa, disk, 8 * SECTORS_PER_TRACK + sector));
+    }
+
+    msa.reset();
+    remove("test_msa_truncated.msa");
+}
+
+// Jumping around far more tracks than are kept decoded always reads the right track, whether it was still decoded or not
+static void RandomAccessAcrossTrackCache() {
+    const std::vector<uint8_t> disk = buildDisk();
+    std::unique_ptr<UncachedMSA> msa = openImage(buildMSA(disk, [](uint32_t track) { return (track % 5 == 2) ? TrackPacking::tpUncompressed : TrackPacking::tpRLE; }), "test_msa_random.msa");
+    TEST_CHECK(msa && msa->available());
+    if (!msa) return;
+
+    // Forwards then backwards over 40 tracks, so the start has been pushed out but the end is still decoded
+    uint32_t mismatches = 0;
+    for (uint32_t track = 0; track < 40; track++)
+        if (!sectorMatches(*msa, disk, track * SECTORS_PER_TRACK)) mismatches++;
+    for (uint32_t track = 40; track > 0; track--)
+        if (!sectorMatches(*msa, disk, (track - 1) * SECTORS_PER_TRACK + 1)) mismatches++;
+
+    // Then anywhere, sometimes going back to a track used recently
+    std::mt19937 random(11);
+    uint32_t lastSector = 0;
+    for (uint32_t count = 0; count < 3000; count++) {
+        const uint32_t sector = (random() % 3 == 0) ? (lastSector / SECTORS_PER_TRACK) * SECTORS_PER_TRACK + random() % SECTORS_PER_TRACK : random() % NUM_SECTORS;
+        if (!sectorMatches(*msa, disk, sector)) mismatches++;
+        lastSector = sector;
+    }
+    TEST_CHECK(mismatches == 0);
+
+    msa.reset();
+    remove("test_msa_random.msa");
+}
+
+int main() {
+    TEST_RUN(PackedAndUncompressedTracksRead);
+    TEST_RUN(TruncatedRunFailsTrack);
+    TEST_RUN(RandomAccessAcrossTrackCache);
+    return TEST_RESULT();
+}
@@ -0,0 +1,161 @@
+/* DiskFlashback, Copyright (C) 2021-2024 Robert Smith (@RobSmithDev)
+ * https://robsmithdev.co.uk/diskflashback
+ *
+ * This file is multi-licensed under the terms of the Mozilla Public
+ * License Version 2.0 as published by Mozilla Corporation and the
+ * GNU General Public License, version 2 or later, as published by the
+ * Free Software Foundation.
+ *
+ * MPL2: https://www.mozilla.org/en-US/MPL/2.0/
+ * GPL2: https://www.gnu.org/licenses/old-licenses/gpl-2.0.en.html
+ *
+ * This file is maintained at https://github.com/RobSmithDev/DiskFlashback
+ */
+
+// Tests for the PLL, checked against the original version that decoded a flux time and wrote out a bit at a time
+#include <string.h>
+#include <algorithm>
+#include <random>
+#include <vector>
+#include "pll.h"
+#include "testUtil.h"
+
+// The original PLL
+class ReferencePLL {
+private:
+    int32_t m_clock = 2000;
+    int32_t m_nFluxSoFar = 0;
+    uint32_t m_bitsRemaining = 0;
+    std::vector<uint8_t> m_mfmData;
+
+    void addBit(const uint8_t bit) {
+        if (m_bitsRemaining == 0) {
+            m_mfmData.push_back(bit);
+            m_bitsRemaining = 7;
+        }
+        else {
+            m_bitsRemaining--;
+            m_mfmData.back() = (uint8_t)((m_mfmData.back() << 1) | bit);
+        }
+    }
+
+public:
+    void newTrack() {
+        m_bitsRemaining = 0;
+        m_mfmData.clear();
+    }
+
+    void decodeFlux(const uint32_t fluxTime) {
+        m_nFluxSoFar += fluxTime;
+        if (m_nFluxSoFar < (m_clock / 2)) return;
+        int32_t clockedZeros = (m_nFluxSoFar - (m_clock / 2)) / m_clock;
+        m_nFluxSoFar -= ((clockedZeros + 1) * m_clock);
+        if ((clockedZeros >= 1) && (clockedZeros <= 3)) m_clock += (m_nFluxSoFar / (int)(clockedZeros + 1)) / 10;
+        else m_clock += (2000 - m_clock) / 10;
+        m_clock = std::max(1800, std::min(2200, m_clock));
+        m_nFluxSoFar /= 2;
+        while (clockedZeros--) addBit(0);
+        addBit(1);
+    }
+
+    // The track, with any partial last byte shifted up to the top
+    std::vector<uint8_t> finaliseTrack(uint32_t& sizeInBits) {
+        std::vector<uint8_t> data = m_mfmData;
+        if (m_bitsRemaining) data.back() <<= m_bitsRemaining;
+        sizeInBits = ((uint32_t)data.size() * 8) - m_bitsRemaining;
+        return data;
+    }
+};
+
+// Returns TRUE if both PLLs produced the same track
+static bool sameTrack(PLL& pll, ReferencePLL& reference) {
+    void* buffer = nullptr;
+    const uint32_t sizeInBits = pll.finaliseTrack(&buffer);
+    uint32_t expectedBits;
+    const std::vector<uint8_t> expected = reference.finaliseTrack(expectedBits);
+    if (sizeInBits != expectedBits) return false;
+    return memcmp(buffer, expected.data(), (sizeInBits + 7) / 8) == 0;
+}
+
+// Flux times like a real DD disk: mostly 2, 3 or 4 clocks with some jitter, the odd long gap and some noise
+static uint32_t randomFlux(std::mt19937& random) {
+    const uint32_t kind = random() % 100;
+    if (kind < 2) return 20000 + random() % 300000;
+    if (kind < 5) return random() % 1500;
+    return (4000 + (random() % 3) * 2000) + (random() % 801) - 400;
+}
+
+// Single flux times go through the same clock as before
+static void SingleFluxMatchesOriginal() {
+    std::mt19937 random(46);
+    PLL pll;
+    ReferencePLL reference;
+    for (uint32_t track = 0; track < 20; track++) {
+        // Hints that are right, missing, and far too small, so the buffer has to grow
+        const uint32_t numFlux = 1000 + random() % 60000;
+        pll.newTrack((track % 3 == 0) ? 0 : ((track % 3 == 1) ? (uint64_t)numFlux * 6000 : 1000));
+        reference.newTrack();
+        for (uint32_t i = 0; i < numFlux; i++) {
+            const uint32_t flux = randomFlux(random);
+            pll.decodeFlux(flux);
+            reference.decodeFlux(flux);
+        }
+        TEST_CHECK(sameTrack(pll, reference));
+    }
+}
+
+// Blocks of SCP flux cells decode exactly as the cells did when they were fed in one at a time, however the blocks are split
+static void FluxCellsMatchOriginal() {
+    std::mt19937 random(47);
+    PLL pll;
+    ReferencePLL reference;
+    for (uint32_t track = 0; track < 20; track++) {
+        // SCP cells are 25ns, and HD disks read at DD density are doubled
+        const uint32_t multiplier = 25 * ((track & 1) + 1);
+        std::vector<uint8_t> cells;
+        for (uint32_t i = 0; i < 40000; i++) {
+            uint32_t cell = randomFlux(random) / multiplier;
+            if (!cell) cell = 1;
+            // Now and again a gap long enough to need overflow cells
+            if (random() % 500 == 0) cell += 65536 * (1 + random() % 3);
+            // Cells too long for 16 bits are zeros followed by the remainder
+            while (cell > 65535) {
+                cells.push_back(0);
+                cells.push_back(0);
+                cell -= 65536;
+            }
+            if (!cell) cell = 1;
+            cells.push_back((uint8_t)(cell >> 8));
+            cells.push_back((uint8_t)cell);
+        }
+        const uint32_t numCells = (uint32_t)cells.size() / 2;
+
+        pll.newTrack((uint64_t)numCells * 6000);
+        uint32_t done = 0;
+        while (done < numCells) {
+            const uint32_t block = std::min(numCells - done, 1 + (uint32_t)(random() % 3000));
+            // Start one byte in, as the cells don't have to be aligned
+            std::vector<uint8_t> unaligned(1 + block * 2);
+            memcpy(&unaligned[1], &cells[done * 2], block * 2);
+            pll.decodeFluxCells(&unaligned[1], block, multiplier);
+            done += block;
+        }
+
+        reference.newTrack();
+        uint32_t lastTime = 0;
+        for (uint32_t i = 0; i < numCells; i++) {
+            const uint32_t t = ((uint32_t)cells[i * 2] << 8) | cells[i * 2 + 1];
+            if (t == 0) lastTime += 65536; else {
+                reference.decodeFlux((lastTime + t) * multiplier);
+                lastTime = 0;
+            }
+        }
+        TEST_CHECK(sameTrack(pll, reference));
+    }
+}
+
+int main() {
+    TEST_RUN(SingleFluxMatchesOriginal);
+    TEST_RUN(FluxCellsMatchOriginal);
+    return TEST_RESULT();
+}
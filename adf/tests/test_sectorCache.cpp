@@ -0,0 +1,434 @@
+/* DiskFlashback, Copyright (C) 2021-2024 Robert Smith (@RobSmithDev)
+ * https://robsmithdev.co.uk/diskflashback
+ *
+ * This file is multi-licensed under the terms of the Mozilla Public
+ * License Version 2.0 as published by Mozilla Corporation and the
+ * GNU General Public License, version 2 or later, as published by the
+ * Free Software Foundation.
+ *
+ * MPL2: https://www.mozilla.org/en-US/MPL/2.0/
+ * GPL2: https://www.gnu.org/licenses/old-licenses/gpl-2.0.en.html
+ *
+ * This file is maintained at https://github.com/RobSmithDev/DiskFlashback
+ */
+
+// Tests for SectorCacheEngine using a disk held in memory
+#include <random>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <future>
+#include <functional>
+#include "testUtil.h"
+#include "memoryDisk.h"
+
+// Filling the cache past its limit pushes out the sectors used longest ago
+static void testEvictsLeastRecentlyUsed() {
+    MemoryDisk disk(64, 8 * 512);
+    uint8_t buffer[512];
+
+    for (uint32_t sector = 0; sector < 16; sector++) TEST_CHECK(disk.readData(sector, 512, buffer));
+    TEST_CHECK(disk.m_sectorsRead == 16);
+
+    // The last 8 are still there
+    for (uint32_t sector = 16; sector > 8; sector--) TEST_CHECK(disk.readData(sector - 1, 512, buffer));
+    TEST_CHECK(disk.m_sectorsRead == 16);
+
+    // But the first ones had to go
+    TEST_CHECK(disk.readData(0, 512, buffer));
+    TEST_CHECK(disk.m_sectorsRead == 17);
+}
+
+// The cache holds exactly as many sectors as fit in its memory limit, and no more
+static void testStaysWithinLimit() {
+    MemoryDisk disk(2000, 100 * 512);
+    uint8_t buffer[512];
+
+    for (uint32_t sector = 0; sector < 100; sector++) TEST_CHECK(disk.readData(sector, 512, buffer));
+    for (uint32_t sector = 0; sector < 100; sector++) TEST_CHECK(disk.readData(sector, 512, buffer));
+    TEST_CHECK(disk.m_sectorsRead == 100);
+
+    // One more pushes out the oldest, and only that one
+    TEST_CHECK(disk.readData(100, 512, buffer));
+    const uint32_t reads = disk.m_sectorsRead;
+    for (uint32_t sector = 100; sector > 1; sector--) TEST_CHECK(disk.readData(sector, 512, buffer));
+    TEST_CHECK(disk.m_sectorsRead == reads);
+    TEST_CHECK(disk.readData(0, 512, buffer));
+    TEST_CHECK(disk.m_sectorsRead == reads + 1);
+}
+
+// Random reads and writes through a small cache always return what was last written
+static void testRandomWorkloadMatchesDevice() {
+    const uint32_t numSectors = 300;
+    MemoryDisk disk(numSectors, 40 * 512);
+    std::vector<uint8_t> expected(disk.deviceSector(0), disk.deviceSector(0) + (size_t)numSectors * 512);
+    std::mt19937 random(2);
+    uint8_t buffer[512];
+
+    for (uint32_t count = 0; count < 20000; count++) {
+        const uint32_t sector = random() % numSectors;
+        uint8_t* copy = &expected[(size_t)sector * 512];
+        if (random() % 4 == 0) {
+            for (uint32_t index = 0; index < 512; index++) copy[index] = (uint8_t)random();
+            TEST_CHECK(disk.writeData(sector, 512, copy));
+        }
+        else {
+            TEST_CHECK(disk.readData(sector, 512, buffer));
+            if (memcmp(buffer, copy, 512)) {
+                TEST_CHECK(memcmp(buffer, copy, 512) == 0);
+                break;
+            }
+        }
+    }
+    TEST_CHECK(memcmp(disk.deviceSector(0), expected.data(), expected.size()) == 0);
+}
+
+// Resetting the cache throws everything away
+static void testResetEmptiesCache() {
+    MemoryDisk disk(64, 32 * 512);
+    uint8_t buffer[512];
+
+    for (uint32_t sector = 0; sector < 10; sector++) TEST_CHECK(disk.readData(sector, 512, buffer));
+    disk.resetCache();
+    for (uint32_t sector = 0; sector < 10; sector++) TEST_CHECK(disk.readData(sector, 512, buffer));
+    TEST_CHECK(disk.m_sectorsRead == 20);
+}
+
+// Wait up to a couple of seconds for something to happen
+static bool waitFor(const std::function<bool()>& condition) {
+    for (uint32_t count = 0; count < 200; count++) {
+        if (condition()) return true;
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return condition();
+}
+
+// A cache hit is served while another thread is stuck waiting on the device
+static void testHitsDontWaitForDevice() {
+    MemoryDisk disk(64, 32 * 512);
+    uint8_t buffer[512];
+    TEST_CHECK(disk.readData(0, 512, buffer));
+
+    disk.setBlocked(true);
+    std::thread reader([&disk]() {
+        uint8_t missed[512];
+        TEST_CHECK(disk.readData(5, 512, missed));
+        TEST_CHECK(memcmp(missed, disk.deviceSector(5), 512) == 0);
+    });
+    TEST_CHECK(waitFor([&disk]() { return disk.m_deviceWaiting.load(); }));
+
+    std::future<bool> hit = std::async(std::launch::async, [&disk]() {
+        uint8_t cached[512];
+        return disk.readData(0, 512, cached) && (memcmp(cached, disk.deviceSector(0), 512) == 0);
+    });
+    const bool served = hit.wait_for(std::chrono::seconds(2)) == std::future_status::ready;
+    TEST_CHECK(served);
+
+    disk.setBlocked(false);
+    reader.join();
+    TEST_CHECK(hit.get());
+}
+
+// Several threads missing on the same sector only read it from the device once
+static void testConcurrentMissesReadOnce() {
+    MemoryDisk disk(64, 32 * 512);
+
+    disk.setBlocked(true);
+    std::vector<std::thread> readers;
+    for (uint32_t count = 0; count < 4; count++)
+        readers.emplace_back([&disk]() {
+            uint8_t buffer[512];
+            TEST_CHECK(disk.readData(7, 512, buffer));
+            TEST_CHECK(memcmp(buffer, disk.deviceSector(7), 512) == 0);
+        });
+    TEST_CHECK(waitFor([&disk]() { return disk.m_deviceWaiting.load(); }));
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    disk.setBlocked(false);
+    for (std::thread& reader : readers) reader.join();
+    TEST_CHECK(disk.m_sectorsRead == 1);
+}
+
+// Reading a run fetches only the missing sectors, all in one go
+static void testReadSectorsFetchesGapsTogether() {
+    MemoryDisk disk(64, 64 * 512);
+    std::vector<uint8_t> buffer(32 * 512);
+
+    for (uint32_t sector = 10; sector < 14; sector++) TEST_CHECK(disk.readData(sector, 512, buffer.data()));
+    const uint32_t batches = disk.m_readBatches;
+
+    TEST_CHECK(disk.readSectors(0, 32, 512, buffer.data()));
+    TEST_CHECK(memcmp(buffer.data(), disk.deviceSector(0), buffer.size()) == 0);
+    TEST_CHECK(disk.m_sectorsRead == 4 + 28);
+    TEST_CHECK(disk.m_readBatches == batches + 1);
+
+    // And now it's all cached
+    TEST_CHECK(disk.readSectors(0, 32, 512, buffer.data()));
+    TEST_CHECK(disk.m_sectorsRead == 32);
+}
+
+// Writing a run goes straight to the device and updates the cache
+static void testWriteSectorsUpdatesCache() {
+    MemoryDisk disk(64, 64 * 512);
+    std::vector<uint8_t> buffer(8 * 512);
+    TEST_CHECK(disk.readSectors(4, 8, 512, buffer.data()));
+
+    for (size_t index = 0; index < buffer.size(); index++) buffer[index] = (uint8_t)(index * 3);
+    TEST_CHECK(disk.writeSectors(4, 8, 512, buffer.data()));
+    TEST_CHECK(memcmp(disk.deviceSector(4), buffer.data(), buffer.size()) == 0);
+
+    std::vector<uint8_t> check(buffer.size());
+    const uint32_t reads = disk.m_sectorsRead;
+    TEST_CHECK(disk.readSectors(4, 8, 512, check.data()));
+    TEST_CHECK(check == buffer);
+    TEST_CHECK(disk.m_sectorsRead == reads);
+}
+
+// Write back mode holds writes until they're flushed, then writes them in order in as few runs as possible
+static void testWriteBackFlushesInOrder() {
+    MemoryDisk disk(64, 64 * 512);
+    disk.setWriteBackMode(true, 32 * 512, 1000000);
+    std::vector<uint8_t> expected(disk.deviceSector(0), disk.deviceSector(0) + 64 * 512);
+    uint8_t buffer[512];
+
+    // Two runs of sectors, written in a jumbled order
+    for (const uint32_t sector : { 12, 3, 14, 2, 13, 4, 15, 5 }) {
+        memset(buffer, sector, 512);
+        memcpy(&expected[(size_t)sector * 512], buffer, 512);
+        TEST_CHECK(disk.writeData(sector, 512, buffer));
+    }
+    TEST_CHECK(disk.m_sectorsWritten == 0);
+
+    // Reads see the new data before it reaches the device
+    TEST_CHECK(disk.readData(13, 512, buffer));
+    TEST_CHECK(buffer[0] == 13);
+
+    TEST_CHECK(disk.flushWriteCache());
+    TEST_CHECK(disk.m_sectorsWritten == 8);
+    TEST_CHECK(disk.m_writeBatches == 1);
+    TEST_CHECK(memcmp(disk.deviceSector(0), expected.data(), expected.size()) == 0);
+}
+
+// Evicting to make room never writes to the device. Dirty sectors stay cached until they're flushed
+static void testEvictionDoesntWrite() {
+    MemoryDisk disk(256, 16 * 512);
+    disk.setWriteBackMode(true, 16 * 512, 1000000);
+    uint8_t buffer[512];
+
+    for (uint32_t sector = 0; sector < 6; sector++) {
+        memset(buffer, 0xA0 + sector, 512);
+        TEST_CHECK(disk.writeData(sector, 512, buffer));
+    }
+
+    // Read enough to cycle the rest of the cache many times over
+    for (uint32_t sector = 100; sector < 200; sector++) TEST_CHECK(disk.readData(sector, 512, buffer));
+    TEST_CHECK(disk.m_sectorsWritten == 0);
+
+    const uint32_t reads = disk.m_sectorsRead;
+    for (uint32_t sector = 0; sector < 6; sector++) {
+        TEST_CHECK(disk.readData(sector, 512, buffer));
+        TEST_CHECK(buffer[0] == 0xA0 + sector);
+    }
+    TEST_CHECK(disk.m_sectorsRead == reads);
+
+    TEST_CHECK(disk.flushWriteCache());
+    TEST_CHECK(disk.m_sectorsWritten == 6);
+    TEST_CHECK(disk.m_writeBatches == 1);
+    TEST_CHECK(disk.deviceSector(5)[0] == 0xA5);
+}
+
+// Reading sequentially starts read-ahead, so most of the later sectors are already cached when they're asked for
+static void testSequentialReadsFetchAhead() {
+    MemoryDisk disk(512, 256 * 512);
+    disk.setReadAhead(true, 64 * 512, 64 * 512);
+    uint8_t buffer[512];
+
+    for (uint32_t sector = 0; sector < 16; sector++) TEST_CHECK(disk.readData(sector, 512, buffer));
+    TEST_CHECK(waitFor([&disk]() { return disk.m_sectorsRead > 16; }));
+
+    // The memory disk is instant, so give the read-ahead thread a chance as a real reader would while it uses the data
+    for (uint32_t sector = 16; sector < 200; sector++) {
+        TEST_CHECK(disk.readData(sector, 512, buffer));
+        TEST_CHECK(memcmp(buffer, disk.deviceSector(sector), 512) == 0);
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    // Read-ahead goes to the device in batches, anything else was a miss the reader had to wait for
+    TEST_CHECK(disk.m_sectorsRead - disk.m_sectorsReadInBatches <= 50);
+    disk.setReadAhead(false, 0, 0);
+}
+
+// Random reads don't trigger any read-ahead
+static void testRandomReadsDontFetchAhead() {
+    MemoryDisk disk(512, 256 * 512);
+    disk.setReadAhead(true, 64 * 512, 64 * 512);
+    uint8_t buffer[512];
+
+    for (uint32_t count = 0; count < 40; count++) TEST_CHECK(disk.readData((count * 37) % 512, 512, buffer));
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    TEST_CHECK(disk.m_sectorsRead == 40);
+    disk.setReadAhead(false, 0, 0);
+}
+
+// Sectors that keep getting used survive a large scan that only touches each sector once
+static void testScanDoesntFlushWorkingSet() {
+    MemoryDisk disk(1024, 32 * 512);
+    uint8_t buffer[512];
+
+    for (uint32_t pass = 0; pass < 2; pass++)
+        for (uint32_t sector = 0; sector < 8; sector++) TEST_CHECK(disk.readData(sector, 512, buffer));
+    for (uint32_t sector = 100; sector < 900; sector++) TEST_CHECK(disk.readData(sector, 512, buffer));
+
+    const uint32_t reads = disk.m_sectorsRead;
+    for (uint32_t sector = 0; sector < 8; sector++) TEST_CHECK(disk.readData(sector, 512, buffer));
+    TEST_CHECK(disk.m_sectorsRead == reads);
+}
+
+// Metadata is protected from the first time it's read
+static void testMetadataSurvivesScan() {
+    MemoryDisk disk(1024, 32 * 512);
+    uint8_t buffer[512];
+
+    for (uint32_t sector = 880; sector < 884; sector++) TEST_CHECK(disk.readData(sector, 512, buffer, CachePriority::cpMetadata));
+    std::vector<uint8_t> run(100 * 512);
+    for (uint32_t sector = 0; sector < 800; sector += 100) TEST_CHECK(disk.readSectors(sector, 100, 512, run.data()));
+
+    const uint32_t reads = disk.m_sectorsRead;
+    for (uint32_t sector = 880; sector < 884; sector++) TEST_CHECK(disk.readData(sector, 512, buffer, CachePriority::cpMetadata));
+    TEST_CHECK(disk.m_sectorsRead == reads);
+}
+
+// Dirty sectors are kept to half of the cache however much write back is asked for, so eviction always has clean sectors to take
+static void testCacheLimitCapsDirtyData() {
+    MemoryDisk disk(256, 8 * 512);
+    disk.setWriteBackMode(true, 32 * 512, 1000000);
+    uint8_t buffer[512];
+
+    // Only 4 sectors can wait, so writing 20 flushes several times along the way
+    for (uint32_t sector = 0; sector < 20; sector++) {
+        memset(buffer, sector + 1, 512);
+        TEST_CHECK(disk.writeData(sector * 2, 512, buffer));
+    }
+    TEST_CHECK(disk.m_writeBatches == 5);
+    TEST_CHECK(disk.flushWriteCache());
+    for (uint32_t sector = 0; sector < 20; sector++) TEST_CHECK(disk.deviceSector(sector * 2)[0] == sector + 1);
+}
+
+// Turning the cache off (for memory mapped files) writes out anything waiting, then everything goes straight to the device
+static void testDisableCacheFlushes() {
+    MemoryDisk disk(64, 32 * 512);
+    disk.setWriteBackMode(true, 16 * 512, 1000000);
+    disk.setReadAhead(true, 16 * 512, 16 * 512);
+    uint8_t buffer[512];
+
+    memset(buffer, 0x5A, 512);
+    TEST_CHECK(disk.writeData(3, 512, buffer));
+    TEST_CHECK(disk.m_sectorsWritten == 0);
+
+    disk.turnOffCache();
+    TEST_CHECK(disk.deviceSector(3)[0] == 0x5A);
+    TEST_CHECK(!disk.isCacheEnabled());
+    TEST_CHECK(!disk.isWriteBackMode());
+
+    const uint32_t reads = disk.m_sectorsRead;
+    for (uint32_t count = 0; count < 3; count++) TEST_CHECK(disk.readData(3, 512, buffer));
+    TEST_CHECK(disk.m_sectorsRead == reads + 3);
+
+    TEST_CHECK(disk.writeData(4, 512, buffer));
+    TEST_CHECK(disk.deviceSector(4)[0] == 0x5A);
+}
+
+// Every gap in a read is handed to the device together as separate runs, so a device that can queue them can overlap them
+static void testGapsGoToDeviceAsOneBatch() {
+    MemoryDisk disk(64, 64 * 512);
+    std::vector<uint8_t> buffer(20 * 512);
+    for (const uint32_t sector : { 5, 10, 15 }) TEST_CHECK(disk.readData(sector, 512, buffer.data()));
+
+    const uint32_t batches = disk.m_readBatches;
+    TEST_CHECK(disk.readSectors(0, 20, 512, buffer.data()));
+    TEST_CHECK(disk.m_readBatches == batches + 1);
+    const std::vector<std::pair<uint32_t, uint32_t>> expected = { { 0, 5 }, { 6, 4 }, { 11, 4 }, { 16, 4 } };
+    TEST_CHECK(disk.m_lastReadRuns == expected);
+    TEST_CHECK(memcmp(buffer.data(), disk.deviceSector(0), buffer.size()) == 0);
+}
+
+// Waiters on an ElevatorLock, each one noting the order it got the lock in
+struct ElevatorWaiters {
+    ElevatorLock elevator;
+    std::vector<std::thread> threads;
+    std::mutex orderLock;
+    std::vector<uint32_t> order;
+
+    // Start a thread asking for the lock at position, and wait until it's queued so they arrive in a known order
+    void queue(const uint32_t position) {
+        const size_t waiting = elevator.numWaiting();
+        threads.emplace_back([this, position]() {
+            elevator.lock(position);
+            {
+                std::lock_guard lock(orderLock);
+                order.push_back(position);
+            }
+            elevator.unlock();
+        });
+        TEST_CHECK(waitFor([this, waiting]() { return elevator.numWaiting() == waiting + 1; }));
+    }
+
+    // Let them all go and wait for them
+    void run() {
+        elevator.unlock();
+        for (std::thread& thread : threads) thread.join();
+    }
+};
+
+// Waiters are let in sweeping up from where the head was, then from the lowest again, whatever order they arrived in
+static void testElevatorSweepsUp() {
+    ElevatorWaiters waiters;
+    waiters.elevator.lock(50);
+    for (const uint32_t position : { 70, 20, 90, 55, 10 }) waiters.queue(position);
+    waiters.run();
+    const std::vector<uint32_t> expected = { 55, 70, 90, 10, 20 };
+    TEST_CHECK(waiters.order == expected);
+}
+
+// Requests that don't care where the head is go before any that do, oldest first, and don't move the head
+static void testElevatorAnyPositionFirst() {
+    ElevatorWaiters waiters;
+    waiters.elevator.lock(50);
+    for (const uint32_t position : { 60U, ElevatorLock::ANY_POSITION, 55U, ElevatorLock::ANY_POSITION }) waiters.queue(position);
+    waiters.run();
+    const std::vector<uint32_t> expected = { ElevatorLock::ANY_POSITION, ElevatorLock::ANY_POSITION, 55, 60 };
+    TEST_CHECK(waiters.order == expected);
+}
+
+// A request behind the head that keeps being overtaken goes next once it's been passed 8 times, even with more still ahead of the head
+static void testElevatorOvertakenGoesNext() {
+    ElevatorWaiters waiters;
+    waiters.elevator.lock(50);
+    waiters.queue(10);
+    for (uint32_t position = 60; position <= 68; position++) waiters.queue(position);
+    waiters.run();
+    const std::vector<uint32_t> expected = { 60, 61, 62, 63, 64, 65, 66, 67, 10, 68 };
+    TEST_CHECK(waiters.order == expected);
+}
+
+int main() {
+    TEST_RUN(testEvictsLeastRecentlyUsed);
+    TEST_RUN(testStaysWithinLimit);
+    TEST_RUN(testRandomWorkloadMatchesDevice);
+    TEST_RUN(testResetEmptiesCache);
+    TEST_RUN(testHitsDontWaitForDevice);
+    TEST_RUN(testConcurrentMissesReadOnce);
+    TEST_RUN(testReadSectorsFetchesGapsTogether);
+    TEST_RUN(testWriteSectorsUpdatesCache);
+    TEST_RUN(testWriteBackFlushesInOrder);
+    TEST_RUN(testEvictionDoesntWrite);
+    TEST_RUN(testSequentialReadsFetchAhead);
+    TEST_RUN(testRandomReadsDontFetchAhead);
+    TEST_RUN(testScanDoesntFlushWorkingSet);
+    TEST_RUN(testMetadataSurvivesScan);
+    TEST_RUN(testCacheLimitCapsDirtyData);
+    TEST_RUN(testDisableCacheFlushes);
+    TEST_RUN(testGapsGoToDeviceAsOneBatch);
+    TEST_RUN(testElevatorSweepsUp);
+    TEST_RUN(testElevatorAnyPositionFirst);
+    TEST_RUN(testElevatorOvertakenGoesNext);
+    return TEST_RESULT();
+}
@@ -73,3 +73,41 @@
 
 
 #define DIR_SEPARATORS ":\\/"
+
+
+/*  Table sizes used by the Deep and Heavy decrunchers  */
+#define DEEP_N_CHAR (256 - 2 + 60)
+#define DEEP_T (DEEP_N_CHAR * 2 - 1)
+#define HEAVY_NC 510
+#define HEAVY_NPT 20
+
+
+/*
+ *  Everything the decrunchers carry between calls. Each track being
+ *  unpacked at the same time needs its own copy of this.
+ */
+typedef struct {
+	/*  bit reader  */
+	ULONG bitbuf;
+	UCHAR *indata, bitcount;
+
+	/*  dictionary, 16Kb is enough for every mode  */
+	UCHAR text[0x4000];
+	USHORT quick_text_loc, medium_text_loc, deep_text_loc;
+	USHORT heavy_text_loc, heavy_lastlen;
+
+	/*  Deep mode dynamic Huffman tree  */
+	int init_deep_tabs;
+	USHORT freq[DEEP_T + 1], prnt[DEEP_T + DEEP_N_CHAR], son[DEEP_T];
+
+	/*  Heavy mode decoding tables  */
+	USHORT left[2 * HEAVY_NC - 1], right[2 * HEAVY_NC - 1 + 9];
+	UCHAR c_len[HEAVY_NC], pt_len[HEAVY_NPT];
+	USHORT c_table[4096], pt_table[256], np;
+
+	/*  make_table working variables  */
+	SHORT tbl_c;
+	USHORT tbl_n, tbl_size, tbl_len, tbl_depth, tbl_maxdepth, tbl_avail;
+	USHORT tbl_codeword, tbl_bit, *tbl, tbl_err;
+	UCHAR *tbl_blen;
+} DECRUNCH_STATE;
@@ -19,16 +19,11 @@ ULONG mask_bits[]={
 };
 
 
-UCHAR *indata, bitcount;
-ULONG bitbuf;
-
-
-
-void initbitbuf(UCHAR *in){
-	bitbuf = 0;
-	bitcount = 0;
-	indata = in;
-	DROPBITS(0);
+void initbitbuf(DECRUNCH_STATE *ds, UCHAR *in){
+	ds->bitbuf = 0;
+	ds->bitcount = 0;
+	ds->indata = in;
+	DROPBITS(ds,0);
 }	
 
 
@@ -1,10 +1,11 @@
 
-extern ULONG mask_bits[], bitbuf;
-extern UCHAR *indata, bitcount;
 
-#define GETBITS(n) ((USHORT)(bitbuf >> (bitcount-(n))))
-#define DROPBITS(n) {bitbuf &= mask_bits[bitcount-=(n)]; while (bitcount<16) {bitbuf = (bitbuf << 8) | *indata++;  bitcount += 8;}}
+extern ULONG mask_bits[];
 
+#define GETBITS(s,n) ((USHORT)((s)->bitbuf >> ((s)->bitcount-(n))))
+#define DROPBITS(s,n) {(s)->bitbuf &= mask_bits[(s)->bitcount-=(n)]; while ((s)->bitcount<16) {(s)->bitbuf = ((s)->bitbuf << 8) | *(s)->indata++;  (s)->bitcount += 8;}}
+
+
+void initbitbuf(DECRUNCH_STATE *, UCHAR *);
 
-void initbitbuf(UCHAR *);
 
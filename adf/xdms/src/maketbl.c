@@ -13,80 +13,75 @@
 #include "maketbl.h"
 
 
-static SHORT c;
-static USHORT n, tblsiz, len, depth, maxdepth, avail;
-static USHORT codeword, bit, *tbl, TabErr;
-static UCHAR *blen;
-
-
-static USHORT mktbl(void);
-
-
-
-USHORT make_table(USHORT nchar, UCHAR bitlen[],USHORT tablebits, USHORT table[]){
-	n = avail = nchar;
-	blen = bitlen;
-	tbl = table;
-	tblsiz = (USHORT) (1U << tablebits);
-	bit = (USHORT) (tblsiz / 2);
-	maxdepth = (USHORT)(tablebits + 1);
-	depth = len = 1;
-	c = -1;
-	codeword = 0;
-	TabErr = 0;
-	mktbl();	/* left subtree */
-	if (TabErr) return TabErr;
-	mktbl();	/* right subtree */
-	if (TabErr) return TabErr;
-	if (codeword != tblsiz) return 5;
+static USHORT mktbl(DECRUNCH_STATE *);
+
+
+
+USHORT make_table(DECRUNCH_STATE *ds, USHORT nchar, UCHAR bitlen[],USHORT tablebits, USHORT table[]){
+	ds->tbl_n = ds->tbl_avail = nchar;
+	ds->tbl_blen = bitlen;
+	ds->tbl = table;
+	ds->tbl_size = (USHORT) (1U << tablebits);
+	ds->tbl_bit = (USHORT) (ds->tbl_size / 2);
+	ds->tbl_maxdepth = (USHORT)(tablebits + 1);
+	ds->tbl_depth = ds->tbl_len = 1;
+	ds->tbl_c = -1;
+	ds->tbl_codeword = 0;
+	ds->tbl_err = 0;
+	mktbl(ds);	/* left subtree */
+	if (ds->tbl_err) return ds->tbl_err;
+	mktbl(ds);	/* right subtree */
+	if (ds->tbl_err) return ds->tbl_err;
+	if (ds->tbl_codeword != ds->tbl_size) return 5;
 	return 0;
 }
 
 
 
-static USHORT mktbl(void){
+static USHORT mktbl(DECRUNCH_STATE *ds){
 	USHORT i=0;
 
-	if (TabErr) return 0;
+	if (ds->tbl_err) return 0;
 
-	if (len == depth) {
-		while (++c < n)
-			if (blen[c] == len) {
-				i = codeword;
-				codeword += bit;
-				if (codeword > tblsiz) {
-					TabErr=1;
+	if (ds->tbl_len == ds->tbl_depth) {
+		while (++ds->tbl_c < ds->tbl_n)
+			if (ds->tbl_blen[ds->tbl_c] == ds->tbl_len) {
+				i = ds->tbl_codeword;
+				ds->tbl_codeword += ds->tbl_bit;
+				if (ds->tbl_codeword > ds->tbl_size) {
+					ds->tbl_err=1;
 					return 0;
 				}
-				while (i < codeword) tbl[i++] = (USHORT)c;
-				return (USHORT)c;
+				while (i < ds->tbl_codeword) ds->tbl[i++] = (USHORT)ds->tbl_c;
+				return (USHORT)ds->tbl_c;
 			}
-		c = -1;
-		len++;
-		bit >>= 1;
+		ds->tbl_c = -1;
+		ds->tbl_len++;
+		ds->tbl_bit >>= 1;
 	}
-	depth++;
-	if (depth < maxdepth) {
-		mktbl();
-		mktbl();
-	} else if (depth > 32) {
-		TabErr = 2;
+	ds->tbl_depth++;
+	if (ds->tbl_depth < ds->tbl_maxdepth) {
+		mktbl(ds);
+		mktbl(ds);
+	} else if (ds->tbl_depth > 32) {
+		ds->tbl_err = 2;
 		return 0;
 	} else {
-		if ((i = avail++) >= 2 * n - 1) {
-			TabErr = 3;
+		if ((i = ds->tbl_avail++) >= 2 * ds->tbl_n - 1) {
+			ds->tbl_err = 3;
 			return 0;
 		}
-		left[i] = mktbl();
-		right[i] = mktbl();
-		if (codeword >= tblsiz) {
-			TabErr = 4;
+		ds->left[i] = mktbl(ds);
+		ds->right[i] = mktbl(ds);
+		if (ds->tbl_codeword >= ds->tbl_size) {
+			ds->tbl_err = 4;
 			return 0;
 		}
-		if (depth == maxdepth) tbl[codeword++] = i;
+		if (ds->tbl_depth == ds->tbl_maxdepth) ds->tbl[ds->tbl_codeword++] = i;
 	}
-	depth--;
+	ds->tbl_depth--;
 	return i;
 }
 
 
+
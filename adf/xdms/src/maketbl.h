@@ -1,5 +1,3 @@
 
-extern USHORT left[], right[];
-
-USHORT make_table(USHORT nchar, UCHAR bitlen[], USHORT tablebits, USHORT table[]);
+USHORT make_table(DECRUNCH_STATE *ds, USHORT nchar, UCHAR bitlen[], USHORT tablebits, USHORT table[]);
 
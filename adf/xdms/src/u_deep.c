@@ -17,14 +17,10 @@
 #include "getbits.h"
 
 
-static USHORT DecodeChar(void);
-static USHORT DecodePosition(void);
-static void update(USHORT c);
-static void reconst(void);
-
-
-USHORT deep_text_loc;
-int init_deep_tabs=1;
+static USHORT DecodeChar(DECRUNCH_STATE *);
+static USHORT DecodePosition(DECRUNCH_STATE *);
+static void update(DECRUNCH_STATE *, USHORT c);
+static void reconst(DECRUNCH_STATE *);
 
 
 
@@ -32,24 +28,22 @@ int init_deep_tabs=1;
 
 #define F       60  /* lookahead buffer size */
 #define THRESHOLD   2
-#define N_CHAR      (256 - THRESHOLD + F)   /* kinds of characters (character code = 0..N_CHAR-1) */
-#define T       (N_CHAR * 2 - 1)    /* size of table */
+#define N_CHAR      DEEP_N_CHAR   /* kinds of characters (character code = 0..N_CHAR-1) */
+#define T       DEEP_T    /* size of table */
 #define R       (T - 1)         /* position of root */
 #define MAX_FREQ    0x8000      /* updates tree when the */
 
 
-USHORT freq[T + 1]; /* frequency table */
-
-USHORT prnt[T + N_CHAR]; /* pointers to parent nodes, except for the */
-				/* elements [T..T + N_CHAR - 1] which are used to get */
-				/* the positions of leaves corresponding to the codes. */
-
-USHORT son[T];   /* pointers to child nodes (son[], son[] + 1) */
+/*  freq[] is the frequency table, son[] points to child nodes (son[], son[] + 1)
+ *  and prnt[] to parent nodes, except for the elements [T..T + N_CHAR - 1]
+ *  which are used to get the positions of leaves corresponding to the codes.
+ *  They all live in DECRUNCH_STATE.  */
 
 
 
-void Init_DEEP_Tabs(void){
+void Init_DEEP_Tabs(DECRUNCH_STATE *ds){
 	USHORT i, j;
+	USHORT *freq = ds->freq, *son = ds->son, *prnt = ds->prnt;
 
 	for (i = 0; i < N_CHAR; i++) {
 		freq[i] = 1;
@@ -66,64 +60,64 @@ void Init_DEEP_Tabs(void){
 	freq[T] = 0xffff;
 	prnt[R] = 0;
 
-	init_deep_tabs = 0;
+	ds->init_deep_tabs = 0;
 }
 
 
 
-USHORT Unpack_DEEP(UCHAR *in, UCHAR *out, USHORT origsize, UCHAR* text){
+USHORT Unpack_DEEP(DECRUNCH_STATE *ds, UCHAR *in, UCHAR *out, USHORT origsize){
 	USHORT i, j, c;
-	UCHAR *outend;
+	UCHAR *outend, *text = ds->text;
 
-	initbitbuf(in);
+	initbitbuf(ds,in);
 
-	if (init_deep_tabs) Init_DEEP_Tabs();
+	if (ds->init_deep_tabs) Init_DEEP_Tabs(ds);
 
 	outend = out+origsize;
 	while (out < outend) {
-		c = DecodeChar();
+		c = DecodeChar(ds);
 		if (c < 256) {
-			*out++ = text[deep_text_loc++ & DBITMASK] = (UCHAR)c;
+			*out++ = text[ds->deep_text_loc++ & DBITMASK] = (UCHAR)c;
 		} else {
 			j = (USHORT) (c - 255 + THRESHOLD);
-			i = (USHORT) (deep_text_loc - DecodePosition() - 1);
-			while (j--) *out++ = text[deep_text_loc++ & DBITMASK] = text[i++ & DBITMASK];
+			i = (USHORT) (ds->deep_text_loc - DecodePosition(ds) - 1);
+			while (j--) *out++ = text[ds->deep_text_loc++ & DBITMASK] = text[i++ & DBITMASK];
 		}
 	}
 
-	deep_text_loc = (USHORT)((deep_text_loc+60) & DBITMASK);
+	ds->deep_text_loc = (USHORT)((ds->deep_text_loc+60) & DBITMASK);
 
 	return 0;
 }
 
 
 
-static USHORT DecodeChar(void){
+static USHORT DecodeChar(DECRUNCH_STATE *ds){
 	USHORT c;
 
-	c = son[R];
+	c = ds->son[R];
 
 	/* travel from root to leaf, */
 	/* choosing the smaller child node (son[]) if the read bit is 0, */
 	/* the bigger (son[]+1} if 1 */
 	while (c < T) {
-		c = son[c + GETBITS(1)];
-		DROPBITS(1);
+		c = ds->son[c + GETBITS(ds,1)];
+		DROPBITS(ds,1);
 	}
 	c -= T;
-	update(c);
+	update(ds,c);
 	return c;
 }
 
 
 
-static USHORT DecodePosition(void){
+static USHORT DecodePosition(DECRUNCH_STATE *ds){
 	USHORT i, j, c;
 
-	i = GETBITS(8);  DROPBITS(8);
+	i = GETBITS(ds,8);  DROPBITS(ds,8);
 	c = (USHORT) (d_code[i] << 8);
 	j = d_len[i];
-	i = (USHORT) (((i << j) | GETBITS(j)) & 0xff);  DROPBITS(j);
+	i = (USHORT) (((i << j) | GETBITS(ds,j)) & 0xff);  DROPBITS(ds,j);
 
 	return (USHORT) (c | i) ;
 }
@@ -132,8 +126,9 @@ static USHORT DecodePosition(void){
 
 /* reconstruction of tree */
 
-static void reconst(void){
+static void reconst(DECRUNCH_STATE *ds){
 	USHORT i, j, k, f, l;
+	USHORT *freq = ds->freq, *son = ds->son, *prnt = ds->prnt;
 
 	/* collect leaf nodes in the first half of the table */
 	/* and replace the freq by (freq + 1) / 2. */
@@ -171,11 +166,12 @@ static void reconst(void){
 
 /* increment frequency of given code by one, and update tree */
 
-static void update(USHORT c){
+static void update(DECRUNCH_STATE *ds, USHORT c){
 	USHORT i, j, k, l;
+	USHORT *freq = ds->freq, *son = ds->son, *prnt = ds->prnt;
 
 	if (freq[R] == MAX_FREQ) {
-		reconst();
+		reconst(ds);
 	}
 	c = prnt[c + T];
 	do {
@@ -1,7 +1,4 @@
 
 
-USHORT Unpack_DEEP(UCHAR *, UCHAR *, USHORT, UCHAR *);
-
-extern int init_deep_tabs;
-extern USHORT deep_text_loc;
+USHORT Unpack_DEEP(DECRUNCH_STATE *, UCHAR *, UCHAR *, USHORT);
 
@@ -16,56 +16,50 @@
 #include "maketbl.h"
 
 
-#define NC 510
-#define NPT 20
+#define NC HEAVY_NC
+#define NPT HEAVY_NPT
 #define N1 510
 #define OFFSET 253
 
-USHORT left[2 * NC - 1], right[2 * NC - 1 + 9];
-static UCHAR c_len[NC], pt_len[NPT];
-static USHORT c_table[4096], pt_table[256];
-static USHORT np;
-USHORT heavy_text_loc, heavy_lastlen;
 
+static USHORT read_tree_c(DECRUNCH_STATE *);
+static USHORT read_tree_p(DECRUNCH_STATE *);
+static USHORT decode_c(DECRUNCH_STATE *);
+static USHORT decode_p(DECRUNCH_STATE *);
 
-static USHORT read_tree_c(void);
-static USHORT read_tree_p(void);
-static USHORT decode_c(void);
-static USHORT decode_p(void);
 
 
-
-USHORT Unpack_HEAVY(UCHAR *in, UCHAR *out, UCHAR flags, USHORT origsize, UCHAR* text){
+USHORT Unpack_HEAVY(DECRUNCH_STATE *ds, UCHAR *in, UCHAR *out, UCHAR flags, USHORT origsize){
 	USHORT j, i, c, bitmask;
-	UCHAR *outend;
+	UCHAR *outend, *text = ds->text;
 
 	/*  Heavy 1 uses a 4Kb dictionary,  Heavy 2 uses 8Kb  */
 
 	if (flags & 8) {
-		np = 15;
+		ds->np = 15;
 		bitmask = 0x1fff;
 	} else {
-		np = 14;
+		ds->np = 14;
 		bitmask = 0x0fff;
 	}
 
-	initbitbuf(in);
+	initbitbuf(ds,in);
 
 	if (flags & 2) {
-		if (read_tree_c()) return 1;
-		if (read_tree_p()) return 2;
+		if (read_tree_c(ds)) return 1;
+		if (read_tree_p(ds)) return 2;
 	}
 
 	outend = out+origsize;
 
 	while (out<outend) {
-		c = decode_c();
+		c = decode_c(ds);
 		if (c < 256) {
-			*out++ = text[heavy_text_loc++ & bitmask] = (UCHAR)c;
+			*out++ = text[ds->heavy_text_loc++ & bitmask] = (UCHAR)c;
 		} else {
 			j = (USHORT) (c - OFFSET);
-			i = (USHORT) (heavy_text_loc - decode_p() - 1);
-			while(j--) *out++ = text[heavy_text_loc++ & bitmask] = text[i++ & bitmask];
+			i = (USHORT) (ds->heavy_text_loc - decode_p(ds) - 1);
+			while(j--) *out++ = text[ds->heavy_text_loc++ & bitmask] = text[i++ & bitmask];
 		}
 	}
 
@@ -74,100 +68,102 @@ USHORT Unpack_HEAVY(UCHAR *in, UCHAR *out, UCHAR flags, USHORT origsize, UCHAR*
 
 
 
-static USHORT decode_c(void){
+static USHORT decode_c(DECRUNCH_STATE *ds){
 	USHORT i, j, m;
 
-	j = c_table[GETBITS(12)];
+	j = ds->c_table[GETBITS(ds,12)];
 	if (j < N1) {
-		DROPBITS(c_len[j]);
+		DROPBITS(ds,ds->c_len[j]);
 	} else {
-		DROPBITS(12);
-		i = GETBITS(16);
+		DROPBITS(ds,12);
+		i = GETBITS(ds,16);
 		m = 0x8000;
 		do {
-			if (i & m) j = right[j];
-			else              j = left [j];
+			if (i & m) j = ds->right[j];
+			else              j = ds->left [j];
 			m >>= 1;
 		} while (j >= N1);
-		DROPBITS(c_len[j] - 12);
+		DROPBITS(ds,ds->c_len[j] - 12);
 	}
 	return j;
 }
 
 
 
-static USHORT decode_p(void){
+static USHORT decode_p(DECRUNCH_STATE *ds){
 	USHORT i, j, m;
 
-	j = pt_table[GETBITS(8)];
-	if (j < np) {
-		DROPBITS(pt_len[j]);
+	j = ds->pt_table[GETBITS(ds,8)];
+	if (j < ds->np) {
+		DROPBITS(ds,ds->pt_len[j]);
 	} else {
-		DROPBITS(8);
-		i = GETBITS(16);
+		DROPBITS(ds,8);
+		i = GETBITS(ds,16);
 		m = 0x8000;
 		do {
-			if (i & m) j = right[j];
-			else             j = left [j];
+			if (i & m) j = ds->right[j];
+			else             j = ds->left [j];
 			m >>= 1;
-		} while (j >= np);
-		DROPBITS(pt_len[j] - 8);
+		} while (j >= ds->np);
+		DROPBITS(ds,ds->pt_len[j] - 8);
 	}
 
-	if (j != np-1) {
+	if (j != ds->np-1) {
 		if (j > 0) {
-			j = (USHORT)(GETBITS(i=(USHORT)(j-1)) | (1U << (j-1)));
-			DROPBITS(i);
+			j = (USHORT)(GETBITS(ds,i=(USHORT)(j-1)) | (1U << (j-1)));
+			DROPBITS(ds,i);
 		}
-		heavy_lastlen=j;
+		ds->heavy_lastlen=j;
 	}
 
-	return heavy_lastlen;
+	return ds->heavy_lastlen;
 
 }
 
 
 
-static USHORT read_tree_c(void){
+static USHORT read_tree_c(DECRUNCH_STATE *ds){
 	USHORT i,n;
 
-	n = GETBITS(9);
-	DROPBITS(9);
+	n = GETBITS(ds,9);
+	DROPBITS(ds,9);
+	if (n>NC) return 1;
 	if (n>0){
 		for (i=0; i<n; i++) {
-			c_len[i] = (UCHAR)GETBITS(5);
-			DROPBITS(5);
+			ds->c_len[i] = (UCHAR)GETBITS(ds,5);
+			DROPBITS(ds,5);
 		}
-		for (i=n; i<510; i++) c_len[i] = 0;
-		if (make_table(510,c_len,12,c_table)) return 1;
+		for (i=n; i<510; i++) ds->c_len[i] = 0;
+		if (make_table(ds,510,ds->c_len,12,ds->c_table)) return 1;
 	} else {
-		n = GETBITS(9);
-		DROPBITS(9);
-		for (i=0; i<510; i++) c_len[i] = 0;
-		for (i=0; i<4096; i++) c_table[i] = n;
+		n = GETBITS(ds,9);
+		DROPBITS(ds,9);
+		for (i=0; i<510; i++) ds->c_len[i] = 0;
+		for (i=0; i<4096; i++) ds->c_table[i] = n;
 	}
 	return 0;
 }
 
 
 
-static USHORT read_tree_p(void){
+static USHORT read_tree_p(DECRUNCH_STATE *ds){
 	USHORT i,n;
 
-	n = GETBITS(5);
-	DROPBITS(5);
+	n = GETBITS(ds,5);
+	DROPBITS(ds,5);
+	if (n>NPT) return 1;
 	if (n>0){
 		for (i=0; i<n; i++) {
-			pt_len[i] = (UCHAR)GETBITS(4);
-			DROPBITS(4);
+			ds->pt_len[i] = (UCHAR)GETBITS(ds,4);
+			DROPBITS(ds,4);
 		}
-		for (i=n; i<np; i++) pt_len[i] = 0;
-		if (make_table(np,pt_len,8,pt_table)) return 1;
+		for (i=n; i<ds->np; i++) ds->pt_len[i] = 0;
+		if (make_table(ds,ds->np,ds->pt_len,8,ds->pt_table)) return 1;
 	} else {
-		n = GETBITS(5);
-		DROPBITS(5);
-		for (i=0; i<np; i++) pt_len[i] = 0;
-		for (i=0; i<256; i++) pt_table[i] = n;
+		n = GETBITS(ds,5);
+		DROPBITS(ds,5);
+		for (i=0; i<ds->np; i++) ds->pt_len[i] = 0;
+		for (i=0; i<256; i++) ds->pt_table[i] = n;
 	}
 	return 0;
 }
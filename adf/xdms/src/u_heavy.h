@@ -1,6 +1,4 @@
 
 
-USHORT Unpack_HEAVY(UCHAR *, UCHAR *, UCHAR, USHORT, UCHAR *);
-
-extern USHORT heavy_text_loc, heavy_lastlen;
+USHORT Unpack_HEAVY(DECRUNCH_STATE *, UCHAR *, UCHAR *, UCHAR, USHORT);
 
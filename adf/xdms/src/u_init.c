@@ -20,12 +20,12 @@
 #include "u_heavy.h"
 
 
-void Init_Decrunchers(UCHAR* text){
-	quick_text_loc = 251;
-	medium_text_loc = 0x3fbe;
-	heavy_lastlen = 0;
-	heavy_text_loc = 0;
-	deep_text_loc = 0x3fc4;
-	init_deep_tabs = 1;
-	memset(text,0,0x3fc8);
+void Init_Decrunchers(DECRUNCH_STATE *ds){
+	ds->quick_text_loc = 251;
+	ds->medium_text_loc = 0x3fbe;
+	ds->heavy_lastlen = 0;
+	ds->heavy_text_loc = 0;
+	ds->deep_text_loc = 0x3fc4;
+	ds->init_deep_tabs = 1;
+	memset(ds->text,0,sizeof(ds->text));
 }
@@ -1,3 +1,3 @@
 
-void Init_Decrunchers(UCHAR* text);
+void Init_Decrunchers(DECRUNCH_STATE *);
 
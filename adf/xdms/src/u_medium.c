@@ -19,38 +19,34 @@
 #define MBITMASK 0x3fff
 
 
-USHORT medium_text_loc;
-
-
-
-USHORT Unpack_MEDIUM(UCHAR *in, UCHAR *out, USHORT origsize, UCHAR* text){
+USHORT Unpack_MEDIUM(DECRUNCH_STATE *ds, UCHAR *in, UCHAR *out, USHORT origsize){
 	USHORT i, j, c;
-	UCHAR u, *outend;
+	UCHAR u, *outend, *text = ds->text;
 
 
-	initbitbuf(in);
+	initbitbuf(ds,in);
 
 	outend = out+origsize;
 	while (out < outend) {
-		if (GETBITS(1)!=0) {
-			DROPBITS(1);
-			*out++ = text[medium_text_loc++ & MBITMASK] = (UCHAR)GETBITS(8);
-			DROPBITS(8);
+		if (GETBITS(ds,1)!=0) {
+			DROPBITS(ds,1);
+			*out++ = text[ds->medium_text_loc++ & MBITMASK] = (UCHAR)GETBITS(ds,8);
+			DROPBITS(ds,8);
 		} else {
-			DROPBITS(1);
-			c = GETBITS(8);  DROPBITS(8);
+			DROPBITS(ds,1);
+			c = GETBITS(ds,8);  DROPBITS(ds,8);
 			j = (USHORT) (d_code[c]+3);
 			u = d_len[c];
-			c = (USHORT) (((c << u) | GETBITS(u)) & 0xff);  DROPBITS(u);
+			c = (USHORT) (((c << u) | GETBITS(ds,u)) & 0xff);  DROPBITS(ds,u);
 			u = d_len[c];
-			c = (USHORT) ((d_code[c] << 8) | (((c << u) | GETBITS(u)) & 0xff));  DROPBITS(u);
-			i = (USHORT) (medium_text_loc - c - 1);
+			c = (USHORT) ((d_code[c] << 8) | (((c << u) | GETBITS(ds,u)) & 0xff));  DROPBITS(ds,u);
+			i = (USHORT) (ds->medium_text_loc - c - 1);
 
-			while(j--) *out++ = text[medium_text_loc++ & MBITMASK] = text[i++ & MBITMASK];
+			while(j--) *out++ = text[ds->medium_text_loc++ & MBITMASK] = text[i++ & MBITMASK];
 			
 		}
 	}
-	medium_text_loc = (USHORT)((medium_text_loc+66) & MBITMASK);
+	ds->medium_text_loc = (USHORT)((ds->medium_text_loc+66) & MBITMASK);
 
 	return 0;
 }
@@ -1,5 +1,3 @@
 
-USHORT Unpack_MEDIUM(UCHAR *, UCHAR *, USHORT, UCHAR*);
-
-extern USHORT medium_text_loc;
+USHORT Unpack_MEDIUM(DECRUNCH_STATE *, UCHAR *, UCHAR *, USHORT);
 
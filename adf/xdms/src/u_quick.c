@@ -17,30 +17,27 @@
 #define QBITMASK 0xff
 
 
-USHORT quick_text_loc;
-
-
-USHORT Unpack_QUICK(UCHAR *in, UCHAR *out, USHORT origsize, UCHAR* text){
+USHORT Unpack_QUICK(DECRUNCH_STATE *ds, UCHAR *in, UCHAR *out, USHORT origsize){
 	USHORT i, j;
-	UCHAR *outend;
+	UCHAR *outend, *text = ds->text;
 
-	initbitbuf(in);
+	initbitbuf(ds,in);
 
 	outend = out+origsize;
 	while (out < outend) {
-		if (GETBITS(1)!=0) {
-			DROPBITS(1);
-			*out++ = text[quick_text_loc++ & QBITMASK] = (UCHAR)GETBITS(8);  DROPBITS(8);
+		if (GETBITS(ds,1)!=0) {
+			DROPBITS(ds,1);
+			*out++ = text[ds->quick_text_loc++ & QBITMASK] = (UCHAR)GETBITS(ds,8);  DROPBITS(ds,8);
 		} else {
-			DROPBITS(1);
-			j = (USHORT) (GETBITS(2)+2);  DROPBITS(2);
-			i = (USHORT) (quick_text_loc - GETBITS(8) - 1);  DROPBITS(8);
+			DROPBITS(ds,1);
+			j = (USHORT) (GETBITS(ds,2)+2);  DROPBITS(ds,2);
+			i = (USHORT) (ds->quick_text_loc - GETBITS(ds,8) - 1);  DROPBITS(ds,8);
 			while(j--) {
-				*out++ = text[quick_text_loc++ & QBITMASK] = text[i++ & QBITMASK];
+				*out++ = text[ds->quick_text_loc++ & QBITMASK] = text[i++ & QBITMASK];
 			}
 		}
 	}
-	quick_text_loc = (USHORT)((quick_text_loc+5) & QBITMASK);
+	ds->quick_text_loc = (USHORT)((ds->quick_text_loc+5) & QBITMASK);
 
 	return 0;
 }
@@ -1,5 +1,3 @@
 
-USHORT Unpack_QUICK(UCHAR *, UCHAR *, USHORT, UCHAR*);
-
-extern USHORT quick_text_loc;
+USHORT Unpack_QUICK(DECRUNCH_STATE *, UCHAR *, UCHAR *, USHORT);
 